@@ -35,6 +35,8 @@
 #include "ipebase.h"
 #include "ipegeo.h"
 
+#include <mutex>
+
 // --------------------------------------------------------------------
 
 namespace ipe {
@@ -238,8 +240,38 @@ namespace ipe {
     // int getIndex(String str) const;
   private:
     Repository();
-    static Repository *singleton;
-    std::vector<String> iStrings;
+    ~Repository();
+    Repository(const Repository &rhs) = delete;
+    Repository &operator=(const Repository &rhs) = delete;
+
+    // indices must fit below the type bits of Attribute
+    enum { EBlockBits = 10, EBlockSize = 1 << EBlockBits,
+	   EDirBits = 10, EDirSize = 1 << EDirBits,
+	   EMaxDirs = 512, EMaxIndex = EMaxDirs * EDirSize * EBlockSize };
+    using Block = std::atomic<String *>;
+
+    //! Open addressing hash table of string indices (-1 for empty slots).
+    struct Table {
+      Table(int size);
+      int iMask;
+      std::unique_ptr<std::atomic<int>[]> iSlots;
+    };
+
+    inline const String &string(int index) const {
+      return iDirs[index >> (EBlockBits + EDirBits)]
+	.load(std::memory_order_acquire)[(index >> EBlockBits) & (EDirSize - 1)]
+	.load(std::memory_order_acquire)[index & (EBlockSize - 1)]; }
+    int find(const String &str, uint32_t hash) const;
+    void insert(Table *table, int index, uint32_t hash);
+
+    static std::atomic<Repository *> singleton;
+    // strings are stored in blocks that never move, found through
+    // directories of blocks that are allocated as needed
+    std::atomic<Block *> iDirs[EMaxDirs];
+    int iCount;
+    std::atomic<Table *> iTable;
+    std::vector<std::unique_ptr<Table>> iTables;  // including retired ones
+    std::mutex iMutex;  // serializes insertions
   };
 
   // --------------------------------------------------------------------
@@ -32,10 +32,13 @@
 #ifndef IPEBASE_H
 #define IPEBASE_H
 
+#include <cstdint>
 #include <cstdio>
 #include <vector>
 #include <algorithm>
 #include <memory>
+#include <atomic>
+#include <functional>
 
 #ifdef IPESTRICT
 #include "ipeosx.h"
@@ -130,6 +133,7 @@ namespace ipe {
     void erase() noexcept;
     void append(const String &rhs) noexcept;
     void append(const char *rhs) noexcept;
+    void append(const char *data, int n) noexcept;
     void append(char ch) noexcept;
     bool hasPrefix(const char *rhs) const noexcept;
     bool operator==(const String &rhs) const noexcept;
@@ -143,7 +147,7 @@ namespace ipe {
     void detach(int n) noexcept;
   private:
     struct Imp {
-      int iRefCount;
+      std::atomic<int> iRefCount;  // strings may be shared between threads
       int iSize;
       int iCapacity;
       char *iData;
@@ -279,6 +283,7 @@ namespace ipe {
   class TellStream : public Stream {
   public:
     virtual long tell() const = 0;
+    virtual bool seek(long pos);
   };
 
   class StringStream : public TellStream {
@@ -301,6 +306,7 @@ namespace ipe {
     virtual void putCString(const char *s);
     virtual void putRaw(const char *data, int size);
     virtual long tell() const;
+    virtual bool seek(long pos);
   private:
     std::FILE *iFile;
   };
@@ -312,6 +318,9 @@ namespace ipe {
     virtual ~DataSource() = 0;
     //! Get one more character, or EOF.
     virtual int getChar() = 0;
+    virtual int span(const char *&data);
+    virtual void skip(int n);
+    virtual int getChars(char *buf, int n);
   };
 
   class FileSource : public DataSource {
@@ -326,12 +335,37 @@ namespace ipe {
   public:
     BufferSource(const Buffer &buffer);
     virtual int getChar();
+    virtual int span(const char *&data);
+    virtual void skip(int n);
     void setPosition(int pos);
   private:
     const Buffer &iBuffer;
     int iPos;
   };
 
+  class MappedFileSource : public DataSource {
+  public:
+    MappedFileSource(const char *fname, bool map = true);
+    virtual ~MappedFileSource();
+    MappedFileSource(const MappedFileSource &rhs) = delete;
+    MappedFileSource &operator=(const MappedFileSource &rhs) = delete;
+    //! Could the file be opened?
+    bool isOpen() const { return iOpen; }
+    //! Size of the file in bytes.
+    size_t size() const { return iSize; }
+    virtual int getChar();
+    virtual int span(const char *&data);
+    virtual void skip(int n);
+    void setPosition(size_t pos);
+  private:
+    bool iOpen;
+    bool iMapped;
+    const char *iData;
+    size_t iSize;
+    size_t iPos;
+    String iCopy;  // file contents if the file could not be mapped
+  };
+
   // --------------------------------------------------------------------
 
   class Platform {
@@ -355,14 +389,17 @@ namespace ipe {
     static void setDebug(bool debug);
     static String currentDirectory();
     static String latexDirectory();
+    static String latexSubdirectory(String name);
     static String latexPath();
     static bool fileExists(String fname);
+    static bool fileStatus(String fname, int64_t &mtime, int64_t &size);
     static bool listDirectory(String path, std::vector<String> &files);
     static String realPath(String fname);
     static String readFile(String fname);
     static int runLatex(String dir, LatexType engine) noexcept;
     static double toDouble(String s);
     static int toNumber(String s, int &iValue, double &dValue);
+    static void parallelFor(int n, const std::function<void (int)> &job);
   };
 
   // --------------------------------------------------------------------
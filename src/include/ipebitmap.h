@@ -36,6 +36,8 @@
 #include "ipegeo.h"
 #include "ipexml.h"
 
+#include <mutex>
+
 // --------------------------------------------------------------------
 
 namespace ipe {
@@ -71,8 +73,12 @@ namespace ipe {
     inline bool isGray() const;
     inline bool hasAlpha() const;
     inline int colorKey() const;
+    inline int checksum() const;
 
     Buffer pixelData();
+    Buffer pixelData(int level, int &width, int &height);
+    int displayLevel(Vector ex, Vector ey, double &ratio) const;
+    void decodeInBackground(int level = 0);
 
     inline int objNum() const;
     inline void setObjNum(int objNum) const;
@@ -93,17 +99,22 @@ namespace ipe {
     void computeChecksum();
     void unpack(Buffer alphaChannel);
     void analyze();
+    Buffer mipLevel(int level, int &width, int &height);
 
   private:
     struct Imp {
-      int iRefCount;
+      std::atomic<int> iRefCount;
       uint32_t iFlags;
       int iWidth;
       int iHeight;
       int iColorKey;
       Buffer iData;               // native-endian ARGB32 or DCT encoded
       Buffer iPixelData;          // native-endian ARGB32 pre-multiplied for Cairo
-      bool iPixelsComputed;
+      std::atomic<bool> iPixelsComputed;
+      std::mutex iPixelsMutex;    // protects iPixelData while computing
+      Buffer iMipData[12];        // pixels at 1/2, 1/4, ..., 1/4096 size
+      bool iReducedDctFailed;     // Jpeg cannot be decoded at reduced size
+      std::mutex iMipMutex;       // protects iMipData and iReducedDctFailed
       int iChecksum;
       mutable int iObjNum;        // Object number (e.g. in PDF file)
     };
@@ -156,6 +167,12 @@ namespace ipe {
     return iImp->iColorKey;
   }
 
+  //! Return checksum of the bitmap data.
+  inline int Bitmap::checksum() const
+  {
+    return iImp->iChecksum;
+  }
+
   //! Return object number of the bitmap.
   inline int Bitmap::objNum() const
   {
@@ -43,6 +43,7 @@ namespace ipe {
 
   class BitmapFinder;
   class PdfResources;
+  class PdfSaveRecord;
 
   //! Flags for saving Ipe documents (to PDF)
   class SaveFlag {
@@ -53,6 +54,7 @@ namespace ipe {
       NoZip = 2,        //!< Do not compress streams
       MarkedView = 4,   //!< Create marked views only
       KeepNotes = 8,    //!< Keep page notes as PDF annotations even when exporting
+      Incremental = 16, //!< Append changes to the PDF file saved before
     };
   };
 
@@ -113,6 +115,7 @@ namespace ipe {
 		    uint32_t flags, int pno, int vno) const;
 
     void saveAsXml(Stream &stream, bool usePdfBitmaps = false) const;
+    void saveXmlHeader(Stream &stream, bool usePdfBitmaps) const;
 
     //! Return number of pages of document.
     int countPages() const { return int(iPages.size()); }
@@ -154,13 +157,19 @@ namespace ipe {
 	   ErrOldPdfLatex, ErrRunLatex, ErrLatex, ErrLatexOutput };
     int runLatex(String &logFile);
     int runLatex();
+    static void prepareLatex(const std::vector<Document *> &docs);
 
 
+  private:
+    bool saveIncremental(const char *fname, uint32_t flags) const;
+
   private:
     std::vector<Page *> iPages;
     Cascade *iCascade;
     SProperties iProperties;
     PdfResources *iResources;
+    //! What the last incremental save has written.
+    mutable std::unique_ptr<PdfSaveRecord> iPdfRecord;
   };
 
 } // namespace
@@ -33,6 +33,7 @@
 #define PDFLATEX_P_H
 
 #include <list>
+#include <map>
 
 #include "ipepage.h"
 #include "ipetext.h"
@@ -51,38 +52,69 @@ namespace ipe {
     Latex(const Cascade *sheet, LatexType latexType);
     ~Latex();
 
+    void setCacheDirectory(String dir);
     int scanObject(const Object *obj);
     int scanPage(Page *page);
     void addPageNumber(int pno, int vno, int npages, int nviews);
-    int createLatexSource(Stream &stream, String preamble);
-    bool readPdf(DataSource &source);
+    int prepareShards(String preamble, int maxShards);
+    //! Return the Latex source preceding the texts (after prepareShards).
+    String header() const { return iHeader; }
+    void addUncached(const Latex &other);
+    int distribute(int maxShards);
+    int createLatexSource(Stream &stream, int shard);
+    bool readPdf(const std::vector<String> &fnames, bool &unmergeable);
     bool updateTextObjects();
     PdfResources *takeResources();
 
   private:
-    bool getXForm(String key, const PdfDict *ipeInfo);
+    void writeText(Stream &stream, const Text *text, Attribute size,
+		   Fixed stretch);
+    void findCached(String header);
+    bool readBundle(int bundle, PdfFile &pdf);
+    bool getXForm(String key, const PdfDict *ipeInfo, const PdfFile &pdf,
+		  int bundle, int offset, String suffix);
+    void storeCache(String fname, int bundle);
     void warn(String msg);
 
   private:
     struct SText {
       const Text *iText;
       Attribute iSize;
+      //! Latex source typesetting this text into box 0.
+      String iSource;
+      //! Horizontal stretch factor.
+      Fixed iStretch;
+      //! Cache key for the Latex source of this text.
+      String iKey;
+      //! Index into iBundles of the PDF file with the XForm.
+      int iBundle;
+      //! IpeId of the XForm in this PDF file.
+      int iId;
     };
 
     typedef std::list<SText> TextList;
-    typedef std::list<Text::XForm *> XFormList;
 
     const Cascade *iCascade;
     bool iXetex;
     LatexType iLatexType;
 
-    PdfFile iPdf;
+    //! Directory of the cache, or empty if caching is disabled.
+    String iCacheDir;
+
+    //! Latex source preceding the texts.
+    String iHeader;
+
+    //! Number of Latex runs (at least one, even if none is needed).
+    int iShards;
+
+    //! PDF files with XForms. The first iShards are the output of this run.
+    std::vector<String> iBundles;
 
     //! List of text objects scanned. Objects not owned.
     TextList iTextObjects;
 
-    //! List of XForm objects read from PDF file.  Objects owned!
-    XFormList iXForms;
+    //! XForm objects read from PDF files, by bundle and IpeId. Owned!
+    std::map<std::pair<int, int>, Text::XForm *> iXForms;
 
     //! The resources from the generated PDF file.
     PdfResources *iResources;
@@ -34,6 +34,11 @@
 
 #include "ipetext.h"
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
 // --------------------------------------------------------------------
 
 namespace ipe {
@@ -130,9 +135,20 @@ namespace ipe {
     void objectsPerLayer(std::vector<int> &objcounts) const;
 
     //! Return object at index \a i.
+    /*! The object may be shared with copies of the page.  Use
+      objectForEdit() to modify it. */
     inline Object *object(int i) { return iObjects[i].iObject; }
     //! Return object at index \a i (const version).
     inline const Object *object(int i) const { return iObjects[i].iObject; }
+    //! Return object at index \a i for modification.
+    /*! If the object is shared with a copy of the page, it is
+      duplicated first. */
+    inline Object *objectForEdit(int i) {
+      if (isShared(i)) unshare(i);
+      return iObjects[i].iObject; }
+    //! Is the object at index \a i shared with a copy of the page?
+    inline bool isShared(int i) const { return *iObjects[i].iShared > 1; }
+    int takeDetached();
 
     //! Return selection status of object at index \a i.
     inline TSelect select(int i) const { return iObjects[i].iSelect; }
@@ -143,6 +159,10 @@ namespace ipe {
     inline void setSelect(int i, TSelect sel) { iObjects[i].iSelect = sel; }
     //! Set layer of object at index \a i.
     inline void setLayerOf(int i, int layer) { iObjects[i].iLayer = layer; }
+    //! Return revision number of object at index \a i.
+    /*! The revision changes whenever the object is modified through
+      the Page, for instance by transform, replace, or invalidateBBox. */
+    inline uint32_t revision(int i) const { return iObjects[i].iRevision; }
 
     Rect pageBBox(const Cascade *sheet) const;
     Rect viewBBox(const Cascade *sheet, int view) const;
@@ -154,6 +174,7 @@ namespace ipe {
     void snapCtl(int i, const Vector &mouse, Vector &pos, double &bound) const;
     void snapBnd(int i, const Vector &mouse, Vector &pos, double &bound) const;
     void invalidateBBox(int i) const;
+    void findObjects(const Rect &box, std::vector<int> &objs) const;
 
     void insert(int i, TSelect sel, int layer, Object *obj);
     void append(TSelect sel, int layer, Object *obj);
@@ -193,16 +214,54 @@ namespace ipe {
     struct SObject {
       SObject();
       SObject(const SObject &rhs);
+      SObject(SObject &&rhs) noexcept;
       ~SObject();
       SObject &operator=(const SObject &rhs);
+      SObject &operator=(SObject &&rhs) noexcept;
 
       TSelect iSelect;
       int iLayer;
+      mutable uint32_t iRevision;
       mutable Rect iBBox;
       Object *iObject;
+      //! Reference count of iObject, shared by all copies.
+      std::atomic<int> *iShared;
     };
     typedef std::vector<SObject> ObjSeq;
 
+    // Uniform grid over the cached bounding boxes of the objects
+    class Grid {
+    public:
+      Grid();
+      Grid(const Grid &rhs);
+      Grid &operator=(const Grid &rhs);
+      void insert(int i);
+      void remove(int i);
+      void update(int i);
+      void find(const Page *page, const Rect &box,
+		std::vector<int> &objs);
+    private:
+      void invalidate();
+      void build(const Page *page);
+      void add(const Page *page, int i);
+      void unlink(int i);
+      void shift(int i, int delta);
+      bool cellRange(const Rect &box, int r[4]) const;
+    private:
+      bool iValid;
+      double iCellSize;
+      int iBuiltCount;
+      //! Box under which each object is stored in the cells.
+      std::vector<Rect> iBox;
+      std::unordered_map<uint64_t, std::vector<int>> iCells;
+      //! Objects that are too large (or empty) to be stored in cells.
+      std::vector<int> iLarge;
+      //! Objects whose bounding box has not been computed yet.
+      std::vector<int> iPending;
+      //! Protects the grid, which is built lazily by const queries.
+      std::mutex iMutex;
+    };
+
     LayerSeq iLayers;
     ViewSeq iViews;
 
@@ -211,8 +270,13 @@ namespace ipe {
     bool iUseTitle[2];
     String iSection[2];
     ObjSeq iObjects;
+    mutable Grid iGrid;
     String iNotes;
     bool iMarked;
+    int iDetached;
+
+  private:
+    void unshare(int i);
   };
 
 } // namespace
@@ -36,6 +36,7 @@
 #include "ipegeo.h"
 
 #include <unordered_map>
+#include <mutex>
 
 // --------------------------------------------------------------------
 
@@ -162,6 +163,7 @@ namespace ipe {
 		       bool inflate) const noexcept;
     void setStream(const Buffer &stream);
     void add(String key, const PdfObj *obj);
+    void set(String key, const PdfObj *obj);
     const PdfObj *get(String key, const PdfFile *file) const noexcept;
     bool getNumber(String key, double &val, const PdfFile *file) const noexcept;
     bool getNumberArray(String key, const PdfFile *file,
@@ -225,7 +227,8 @@ namespace ipe {
   class PdfFile {
   public:
     bool parse(DataSource &source);
-    bool parseObjectStream(const PdfDict *d);
+    bool load(const char *fname, bool map = false);
+    bool parseObjectStream(const PdfDict *d, int num = -1) const;
     const PdfObj *object(int num) const noexcept;
     const PdfDict *catalog() const noexcept;
     const PdfDict *page(int pno = 0) const noexcept;
@@ -235,10 +238,26 @@ namespace ipe {
     Rect mediaBox(const PdfDict *page) const;
   private:
     bool readPageTree(const PdfObj *ptn = nullptr);
+    bool readXRef(size_t offset);
+    bool readXRefTable(PdfParser &parser, std::vector<int> &freed);
+    bool readXRefStream(const PdfDict *d,
+			const std::vector<int> *freed = nullptr);
+    PdfObj *objectAt(size_t offset, int num) const;
+    const PdfObj *loadObject(int num) const;
   private:
-    std::unordered_map<int, std::unique_ptr<const PdfObj>> iObjects;
+    //! Cross-reference entry, with the types used by PDF.
+    struct XRef {
+      int iType;       // 0: free, 1: at iOffset, 2: in object stream
+      int iStream;     // object stream for type 2
+      size_t iOffset;  // file offset for type 1, index for type 2
+    };
+    mutable std::unordered_map<int, std::unique_ptr<const PdfObj>> iObjects;
     std::unique_ptr<const PdfDict> iTrailer;
     std::vector<const PdfDict *> iPages;
+    // only used when loading objects on demand
+    std::unique_ptr<MappedFileSource> iSource;
+    std::unordered_map<int, XRef> iXRef;
+    mutable std::recursive_mutex iMutex;
   };
 
 } // namespace
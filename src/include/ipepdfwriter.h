@@ -40,6 +40,7 @@
 #include <list>
 #include <map>
 #include <unordered_map>
+#include <vector>
 
 // --------------------------------------------------------------------
 
@@ -85,10 +86,48 @@ namespace ipe {
 
   // --------------------------------------------------------------------
 
+  class PdfSaveRecord {
+  public:
+    bool unchanged(std::FILE *file) const;
+    void finish(std::FILE *file, String fname, uint32_t flags);
+
+  public:
+    //! File that has been written.
+    String iFileName;
+    //! Flags used for writing it.
+    uint32_t iFlags = 0;
+    //! Size of the file.
+    long iSize = 0;
+    //! Size of the file after the last complete save.
+    long iFullSize = 0;
+    //! Hash of the end of the file, to notice changes by others.
+    uint64_t iTail = 0;
+    //! Position of the last cross-reference section.
+    long iXRefPos = 0;
+    //! Next unused object number (zero if nothing written yet).
+    int iObjNum = 0;
+    //! Object numbers of resources, style sheet objects, and symbols.
+    int iPreambleStart = 0;
+    int iPreambleEnd = 0;
+    //! Hash of these objects.
+    uint64_t iPreambleKey = 0;
+    //! Embedded bitmaps with their object numbers.
+    std::vector<std::pair<Bitmap, int>> iBitmaps;
+    //! Object numbers of contents streams, by hash of their data.
+    std::unordered_map<uint64_t, int> iContents;
+    //! Object numbers of page objects, by hash of their PDF code.
+    std::unordered_map<uint64_t, std::vector<int>> iPages;
+    //! Object numbers of the parts of the XML stream, by hash.
+    std::unordered_map<uint64_t, int> iXmlParts;
+  };
+
+  // --------------------------------------------------------------------
+
   class PdfWriter {
   public:
     PdfWriter(TellStream &stream, const Document *doc, const PdfResources *resources,
-	      uint32_t flags, int fromPage, int toPage, int compression);
+	      uint32_t flags, int fromPage, int toPage, int compression,
+	      PdfSaveRecord *record = nullptr);
     ~PdfWriter();
 
     void createPages();
@@ -96,8 +135,28 @@ namespace ipe {
     void createBookmarks();
     void createNamedDests();
     void createXmlStream(String xmldata, bool preCompressed);
+    void createXmlStream();
     void createTrailer();
 
+  private:
+    // Writes to the file, or collects the output in a string.
+    class Output : public TellStream {
+    public:
+      Output(TellStream &stream);
+      virtual void putChar(char ch);
+      virtual void putString(String s);
+      virtual void putCString(const char *s);
+      virtual void putRaw(const char *data, int size);
+      virtual long tell() const;
+      virtual bool seek(long pos);
+      void capture();
+      String release();
+    private:
+      TellStream &iStream;
+      bool iCapture;
+      String iBuffer;
+    };
+
   private:
     int startObject(int objnum = -1);
     int pageObjectNumber(int page, int view);
@@ -105,6 +164,17 @@ namespace ipe {
     void writeString(String text);
     void embedBitmap(Bitmap bitmap);
     void paintView(Stream &stream, int pno, int view);
+    void findViewBitmaps(int pno, int view, BitmapFinder &bm);
+    String pageContents(int pno, int view, bool compress);
+    void writePageView(int pno, int view, const BitmapFinder &bm,
+		       String pagedata, uint64_t key = 0, int contentsNum = -1);
+    void writePageObjects(int pno, int view, const BitmapFinder &bm,
+			  int contentsNum);
+    void embedPreamble();
+    void appendPreamble(const BitmapFinder &all);
+    void resetPreamble(const BitmapFinder &all);
+    void createXmlParts();
+    void prepareBitmaps(const std::vector<BitmapFinder> &bms);
     void embedBitmaps(const BitmapFinder &bm);
     void createResources(const BitmapFinder &bm);
     void embedResources();
@@ -115,7 +185,7 @@ namespace ipe {
     bool hasResource(String kind) const noexcept;
 
   private:
-    TellStream &iStream;
+    Output iStream;
     const Document *iDoc;
     const PdfResources *iResources;
     //! SaveFlag's
@@ -140,6 +210,8 @@ namespace ipe {
     std::unordered_map<int, int> iResourceNumber;
 
     std::vector<Bitmap> iBitmaps;
+    //! Compressed data of bitmaps about to be embedded.
+    std::map<Bitmap, std::pair<Buffer, Buffer>> iEmbedData;
     //! Next unused PDF object number.
     int iObjNum;
 
@@ -156,6 +228,15 @@ namespace ipe {
     std::vector<PON> iPageObjectNumbers;
     //! List of file locations, in object number order (starting with 0).
     std::map<int, long> iXref;
+
+    //! Record of what is written, for appending updates later.
+    PdfSaveRecord *iRecord;
+    //! Is this an update appended to the recorded file?
+    bool iAppend;
+    //! Parts of the record for this save.
+    std::unordered_map<uint64_t, int> iNewContents;
+    std::unordered_map<uint64_t, std::vector<int>> iNewPages;
+    std::unordered_map<uint64_t, int> iNewXmlParts;
   };
 
 } // namespace
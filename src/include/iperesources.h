@@ -78,7 +78,8 @@ namespace ipe {
   public:
     PdfResources();
     virtual ~PdfResources() = default;
-    bool collect(const PdfDict *resources, PdfFile *file);
+    bool collect(const PdfDict *resources, PdfFile *file,
+		 int offset = 0, String suffix = String());
     virtual const PdfObj *object(int num) const noexcept;
     virtual const PdfDict *baseResources() const noexcept;
     void addPageNumber(SPageNumber &pn) noexcept;
@@ -87,10 +88,10 @@ namespace ipe {
       return iEmbedSequence; }
     void show() const noexcept;
   private:
-    void add(int num, PdfFile *file);
-    void addIndirect(const PdfObj *q, PdfFile *file);
+    void add(int num, PdfFile *file, int offset);
+    void addIndirect(const PdfObj *q, PdfFile *file, int offset);
     bool addToResource(PdfDict *d, String key,
-		       const PdfObj *el, PdfFile *file);
+		       const PdfObj *el, PdfFile *file, int offset);
   private:
     std::unordered_map<int, std::unique_ptr<const PdfObj>> iObjects;
     std::vector<int> iEmbedSequence;
@@ -35,6 +35,9 @@
 #include "ipeattributes.h"
 #include "ipetext.h"
 
+#include <atomic>
+#include <mutex>
+
 // --------------------------------------------------------------------
 
 namespace ipe {
@@ -121,7 +124,7 @@ namespace ipe {
     //! Return Latex preamble.
     inline String preamble() const { return iPreamble; }
     //! Set LaTeX preamble.
-    inline void setPreamble(const String &str) { iPreamble = str; }
+    inline void setPreamble(const String &str) { iPreamble = str; modified(); }
 
     const Layout *layout() const;
     void setLayout(const Layout &margins);
@@ -148,7 +151,16 @@ namespace ipe {
     //! Return name of style sheet.
     inline String name() const { return iName; }
     //! Set name of style sheet.
-    inline void setName(const String &name) { iName = name; }
+    inline void setName(const String &name) { iName = name; modified(); }
+
+    //! Return revision number of the style sheet.
+    /*! The revision changes whenever the style sheet is modified.
+      Revision numbers are unique over all style sheets, but a copy
+      keeps the revision of the original. */
+    inline uint32_t revision() const { return iRevision; }
+
+  private:
+    void modified();
 
   private:
     typedef std::map<int, Symbol> SymbolMap;
@@ -173,6 +185,8 @@ namespace ipe {
     TLineJoin iLineJoin;
     TLineCap iLineCap;
     TFillRule iFillRule;
+
+    uint32_t iRevision;
   };
 
 
@@ -214,8 +228,19 @@ namespace ipe {
     void allNames(Kind kind, AttributeSeq &seq) const;
     int findDefinition(Kind kind, Attribute sym) const;
 
+  private:
+    struct Table;
+    const Table *table() const;
+    void invalidate();
+
   private:
     std::vector<StyleSheet *> iSheets;
+    //! Flattened lookup table, built when needed.
+    mutable std::atomic<Table *> iTable;
+    //! The current table, and the table it replaced.
+    /*! The outdated table is kept, as other threads may still use it. */
+    mutable std::vector<std::unique_ptr<Table>> iTables;
+    mutable std::mutex iTableMutex;
   };
 
 } // namespace
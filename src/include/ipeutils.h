@@ -105,6 +105,9 @@ namespace ipe {
     DeflateStream(Stream &stream, int level);
     virtual ~DeflateStream();
     virtual void putChar(char ch);
+    virtual void putString(String s);
+    virtual void putCString(const char *s);
+    virtual void putRaw(const char *data, int size);
     virtual void close();
 
     static Buffer deflate(const char *data, int size,
@@ -112,6 +115,7 @@ namespace ipe {
 
   private:
     struct Private;
+    void flush();
 
     Stream &iStream;
     Private *iPriv;
@@ -138,6 +142,7 @@ namespace ipe {
     Base64Source(DataSource &source);
     //! Get one more character, or EOF.
     virtual int getChar();
+    virtual int getChars(char *buf, int n);
   private:
     DataSource &iSource;
     bool  iEof;
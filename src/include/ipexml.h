@@ -89,6 +89,7 @@ namespace ipe {
 
   protected:
     String parseToTagX();
+    void appendUntil(int stop, String &s);
 
   protected:
     DataSource &iSource;
@@ -121,7 +121,8 @@ public:  // What platforms must implement:
   virtual void setBookmarks(int no, const String *s) = 0;
   virtual void setToolVisible(int m, bool vis) = 0;
   virtual int pageSorter(lua_State *L, Document *doc,
-			 int width, int height, int thumbWidth) = 0;
+			 int width, int height, int thumbWidth,
+			 String store) = 0;
   virtual int clipboard(lua_State *L) = 0;
   virtual int setClipboard(lua_State *L) = 0;
   // Only used on Windows to compute shortcuts:
@@ -69,7 +69,8 @@ public:
   virtual void setBookmarks(int no, const String *s) override;
   virtual void setToolVisible(int m, bool vis) override;
   virtual int pageSorter(lua_State *L, Document *doc,
-			 int width, int height, int thumbWidth) override;
+			 int width, int height, int thumbWidth,
+			 String store) override;
 
   virtual int clipboard(lua_State *L) override;
   virtual int setClipboard(lua_State *L) override;
@@ -356,7 +356,7 @@ void AppUi::action(String name)
 }
 
 int AppUi::pageSorter(lua_State *L, Document *doc,
-		      int width, int height, int thumbWidth)
+		      int width, int height, int thumbWidth, String store)
 {
   // TODO
   return 0;
@@ -62,7 +62,8 @@ public:
   virtual void setBookmarks(int no, const String *s);
   virtual void setToolVisible(int m, bool vis);
   virtual int pageSorter(lua_State *L, Document *doc,
-			 int width, int height, int thumbWidth);
+			 int width, int height, int thumbWidth,
+			 String store);
 
   virtual int clipboard(lua_State *L);
   virtual int setClipboard(lua_State *L);
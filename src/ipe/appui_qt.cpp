@@ -922,13 +922,13 @@ void AppUi::action(String name)
 // --------------------------------------------------------------------
 
 int AppUi::pageSorter(lua_State *L, Document *doc,
-		      int width, int height, int thumbWidth)
+		      int width, int height, int thumbWidth, String store)
 {
   QDialog *d = new QDialog();
   d->setWindowTitle("Ipe Page Sorter");
 
   QLayout *lo = new QVBoxLayout;
-  PageSorter *p = new PageSorter(doc, thumbWidth);
+  PageSorter *p = new PageSorter(doc, thumbWidth, store);
   QDialogButtonBox *buttonBox =
     new QDialogButtonBox(QDialogButtonBox::Ok|QDialogButtonBox::Cancel);
   lo->addWidget(p);
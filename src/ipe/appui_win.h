@@ -70,7 +70,8 @@ public:
 
   virtual int actionInfo(lua_State *L) const override;
   virtual int pageSorter(lua_State *L, Document *doc,
-			 int width, int height, int thumbWidth) override;
+			 int width, int height, int thumbWidth,
+			 String store) override;
 
   virtual int clipboard(lua_State *L) override;
   virtual int setClipboard(lua_State *L) override;
@@ -39,6 +39,8 @@
 #include <QMenu>
 #include <QContextMenuEvent>
 #include <QPainter>
+#include <QScrollBar>
+#include <QTimer>
 #include <QToolTip>
 
 // --------------------------------------------------------------------
@@ -248,10 +250,12 @@ bool PathView::event(QEvent *ev)
 
 // --------------------------------------------------------------------
 
-PageSorter::PageSorter(Document *doc, int itemWidth, QWidget *parent)
+PageSorter::PageSorter(Document *doc, int itemWidth, String store,
+		       QWidget *parent)
   : QListWidget(parent)
 {
   iDoc = doc;
+  iStore = store;
   setViewMode(QListView::IconMode);
   setSelectionMode(QAbstractItemView::ExtendedSelection);
   setResizeMode(QListView::Adjust);
@@ -261,17 +265,26 @@ PageSorter::PageSorter(Document *doc, int itemWidth, QWidget *parent)
   setSpacing(10);
   setMovement(QListView::Static);
 
-  Thumbnail r(iDoc, itemWidth);
-  setGridSize(QSize(itemWidth, r.height() + 50));
-  setIconSize(QSize(itemWidth, r.height()));
+  iThumbs = std::make_unique<Thumbnail>(iDoc, itemWidth);
+  if (!iStore.empty())
+    iThumbs->loadStore(iStore);
+  setGridSize(QSize(itemWidth, iThumbs->height() + 50));
+  setIconSize(QSize(itemWidth, iThumbs->height()));
+
+  // pages not in the thumbnail cache show a blank icon until rendered
+  QPixmap blank(itemWidth, iThumbs->height());
+  blank.fill(Qt::white);
+  iQueue = std::make_unique<ThumbnailQueue>(iThumbs.get());
 
   for (int i = 0; i < doc->countPages(); ++i) {
     Page *p = doc->page(i);
-    Buffer b = r.render(p, p->countViews() - 1);
-    QImage bits((const uchar *) b.data(), itemWidth, r.height(),
-		QImage::Format_RGB32);
-    // need to copy bits since buffer b is temporary
-    QIcon icon(QPixmap::fromImage(bits.copy()));
+    int view = p->countViews() - 1;
+    Buffer b;
+    QIcon icon(blank);
+    if (iThumbs->lookup(p, view, b))
+      icon = thumbnailIcon(b);
+    else
+      iQueue->add(i, p, view);
 
     QString s;
     QString t = QString::fromUtf8(p->title().z());
@@ -286,7 +299,53 @@ PageSorter::PageSorter(Document *doc, int itemWidth, QWidget *parent)
     item->setToolTip(s);
     item->setData(Qt::UserRole, QVariant(i)); // page number
     addItem(item);
+    iItems.push_back(item);
+  }
+
+  iScrollPos = -1;
+  iTimer = new QTimer(this);
+  connect(iTimer, &QTimer::timeout, this, &PageSorter::updateThumbnails);
+  if (iQueue->pending() > 0)
+    iTimer->start(50);
+}
+
+PageSorter::~PageSorter()
+{
+  // defined here, where Thumbnail and ThumbnailQueue are complete
+  iQueue.reset();
+  if (!iStore.empty())
+    iThumbs->saveStore(iStore);
+}
+
+QIcon PageSorter::thumbnailIcon(const Buffer &b) const
+{
+  QImage bits((const uchar *) b.data(), iThumbs->width(), iThumbs->height(),
+	      QImage::Format_RGB32);
+  // need to copy bits since buffer b may be shared
+  return QIcon(QPixmap::fromImage(bits.copy()));
+}
+
+// Show the thumbnails that have been rendered since the last call.
+void PageSorter::updateThumbnails()
+{
+  // when the visible items have changed, move them to the front
+  int pos = verticalScrollBar()->value();
+  if (pos != iScrollPos) {
+    iScrollPos = pos;
+    QRect vis = viewport()->rect();
+    for (int r = count() - 1; r >= 0; --r) {
+      if (visualItemRect(item(r)).intersects(vis))
+	iQueue->raise(pageAt(r));
+    }
+  }
+  int page;
+  Buffer b;
+  while (iQueue->take(page, b)) {
+    if (iItems[page])
+      iItems[page]->setIcon(thumbnailIcon(b));
   }
+  if (iQueue->pending() == 0)
+    iTimer->stop();
 }
 
 int PageSorter::pageAt(int r) const
@@ -300,6 +359,7 @@ void PageSorter::deletePages()
   for (int i = 0; i < items.count(); ++i) {
     int r = row(items[i]);
     QListWidgetItem *item = takeItem(r);
+    iItems[item->data(Qt::UserRole).toInt()] = nullptr;
     delete item;
   }
 }
@@ -307,8 +367,10 @@ void PageSorter::deletePages()
 void PageSorter::cutPages()
 {
   // delete items in old cut list
-  for (int i = 0; i < iCutList.count(); ++i)
+  for (int i = 0; i < iCutList.count(); ++i) {
+    iItems[iCutList[i]->data(Qt::UserRole).toInt()] = nullptr;
     delete iCutList[i];
+  }
   iCutList.clear();
 
   QList<QListWidgetItem *> items = selectedItems();
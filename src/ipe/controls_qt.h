@@ -36,6 +36,13 @@
 
 #include <QListWidget>
 
+class QTimer;
+
+namespace ipe {
+  class Thumbnail;
+  class ThumbnailQueue;
+}
+
 using namespace ipe;
 
 // --------------------------------------------------------------------
@@ -111,7 +118,9 @@ class PageSorter : public QListWidget {
   Q_OBJECT
 
 public:
-  PageSorter(Document *doc, int width, QWidget *parent = nullptr);
+  PageSorter(Document *doc, int width, String store = String(),
+	     QWidget *parent = nullptr);
+  ~PageSorter();
 
   int pageAt(int r) const;
 
@@ -120,13 +129,24 @@ public slots:
   void cutPages();
   void insertPages();
 
+private slots:
+  void updateThumbnails();
+
 private:
   virtual void contextMenuEvent(QContextMenuEvent *event);
+  QIcon thumbnailIcon(const Buffer &b) const;
 
 private:
   Document *iDoc;
   QList<QListWidgetItem *> iCutList;
   int iActionRow;
+  // thumbnails are rendered in the background
+  std::unique_ptr<Thumbnail> iThumbs;
+  std::unique_ptr<ThumbnailQueue> iQueue;
+  String iStore; // file for persistent thumbnails
+  std::vector<QListWidgetItem *> iItems; // item for each page
+  QTimer *iTimer;
+  int iScrollPos;
 };
 
 // --------------------------------------------------------------------
@@ -607,6 +607,7 @@ function MODEL:action_ipelet(a)
   local name = a:sub(i+1)
   for _, ipelet in ipairs(ipelets) do
     if ipelet.name == name then
+      load_lazy_ipelet(ipelet)
       if (ipelet.methods and ipelet.methods[method] and
 	  ipelet.methods[method].run) then
 	ipelet.methods[method].run(self, method)
@@ -1742,7 +1743,11 @@ function arrange_pages(doc, arr, newpages)
 end
 
 function MODEL:action_page_sorter()
-  local arr = self.ui:pageSorter(self.doc)
+  local store
+  if prefs.thumbnail_store and self.file_name then
+    store = self.file_name .. ".thumbs"
+  end
+  local arr = self.ui:pageSorter(self.doc, store)
   if not arr then return end -- canceled
   if #arr == 0 then
     self:warning("You cannot delete all pages of the document")
@@ -382,15 +382,201 @@ end
 
 --------------------------------------------------------------------
 
+-- Ipelets that only define their own variables, functions, and
+-- shortcuts can be loaded lazily.  After such an ipelet has been
+-- loaded once, its label, about text, method labels, and shortcuts
+-- are kept in an index, and with prefs.lazy_ipelets the ipelet itself
+-- is only loaded when it is first used.
+
+local ipelet_index_file = config.latexdir .. "ipelets.lua"
+local ipelet_index = nil
+local ipelet_index_changed = false
+
+local function read_ipelet_index()
+  ipelet_index = {}
+  if config.latexdir == "" or not ipe.fileExists(ipelet_index_file) then
+    return
+  end
+  local ff = ipe.loadFile(ipelet_index_file, {})
+  local ok, index = false, nil
+  if ff then ok, index = pcall(ff) end
+  if ok and type(index) == "table" then ipelet_index = index end
+end
+
+local function write_ipelet_index()
+  local f = config.latexdir ~= "" and ipe.openFile(ipelet_index_file, "wb")
+  if not f then return end
+  f:write("-- Menu entries of ipelets, written by Ipe\nreturn {\n")
+  for path, e in pairs(ipelet_index) do
+    f:write(string.format("[%q] = { mtime = %d, size = %d, label = %q,\n",
+			  path, e.mtime, e.size, e.label))
+    if e.about then f:write(string.format("  about = %q,\n", e.about)) end
+    if e.methods then
+      f:write("  methods = {")
+      for _, m in ipairs(e.methods) do
+	f:write(string.format(" { label = %q },", m.label))
+      end
+      f:write(" },\n")
+    end
+    f:write("  shortcuts = {")
+    for k, v in pairs(e.shortcuts) do
+      f:write(string.format(" [%q] = %s,", k, v and string.format("%q", v)
+			      or "false"))
+    end
+    f:write(" } },\n")
+  end
+  f:write("}\n")
+  f:close()
+end
+
+-- shallow copies of the shared tables an ipelet could modify, and of
+-- the tables nested in them up to depth levels deep (so that changes
+-- such as prefs.x.y = z are noticed)
+local function snapshot_tables(t, depth, s, seen)
+  seen[t] = true
+  local c = {}
+  for k, v in pairs(t) do
+    c[k] = v
+    if type(v) == "table" and depth > 1 and not seen[v] then
+      snapshot_tables(v, depth - 1, s, seen)
+    end
+  end
+  s[#s + 1] = { t, c }
+end
+
+-- the ipelet's own table and the shortcuts may change
+local function snapshot(ft)
+  local s = {}
+  local seen = { [ft] = true, [shortcuts] = true }
+  for _, t in ipairs({ prefs, config, mouse, MODEL, _G }) do
+    if not seen[t] then snapshot_tables(t, 3, s, seen) end
+  end
+  local sc = {}
+  for k, v in pairs(shortcuts) do sc[k] = v end
+  return s, sc
+end
+
+local function unchanged(s)
+  for _, e in ipairs(s) do
+    local t, c = e[1], e[2]
+    for k, v in pairs(t) do
+      if c[k] ~= v then return false end
+    end
+    for k in pairs(c) do
+      if rawget(t, k) == nil then return false end
+    end
+  end
+  return true
+end
+
+-- shortcuts changed by an ipelet (false for removed ones), or nil if
+-- they cannot be stored in the index
+local function shortcut_changes(before)
+  local changes = {}
+  for k, v in pairs(shortcuts) do
+    if before[k] ~= v then
+      if type(v) ~= "string" then return nil end
+      changes[k] = v
+    end
+  end
+  for k in pairs(before) do
+    if shortcuts[k] == nil then changes[k] = false end
+  end
+  return changes
+end
+
+-- load and run the ipelet, and record it in the index if possible
+-- (the index is only written with prefs.lazy_ipelets)
+local function load_ipelet(ft)
+  if not prefs.lazy_ipelets then
+    local ff = assert(ipe.loadFile(ft.path, ft))
+    ff()
+    return
+  end
+  local mtime, size = ipe.fileStatus(ft.path)
+  local s, sc = snapshot(ft)
+  local ff = assert(ipe.loadFile(ft.path, ft))
+  ff()
+  local changes = shortcut_changes(sc)
+  local entry = nil
+  if mtime and type(ft.label) == "string" and changes and unchanged(s) then
+    entry = { mtime = mtime, size = size, label = ft.label,
+	      shortcuts = changes }
+    if type(ft.about) == "string" then entry.about = ft.about end
+    if type(ft.methods) == "table" then
+      entry.methods = {}
+      for i, m in ipairs(ft.methods) do
+	if type(m.label) ~= "string" then entry = nil break end
+	entry.methods[i] = { label = m.label }
+      end
+    end
+  end
+  if ipelet_index[ft.path] ~= entry then
+    ipelet_index[ft.path] = entry
+    ipelet_index_changed = true
+  end
+end
+
+-- load an ipelet that has been registered lazily
+function load_lazy_ipelet(ft)
+  if not ft.lazy then return end
+  ft.lazy = nil
+  -- its shortcuts have been set from the index already
+  ft.shortcuts = {}
+  local ff = assert(ipe.loadFile(ft.path, ft))
+  ff()
+  ft.shortcuts = nil
+end
+
+-- set up ipelet from its index entry, without loading it
+local function register_ipelet(ft, entry)
+  ft.lazy = true
+  ft.label = entry.label
+  ft.about = entry.about
+  ft.methods = entry.methods
+  for k, v in pairs(entry.shortcuts) do
+    shortcuts[k] = v or nil
+  end
+end
+
 function load_ipelets()
   for _,ft in ipairs(ipelets) do
-    local fd = ipe.openFile(ft.path, "rb")
-    local ff = assert(load(function () return fd:read("*L") end,
-			   ft.path, "bt", ft))
+    ft.lazy = nil
+    ft.shortcuts = shortcuts
+    local ff = assert(ipe.loadFile(ft.path, ft))
     ff()
   end
 end
 
+-- Load all ipelets, in order.  Ipelets found in the index are only
+-- registered, and are loaded at the end unless prefs.lazy_ipelets is
+-- set (possibly by an ipelet loaded in between).
+local function load_ipelets_at_startup()
+  read_ipelet_index()
+  for _,ft in ipairs(ipelets) do
+    local entry = ipelet_index[ft.path]
+    local mtime, size = ipe.fileStatus(ft.path)
+    if entry and entry.mtime == mtime and entry.size == size then
+      register_ipelet(ft, entry)
+    else
+      load_ipelet(ft)
+    end
+  end
+  if prefs.lazy_ipelets then
+    local present = {}
+    for _,ft in ipairs(ipelets) do present[ft.path] = true end
+    for path in pairs(ipelet_index) do
+      if not present[path] then
+	ipelet_index[path] = nil
+	ipelet_index_changed = true
+      end
+    end
+    if ipelet_index_changed then write_ipelet_index() end
+  else
+    for _,ft in ipairs(ipelets) do load_lazy_ipelet(ft) end
+  end
+end
+
 -- look for ipelets
 ipelets = {}
 for _,w in ipairs(config.ipeletDirs) do
@@ -424,7 +610,7 @@ for _,w in ipairs(config.ipeletDirs) do
   end
 end
 
-load_ipelets()
+load_ipelets_at_startup()
 
 --------------------------------------------------------------------
 
@@ -409,8 +409,33 @@ end
 
 ----------------------------------------------------------------------
 
-local function showSource(d)
-  local fname = config.latexdir .. "ipetemp.tex"
+-- return the contents of a file, or nil
+local function readFile(fname)
+  local f = ipe.openFile(fname, "rb")
+  if not f then return nil end
+  local s = f:read("*all")
+  f:close()
+  return s
+end
+
+-- Latex source of the run that produced the log
+-- (with many texts, several Latex runs in subdirectories share the work)
+local function latexSource(log)
+  local sep = config.latexdir:sub(-1)
+  local k = 1
+  while true do
+    local dir = config.latexdir .. "shard" .. k .. sep
+    if not ipe.fileExists(dir .. "ipetemp.tex") then break end
+    if readFile(dir .. "ipetemp.log") == log then
+      return dir .. "ipetemp.tex"
+    end
+    k = k + 1
+  end
+  return config.latexdir .. "ipetemp.tex"
+end
+
+local function showSource(d, log)
+  local fname = latexSource(log)
   ipeui.waitDialog(d, string.format(prefs.external_editor, fname))
 end
 
@@ -422,7 +447,7 @@ function MODEL:latexErrorBox(log)
 	1, 1)
   d:add("text", "text", { read_only=true, syntax="logfile", focus=true }, 2, 1)
   if prefs.external_editor then
-    d:addButton("editor", "&Source", function (d) showSource(d) end)
+    d:addButton("editor", "&Source", function (d) showSource(d, log) end)
   end
   d:addButton("ok", "Ok", "accept")
   d:set("text", log)
@@ -566,7 +591,9 @@ function MODEL:saveDocument(fname)
   props.creator = config.version
   self.doc:setProperties(props)
 
-  if not self.doc:save(fname, fm) then
+  local flags = nil
+  if fm == "pdf" then flags = { incremental = prefs.incremental_save } end
+  if not self.doc:save(fname, fm, flags) then
     self:warning("File not saved!", "Error saving the document")
     return
   end
@@ -639,13 +666,43 @@ end
 
 ----------------------------------------------------------------------
 
--- TODO:  limit on undo stack size?
+-- number of objects that the document pages duplicated, removed, or
+-- replaced while they were shared with a page snapshot since the last
+-- call.  These objects are now held only by the undo snapshots.
+local function detachedObjects(doc)
+  local n = 0
+  for i = 1, #doc do
+    n = n + doc[i]:takeDetached()
+  end
+  return n
+end
+
+-- discard the oldest undo steps if the undo stack holds too many objects
+function MODEL:limitUndo()
+  local limit = prefs.undo_object_limit
+  if not limit then return end
+  local total = 0
+  for _, t in ipairs(self.undo) do
+    total = total + (t.cost or 0)
+  end
+  while #self.undo > 2 and total > limit do
+    local t = self.undo[2]
+    -- the bottom of the stack now represents the state after step t
+    self.undo[1].save_timestamp = t.save_timestamp
+    total = total - (t.cost or 0)
+    table.remove(self.undo, 2)
+  end
+end
+
 function MODEL:registerOnly(t)
   self.pristine = false
+  -- the objects that the edit took from the snapshots
+  t.cost = detachedObjects(self.doc)
   -- store it on undo stack
   self.undo[#self.undo + 1] = t
   -- flush redo stack
   self.redo = {}
+  self:limitUndo()
   self:setPage()
 end
 
@@ -780,6 +837,7 @@ function MODEL:action_undo()
   t = self.undo[#self.undo]
   table.remove(self.undo)
   t.undo(t, self.doc)
+  detachedObjects(self.doc)  -- already counted in t.cost
   self.ui:explain("Undo '" .. t.label .. "'")
   self.redo[#self.redo + 1] = t
   if t.pno then
@@ -818,6 +876,7 @@ function MODEL:action_redo()
   t = self.redo[#self.redo]
   table.remove(self.redo)
   t.redo(t, self.doc)
+  detachedObjects(self.doc)  -- already counted in t.cost
   self.ui:explain("Redo '" .. t.label .. "'")
   self.undo[#self.undo + 1] = t
   if t.pno then
@@ -45,6 +45,13 @@ prefs.tex_engine = "default"
 -- set to nil to disable autosaving
 prefs.autosave_interval = 600 -- 10 minutes
 
+-- Limit on the number of objects kept for undo
+-- Unmodified objects are shared with the document and do not count,
+-- nor do the objects of deleted pages.
+-- The oldest undo steps are discarded when the limit is exceeded.
+-- set to nil to keep the entire undo history
+prefs.undo_object_limit = 500000
+
 -- Filename for autosaving
 -- can contain '%s' for the filename of the current file
 -- can use 'home' for the user's home directory
@@ -152,6 +159,11 @@ prefs.page_sorter_size = { 960, 600 }
 -- Width of page thumbnails (height is computed automatically)
 prefs.thumbnail_width = 200
 
+-- Keep page thumbnails in a file beside the document
+-- (with extension ".thumbs"), so that the page sorter
+-- does not need to render unchanged pages again
+prefs.thumbnail_store = false
+
 -- Canvas customization:
 prefs.canvas_style = {
   paper_color = { r = 1.0, g = 1.0, b = 1.0 },  -- white
@@ -354,6 +366,27 @@ prefs.auto_export_to_pdf = false
 
 ----------------------------------------------------------------------
 
+-- Incremental saving of PDF documents
+-- If this is set, then saving a PDF document that has been saved
+-- before in this session only appends the pages, objects, and style
+-- sheets that have changed to the end of the file.  The file grows
+-- with every save until it is written out in full again, which
+-- happens automatically once it has doubled in size.
+-- Careful: older versions of Ipe cannot open such files.
+
+prefs.incremental_save = false
+
+----------------------------------------------------------------------
+
+-- Load ipelets only when they are first used?
+-- Ipelets that only define their own functions, menu entries, and
+-- shortcuts are then set up from an index in the Latex directory,
+-- which is updated whenever such an ipelet has changed.
+
+prefs.lazy_ipelets = false
+
+----------------------------------------------------------------------
+
 -- Extended properties menu, perhaps useful for tablets:
 prefs.tablet_menu = false
 
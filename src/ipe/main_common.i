@@ -121,6 +121,7 @@ static lua_State *setup_lua()
   luaopen_ipe(L);
   luaopen_ipeui(L);
   luaopen_appui(L);
+  use_bytecode_cache(L);
   return L;
 }
 
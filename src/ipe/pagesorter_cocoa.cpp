@@ -214,10 +214,12 @@ extern NSSize thumbnail_size; // in ipeselector_cocoa.cpp
 // --------------------------------------------------------------------
 
 int AppUi::pageSorter(lua_State *L, Document *doc,
-		      int width, int height, int thumbWidth)
+		      int width, int height, int thumbWidth, String store)
 {
   // double the resolution for retina displays
   Thumbnail thumbs(doc, 2 * thumbWidth);
+  if (!store.empty())
+    thumbs.loadStore(store);
 
   thumbnail_size.width = thumbs.width() / 2.0;
   thumbnail_size.height = thumbs.height() / 2.0;
@@ -322,6 +324,8 @@ int AppUi::pageSorter(lua_State *L, Document *doc,
   [panel setDefaultButtonCell:[bOk cell]]; // changed rendering
 
   int result = [NSApp runModalForWindow:panel];
+  if (!store.empty())
+    thumbs.saveStore(store);
   if (result) {
     int n = [delegate.pages count];
     lua_createtable(L, n, 0);
@@ -94,8 +94,39 @@ struct SData {
   Document *doc;
   std::vector<int> pages;
   std::vector<int> cutlist;
+  // thumbnails are rendered in the background
+  Thumbnail *thumbs;
+  ThumbnailQueue *queue;
+  int topIndex;
 };
 
+// Show the thumbnails that have been rendered since the last call.
+static void updateThumbnails(HWND hwnd, HWND lv, SData *d)
+{
+  // when the visible items have changed, move them to the front
+  int top = ListView_GetTopIndex(lv);
+  if (top != d->topIndex) {
+    d->topIndex = top;
+    int n = std::min(top + ListView_GetCountPerPage(lv), int(d->pages.size()));
+    for (int i = n - 1; i >= top; --i)
+      d->queue->raise(d->pages[i]);
+  }
+  int page;
+  Buffer bx;
+  bool changed = false;
+  while (d->queue->take(page, bx)) {
+    HBITMAP b = createBitmap((uint32_t *) bx.data(),
+			     d->thumbs->width(), d->thumbs->height());
+    ImageList_Replace(d->hImageList, page, b, nullptr);
+    DeleteObject(b);
+    changed = true;
+  }
+  if (changed)
+    InvalidateRect(lv, nullptr, FALSE);
+  if (d->queue->pending() == 0)
+    KillTimer(hwnd, 1);
+}
+
 static void insertItem(HWND h, SData *d, int index, int page)
 {
   LVITEM lvI;
@@ -208,7 +239,12 @@ static INT_PTR CALLBACK dialogProc(HWND hwnd, UINT message,
     SendMessage(h, LVM_SETIMAGELIST, (WPARAM) LVSIL_NORMAL,
 		(LPARAM) d->hImageList);
     populateView(h, d);
+    if (d->queue->pending() > 0)
+      SetTimer(hwnd, 1, 50, nullptr);
     return TRUE; }
+  case WM_TIMER:
+    updateThumbnails(hwnd, h, d);
+    return TRUE;
   case WM_COMMAND:
     switch (LOWORD(wParam)) {
     case IDBASE + 1: // Ok
@@ -240,20 +276,34 @@ static INT_PTR CALLBACK dialogProc(HWND hwnd, UINT message,
 // --------------------------------------------------------------------
 
 int AppUi::pageSorter(lua_State *L, Document *doc,
-		      int width, int height, int thumbWidth)
+		      int width, int height, int thumbWidth, String store)
 {
   SData sData;
   sData.doc = doc;
 
   // Create image list
   Thumbnail r(doc, thumbWidth);
+  if (!store.empty())
+    r.loadStore(store);
+  ThumbnailQueue queue(&r);
+  sData.thumbs = &r;
+  sData.queue = &queue;
+  sData.topIndex = -1;
+  // pages not in the thumbnail cache show a blank icon until rendered
+  Buffer blank(thumbWidth * r.height() * 4);
+  memset(blank.data(), 0xff, blank.size());
   // Image list will be destroyed when ListView is destroyed
   sData.hImageList = ImageList_Create(thumbWidth, r.height(), ILC_COLOR32,
 				      doc->countPages(), 4);
   for (int i = 0; i < doc->countPages(); ++i) {
     sData.pages.push_back(i);
     Page *p = doc->page(i);
-    Buffer bx = r.render(p, p->countViews() - 1);
+    int view = p->countViews() - 1;
+    Buffer bx;
+    if (!r.lookup(p, view, bx)) {
+      bx = blank;
+      queue.add(i, p, view);
+    }
     HBITMAP b = createBitmap((uint32_t *) bx.data(), thumbWidth, r.height());
     ImageList_Add(sData.hImageList, b, nullptr);
   }
@@ -305,6 +355,9 @@ int AppUi::pageSorter(lua_State *L, Document *doc,
     DialogBoxIndirectParamW(nullptr, (LPCDLGTEMPLATE) &t[0],
 			    nullptr, dialogProc, (LPARAM) &sData);
 
+  if (!store.empty())
+    r.saveStore(store);
+
   if (res == 1) {
     int n = sData.pages.size();
     lua_createtable(L, n, 0);
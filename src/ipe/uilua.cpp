@@ -663,10 +663,14 @@ static int appui_pageSorter(lua_State *L)
   AppUiBase **ui = check_appui(L, 1);
   Document **doc = check_document(L, 2);
 
+  String store;
+  if (!lua_isnoneornil(L, 3))
+    store = luaL_checklstring(L, 3, nullptr);
+
   int width, height, thumbWidth;
   get_page_sorter_size(L, width, height, thumbWidth);
 
-  return (*ui)->pageSorter(L, *doc, width, height, thumbWidth);
+  return (*ui)->pageSorter(L, *doc, width, height, thumbWidth, store);
 }
 
 static const char *const render_formats[] = {"svg", "png", "eps", "pdf", nullptr };
@@ -29,6 +29,7 @@
 */
 
 #include "ipetext.h"
+#include "ipestyle.h"
 #include "ipepdfparser.h"
 #include "ipecairopainter.h"
 #include "ipefonts.h"
@@ -260,6 +261,12 @@ CairoPainter::CairoPainter(const Cascade *sheet, Fonts *fonts,
   : Painter(sheet), iFonts(fonts), iCairo(cc), iZoom(zoom), iPretty(pretty)
 {
   iDimmed = false;
+  // stamps must not be reused once the style sheets change
+  iStyleKey = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < sheet->count(); ++i) {
+    iStyleKey = (iStyleKey ^ uint64_t(sheet->sheet(i))) * 0x100000001b3ULL;
+    iStyleKey = (iStyleKey ^ sheet->sheet(i)->revision()) * 0x100000001b3ULL;
+  }
 }
 
 void CairoPainter::doPush()
@@ -473,22 +480,38 @@ void CairoPainter::doAddClipPath()
 
 void CairoPainter::doDrawBitmap(Bitmap bitmap)
 {
-  Buffer data = bitmap.pixelData();
+  // when rendering to the screen, an image shown much smaller than its
+  // size is taken from the mip pyramid, at the level that is at most
+  // twice the device size, and filtered from there
+  int level = 0;
+  double ratio = 0.0;
+  cairo_surface_type_t type = cairo_surface_get_type(cairo_get_target(iCairo));
+  if (type != CAIRO_SURFACE_TYPE_PDF && type != CAIRO_SURFACE_TYPE_PS &&
+      type != CAIRO_SURFACE_TYPE_SVG) {
+    Vector ex = matrix().linear() * Vector(1.0, 0.0);
+    Vector ey = matrix().linear() * Vector(0.0, 1.0);
+    cairo_user_to_device_distance(iCairo, &ex.x, &ex.y);
+    cairo_user_to_device_distance(iCairo, &ey.x, &ey.y);
+    level = bitmap.displayLevel(ex, ey, ratio);
+  }
+  int width, height;
+  Buffer data = bitmap.pixelData(level, width, height);
   if (!data.size())
     return;
   // is this legal?  I don't want cairo to modify my bitmap temporarily.
   cairo_surface_t *image =
     cairo_image_surface_create_for_data((uint8_t *) data.data(),
 					CAIRO_FORMAT_ARGB32,
-					bitmap.width(), bitmap.height(),
-					4 * bitmap.width());
+					width, height, 4 * width);
   cairo_save(iCairo);
-  Matrix tf = matrix() * Matrix(1.0 / bitmap.width(), 0.0,
-				0.0, -1.0 / bitmap.height(),
+  Matrix tf = matrix() * Matrix(1.0 / width, 0.0,
+				0.0, -1.0 / height,
 				0.0, 1.0);
   cairoTransform(iCairo, tf);
   cairo_set_source_surface(iCairo, image, 0, 0);
-  cairo_pattern_set_filter(cairo_get_source(iCairo), CAIRO_FILTER_FAST);
+  // magnified images keep their sharp pixels
+  cairo_pattern_set_filter(cairo_get_source(iCairo), ratio >= 1.0 ?
+			   CAIRO_FILTER_BILINEAR : CAIRO_FILTER_FAST);
   cairo_paint_with_alpha(iCairo, opacity().toDouble());
   cairo_restore(iCairo);
 }
@@ -555,6 +578,139 @@ void CairoPainter::doDrawText(const Text *text)
   }
 }
 
+// positions of stamps per pixel, horizontally and vertically
+const int STAMP_PHASES = 4;
+// largest stamp, in pixels
+const double MAX_STAMP_AREA = 128 * 128;
+
+//! Draw a symbol, copying a pre-rendered stamp if possible.
+/*! When drawing to an image, each symbol is rendered only once for
+  each graphics state and linear transformation, and then copied to
+  every position where it appears.  The position is rounded to a
+  quarter pixel. */
+void CairoPainter::doDrawSymbol(Attribute symbol)
+{
+  const Symbol *sym = cascade()->findSymbol(symbol);
+  if (!sym)
+    return;
+  cairo_surface_t *target = cairo_get_group_target(iCairo);
+  if (cairo_surface_get_type(target) != CAIRO_SURFACE_TYPE_IMAGE) {
+    sym->iObject->draw(*this);
+    return;
+  }
+
+  // transformation from symbol to device pixels
+  double sx, sy, ox, oy;
+  cairo_surface_get_device_scale(target, &sx, &sy);
+  cairo_surface_get_device_offset(target, &ox, &oy);
+  const Matrix &m = matrix();
+  double x = m.a[4], y = m.a[5];
+  double v[4] = { m.a[0], m.a[1], m.a[2], m.a[3] };
+  cairo_user_to_device(iCairo, &x, &y);
+  cairo_user_to_device_distance(iCairo, &v[0], &v[1]);
+  cairo_user_to_device_distance(iCairo, &v[2], &v[3]);
+  int qx = int(std::floor((sx * x + ox) * STAMP_PHASES + 0.5));
+  int qy = int(std::floor((sy * y + oy) * STAMP_PHASES + 0.5));
+  int ix = int(std::floor(double(qx) / STAMP_PHASES));
+  int iy = int(std::floor(double(qy) / STAMP_PHASES));
+  Matrix device(sx * v[0], sy * v[1], sx * v[2], sy * v[3],
+		double(qx - ix * STAMP_PHASES) / STAMP_PHASES,
+		double(qy - iy * STAMP_PHASES) / STAMP_PHASES);
+
+  String key = stampKey(symbol, device);
+  Stamp stamp;
+  if (!iFonts->findStamp(key, stamp)) {
+    stamp = renderStamp(sym, device);
+    iFonts->addStamp(key, stamp);
+  }
+  if (stamp.iVector) {
+    sym->iObject->draw(*this);
+  } else if (stamp.iSurface) {
+    // user coordinates are device pixels
+    cairo_save(iCairo);
+    cairo_identity_matrix(iCairo);
+    cairo_scale(iCairo, 1.0 / sx, 1.0 / sy);
+    cairo_translate(iCairo, -ox, -oy);
+    cairo_set_source_surface(iCairo, stamp.iSurface.get(),
+			     ix + stamp.iX, iy + stamp.iY);
+    cairo_paint(iCairo);
+    cairo_restore(iCairo);
+  }
+}
+
+//! Key for the stamp cache: symbol, graphics state, and transformation.
+String CairoPainter::stampKey(Attribute symbol, const Matrix &device) const
+{
+  const State &s = state();
+  int ints[] = { symbol.internal(), iDimmed, iPretty,
+		 int(cairo_get_antialias(iCairo)),
+		 s.iStroke.iRed.internal(), s.iStroke.iGreen.internal(),
+		 s.iStroke.iBlue.internal(),
+		 s.iFill.iRed.internal(), s.iFill.iGreen.internal(),
+		 s.iFill.iBlue.internal(),
+		 s.iSymStroke.iRed.internal(), s.iSymStroke.iGreen.internal(),
+		 s.iSymStroke.iBlue.internal(),
+		 s.iSymFill.iRed.internal(), s.iSymFill.iGreen.internal(),
+		 s.iSymFill.iBlue.internal(),
+		 s.iPen.internal(), s.iSymPen.internal(),
+		 s.iLineCap, s.iLineJoin, s.iFillRule,
+		 s.iOpacity.internal(), s.iStrokeOpacity.internal(),
+		 s.iTiling.internal(), s.iGradient.internal() };
+  String key;
+  key.append(reinterpret_cast<const char *>(ints), sizeof(ints));
+  key.append(reinterpret_cast<const char *>(&iStyleKey), sizeof(iStyleKey));
+  key.append(reinterpret_cast<const char *>(device.a), sizeof(device.a));
+  key.append(s.iDashStyle);
+  return key;
+}
+
+//! Render the symbol with this transformation to device pixels.
+Stamp CairoPainter::renderStamp(const Symbol *symbol, const Matrix &device)
+{
+  Stamp stamp;
+  stamp.iVector = false;
+  stamp.iX = stamp.iY = 0;
+
+  // record the drawing first to find its extent
+  cairo_surface_t *recording =
+    cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, nullptr);
+  cairo_t *cr = cairo_create(recording);
+  cairo_set_antialias(cr, cairo_get_antialias(iCairo));
+  cairo_matrix_t cm;
+  cairoMatrix(cm, device);
+  cairo_set_matrix(cr, &cm);
+  CairoPainter painter(cascade(), iFonts, cr, iZoom, iPretty);
+  painter.setDimmed(iDimmed);
+  painter.setState(state());
+  symbol->iObject->draw(painter);
+  cairo_destroy(cr);
+
+  double x, y, w, h;
+  cairo_recording_surface_ink_extents(recording, &x, &y, &w, &h);
+  if (w > 0 && h > 0) {
+    double x0 = std::floor(x), y0 = std::floor(y);
+    double x1 = std::ceil(x + w), y1 = std::ceil(y + h);
+    if ((x1 - x0) * (y1 - y0) > MAX_STAMP_AREA) {
+      stamp.iVector = true;
+    } else {
+      cairo_surface_t *image =
+	cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+				   int(x1 - x0), int(y1 - y0));
+      cr = cairo_create(image);
+      cairo_set_source_surface(cr, recording, -x0, -y0);
+      cairo_paint(cr);
+      cairo_destroy(cr);
+      stamp.iSurface.reset(image, cairo_surface_destroy);
+      stamp.iX = int(x0);
+      stamp.iY = int(y0);
+    }
+  }
+  cairo_surface_destroy(recording);
+  return stamp;
+}
+
+// --------------------------------------------------------------------
+
 void CairoPainter::executeStream(const PdfDict *stream, const PdfDict *resources)
 {
   cairo_save(iCairo);
@@ -576,15 +732,6 @@ void CairoPainter::executeStream(const PdfDict *stream, const PdfDict *resources
 
 // --------------------------------------------------------------------
 
-//! Clear PDF argument stack
-void CairoPainter::clearArgs()
-{
-  while (!iArgs.empty()) {
-    delete iArgs.back();
-    iArgs.pop_back();
-  }
-}
-
 const PdfDict *CairoPainter::findResource(String kind, String name)
 {
   if (iResourceStack.size() > 0) {
@@ -596,449 +743,582 @@ const PdfDict *CairoPainter::findResource(String kind, String name)
   return iFonts->resources()->findResource(kind, name);
 }
 
-
 void CairoPainter::execute(const PdfDict *xform, const PdfDict *resources, bool applyMatrix)
 {
   // ipeDebug("execute %s", xform->dictRepr().z());
-  iResourceStack.push_back(resources);
+  replay(*compile(xform, resources), applyMatrix);
+}
+
+// --------------------------------------------------------------------
+
+using PdfArgs = std::vector<std::unique_ptr<const PdfObj>>;
+
+//! Check that the arguments are \a n numbers.
+static bool isNumbers(const PdfArgs &args, int n)
+{
+  if (size(args) != n)
+    return false;
+  for (const auto & arg : args) {
+    if (!arg->number())
+      return false;
+  }
+  return true;
+}
+
+//! Emit operation with \a n numeric arguments (if they are numbers).
+static void emit(DisplayList &dl, DisplayList::Op op, const PdfArgs &args, int n)
+{
+  if (!isNumbers(args, n))
+    return;
+  dl.iOps.push_back(op);
+  for (const auto & arg : args)
+    dl.iNums.push_back(arg->number()->value());
+}
+
+//! Return display list for the content stream, compiling it if necessary.
+/*! The stream is parsed only once, the display list is cached
+  in the Fonts object. */
+const DisplayList *CairoPainter::compile(const PdfDict *stream,
+					 const PdfDict *resources)
+{
+  const DisplayList *cached = iFonts->displayList(stream, resources);
+  if (cached)
+    return cached;
+
+  auto dl = std::make_unique<DisplayList>();
+  dl->iResources = resources;
   std::vector<double> m;
-  if (applyMatrix && xform->getNumberArray("Matrix", nullptr, m) && m.size() == 6) {
-    Matrix mx;
+  dl->iHasMatrix = stream->getNumberArray("Matrix", nullptr, m) && m.size() == 6;
+  if (dl->iHasMatrix) {
     for (int i = 0; i < 6; ++i)
-      mx.a[i] = m[i];
-    cairoTransform(iCairo, mx);
+      dl->iMatrix.a[i] = m[i];
   }
-  Buffer buffer = xform->inflate();
+
+  iResourceStack.push_back(resources);
+  Buffer buffer = stream->inflate();
   BufferSource source(buffer);
   PdfParser parser(source);
-  clearArgs();                  // if called recursively...
+  PdfArgs args;
+  // font selected on each q level (nullptr if not known when compiling)
+  std::vector<Face *> fonts;
+  fonts.push_back(nullptr);
   while (!parser.eos()) {
     PdfToken tok = parser.token();
     if (tok.iType != PdfToken::EOp) {
       const PdfObj *obj = parser.getObject();
       if (!obj)
 	break; // no further parsing attempted
-      iArgs.push_back(obj);
+      args.emplace_back(obj);
     } else {
-      // its an operator, execute it
       String op = tok.iString;
       parser.getToken();
-      if (op == "cm")
-	opcm();
-      else if (op == "q")
-	opq();
-      else if (op == "Q")
-	opQ();
-      else if (op == "rg")
-	oprg(false);
-      else if (op == "RG")
-	oprg(true);
-      else if (op == "g")
-	opg(false);
-      else if (op == "G")
-	opg(true);
-      else if (op == "k")
-	opk(false);
-      else if (op == "K")
-	opk(true);
-      else if (op == "scn")
-	opscn(false);
-      else if (op == "SCN")
-	opscn(true);
-      else if (op == "w")
-	opw();
-      else if (op == "d")
-	opd();
-      else if (op == "Do")
-	opDo();
-      else if (op == "sh")
-	opsh();
-      else if (op == "i")
-	opi();
-      else if (op == "j")
-	opj();
-      else if (op == "J")
-	opJ();
-      else if (op == "M")
-	opM();
-      else if (op == "W")
-	opW(false);
-      else if (op == "W*")
-	opW(true);
-      else if (op == "gs")
-	opgs();
-      else if (op == "m")
-	opm();
-      else if (op == "l")
-	opl();
-      else if (op == "h")
-	oph();
-      else if (op == "c")
-	opc();
-      else if (op == "v")
-	opv();
-      else if (op == "y")
-	opy();
-      else if (op == "re")
-	opre();
-      else if (op == "n")
-	opn();
-      else if (op == "b")
-	opStrokeFill(true, true, true, false);
-      else if (op == "b*")
-	opStrokeFill(true, true, true, true);
-      else if (op == "B")
-	opStrokeFill(false, true, true, false);
-      else if (op == "B*")
-	opStrokeFill(false, true, true, true);
-      else if (op == "f" || op == "F")
-	opStrokeFill(false, true, false, false);
-      else if (op == "f*")
-	opStrokeFill(false, true, false, true);
-      else if (op == "s")
-	opStrokeFill(true, false, true, false);
-      else if (op == "S")
-	opStrokeFill(false, false, true, false);
-      else if (op == "Tc")
-	opTc(&iPdfState.back().iCharacterSpacing);
-      else if (op == "Tw")
-	opTc(&iPdfState.back().iWordSpacing);
-      else if (op == "TL")
-	opTc(&iPdfState.back().iLeading);
-      else if (op == "Ts")
-	opTc(&iPdfState.back().iTextRise);
-      else if (op == "Tz")
-	opTz();
-      else if (op == "Tf")
-	opTf();
-      else if (op == "Tm")
-	opTm();
-      else if (op == "Td")
-	opTd(false);
-      else if (op == "TD")
-	opTd(true);
-      else if (op == "T*")
-	opTstar();
-      else if (op == "TJ")
-	opTJ();
-      else if (op == "Tj")
-	opTj(false, false);
-      else if (op == "'")
-	opTj(true, false);
-      else if (op == "\"")
-	opTj(true, true);
-      else if (op == "BT")
-	opBT();
-      else if (op == "ET")
-	opET();
-      else if (op == "MP" || op == "DP" || op == "BMC"
-	       || op == "BDC" || op == "EMC") {
-	// content markers, ignore
-      } else if (op == "ri") {
-	// set rendering intent, ignore
-      } else {
-	String a;
-	for (const auto & arg : iArgs)
-	  a += arg->repr() + " ";
-	ipeDebug("op %s (%s)", op.z(), a.z());
-      }
-      clearArgs();
+      compileOp(*dl, op, args, fonts);
+      args.clear();
     }
   }
-  clearArgs();
   iResourceStack.pop_back();
+  return iFonts->addDisplayList(stream, resources, std::move(dl));
 }
 
-void CairoPainter::opg(bool stroke)
+void CairoPainter::compileOp(DisplayList &dl, String op, const PdfArgs &args,
+			     std::vector<Face *> &fonts)
 {
-  if (iArgs.size() != 1 || !iArgs[0]->number())
-    return;
-  double gr = iArgs[0]->number()->value();
-  auto & ps = iPdfState.back();
-  if (stroke)
-    ps.iStrokeRgb[0] = ps.iStrokeRgb[1] = ps.iStrokeRgb[2] = gr;
-  else
-    ps.iFillRgb[0] = ps.iFillRgb[1] = ps.iFillRgb[2] = gr;
-}
-
-
-void CairoPainter::oprg(bool stroke)
-{
-  if (iArgs.size() != 3 || !iArgs[0]->number() || !iArgs[1]->number()
-      || !iArgs[2]->number())
-    return;
-  double *col = (stroke ? iPdfState.back().iStrokeRgb :
-		 iPdfState.back().iFillRgb);
-  for (int i = 0; i < 3; ++i)
-    col[i] = iArgs[i]->number()->value();
-}
-
-void CairoPainter::opk(bool stroke)
-{
-  if (iArgs.size() != 4 || !iArgs[0]->number() || !iArgs[1]->number()
-      || !iArgs[2]->number() || !iArgs[3]->number())
-    return;
-  ipeDebug("PDF setting CMYK color");
-  // should use the colorspace of the monitor instead of this crude conversion
-  double v = 1.0  - iArgs[3]->number()->value();
-  double *col = (stroke ? iPdfState.back().iStrokeRgb :
-		 iPdfState.back().iFillRgb);
-  for (int i = 0; i < 3; ++i)
-    col[i] = v * (1.0 - iArgs[i]->number()->value());
-}
-
-void CairoPainter::opscn(bool stroke)
-{
-  // uncolored tiling pattern arguments actually depend on colorspace set with cs,
-  // we simply assume here that it's DeviceRGB
-  String pattern;
-  auto & ps = iPdfState.back();
-  if (iArgs.size() == 1 && iArgs[0]->name()) {
-    // colored tiling pattern
-    pattern = iArgs[0]->name()->value();
-  } else {
-    if (iArgs.size() != 4 || !iArgs[0]->number() || !iArgs[1]->number()
-	|| !iArgs[2]->number() || !iArgs[3]->name())
+  if (op == "cm")
+    emit(dl, DisplayList::ECm, args, 6);
+  else if (op == "q") {
+    if (args.size() != 0)
+      return;
+    dl.iOps.push_back(DisplayList::Eq);
+    fonts.push_back(fonts.back());
+  } else if (op == "Q") {
+    if (args.size() != 0)
       return;
-    // uncolored tiling pattern
-    pattern = iArgs[3]->name()->value();
-    double *col = (stroke ? ps.iStrokeRgb : ps.iFillRgb);
+    dl.iOps.push_back(DisplayList::EQ);
+    fonts.pop_back();
+    if (fonts.empty())
+      fonts.push_back(nullptr);
+  } else if (op == "rg" || op == "RG")
+    emit(dl, op == "RG" ? DisplayList::EStrokeRgb : DisplayList::EFillRgb,
+	 args, 3);
+  else if (op == "g" || op == "G") {
+    if (!isNumbers(args, 1))
+      return;
+    double gr = args[0]->number()->value();
+    dl.iOps.push_back(op == "G" ? DisplayList::EStrokeRgb : DisplayList::EFillRgb);
     for (int i = 0; i < 3; ++i)
-      col[i] = iArgs[i]->number()->value();
-  }
-  if (stroke)
-    ipeDebug("op scn /%s: stroke pattern not implemented.", pattern.z());
-  else
-    ps.iFillPattern = pattern;
-}
-
-void CairoPainter::opcm()
-{
-  if (iArgs.size() != 6)
-    return;
-  Matrix m;
-  for (int i = 0; i < 6; ++i) {
-    if (!iArgs[i]->number())
+      dl.iNums.push_back(gr);
+  } else if (op == "k" || op == "K") {
+    if (!isNumbers(args, 4))
       return;
-    m.a[i] = iArgs[i]->number()->value();
-  }
-  cairoTransform(iCairo, m);
-}
-
-void CairoPainter::opw()
-{
-  if (iArgs.size() != 1 || !iArgs[0]->number())
-    return;
-  cairo_set_line_width(iCairo, iArgs[0]->number()->value());
-}
-
-void CairoPainter::opd()
-{
-  if (iArgs.size() != 2 || !iArgs[0]->array() || !iArgs[1]->number())
-    return;
-  std::vector<double> dashes;
-  for (int i = 0; i < iArgs[0]->array()->count(); ++i) {
-    const PdfObj *obj = iArgs[0]->array()->obj(i, nullptr);
-    if (!obj->number())
+    ipeDebug("PDF setting CMYK color");
+    // should use the colorspace of the monitor instead of this crude conversion
+    double v = 1.0  - args[3]->number()->value();
+    dl.iOps.push_back(op == "K" ? DisplayList::EStrokeRgb : DisplayList::EFillRgb);
+    for (int i = 0; i < 3; ++i)
+      dl.iNums.push_back(v * (1.0 - args[i]->number()->value()));
+  } else if (op == "scn" || op == "SCN") {
+    // uncolored tiling pattern arguments actually depend on colorspace set with cs,
+    // we simply assume here that it's DeviceRGB
+    bool stroke = (op == "SCN");
+    String pattern;
+    if (args.size() == 1 && args[0]->name()) {
+      // colored tiling pattern
+      pattern = args[0]->name()->value();
+    } else {
+      if (args.size() != 4 || !args[0]->number() || !args[1]->number()
+	  || !args[2]->number() || !args[3]->name())
+	return;
+      // uncolored tiling pattern
+      pattern = args[3]->name()->value();
+      dl.iOps.push_back(stroke ? DisplayList::EStrokeRgb : DisplayList::EFillRgb);
+      for (int i = 0; i < 3; ++i)
+	dl.iNums.push_back(args[i]->number()->value());
+    }
+    if (stroke)
+      ipeDebug("op scn /%s: stroke pattern not implemented.", pattern.z());
+    else {
+      dl.iOps.push_back(DisplayList::EFillPattern);
+      dl.iNames.push_back(pattern);
+    }
+  } else if (op == "w")
+    emit(dl, DisplayList::ELineWidth, args, 1);
+  else if (op == "d") {
+    if (args.size() != 2 || !args[0]->array() || !args[1]->number())
       return;
-    dashes.emplace_back(obj->number()->value());
+    const PdfArray *a = args[0]->array();
+    for (int i = 0; i < a->count(); ++i) {
+      if (!a->obj(i, nullptr)->number())
+	return;
+    }
+    dl.iOps.push_back(DisplayList::EDash);
+    dl.iNums.push_back(a->count());
+    for (int i = 0; i < a->count(); ++i)
+      dl.iNums.push_back(a->obj(i, nullptr)->number()->value());
+    dl.iNums.push_back(args[1]->number()->value());
+  } else if (op == "Do") {
+    if (args.size() != 1 || !args[0]->name())
+      return;
+    String name = args[0]->name()->value();
+    const PdfDict *xf = findResource("XObject", name);
+    if (!xf)
+      return;
+    const PdfObj *subtypeObj = xf->get("Subtype", nullptr);
+    if (!subtypeObj || !subtypeObj->name())
+      return;
+    String subtype = subtypeObj->name()->value();
+    if (subtype == "Form") {
+      dl.iForms.push_back(compile(xf, xf));
+      dl.iOps.push_back(DisplayList::EForm);
+      // the form can change the font
+      fonts.back() = nullptr;
+    } else if (subtype == "Image") {
+      dl.iOps.push_back(DisplayList::EImage);
+      dl.iDicts.push_back(xf);
+    } else
+      ipeDebug("Do operator with unsupported XObject subtype %s", subtype.z());
+  } else if (op == "sh") {
+    if (args.size() != 1 || !args[0]->name())
+      return;
+    const PdfDict *d = findResource("Shading", args[0]->name()->value());
+    if (d) {
+      dl.iOps.push_back(DisplayList::EShading);
+      dl.iDicts.push_back(d);
+    }
+  } else if (op == "i") {
+    // ignore flatness tolerance
+  } else if (op == "j")
+    emit(dl, DisplayList::ELineJoin, args, 1);
+  else if (op == "J")
+    emit(dl, DisplayList::ELineCap, args, 1);
+  else if (op == "M")
+    emit(dl, DisplayList::EMiterLimit, args, 1);
+  else if (op == "W")
+    dl.iOps.push_back(DisplayList::EClip);
+  else if (op == "W*")
+    dl.iOps.push_back(DisplayList::EEoClip);
+  else if (op == "gs") {
+    if (args.size() != 1 || !args[0]->name())
+      return;
+    String name = args[0]->name()->value();
+    const PdfDict *d = findResource("ExtGState", name);
+    if (!d) {
+      ipeDebug("gs %s cannot find ExtGState dictionary!", name.z());
+      return;
+    }
+    for (int j = 0; j < d->count(); ++j) {
+      String key = d->key(j);
+      const PdfObj *val = d->value(j);
+      if (key == "ca" || key == "CA") {
+	if (val->number()) {
+	  dl.iOps.push_back(key == "ca" ? DisplayList::EFillOpacity :
+			    DisplayList::EStrokeOpacity);
+	  dl.iNums.push_back(val->number()->value());
+	}
+      } else if (key == "Type" || key == "SA" || key == "TR" || key == "TR2"
+		 || key == "SM" || key == "HT" || key == "OP" || key == "op"
+		 || key == "RI" || key == "UCR" || key == "UCR2" || key == "BG"
+		 || key == "BG2" || key == "OPM" ) {
+	// ignore
+      } else
+	ipeDebug("gs %s %s", key.z(), val->repr().z());
+    }
+  } else if (op == "m")
+    emit(dl, DisplayList::EMoveTo, args, 2);
+  else if (op == "l")
+    emit(dl, DisplayList::ELineTo, args, 2);
+  else if (op == "h") {
+    if (args.size() == 0)
+      dl.iOps.push_back(DisplayList::EClosePath);
+  } else if (op == "c")
+    emit(dl, DisplayList::ECurveTo, args, 6);
+  else if (op == "v")
+    emit(dl, DisplayList::ECurveToV, args, 4);
+  else if (op == "y")
+    emit(dl, DisplayList::ECurveToY, args, 4);
+  else if (op == "re")
+    emit(dl, DisplayList::ERectangle, args, 4);
+  else if (op == "n")
+    dl.iOps.push_back(DisplayList::ENewPath);
+  else if (op == "b" || op == "b*" || op == "B" || op == "B*"
+	   || op == "f" || op == "F" || op == "f*" || op == "s" || op == "S") {
+    uint8_t flags = 0;
+    if (op == "b" || op == "b*" || op == "s")
+      flags |= DisplayList::EPaintClose;
+    if (op != "s" && op != "S")
+      flags |= DisplayList::EPaintFill;
+    if (op != "f" && op != "F" && op != "f*")
+      flags |= DisplayList::EPaintStroke;
+    if (op == "b*" || op == "B*" || op == "f*")
+      flags |= DisplayList::EPaintEoFill;
+    dl.iOps.push_back(DisplayList::EPaint);
+    dl.iOps.push_back(flags);
+  } else if (op == "Tc")
+    emit(dl, DisplayList::ECharSpacing, args, 1);
+  else if (op == "Tw")
+    emit(dl, DisplayList::EWordSpacing, args, 1);
+  else if (op == "TL")
+    emit(dl, DisplayList::ELeading, args, 1);
+  else if (op == "Ts")
+    emit(dl, DisplayList::ETextRise, args, 1);
+  else if (op == "Tz") {
+    if (!isNumbers(args, 1))
+      return;
+    dl.iOps.push_back(DisplayList::EHorizontalScaling);
+    dl.iNums.push_back(args[0]->number()->value() / 100.0);
+  } else if (op == "Tf") {
+    if (args.size() != 2 || !args[0]->name() || !args[1]->number())
+      return;
+    const PdfDict *fd = findResource("Font", args[0]->name()->value());
+    if (fd) {
+      Face *face = iFonts->getFace(fd);
+      dl.iOps.push_back(DisplayList::EFont);
+      dl.iFaces.push_back(face);
+      fonts.back() = face;
+    } else
+      dl.iOps.push_back(DisplayList::EFontSize);
+    dl.iNums.push_back(args[1]->number()->value());
+  } else if (op == "Tm")
+    emit(dl, DisplayList::ETextMatrix, args, 6);
+  else if (op == "Td")
+    emit(dl, DisplayList::ETextMove, args, 2);
+  else if (op == "TD")
+    emit(dl, DisplayList::ETextMoveLeading, args, 2);
+  else if (op == "T*") {
+    if (args.size() == 0)
+      dl.iOps.push_back(DisplayList::ETextNextLine);
+  } else if (op == "TJ") {
+    if (args.size() == 1 && args[0]->array())
+      compileText(dl, args[0].get(), fonts.back());
+  } else if (op == "Tj") {
+    if (args.size() == 1 && args[0]->string())
+      compileText(dl, args[0].get(), fonts.back());
+  } else if (op == "'") {
+    if (args.size() != 1 || !args[0]->string())
+      return;
+    dl.iOps.push_back(DisplayList::ETextNextLine);
+    compileText(dl, args[0].get(), fonts.back());
+  } else if (op == "\"") {
+    if (args.size() != 3 || !args[0]->number() || !args[1]->number()
+	|| !args[2]->string())
+      return;
+    dl.iOps.push_back(DisplayList::EWordSpacing);
+    dl.iNums.push_back(args[0]->number()->value());
+    dl.iOps.push_back(DisplayList::ECharSpacing);
+    dl.iNums.push_back(args[1]->number()->value());
+    dl.iOps.push_back(DisplayList::ETextNextLine);
+    compileText(dl, args[2].get(), fonts.back());
+  } else if (op == "BT")
+    dl.iOps.push_back(DisplayList::EBT);
+  else if (op == "ET") {
+    // nothing
+  } else if (op == "MP" || op == "DP" || op == "BMC"
+	     || op == "BDC" || op == "EMC") {
+    // content markers, ignore
+  } else if (op == "ri") {
+    // set rendering intent, ignore
+  } else {
+    String a;
+    for (const auto & arg : args)
+      a += arg->repr() + " ";
+    ipeDebug("op %s (%s)", op.z(), a.z());
   }
-  double offset = iArgs[1]->number()->value();
-  cairo_set_dash(iCairo, &dashes[0], dashes.size(), offset);
 }
 
-void CairoPainter::opi()
+//! Compile a text showing operator with string or array argument \a obj.
+/*! If the font is known at compile time, the glyphs are resolved now. */
+void CairoPainter::compileText(DisplayList &dl, const PdfObj *obj, Face *font)
 {
-  if (iArgs.size() != 1 || !iArgs[0]->number())
-    return;
-  // ipeDebug("Set flatness tolerance to %g", iArgs[0]->number()->value());
-}
-
-void CairoPainter::opj()
-{
-  if (iArgs.size() != 1 || !iArgs[0]->number())
-    return;
-  cairo_set_line_join(iCairo, cairo_line_join_t(iArgs[0]->number()->value()));
-}
-
-void CairoPainter::opJ()
-{
-  if (iArgs.size() != 1 || !iArgs[0]->number())
-    return;
-  cairo_set_line_cap(iCairo, cairo_line_cap_t(iArgs[0]->number()->value()));
-}
-
-void CairoPainter::opM()
-{
-  if (iArgs.size() != 1 || !iArgs[0]->number())
-    return;
-  cairo_set_miter_limit(iCairo, iArgs[0]->number()->value());
-}
-
-void CairoPainter::opW(bool eofill)
-{
-  cairo_set_fill_rule(iCairo, eofill ? CAIRO_FILL_RULE_EVEN_ODD :
-		      CAIRO_FILL_RULE_WINDING);
-  cairo_clip_preserve(iCairo);
-}
-
-// --------------------------------------------------------------------
-
-void CairoPainter::opgs()
-{
-  if (iArgs.size() != 1 || !iArgs[0]->name())
-    return;
-  String name = iArgs[0]->name()->value();
-  const PdfDict *d = findResource("ExtGState", name);
-  if (!d) {
-    ipeDebug("gs %s cannot find ExtGState dictionary!", name.z());
-    return;
-  }
-  for (int j = 0; j < d->count(); ++j) {
-    String key = d->key(j);
-    const PdfObj *val = d->value(j);
-    if (key == "ca") {
-      if (val->number())
-	iPdfState.back().iFillOpacity = val->number()->value();
-    } else if (key == "CA") {
-      if (val->number())
-	iPdfState.back().iStrokeOpacity = val->number()->value();
-    } else if (key == "Type" || key == "SA" || key == "TR" || key == "TR2"
-	       || key == "SM" || key == "HT" || key == "OP" || key == "op"
-	       || key == "RI" || key == "UCR" || key == "UCR2" || key == "BG"
-	       || key == "BG2" || key == "OPM" ) {
-      // ignore
+  DisplayList::TextRun run;
+  run.iFace = font;
+  run.iFirst = size(dl.iPieces);
+  int count = obj->array() ? obj->array()->count() : 1;
+  for (int i = 0; i < count; ++i) {
+    const PdfObj *el = obj->array() ? obj->array()->obj(i, nullptr) : obj;
+    DisplayList::TextPiece piece;
+    piece.iAdjust = 0.0;
+    piece.iFirst = -1;
+    piece.iCount = 0;
+    if (el->number())
+      piece.iAdjust = el->number()->value();
+    else if (el->string()) {
+      piece.iText = el->string()->decode();
+      piece.iFirst = size(dl.iGlyphs);
+      if (font) {
+	bool ucs = (font->type() == FontType::CIDType0 ||
+		    font->type() == FontType::CIDType2);
+	String s = piece.iText;
+	int j = 0;
+	while (j < s.size()) {
+	  int ch = uint8_t(s[j++]);
+	  if (ucs && j < s.size())
+	    ch = (ch << 8) | uint8_t(s[j++]);
+	  DisplayList::Glyph g;
+	  g.iCode = ch;
+	  g.iIndex = font->glyphIndex(ch);
+	  g.iWidth = font->width(ch);
+	  dl.iGlyphs.push_back(g);
+	}
+      }
+      piece.iCount = size(dl.iGlyphs) - piece.iFirst;
     } else
-      ipeDebug("gs %s %s", key.z(), val->repr().z());
+      continue;
+    dl.iPieces.push_back(piece);
   }
-}
-
-void CairoPainter::opsh()
-{
-  if (iArgs.size() != 1 || !iArgs[0]->name())
-    return;
-  String name = iArgs[0]->name()->value();
-  const PdfDict *d = findResource("Shading", name);
-  if (d)
-    drawShading(iCairo, d, iFonts->resources());
-}
-
-void CairoPainter::opDo()
-{
-  if (iArgs.size() != 1 || !iArgs[0]->name())
-    return;
-  String name = iArgs[0]->name()->value();
-  // ipeDebug("Do %s at level %d", name.z(), iResourceStack.size());
-  const PdfDict *xf = findResource("XObject", name);
-  if (!xf)
-    return;
-  const PdfObj *subtypeObj = xf->get("Subtype", nullptr);
-  if (!subtypeObj || !subtypeObj->name())
-    return;
-  String subtype = subtypeObj->name()->value();
-  if (subtype == "Form") {
-    cairo_save(iCairo);
-    execute(xf, xf);
-    cairo_restore(iCairo);
-  } else if (subtype == "Image") {
-    drawImage(iCairo, xf, iFonts->resources(), iPdfState.back().iFillOpacity);
-  } else
-    ipeDebug("Do operator with unsupported XObject subtype %s", subtype.z());
+  run.iCount = size(dl.iPieces) - run.iFirst;
+  dl.iOps.push_back(DisplayList::EText);
+  dl.iRuns.push_back(run);
 }
 
 // --------------------------------------------------------------------
 
-void CairoPainter::opq()
+//! Replay a compiled content stream.
+void CairoPainter::replay(const DisplayList &dl, bool applyMatrix)
 {
-  if (iArgs.size() != 0)
-    return;
-  cairo_save(iCairo);
-  iPdfState.push_back(iPdfState.back());
+  iResourceStack.push_back(dl.iResources);
+  if (applyMatrix && dl.iHasMatrix)
+    cairoTransform(iCairo, dl.iMatrix);
+
+  const double *v = dl.iNums.data();
+  auto dict = dl.iDicts.begin();
+  auto form = dl.iForms.begin();
+  auto face = dl.iFaces.begin();
+  auto name = dl.iNames.begin();
+  auto run = dl.iRuns.begin();
+
+  for (auto it = dl.iOps.begin(); it != dl.iOps.end(); ++it) {
+    PdfState &ps = iPdfState.back();
+    switch (*it) {
+    case DisplayList::ECm:
+      cairoTransform(iCairo, Matrix(v[0], v[1], v[2], v[3], v[4], v[5]));
+      v += 6;
+      break;
+    case DisplayList::Eq:
+      cairo_save(iCairo);
+      iPdfState.push_back(ps);
+      break;
+    case DisplayList::EQ:
+      cairo_restore(iCairo);
+      iPdfState.pop_back();
+      break;
+    case DisplayList::EFillRgb:
+    case DisplayList::EStrokeRgb: {
+      double *col = (*it == DisplayList::EStrokeRgb) ?
+	ps.iStrokeRgb : ps.iFillRgb;
+      for (int i = 0; i < 3; ++i)
+	col[i] = *v++;
+      break; }
+    case DisplayList::EFillPattern:
+      ps.iFillPattern = *name++;
+      break;
+    case DisplayList::ELineWidth:
+      cairo_set_line_width(iCairo, *v++);
+      break;
+    case DisplayList::EDash: {
+      int n = int(v[0]);
+      cairo_set_dash(iCairo, v + 1, n, v[n + 1]);
+      v += n + 2;
+      break; }
+    case DisplayList::ELineJoin:
+      cairo_set_line_join(iCairo, cairo_line_join_t(*v++));
+      break;
+    case DisplayList::ELineCap:
+      cairo_set_line_cap(iCairo, cairo_line_cap_t(*v++));
+      break;
+    case DisplayList::EMiterLimit:
+      cairo_set_miter_limit(iCairo, *v++);
+      break;
+    case DisplayList::EClip:
+    case DisplayList::EEoClip:
+      cairo_set_fill_rule(iCairo, (*it == DisplayList::EEoClip) ?
+			  CAIRO_FILL_RULE_EVEN_ODD : CAIRO_FILL_RULE_WINDING);
+      cairo_clip_preserve(iCairo);
+      break;
+    case DisplayList::EFillOpacity:
+      ps.iFillOpacity = *v++;
+      break;
+    case DisplayList::EStrokeOpacity:
+      ps.iStrokeOpacity = *v++;
+      break;
+    case DisplayList::EShading:
+      drawShading(iCairo, *dict++, iFonts->resources());
+      break;
+    case DisplayList::EForm:
+      cairo_save(iCairo);
+      replay(**form++, true);
+      cairo_restore(iCairo);
+      break;
+    case DisplayList::EImage:
+      drawImage(iCairo, *dict++, iFonts->resources(), ps.iFillOpacity);
+      break;
+    case DisplayList::EMoveTo:
+      cairo_move_to(iCairo, v[0], v[1]);
+      v += 2;
+      break;
+    case DisplayList::ELineTo:
+      cairo_line_to(iCairo, v[0], v[1]);
+      v += 2;
+      break;
+    case DisplayList::ECurveTo:
+      cairo_curve_to(iCairo, v[0], v[1], v[2], v[3], v[4], v[5]);
+      v += 6;
+      break;
+    case DisplayList::ECurveToV: {
+      double x1, y1;
+      cairo_get_current_point(iCairo, &x1, &y1);
+      cairo_curve_to(iCairo, x1, y1, v[0], v[1], v[2], v[3]);
+      v += 4;
+      break; }
+    case DisplayList::ECurveToY:
+      cairo_curve_to(iCairo, v[0], v[1], v[2], v[3], v[2], v[3]);
+      v += 4;
+      break;
+    case DisplayList::ERectangle:
+      cairo_rectangle(iCairo, v[0], v[1], v[2], v[3]);
+      v += 4;
+      break;
+    case DisplayList::EClosePath:
+      cairo_close_path(iCairo);
+      break;
+    case DisplayList::ENewPath:
+      // the sequence "W n" updates the clipping path and then clears the current path
+      cairo_new_path(iCairo);
+      break;
+    case DisplayList::EPaint: {
+      uint8_t flags = *++it;
+      opStrokeFill(flags & DisplayList::EPaintClose,
+		   flags & DisplayList::EPaintFill,
+		   flags & DisplayList::EPaintStroke,
+		   flags & DisplayList::EPaintEoFill);
+      break; }
+    case DisplayList::ECharSpacing:
+      ps.iCharacterSpacing = *v++;
+      break;
+    case DisplayList::EWordSpacing:
+      ps.iWordSpacing = *v++;
+      break;
+    case DisplayList::ELeading:
+      ps.iLeading = *v++;
+      break;
+    case DisplayList::ETextRise:
+      ps.iTextRise = *v++;
+      break;
+    case DisplayList::EHorizontalScaling:
+      ps.iHorizontalScaling = *v++;
+      break;
+    case DisplayList::EFont:
+      ps.iFont = *face++;
+      ps.iFontSize = *v++;
+      break;
+    case DisplayList::EFontSize:
+      ps.iFontSize = *v++;
+      break;
+    case DisplayList::EBT:
+      iTextMatrix = iTextLineMatrix = Matrix();
+      break;
+    case DisplayList::ETextMatrix:
+      iTextMatrix = iTextLineMatrix =
+	Matrix(v[0], v[1], v[2], v[3], v[4], v[5]);
+      v += 6;
+      break;
+    case DisplayList::ETextMove:
+    case DisplayList::ETextMoveLeading:
+      iTextMatrix = iTextLineMatrix =
+	iTextLineMatrix * Matrix(Vector(v[0], v[1]));
+      if (*it == DisplayList::ETextMoveLeading)
+	ps.iLeading = v[1];
+      v += 2;
+      break;
+    case DisplayList::ETextNextLine:
+      iTextMatrix = iTextLineMatrix =
+	iTextLineMatrix * Matrix(Vector(0, ps.iLeading));
+      break;
+    case DisplayList::EText:
+      if (ps.iFont)
+	showText(dl, *run);
+      ++run;
+      break;
+    }
+  }
+  iResourceStack.pop_back();
 }
 
-void CairoPainter::opQ()
+//! Show the text of a text showing operator.
+void CairoPainter::showText(const DisplayList &dl, const DisplayList::TextRun &run)
 {
-  if (iArgs.size() != 0)
-    return;
-  cairo_restore(iCairo);
-  iPdfState.pop_back();
+  PdfState &ps = iPdfState.back();
+  std::vector<cairo_glyph_t> glyphs;
+  Vector textPos(0, 0);
+  for (int i = run.iFirst; i < run.iFirst + run.iCount; ++i) {
+    const DisplayList::TextPiece &piece = dl.iPieces[i];
+    if (piece.iFirst < 0)
+      textPos.x -=
+	0.001 * ps.iFontSize * piece.iAdjust * ps.iHorizontalScaling;
+    else if (run.iFace != ps.iFont)
+      collectGlyphs(piece.iText, glyphs, textPos);
+    else {
+      Linear m = iTextMatrix.linear();
+      for (int j = piece.iFirst; j < piece.iFirst + piece.iCount; ++j) {
+	const DisplayList::Glyph &gl = dl.iGlyphs[j];
+	cairo_glyph_t g;
+	g.index = gl.iIndex;
+	Vector p = m * textPos;
+	g.x = p.x;
+	g.y = p.y;
+	glyphs.push_back(g);
+	textPos.x +=
+	  (0.001 * ps.iFontSize * gl.iWidth + ps.iCharacterSpacing)
+	  * ps.iHorizontalScaling;
+	if (gl.iCode == ' ')
+	  textPos.x += ps.iWordSpacing * ps.iHorizontalScaling;
+      }
+    }
+  }
+  drawGlyphs(glyphs);
+  iTextMatrix = iTextMatrix * Matrix(textPos);
 }
 
 // --------------------------------------------------------------------
 
-void CairoPainter::opm()
-{
-  if (iArgs.size() != 2 || !iArgs[0]->number() || !iArgs[1]->number())
-    return;
-  Vector t(iArgs[0]->number()->value(), iArgs[1]->number()->value());
-  cairo_move_to(iCairo, t.x, t.y);
-}
-
-void CairoPainter::opl()
-{
-  if (iArgs.size() != 2 || !iArgs[0]->number() || !iArgs[1]->number())
-    return;
-  Vector t(iArgs[0]->number()->value(), iArgs[1]->number()->value());
-  cairo_line_to(iCairo, t.x, t.y);
-}
-
-void CairoPainter::oph()
-{
-  if (iArgs.size() != 0)
-    return;
-  cairo_close_path(iCairo);
-}
-
-void CairoPainter::opc()
-{
-  if (iArgs.size() != 6 || !iArgs[0]->number() || !iArgs[1]->number()
-      || !iArgs[2]->number() || !iArgs[3]->number()
-      || !iArgs[4]->number() || !iArgs[5]->number())
-    return;
-  Vector p1(iArgs[0]->number()->value(), iArgs[1]->number()->value());
-  Vector p2(iArgs[2]->number()->value(), iArgs[3]->number()->value());
-  Vector p3(iArgs[4]->number()->value(), iArgs[5]->number()->value());
-  cairo_curve_to(iCairo, p1.x, p1.y, p2.x, p2.y, p3.x, p3.y);
-}
-
-void CairoPainter::opv()
-{
-  if (iArgs.size() != 4 || !iArgs[0]->number() || !iArgs[1]->number()
-      || !iArgs[2]->number() || !iArgs[3]->number())
-    return;
-  double x1, y1;
-  cairo_get_current_point(iCairo, &x1, &y1);
-  Vector p2(iArgs[0]->number()->value(), iArgs[1]->number()->value());
-  Vector p3(iArgs[2]->number()->value(), iArgs[3]->number()->value());
-  cairo_curve_to(iCairo, x1, y1, p2.x, p2.y, p3.x, p3.y);
-}
-
-void CairoPainter::opy()
-{
-  if (iArgs.size() != 4 || !iArgs[0]->number() || !iArgs[1]->number()
-      || !iArgs[2]->number() || !iArgs[3]->number())
-    return;
-  Vector p1(iArgs[0]->number()->value(), iArgs[1]->number()->value());
-  Vector p3(iArgs[2]->number()->value(), iArgs[3]->number()->value());
-  cairo_curve_to(iCairo, p1.x, p1.y, p3.x, p3.y, p3.x, p3.y);
-}
-
-void CairoPainter::opre()
-{
-  if (iArgs.size() != 4 || !iArgs[0]->number() || !iArgs[1]->number()
-      || !iArgs[2]->number() || !iArgs[3]->number())
-    return;
-  Vector t(iArgs[0]->number()->value(), iArgs[1]->number()->value());
-  Vector wh(iArgs[2]->number()->value(), iArgs[3]->number()->value());
-  cairo_rectangle(iCairo, t.x, t.y, wh.x, wh.y);
-}
-
-void CairoPainter::opn()
-{
-  // the sequence "W n" updates the clipping path and then clears the current path
-  cairo_new_path(iCairo);
-}
-
 // TODO: cache patterns instead of recreating them for every object?
 // caching would need different handling of uncolored tiling patterns.
 // shading patterns are not implemented here, because Ipe and tikz create
@@ -1159,122 +1439,6 @@ void CairoPainter::opStrokeFill(bool close, bool fill, bool stroke, bool eofill)
 
 // --------------------------------------------------------------------
 
-void CairoPainter::opBT()
-{
-  iTextMatrix = iTextLineMatrix = Matrix();
-}
-
-void CairoPainter::opET()
-{
-  // nothing
-}
-
-void CairoPainter::opTc(double *p)
-{
-  if (iArgs.size() != 1 || !iArgs[0]->number())
-    return;
-  *p = iArgs[0]->number()->value();
-}
-
-void CairoPainter::opTz()
-{
-  if (iArgs.size() != 1 || !iArgs[0]->number())
-    return;
-  iPdfState.back().iHorizontalScaling = iArgs[0]->number()->value() / 100.0;
-}
-
-void CairoPainter::opTm()
-{
-  if (iArgs.size() != 6)
-    return;
-  Matrix m;
-  for (int i = 0; i < 6; ++i) {
-    if (!iArgs[i]->number())
-      return;
-    m.a[i] = iArgs[i]->number()->value();
-  }
-  iTextMatrix = iTextLineMatrix = m;
-}
-
-void CairoPainter::opTf()
-{
-  if (iArgs.size() != 2 || !iArgs[0]->name() || !iArgs[1]->number())
-    return;
-  String name = iArgs[0]->name()->value();
-  iPdfState.back().iFontSize = iArgs[1]->number()->value();
-  const PdfDict *fd = findResource("Font", name);
-  if (fd)
-    iPdfState.back().iFont = iFonts->getFace(fd);
-}
-
-void CairoPainter::opTd(bool setLeading)
-{
-  if (iArgs.size() != 2 || !iArgs[0]->number() || !iArgs[1]->number())
-    return;
-  Vector t(iArgs[0]->number()->value(), iArgs[1]->number()->value());
-  iTextMatrix = iTextLineMatrix = iTextLineMatrix * Matrix(t);
-  if (setLeading)
-    iPdfState.back().iLeading = t.y;
-}
-
-void CairoPainter::opTstar()
-{
-  if (iArgs.size() != 0)
-    return;
-  Vector t(0, iPdfState.back().iLeading);
-  iTextMatrix = iTextLineMatrix = iTextLineMatrix * Matrix(t);
-}
-
-void CairoPainter::opTj(bool nextLine, bool setSpacing)
-{
-  PdfState &ps = iPdfState.back();
-  if (!setSpacing) {
-    if (iArgs.size() != 1 || !iArgs[0]->string())
-      return;
-  } else {
-    if (iArgs.size() != 3 || !iArgs[0]->number() || !iArgs[1]->number()
-	|| !iArgs[2]->string())
-      return;
-  }
-  String s = iArgs[iArgs.size() - 1]->string()->decode();
-  if (setSpacing) {
-    ps.iWordSpacing = iArgs[0]->number()->value();
-    ps.iCharacterSpacing = iArgs[1]->number()->value();
-  }
-  if (nextLine) {
-    Vector t(0, ps.iLeading);
-    iTextMatrix = iTextLineMatrix = iTextLineMatrix * Matrix(t);
-  }
-
-  if (!ps.iFont)
-    return;
-
-  std::vector<cairo_glyph_t> glyphs;
-  Vector textPos(0, 0);
-  collectGlyphs(s, glyphs, textPos);
-  drawGlyphs(glyphs);
-  iTextMatrix = iTextMatrix * Matrix(textPos);
-}
-
-void CairoPainter::opTJ()
-{
-  PdfState &ps = iPdfState.back();
-  if (!ps.iFont || iArgs.size() != 1 || !iArgs[0]->array())
-    return;
-  std::vector<cairo_glyph_t> glyphs;
-  Vector textPos(0, 0);
-  for (int i = 0; i < iArgs[0]->array()->count(); ++i) {
-    const PdfObj *obj = iArgs[0]->array()->obj(i, nullptr);
-    if (obj->number())
-      textPos.x -=
-	0.001 * ps.iFontSize * obj->number()->value() * ps.iHorizontalScaling;
-    else if (obj->string())
-      collectGlyphs(obj->string()->decode(), glyphs, textPos);
-  }
-  drawGlyphs(glyphs);
-  iTextMatrix = iTextMatrix * Matrix(textPos);
-}
-
 void CairoPainter::collectGlyphs(String s, std::vector<cairo_glyph_t> &glyphs,
 				 Vector &textPos)
 {
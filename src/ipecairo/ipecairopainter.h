@@ -44,6 +44,7 @@ namespace ipe {
 
   class Cascade;
   class PdfObj;
+  struct Symbol;
 
   class CairoPainter : public Painter {
   public:
@@ -69,50 +70,24 @@ namespace ipe {
     virtual void doDrawPath(TPathMode mode);
     virtual void doDrawBitmap(Bitmap bitmap);
     virtual void doDrawText(const Text *text);
+    virtual void doDrawSymbol(Attribute symbol);
 
   private:
+    String stampKey(Attribute symbol, const Matrix &device) const;
+    Stamp renderStamp(const Symbol *symbol, const Matrix &device);
     const PdfDict *findResource(String kind, String name);
     void drawGlyphs(std::vector<cairo_glyph_t> &glyphs);
     void collectGlyphs(String s, std::vector<cairo_glyph_t> &glyphs,
 		       Vector &textPos);
     void execute(const PdfDict *stream, const PdfDict *resources, bool applyMatrix = true);
-    void clearArgs();
-    void opcm();
-    void opBT();
-    void opET();
-    void opTf();
-    void opTm();
-    void opTd(bool setLeading);
-    void opTstar();
-    void opTc(double *p);
-    void opTz();
-    void opTJ();
-    void opTj(bool nextLine, bool setSpacing);
-    void opk(bool stroke);
-    void opg(bool stroke);
-    void oprg(bool stroke);
-    void opscn(bool stroke);
-    void opw();
-    void opd();
-    void opDo();
-    void opi();
-    void opj();
-    void opJ();
-    void opM();
-    void opW(bool eofill);
-    void opgs();
-    void opm();
-    void opl();
-    void opc();
-    void opy();
-    void opv();
-    void oph();
-    void opq();
-    void opQ();
-    void opre();
-    void opn();
+    const DisplayList *compile(const PdfDict *stream, const PdfDict *resources);
+    void compileOp(DisplayList &dl, String op,
+		   const std::vector<std::unique_ptr<const PdfObj>> &args,
+		   std::vector<Face *> &fonts);
+    void compileText(DisplayList &dl, const PdfObj *obj, Face *font);
+    void replay(const DisplayList &dl, bool applyMatrix);
+    void showText(const DisplayList &dl, const DisplayList::TextRun &run);
     void opStrokeFill(bool close, bool fill, bool stroke, bool eofill);
-    void opsh();
     void createPattern();
 
   private:
@@ -121,13 +96,13 @@ namespace ipe {
 
     double iZoom;
     bool iPretty;
+    //! Identifies the style sheets in their current state.
+    uint64_t iStyleKey;
 
     bool iDimmed;
     bool iAfterMoveTo;
 
     // PDF operator drawing
-    std::vector<const PdfObj *> iArgs;
-
     std::vector<const PdfDict *> iResourceStack;
 
     struct PdfState {
@@ -57,6 +57,8 @@ private:
 public:
   bool iOk;
   FT_Library iLib;
+  // Freetype library and faces are shared by all threads
+  std::mutex iMutex;
   int iFacesLoaded;
   int iFacesUnloaded;
   int iFacesDiscarded;
@@ -98,6 +100,7 @@ Engine::~Engine()
 
 cairo_font_face_t *Engine::screenFont()
 {
+  std::lock_guard<std::mutex> lock(iMutex);
   if (!iScreenFontLoaded) {
     iScreenFontLoaded = true;
     iScreenFont = cairo_toy_font_face_create("Sans", CAIRO_FONT_SLANT_NORMAL,
@@ -111,6 +114,8 @@ cairo_font_face_t *Engine::screenFont()
 /*! \class ipe::Fonts
   \ingroup cairo
   \brief Provides the fonts used to render text.
+
+  Several threads can render with the same Fonts object at once.
 */
 
 Fonts::Fonts(const PdfResourceBase *resources) : iResources(resources)
@@ -144,6 +149,7 @@ Face *Fonts::getFace(const PdfDict *d)
   if (!engine.iOk)
     return nullptr;
 
+  std::lock_guard<std::mutex> lock(engine.iMutex);
   auto it = std::find_if(iFaces.begin(), iFaces.end(),
 			 [d](std::unique_ptr<Face> &f) { return f->matches(d); } );
   if (it != iFaces.end())
@@ -153,6 +159,81 @@ Face *Fonts::getFace(const PdfDict *d)
   return iFaces.back().get();
 }
 
+/*! \class ipe::DisplayList
+  \ingroup cairo
+  \brief A PDF content stream compiled for replay by CairoPainter.
+
+  The operators are decoded into a compact list of operations, with
+  their operands already converted to numbers, resources looked up,
+  and the glyphs of text operators resolved.  Display lists are cached
+  in the Fonts object, so each XForm is parsed only once.
+*/
+
+//! Return the cached display list for a content stream.
+/*! Returns nullptr if the stream has not been compiled yet with
+  these resources. */
+const DisplayList *Fonts::displayList(const PdfDict *stream,
+				      const PdfDict *resources) const noexcept
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  auto it = iDisplayLists.find(std::make_pair(stream, resources));
+  if (it == iDisplayLists.end())
+    return nullptr;
+  return it->second.get();
+}
+
+//! Store the compiled display list for a content stream.
+const DisplayList *Fonts::addDisplayList(const PdfDict *stream,
+					 const PdfDict *resources,
+					 std::unique_ptr<DisplayList> dl)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  auto &entry = iDisplayLists[std::make_pair(stream, resources)];
+  // another thread may have compiled the same stream meanwhile
+  if (!entry)
+    entry = std::move(dl);
+  return entry.get();
+}
+
+// total size of the stamp cache in pixels
+const int MAX_STAMP_PIXELS = 16 << 20;
+
+//! Find a pre-rendered symbol.
+bool Fonts::findStamp(const String &key, Stamp &stamp) const noexcept
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  auto it = iStamps.find(key);
+  if (it == iStamps.end())
+    return false;
+  // move to the front of the list
+  iStampList.splice(iStampList.begin(), iStampList, it->second);
+  stamp = it->second->iStamp;
+  return true;
+}
+
+//! Store a pre-rendered symbol.
+/*! When the cache is full, the least recently used stamps are
+  discarded. */
+void Fonts::addStamp(const String &key, const Stamp &stamp)
+{
+  int pixels = 0;
+  if (stamp.iSurface)
+    pixels = cairo_image_surface_get_width(stamp.iSurface.get()) *
+      cairo_image_surface_get_height(stamp.iSurface.get());
+  std::lock_guard<std::mutex> lock(iMutex);
+  if (iStamps.find(key) != iStamps.end())
+    return;
+  iStampList.push_front(CachedStamp { key, stamp, pixels });
+  iStamps[key] = iStampList.begin();
+  iStampPixels += pixels;
+  while (iStampPixels > MAX_STAMP_PIXELS && iStampList.size() > 1) {
+    const CachedStamp &old = iStampList.back();
+    iStampPixels -= old.iPixels;
+    iStamps.erase(old.iKey);
+    iStampList.pop_back();
+  }
+}
+
 // --------------------------------------------------------------------
 
 struct FaceData {
@@ -323,9 +404,8 @@ int Face::glyphIndex(int ch) noexcept
     return 0;
   switch (iType) {
   case FontType::Type1:
-    return iEncoding[ch];
   case FontType::Truetype:
-    return FT_Get_Char_Index(iFace, (FT_ULong) ch);
+    return iEncoding[ch];
   case FontType::CIDType0:
   case FontType::CIDType2:
     return ch; // for cid-keyed font, this is a cid
@@ -462,6 +542,9 @@ void Face::setupTruetypeEncoding() noexcept
 	       iFace->charmaps[i]->encoding_id);
     }
   }
+  // look up glyphs now, so that the face is not touched while rendering
+  for (int i = 0; i < 0x100; ++i)
+    iEncoding.push_back(FT_Get_Char_Index(iFace, i));
 }
 
 bool Face::getFontFile(const PdfDict *d, Buffer &data) noexcept
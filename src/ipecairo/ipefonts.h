@@ -1,6 +1,7 @@
 // -*- C++ -*-
 // --------------------------------------------------------------------
 // CanvasFonts maintains the Freetype fonts for the canvas
+// and the compiled display lists of PDF content streams
 // --------------------------------------------------------------------
 /*
 
@@ -37,6 +38,9 @@
 #include "iperesources.h"
 
 #include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <cairo.h>
 
 //------------------------------------------------------------------------
@@ -81,6 +85,75 @@ namespace ipe {
     int iDefaultWidth { 1000 };
   };
 
+  class DisplayList {
+  public:
+    //! Operations of a compiled content stream.
+    enum Op : uint8_t {
+      ECm, Eq, EQ, EFillRgb, EStrokeRgb, EFillPattern,
+      ELineWidth, EDash, ELineJoin, ELineCap, EMiterLimit,
+      EClip, EEoClip, EFillOpacity, EStrokeOpacity,
+      EShading, EForm, EImage,
+      EMoveTo, ELineTo, ECurveTo, ECurveToV, ECurveToY, ERectangle,
+      EClosePath, ENewPath, EPaint,
+      ECharSpacing, EWordSpacing, ELeading, ETextRise, EHorizontalScaling,
+      EFont, EFontSize, EBT, ETextMatrix, ETextMove, ETextMoveLeading,
+      ETextNextLine, EText };
+
+    //! Flags for the EPaint operation.
+    enum { EPaintClose = 1, EPaintFill = 2, EPaintStroke = 4, EPaintEoFill = 8 };
+
+    //! A glyph resolved against the face of its TextRun.
+    struct Glyph {
+      int iCode;
+      int iIndex;
+      int iWidth;
+    };
+
+    //! A string or (if iFirst < 0) a TJ position adjustment.
+    struct TextPiece {
+      String iText;
+      double iAdjust;
+      int iFirst;
+      int iCount;
+    };
+
+    //! Pieces of one text showing operator.
+    /*! The glyphs are valid only if the current font is iFace,
+      otherwise the strings have to be decoded again. */
+    struct TextRun {
+      Face *iFace;
+      int iFirst;
+      int iCount;
+    };
+
+  public:
+    const PdfDict *iResources;
+    bool iHasMatrix;
+    Matrix iMatrix;
+    //! Operations, with EPaint flags inline.
+    std::vector<uint8_t> iOps;
+    //! Numeric operands, in the order the operations consume them.
+    std::vector<double> iNums;
+    std::vector<const PdfDict *> iDicts;
+    std::vector<const DisplayList *> iForms;
+    std::vector<Face *> iFaces;
+    std::vector<String> iNames;
+    std::vector<TextRun> iRuns;
+    std::vector<TextPiece> iPieces;
+    std::vector<Glyph> iGlyphs;
+  };
+
+  //! A symbol rendered to a small image.
+  struct Stamp {
+    //! The image (nullptr if the symbol leaves no ink).
+    std::shared_ptr<cairo_surface_t> iSurface;
+    //! Is the symbol too large, so that it is better drawn directly?
+    bool iVector;
+    //! Position of the image relative to the pixel of the symbol origin.
+    int iX;
+    int iY;
+  };
+
   class Fonts {
   public:
     Fonts(const PdfResourceBase *resources);
@@ -90,9 +163,33 @@ namespace ipe {
     static String freetypeVersion();
     const PdfResourceBase *resources() const noexcept { return iResources; }
 
+    const DisplayList *displayList(const PdfDict *stream,
+				   const PdfDict *resources) const noexcept;
+    const DisplayList *addDisplayList(const PdfDict *stream,
+				      const PdfDict *resources,
+				      std::unique_ptr<DisplayList> dl);
+
+    bool findStamp(const String &key, Stamp &stamp) const noexcept;
+    void addStamp(const String &key, const Stamp &stamp);
+
+  private:
+    struct CachedStamp {
+      String iKey;
+      Stamp iStamp;
+      int iPixels;
+    };
+    using StampList = std::list<CachedStamp>;
+
   private:
     const PdfResourceBase *iResources;
     std::list<std::unique_ptr<Face>> iFaces;
+    std::map<std::pair<const PdfDict *, const PdfDict *>,
+	     std::unique_ptr<DisplayList>> iDisplayLists;
+    //! Stamps, the most recently used first.
+    mutable StampList iStampList;
+    std::map<String, StampList::iterator> iStamps;
+    int iStampPixels { 0 };
+    mutable std::mutex iMutex;  // protects iDisplayLists and the stamps
   };
 
 } // namespace
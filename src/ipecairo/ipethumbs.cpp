@@ -29,6 +29,7 @@
 */
 
 #include "ipethumbs.h"
+#include "ipeutils.h"
 
 #include "ipecairopainter.h"
 #include <cairo.h>
@@ -44,11 +45,182 @@
 #endif
 
 #include <cstring>
+#include <unordered_map>
 
 using namespace ipe;
 
 // --------------------------------------------------------------------
 
+// memory used by thumbnails cached during the session
+const size_t CACHE_BUDGET = 64 << 20;
+
+// Thumbnails already rendered, shared by all Thumbnail objects.
+struct ThumbnailCache {
+  struct Entry {
+    Buffer iBuffer;
+    uint64_t iLastUse;
+  };
+
+  bool find(uint64_t key, Buffer &buffer);
+  void store(uint64_t key, Buffer buffer);
+  void remove(uint64_t key);
+
+  std::mutex iMutex;
+  std::unordered_map<uint64_t, Entry> iEntries;
+  size_t iSize = 0;
+  uint64_t iClock = 0;
+};
+
+static ThumbnailCache cache;
+
+bool ThumbnailCache::find(uint64_t key, Buffer &buffer)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  auto it = iEntries.find(key);
+  if (it == iEntries.end())
+    return false;
+  it->second.iLastUse = ++iClock;
+  buffer = it->second.iBuffer;
+  return true;
+}
+
+void ThumbnailCache::store(uint64_t key, Buffer buffer)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  auto old = iEntries.find(key);
+  if (old != iEntries.end()) {
+    iSize -= old->second.iBuffer.size();
+    iEntries.erase(old);
+  }
+  // discard least recently used thumbnails
+  while (!iEntries.empty() && iSize + buffer.size() > CACHE_BUDGET) {
+    auto lru = iEntries.begin();
+    for (auto it = iEntries.begin(); it != iEntries.end(); ++it) {
+      if (it->second.iLastUse < lru->second.iLastUse)
+	lru = it;
+    }
+    iSize -= lru->second.iBuffer.size();
+    iEntries.erase(lru);
+  }
+  iEntries[key] = Entry { buffer, ++iClock };
+  iSize += buffer.size();
+}
+
+void ThumbnailCache::remove(uint64_t key)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  auto it = iEntries.find(key);
+  if (it != iEntries.end()) {
+    iSize -= it->second.iBuffer.size();
+    iEntries.erase(it);
+  }
+}
+
+// FNV-1a hash
+static uint64_t hashBytes(const char *data, int size,
+			  uint64_t h = 0xcbf29ce484222325ULL)
+{
+  for (int i = 0; i < size; ++i) {
+    h ^= uint8_t(data[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// --------------------------------------------------------------------
+
+static const char STORE_MAGIC[] = "IpeThumbnails 1\n";
+
+// Thumbnails that persist between sessions, keyed by page contents.
+struct Thumbnail::Store {
+  struct Entry {
+    Buffer iData;  // deflated pixels
+    bool iUsed;    // only used entries are saved
+  };
+
+  bool use(uint64_t key);
+  bool find(uint64_t key, int size, Buffer &buffer);
+  void insert(uint64_t key, const Buffer &buffer);
+  void remove(uint64_t key);
+
+  std::mutex iMutex;
+  std::unordered_map<uint64_t, Entry> iEntries;
+  // content keys of pages already seen, by revision key
+  std::unordered_map<uint64_t, uint64_t> iContentKeys;
+};
+
+// Mark entry as used, return false if there is none.
+bool Thumbnail::Store::use(uint64_t key)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  auto it = iEntries.find(key);
+  if (it == iEntries.end())
+    return false;
+  it->second.iUsed = true;
+  return true;
+}
+
+bool Thumbnail::Store::find(uint64_t key, int size, Buffer &buffer)
+{
+  Buffer data;
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    auto it = iEntries.find(key);
+    if (it == iEntries.end())
+      return false;
+    it->second.iUsed = true;
+    data = it->second.iData;
+  }
+  BufferSource source(data);
+  InflateSource inf(source);
+  Buffer pixels(size);
+  char *p = pixels.data();
+  for (int i = 0; i < size; ++i) {
+    int ch = inf.getChar();
+    if (ch == EOF)
+      return false;
+    *p++ = char(ch);
+  }
+  buffer = pixels;
+  return true;
+}
+
+void Thumbnail::Store::insert(uint64_t key, const Buffer &buffer)
+{
+  int size;
+  Buffer out = DeflateStream::deflate(buffer.data(), buffer.size(), size, 9);
+  std::lock_guard<std::mutex> lock(iMutex);
+  iEntries[key] = Entry { Buffer(out.data(), size), true };
+}
+
+void Thumbnail::Store::remove(uint64_t key)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  iEntries.erase(key);
+}
+
+// --------------------------------------------------------------------
+
+/*! \class ipe::Thumbnail
+  \ingroup cairo
+  \brief Renders small images of the pages of a document.
+
+  Rendered thumbnails are cached for the session, keyed by the style
+  sheets, Latex preamble and engine of the document, the size of the
+  thumbnail, and the revision numbers of the objects visible in the
+  view.  (Running Latex with a new preamble changes the text objects
+  without changing their revision.)  Since a copy of a page
+  keeps these revisions, only pages that have actually been modified
+  are rendered again.
+
+  Thumbnails can also be kept between sessions in a store file (see
+  loadStore and saveStore).  Entries in the store are keyed by a hash
+  of the XML representation of the visible objects, so an unchanged
+  page of a reloaded document needs no rendering.
+
+  Several threads can render thumbnails using the same Thumbnail.
+*/
+
 Thumbnail::Thumbnail(const Document *doc, int width)
 {
   iDoc = doc;
@@ -59,10 +231,159 @@ Thumbnail::Thumbnail(const Document *doc, int width)
   iHeight = int(iWidth * paper.height() / paper.width());
   iZoom = iWidth / paper.width();
   iFonts = std::make_unique<Fonts>(doc->resources());
+
+  String sheets;
+  StringStream ss(sheets);
+  ss << iWidth << " " << iHeight << "\n";
+  iDoc->cascade()->saveAsXml(ss);
+  ss << int(iDoc->properties().iTexEngine) << "\n"
+     << iDoc->properties().iPreamble;
+  iStyleKey = hashBytes(sheets.data(), sheets.size());
+}
+
+Thumbnail::~Thumbnail()
+{
+  // defined here, where Store is complete
+}
+
+uint64_t Thumbnail::key(const Page *page, int view) const
+{
+  uint64_t h = iStyleKey;
+  for (int i = 0; i < page->count(); ++i) {
+    if (page->objectVisible(view, i)) {
+      uint32_t rev = page->revision(i);
+      h = hashBytes((const char *) &rev, sizeof(rev), h);
+    }
+  }
+  return h;
+}
+
+// Hash of the contents of the view, \a k is its revision key.
+uint64_t Thumbnail::contentKey(const Page *page, int view, uint64_t k) const
+{
+  {
+    std::lock_guard<std::mutex> lock(iStore->iMutex);
+    auto it = iStore->iContentKeys.find(k);
+    if (it != iStore->iContentKeys.end())
+      return it->second;
+  }
+  String xml;
+  StringStream ss(xml);
+  BitmapFinder bm;
+  for (int i = 0; i < page->count(); ++i) {
+    if (page->objectVisible(view, i)) {
+      page->object(i)->saveAsXml(ss, String());
+      page->object(i)->accept(bm);
+    }
+  }
+  // the XML only contains the object numbers of bitmaps
+  for (const auto &bitmap : bm.iBitmaps)
+    ss << bitmap.checksum() << " " << bitmap.width() << " "
+       << bitmap.height() << "\n";
+  uint64_t h = hashBytes(xml.data(), xml.size(), iStyleKey);
+  std::lock_guard<std::mutex> lock(iStore->iMutex);
+  iStore->iContentKeys[k] = h;
+  return h;
+}
+
+//! Look up thumbnail of \a view of \a page in the cache and the store.
+/*! Returns false if it needs to be rendered. */
+bool Thumbnail::lookup(const Page *page, int view, Buffer &buffer) const
+{
+  uint64_t k = key(page, view);
+  if (!iStore)
+    return cache.find(k, buffer);
+  uint64_t ck = contentKey(page, view, k);
+  if (cache.find(k, buffer)) {
+    if (!iStore->use(ck))
+      iStore->insert(ck, buffer);
+    return true;
+  }
+  if (iStore->find(ck, iWidth * iHeight * 4, buffer)) {
+    cache.store(k, buffer);
+    return true;
+  }
+  return false;
+}
+
+//! Enter \a buffer as the thumbnail of \a view of \a page.
+void Thumbnail::fill(const Page *page, int view, Buffer buffer) const
+{
+  uint64_t k = key(page, view);
+  cache.store(k, buffer);
+  if (iStore)
+    iStore->insert(contentKey(page, view, k), buffer);
 }
 
-Buffer Thumbnail::render(const Page *page, int view)
+//! Remove thumbnail of \a view of \a page from the cache and the store.
+void Thumbnail::invalidate(const Page *page, int view) const
 {
+  uint64_t k = key(page, view);
+  cache.remove(k);
+  if (iStore) {
+    iStore->remove(contentKey(page, view, k));
+    std::lock_guard<std::mutex> lock(iStore->iMutex);
+    iStore->iContentKeys.erase(k);
+  }
+}
+
+//! Load persistent thumbnails from file \a fname.
+/*! From now on, thumbnails are also looked up in the store and
+  entered there.  Returns false if the file could not be read (the
+  store is then empty). */
+bool Thumbnail::loadStore(String fname)
+{
+  iStore = std::make_unique<Store>();
+  String data = Platform::readFile(fname);
+  int pos = sizeof(STORE_MAGIC) - 1;
+  if (data.size() < pos || data.left(pos) != STORE_MAGIC)
+    return false;
+  while (pos + 12 <= data.size()) {
+    uint64_t key;
+    int32_t size;
+    memcpy(&key, data.data() + pos, 8);
+    memcpy(&size, data.data() + pos + 8, 4);
+    pos += 12;
+    if (size < 0 || size > data.size() - pos)
+      break;
+    iStore->iEntries[key] = Store::Entry { Buffer(data.data() + pos, size),
+					   false };
+    pos += size;
+  }
+  return true;
+}
+
+//! Save the thumbnails used in this session to file \a fname.
+bool Thumbnail::saveStore(String fname) const
+{
+  if (!iStore)
+    return false;
+  std::FILE *file = Platform::fopen(fname.z(), "wb");
+  if (!file)
+    return false;
+  std::lock_guard<std::mutex> lock(iStore->iMutex);
+  bool ok = (std::fwrite(STORE_MAGIC, 1, sizeof(STORE_MAGIC) - 1, file)
+	     == sizeof(STORE_MAGIC) - 1);
+  for (const auto &it : iStore->iEntries) {
+    if (!ok)
+      break;
+    if (!it.second.iUsed)
+      continue;
+    int32_t size = it.second.iData.size();
+    ok = (std::fwrite(&it.first, 8, 1, file) == 1 &&
+	  std::fwrite(&size, 4, 1, file) == 1 &&
+	  std::fwrite(it.second.iData.data(), 1, size, file) == size_t(size));
+  }
+  return (std::fclose(file) == 0) && ok;
+}
+
+//! Return thumbnail of \a view of \a page (from the cache if possible).
+Buffer Thumbnail::render(const Page *page, int view) const
+{
+  Buffer cached;
+  if (lookup(page, view, cached))
+    return cached;
+
   Buffer buffer(iWidth * iHeight * 4);
   memset(buffer.data(), 0xff, iWidth * iHeight * 4);
 
@@ -87,6 +408,7 @@ Buffer Thumbnail::render(const Page *page, int view)
   cairo_destroy(cc);
   cairo_surface_destroy(surface);
 
+  fill(page, view, buffer);
   return buffer;
 }
 
@@ -99,7 +421,7 @@ static cairo_status_t stream_writer(void *closure, const unsigned char *data, un
 
 bool Thumbnail::saveRender(TargetFormat fm, const char *dst,
 			   const Page *page, int view, double zoom,
-			   bool transparent, bool nocrop)
+			   bool transparent, bool nocrop) const
 {
   Rect bbox;
   int wid, ht;
@@ -229,3 +551,93 @@ Buffer PdfThumbnail::render(const PdfDict *page)
 }
 
 // --------------------------------------------------------------------
+
+/*! \class ipe::ThumbnailQueue
+  \ingroup cairo
+  \brief Renders thumbnails on a pool of worker threads.
+
+  The user interface adds the pages it needs, and periodically takes
+  the finished thumbnails.  Thumbnails are rendered in the order they
+  were added, but can be moved to the front of the queue, for instance
+  when they become visible.
+*/
+
+//! Create queue rendering with \a thumb on \a threads threads.
+/*! If \a threads is zero, uses one thread per core, leaving one core
+  for the user interface. */
+ThumbnailQueue::ThumbnailQueue(const Thumbnail *thumb, int threads)
+  : iThumb(thumb), iPending(0), iStop(false)
+{
+  if (threads <= 0)
+    threads = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+  for (int i = 0; i < threads; ++i)
+    iThreads.emplace_back(&ThumbnailQueue::work, this);
+}
+
+//! Destructor waits for the thumbnails being rendered.
+ThumbnailQueue::~ThumbnailQueue()
+{
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    iStop = true;
+  }
+  iWork.notify_all();
+  for (auto &t : iThreads)
+    t.join();
+}
+
+//! Add thumbnail of \a view of \a page with identifier \a id to the queue.
+void ThumbnailQueue::add(int id, const Page *page, int view)
+{
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    iJobs.push_back(Job { id, page, view });
+    ++iPending;
+  }
+  iWork.notify_one();
+}
+
+//! Move thumbnail \a id to the front of the queue (if not yet started).
+void ThumbnailQueue::raise(int id)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  for (int i = 0; i < int(iJobs.size()); ++i) {
+    if (iJobs[i].iId == id) {
+      Job job = iJobs[i];
+      iJobs.erase(iJobs.begin() + i);
+      iJobs.push_front(job);
+      return;
+    }
+  }
+}
+
+//! Take a finished thumbnail, returns false if there is none.
+bool ThumbnailQueue::take(int &id, Buffer &buffer)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  if (iFinished.empty())
+    return false;
+  id = iFinished.back().first;
+  buffer = iFinished.back().second;
+  iFinished.pop_back();
+  --iPending;
+  return true;
+}
+
+void ThumbnailQueue::work()
+{
+  std::unique_lock<std::mutex> lock(iMutex);
+  for (;;) {
+    iWork.wait(lock, [this] { return iStop || !iJobs.empty(); });
+    if (iStop)
+      return;
+    Job job = iJobs.front();
+    iJobs.pop_front();
+    lock.unlock();
+    Buffer buffer = iThumb->render(job.iPage, job.iView);
+    lock.lock();
+    iFinished.push_back(std::make_pair(job.iId, buffer));
+  }
+}
+
+// --------------------------------------------------------------------
@@ -35,6 +35,11 @@
 #include "ipedoc.h"
 #include "ipefonts.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 // --------------------------------------------------------------------
 
 namespace ipe {
@@ -44,13 +49,25 @@ namespace ipe {
     enum TargetFormat { ESVG, EPNG, EPS, EPDF };
 
     Thumbnail(const Document *doc, int width);
+    ~Thumbnail();
 
     int width() const { return iWidth; }
     int height() const { return iHeight; }
-    Buffer render(const Page *page, int view);
+    Buffer render(const Page *page, int view) const;
     bool saveRender(TargetFormat fm, const char *dst,
 		    const Page *page, int view, double zoom,
-		    bool transparent, bool nocrop);
+		    bool transparent, bool nocrop) const;
+
+    bool lookup(const Page *page, int view, Buffer &buffer) const;
+    void fill(const Page *page, int view, Buffer buffer) const;
+    void invalidate(const Page *page, int view) const;
+    bool loadStore(String fname);
+    bool saveStore(String fname) const;
+
+  private:
+    struct Store;
+    uint64_t key(const Page *page, int view) const;
+    uint64_t contentKey(const Page *page, int view, uint64_t k) const;
   private:
     const Document *iDoc;
     int iWidth;
@@ -58,6 +75,38 @@ namespace ipe {
     double iZoom;
     const Layout *iLayout;
     std::unique_ptr<Fonts> iFonts;
+    uint64_t iStyleKey; // hash of size and style sheets
+    std::unique_ptr<Store> iStore; // persistent thumbnails
+  };
+
+  class ThumbnailQueue {
+  public:
+    ThumbnailQueue(const Thumbnail *thumb, int threads = 0);
+    ~ThumbnailQueue();
+
+    void add(int id, const Page *page, int view);
+    void raise(int id);
+    bool take(int &id, Buffer &buffer);
+    //! Return number of thumbnails not yet taken.
+    int pending() const { return iPending; }
+
+  private:
+    struct Job {
+      int iId;
+      const Page *iPage;
+      int iView;
+    };
+    void work();
+
+  private:
+    const Thumbnail *iThumb;
+    int iPending;
+    bool iStop;
+    std::deque<Job> iJobs;
+    std::vector<std::pair<int, Buffer>> iFinished;
+    std::mutex iMutex;
+    std::condition_variable iWork;
+    std::vector<std::thread> iThreads;
   };
 
   class PdfThumbnail {
@@ -32,6 +32,7 @@
 #include "ipetool.h"
 
 #include "ipecairopainter.h"
+#include "ipeutils.h"
 
 using namespace ipe;
 
@@ -69,6 +70,8 @@ CanvasBase::CanvasBase()
   iObserver = nullptr;
   iTool = nullptr;
   iPage = nullptr;
+  iPageNumber = 0;
+  iView = 0;
   iCascade = nullptr;
   iSurface = nullptr;
   iPan = Vector::ZERO;
@@ -85,6 +88,11 @@ CanvasBase::CanvasBase()
   iFifiMode = Snap::ESnapNone;
   iSelectionVisible = true;
 
+  iTileScale = Vector::ZERO;
+  iTilePhase = Vector::ZERO;
+  iTileClock = 0;
+  iPaintedBackground = false;
+
   isInkMode = false;
   iAdditionalModifiers = 0;
 
@@ -113,6 +121,7 @@ CanvasBase::CanvasBase()
 //! destructor.
 CanvasBase::~CanvasBase()
 {
+  flushTiles();
   if (iSurface)
     cairo_surface_destroy(iSurface);
   delete iTool;
@@ -127,6 +136,9 @@ void CanvasBase::setResources(const PdfResources *resources)
   iFonts.reset();
   iResources = resources;
   iFonts = std::make_unique<Fonts>(resources);
+  flushTiles();
+  // Latex changes the size of text objects without a new revision
+  iPainted.clear();
 }
 
 // --------------------------------------------------------------------
@@ -138,6 +150,8 @@ void CanvasBase::setResources(const PdfResources *resources)
 void CanvasBase::setPage(const Page *page, int pno, int view,
 			 const Cascade *sheet)
 {
+  if (pno != iPageNumber || view != iView)
+    flushTiles();
   iPage = page;
   iPageNumber = pno;
   iView = view;
@@ -149,6 +163,7 @@ void CanvasBase::setPage(const Page *page, int pno, int view,
 void CanvasBase::setCanvasStyle(const Style &style)
 {
   iStyle = style;
+  flushTiles();
 }
 
 //! Set current pan position.
@@ -169,6 +184,8 @@ void CanvasBase::setZoom(double zoom)
 //! Set the snapping information.
 void CanvasBase::setSnap(const Snap &s)
 {
+  if (s.iGridVisible != iSnap.iGridVisible || s.iGridSize != iSnap.iGridSize)
+    flushTiles();
   iSnap = s;
 }
 
@@ -176,6 +193,8 @@ void CanvasBase::setSnap(const Snap &s)
 /*! This mode will be reset when the Tool finishes. */
 void CanvasBase::setDimmed(bool dimmed)
 {
+  if (dimmed != iDimmed)
+    flushTiles();
   iDimmed = dimmed;
 }
 
@@ -246,7 +265,8 @@ void CanvasBase::drawAxes(cairo_t *cc)
   cairo_restore(cc);
 }
 
-void CanvasBase::drawGrid(cairo_t *cc)
+//! Draw the grid lines that intersect \a area.
+void CanvasBase::drawGrid(cairo_t *cc, const Rect &area)
 {
   int step = iSnap.iGridSize * iStyle.thinStep;
   double pixstep = step * iZoom;
@@ -266,9 +286,9 @@ void CanvasBase::drawGrid(cairo_t *cc)
   if (bottom < ll.y)
     ++bottom;
 
-  // only draw lines that intersect canvas
-  Vector screenUL = devToUser(Vector::ZERO);
-  Vector screenLR = devToUser(Vector(iWidth, iHeight));
+  // only draw lines that intersect area
+  Vector screenUL = area.topLeft();
+  Vector screenLR = area.bottomRight();
 
   cairo_save(cc);
   cairo_set_source_rgb(cc, 0.3, 0.3, 0.3);
@@ -344,7 +364,9 @@ void CanvasBase::drawFrame(cairo_t *cc)
   cairo_restore(cc);
 }
 
-void CanvasBase::drawObjects(cairo_t *cc)
+//! Draw the objects whose painted extent intersects \a area.
+/*! Relies on the extents computed in updatePainted. */
+void CanvasBase::drawObjects(cairo_t *cc, const Rect &area)
 {
   if (!iPage)
     return;
@@ -377,7 +399,7 @@ void CanvasBase::drawObjects(cairo_t *cc)
     title->draw(painter);
 
   for (int i = 0; i < iPage->count(); ++i) {
-    if (iPage->objectVisible(iView, i))
+    if (iPainted[i].iBox.intersects(area))
       iPage->object(i)->draw(painter);
   }
   painter.popMatrix();
@@ -677,26 +699,16 @@ void CanvasBase::refreshSurface()
     iRepaintObjects = false;
     if (!iSurface)
       iSurface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, iBWidth, iBHeight);
+    updatePainted();
     cairo_t *cc = cairo_create(iSurface);
-    // background
-    cairo_set_source_rgb(cc, 0.4, 0.4, 0.4);
-    cairo_rectangle(cc, 0, 0, iBWidth, iBHeight);
-    cairo_fill(cc);
-
-    cairo_translate(cc, 0.5 * iBWidth, 0.5 * iBHeight);
-    cairo_scale(cc, iBWidth / iWidth, iBHeight / iHeight);
-    cairo_scale(cc, iZoom, -iZoom);
-    cairo_translate(cc, -iPan.x, -iPan.y);
-
-    if (iPage) {
-      drawPaper(cc);
-      if (!iStyle.pretty)
-	drawFrame(cc);
-      if (iSnap.iGridVisible)
-	drawGrid(cc);
-      drawObjects(cc);
-      if (iSnap.iWithAxes)
-	drawAxes(cc);
+    composeTiles(cc);
+
+    if (iPage && iSnap.iWithAxes) {
+      cairo_translate(cc, 0.5 * iBWidth, 0.5 * iBHeight);
+      cairo_scale(cc, iBWidth / iWidth, iBHeight / iHeight);
+      cairo_scale(cc, iZoom, -iZoom);
+      cairo_translate(cc, -iPan.x, -iPan.y);
+      drawAxes(cc);
     }
     cairo_surface_flush(iSurface);
     cairo_destroy(cc);
@@ -704,3 +716,273 @@ void CanvasBase::refreshSurface()
 }
 
 // --------------------------------------------------------------------
+
+/*! The backing store is assembled from square tiles of TILE_SIZE
+  pixels, which are cached between repaints.  The tile grid is fixed
+  in user space for a given zoom factor, so panning the canvas by
+  whole pixels only copies cached tiles.  When the page changes,
+  updatePainted compares the objects with those of the last repaint,
+  and only the tiles covering objects that have been added, removed,
+  or modified are discarded.  Changing the zoom factor, the page, or
+  the style discards all tiles. */
+
+const int TILE_SIZE = 256;
+// extra pixels around damaged areas, for antialiasing
+const double TILE_MARGIN = 2.0;
+// with more damaged objects than this it is cheaper to start over
+const int MAX_DAMAGE = 64;
+
+inline uint64_t tileKey(int tx, int ty)
+{
+  return (uint64_t(uint32_t(tx)) << 32) | uint32_t(ty);
+}
+
+inline int tileX(uint64_t key) { return int(uint32_t(key >> 32)); }
+inline int tileY(uint64_t key) { return int(uint32_t(key)); }
+
+inline int tileIndex(double pixel)
+{
+  return int(std::max(-1e9, std::min(1e9, std::floor(pixel / TILE_SIZE))));
+}
+
+//! Discard all cached tiles.
+void CanvasBase::flushTiles()
+{
+  for (auto &t : iTiles)
+    cairo_surface_destroy(t.second.iSurface);
+  iTiles.clear();
+}
+
+//! Discard the cached tiles intersecting \a box (in user coordinates).
+void CanvasBase::damageTiles(const Rect &box)
+{
+  if (box.isEmpty() || iTiles.empty())
+    return;
+  int x0 = tileIndex(iTileScale.x * box.left() + iTilePhase.x - TILE_MARGIN);
+  int x1 = tileIndex(iTileScale.x * box.right() + iTilePhase.x + TILE_MARGIN);
+  int y0 = tileIndex(-iTileScale.y * box.top() + iTilePhase.y - TILE_MARGIN);
+  int y1 = tileIndex(-iTileScale.y * box.bottom() + iTilePhase.y
+		     + TILE_MARGIN);
+  for (auto it = iTiles.begin(); it != iTiles.end(); ) {
+    int tx = tileX(it->first);
+    int ty = tileY(it->first);
+    if (x0 <= tx && tx <= x1 && y0 <= ty && ty <= y1) {
+      cairo_surface_destroy(it->second.iSurface);
+      it = iTiles.erase(it);
+    } else
+      ++it;
+  }
+}
+
+namespace {
+  // Computes the painted extent of an object, and starts decoding its
+  // bitmaps at the resolution at which they will be shown.
+  class ExtentPainter : public BBoxPainter {
+  public:
+    ExtentPainter(const Cascade *style, Vector scale)
+      : BBoxPainter(style), iScale(scale), iMargin(0.0) { /* nothing */ }
+    //! Return how far strokes can stick out of the bounding box.
+    double margin() const { return iMargin; }
+
+  protected:
+    virtual void doDrawPath(TPathMode mode);
+    virtual void doDrawBitmap(Bitmap bitmap);
+
+  private:
+    Vector iScale;  // device pixels per user unit
+    double iMargin;
+  };
+}
+
+void ExtentPainter::doDrawPath(TPathMode mode)
+{
+  BBoxPainter::doDrawPath(mode);
+  if (mode != EFilledOnly) {
+    // the BBoxPainter ignores miter joins, which can stick out by up
+    // to five pen widths with the default miter limit, and square caps
+    double w = pen().toDouble();
+    iMargin = std::max(iMargin, (lineJoin() == EMiterJoin ? 5.0 : 1.0) * w);
+  }
+}
+
+void ExtentPainter::doDrawBitmap(Bitmap bitmap)
+{
+  BBoxPainter::doDrawBitmap(bitmap);
+  Vector ex = matrix().linear() * Vector(1.0, 0.0);
+  Vector ey = matrix().linear() * Vector(0.0, 1.0);
+  ex = Vector(iScale.x * ex.x, iScale.y * ex.y);
+  ey = Vector(iScale.x * ey.x, iScale.y * ey.y);
+  double ratio;
+  bitmap.decodeInBackground(bitmap.displayLevel(ex, ey, ratio));
+}
+
+//! Compare page with last repaint, and discard the tiles that changed.
+/*! Also starts decoding the bitmaps of objects that are new or have
+  changed, so that they are ready when the tiles are rendered. */
+void CanvasBase::updatePainted()
+{
+  // sheets can be modified in place, or a new sheet can be allocated
+  // at the address of a deleted one, so compare the revisions too
+  std::vector<std::pair<const StyleSheet *, uint32_t>> sheets;
+  if (iCascade) {
+    for (int i = 0; i < iCascade->count(); ++i) {
+      const StyleSheet *sheet = iCascade->sheet(i);
+      sheets.emplace_back(sheet, sheet->revision());
+    }
+  }
+  String title = iPage ? iPage->title() : String();
+  bool background = iPage && iPage->findLayer("BACKGROUND") < 0;
+  if (sheets != iPaintedSheets || title != iPaintedTitle
+      || background != iPaintedBackground) {
+    flushTiles();
+    iPainted.clear();   // the extents depend on the style sheets
+    iPaintedSheets.swap(sheets);
+    iPaintedTitle = title;
+    iPaintedBackground = background;
+  }
+
+  int n = iPage ? iPage->count() : 0;
+  if (n == 0 && iPainted.empty())
+    return;
+
+  std::unordered_map<uint32_t, int> old;
+  old.reserve(iPainted.size());
+  for (int j = 0; j < size(iPainted); ++j)
+    old[iPainted[j].iRevision] = j;
+  std::vector<bool> seen(iPainted.size(), false);
+
+  Vector scale(iZoom * iBWidth / iWidth, iZoom * iBHeight / iHeight);
+  std::vector<Painted> painted(n);
+  std::vector<Rect> damage;
+  for (int i = 0; i < n; ++i) {
+    Painted &p = painted[i];
+    p.iRevision = iPage->revision(i);
+    p.iVisible = iPage->objectVisible(iView, i);
+    auto it = old.find(p.iRevision);
+    if (it != old.end()) {
+      seen[it->second] = true;
+      const Painted &q = iPainted[it->second];
+      if (q.iVisible == p.iVisible) {
+	p.iBox = q.iBox;
+	continue;
+      }
+      damage.push_back(q.iBox);
+    }
+    if (p.iVisible) {
+      ExtentPainter painter(iCascade, scale);
+      iPage->object(i)->draw(painter);
+      Rect box = painter.bbox();
+      double margin = painter.margin();
+      if (!box.isEmpty()) {
+	p.iBox.addPoint(box.bottomLeft() - Vector(margin, margin));
+	p.iBox.addPoint(box.topRight() + Vector(margin, margin));
+      }
+      damage.push_back(p.iBox);
+    }
+  }
+  for (int j = 0; j < size(iPainted); ++j) {
+    if (!seen[j])
+      damage.push_back(iPainted[j].iBox);
+  }
+  iPainted.swap(painted);
+
+  if (size(damage) > MAX_DAMAGE)
+    flushTiles();
+  else {
+    for (const auto &box : damage)
+      damageTiles(box);
+  }
+}
+
+//! Render the tile at tile coordinates \a tx, \a ty.
+cairo_surface_t *CanvasBase::renderTile(int tx, int ty)
+{
+  cairo_surface_t *surface =
+    cairo_image_surface_create(CAIRO_FORMAT_RGB24, TILE_SIZE, TILE_SIZE);
+  cairo_t *cc = cairo_create(surface);
+  // background
+  cairo_set_source_rgb(cc, 0.4, 0.4, 0.4);
+  cairo_paint(cc);
+
+  cairo_translate(cc, iTilePhase.x - tx * TILE_SIZE,
+		  iTilePhase.y - ty * TILE_SIZE);
+  cairo_scale(cc, iTileScale.x, -iTileScale.y);
+
+  if (iPage) {
+    // area covered by the tile in user coordinates
+    Vector ll((tx * TILE_SIZE - iTilePhase.x - TILE_MARGIN) / iTileScale.x,
+	      (iTilePhase.y - (ty + 1) * TILE_SIZE - TILE_MARGIN)
+	      / iTileScale.y);
+    Vector ur(((tx + 1) * TILE_SIZE - iTilePhase.x + TILE_MARGIN)
+	      / iTileScale.x,
+	      (iTilePhase.y - ty * TILE_SIZE + TILE_MARGIN) / iTileScale.y);
+    Rect area(ll, ur);
+    drawPaper(cc);
+    if (!iStyle.pretty)
+      drawFrame(cc);
+    if (iSnap.iGridVisible)
+      drawGrid(cc, area);
+    drawObjects(cc, area);
+  }
+  cairo_destroy(cc);
+  cairo_surface_flush(surface);
+  return surface;
+}
+
+//! Fill the backing store from the tile cache, rendering missing tiles.
+void CanvasBase::composeTiles(cairo_t *cc)
+{
+  Vector scale(iZoom * iBWidth / iWidth, iZoom * iBHeight / iHeight);
+  // device position of the user space origin
+  Vector offset(0.5 * iBWidth - scale.x * iPan.x,
+		0.5 * iBHeight + scale.y * iPan.y);
+  if (scale != iTileScale) {
+    flushTiles();
+    iTileScale = scale;
+  }
+  // the cached tiles can be reused if the offset changed by whole pixels
+  Vector d = offset - iTilePhase;
+  double ox = std::floor(d.x + 0.5);
+  double oy = std::floor(d.y + 0.5);
+  if (std::fabs(d.x - ox) > 1e-3 || std::fabs(d.y - oy) > 1e-3) {
+    flushTiles();
+    ox = std::floor(offset.x);
+    oy = std::floor(offset.y);
+    iTilePhase = offset - Vector(ox, oy);
+  }
+
+  ++iTileClock;
+  int x0 = tileIndex(-ox);
+  int x1 = tileIndex(iBWidth - 1 - ox);
+  int y0 = tileIndex(-oy);
+  int y1 = tileIndex(iBHeight - 1 - oy);
+  for (int ty = y0; ty <= y1; ++ty) {
+    for (int tx = x0; tx <= x1; ++tx) {
+      Tile &t = iTiles[tileKey(tx, ty)];
+      if (!t.iSurface)
+	t.iSurface = renderTile(tx, ty);
+      t.iUsed = iTileClock;
+      double x = ox + tx * TILE_SIZE;
+      double y = oy + ty * TILE_SIZE;
+      cairo_set_source_surface(cc, t.iSurface, x, y);
+      cairo_rectangle(cc, x, y, TILE_SIZE, TILE_SIZE);
+      cairo_fill(cc);
+    }
+  }
+
+  // keep recently used tiles around for panning back
+  size_t limit = 2 * size_t(x1 - x0 + 1) * size_t(y1 - y0 + 1) + 16;
+  if (iTiles.size() > limit) {
+    std::vector<std::pair<uint64_t, uint64_t>> used;
+    for (const auto &t : iTiles)
+      used.emplace_back(t.second.iUsed, t.first);
+    std::sort(used.begin(), used.end());
+    for (size_t k = 0; iTiles.size() > limit; ++k) {
+      auto it = iTiles.find(used[k].second);
+      cairo_surface_destroy(it->second.iSurface);
+      iTiles.erase(it);
+    }
+  }
+}
+
+// --------------------------------------------------------------------
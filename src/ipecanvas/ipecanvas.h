@@ -34,6 +34,8 @@
 
 #include "ipelib.h"
 
+#include <unordered_map>
+
 // --------------------------------------------------------------------
 
 // Avoid including cairo.h
@@ -166,11 +168,16 @@ namespace ipe {
     void drawPaper(cairo_t *cc);
     void drawFrame(cairo_t *cc);
     void drawAxes(cairo_t *cc);
-    void drawGrid(cairo_t *cc);
-    void drawObjects(cairo_t *cc);
+    void drawGrid(cairo_t *cc, const Rect &area);
+    void drawObjects(cairo_t *cc, const Rect &area);
     void drawTool(Painter &painter);
     void snapToPaperAndFrame();
     void refreshSurface();
+    void flushTiles();
+    void damageTiles(const Rect &box);
+    void updatePainted();
+    void composeTiles(cairo_t *cc);
+    cairo_surface_t *renderTile(int tx, int ty);
     void computeFifi(double x, double y);
     void drawFifi(cairo_t *cr);
 
@@ -210,6 +217,30 @@ namespace ipe {
 
     const PdfResources *iResources;
     std::unique_ptr<Fonts> iFonts;
+
+  private:
+    struct Tile {
+      cairo_surface_t *iSurface;
+      uint64_t iUsed;
+    };
+    //! Painted extent of an object as of the last repaint.
+    struct Painted {
+      uint32_t iRevision;
+      bool iVisible;
+      Rect iBox;
+    };
+
+    // cached tiles, keyed by tile coordinates
+    std::unordered_map<uint64_t, Tile> iTiles;
+    Vector iTileScale;  // pixels per user unit for the cached tiles
+    Vector iTilePhase;  // subpixel offset of the tile grid
+    uint64_t iTileClock;
+    // state of the page when the tiles were rendered
+    std::vector<Painted> iPainted;
+    // style sheets and their revisions at the last repaint
+    std::vector<std::pair<const StyleSheet *, uint32_t>> iPaintedSheets;
+    String iPaintedTitle;
+    bool iPaintedBackground;
   };
 
 } // namespace
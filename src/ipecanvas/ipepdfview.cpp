@@ -32,10 +32,260 @@
 
 #include "ipecairopainter.h"
 
+#include <algorithm>
+
 using namespace ipe;
 
 // --------------------------------------------------------------------
 
+/*! \class ipe::PdfRenderCache
+  \ingroup canvas
+  \brief A cache of pages rendered for PdfViews.
+
+  Pages that are likely to be shown next can be prefetched: they are
+  rendered on a pool of worker threads, at the size, zoom, and pan
+  of the view that will show them.  When the view then switches to
+  such a page, it only needs to display the finished surface.
+
+  The surfaces in the cache take at most \a budget bytes.  When more
+  space is needed, the least recently used surfaces are discarded.
+*/
+
+//! Create cache with given memory budget and number of worker threads.
+/*! If \a threads is zero, a thread is used for each core, leaving
+  one core for the user interface, up to a maximum of four. */
+PdfRenderCache::PdfRenderCache(size_t budget, int threads)
+  : iBudget(budget), iUsed(0), iClock(0), iStop(false)
+{
+  if (threads <= 0)
+    threads = std::min(4, std::max(1, int(std::thread::hardware_concurrency()) - 1));
+  for (int i = 0; i < threads; ++i)
+    iThreads.emplace_back(&PdfRenderCache::work, this);
+}
+
+//! Destructor waits for the worker threads to finish.
+PdfRenderCache::~PdfRenderCache()
+{
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    iStop = true;
+    iQueue.clear();
+  }
+  iWork.notify_all();
+  for (auto &t : iThreads)
+    t.join();
+  for (auto &e : iEntries) {
+    if (e.iSurface)
+      cairo_surface_destroy(e.iSurface);
+  }
+}
+
+//! Render the page and return a new surface.
+cairo_surface_t *PdfRenderCache::Job::render() const
+{
+  cairo_surface_t *surface =
+    cairo_image_surface_create(CAIRO_FORMAT_RGB24, iBWidth, iBHeight);
+  cairo_t *cc = cairo_create(surface);
+  // background
+  cairo_set_source_rgb(cc, 0.4, 0.4, 0.4);
+  cairo_rectangle(cc, 0, 0, iBWidth, iBHeight);
+  cairo_fill(cc);
+
+  cairo_translate(cc, 0.5 * iBWidth, 0.5 * iBHeight);
+  cairo_scale(cc, iBWidth / iWidth, iBHeight / iHeight);
+  cairo_scale(cc, iZoom, -iZoom);
+  cairo_translate(cc, -iPan.x, -iPan.y);
+
+  // paper
+  if (!iPaperBox.isEmpty()) {
+    cairo_rectangle(cc, iPaperBox.left(), iPaperBox.bottom(),
+		    iPaperBox.width(), iPaperBox.height());
+    cairo_set_source_rgb(cc, 1.0, 1.0, 1.0);
+    cairo_fill(cc);
+  }
+  if (iStream) {
+    CairoPainter painter(iCascade, iFonts, cc, iZoom, false);
+    painter.executeStream(iStream, iPage);
+  }
+  cairo_surface_flush(surface);
+  cairo_destroy(cc);
+  return surface;
+}
+
+//! Do the jobs render the same image?
+bool PdfRenderCache::Job::operator==(const Job &rhs) const
+{
+  return iView == rhs.iView && iPage == rhs.iPage
+    && iBWidth == rhs.iBWidth && iBHeight == rhs.iBHeight
+    && iWidth == rhs.iWidth && iHeight == rhs.iHeight
+    && iZoom == rhs.iZoom && iPan == rhs.iPan;
+}
+
+int PdfRenderCache::findEntry(const Job &job) const
+{
+  for (int i = 0; i < size(iEntries); ++i) {
+    if (!iEntries[i].iDiscard && iEntries[i].iJob == job)
+      return i;
+  }
+  return -1;
+}
+
+// Every entry takes its memory from the budget, even while rendering.
+void PdfRenderCache::eraseEntry(int i)
+{
+  iUsed -= 4 * size_t(iEntries[i].iJob.iBWidth) * iEntries[i].iJob.iBHeight;
+  if (iEntries[i].iSurface)
+    cairo_surface_destroy(iEntries[i].iSurface);
+  iEntries.erase(iEntries.begin() + i);
+}
+
+// Discard least recently used surfaces until there is room for \a bytes.
+void PdfRenderCache::makeRoom(size_t bytes)
+{
+  while (iUsed + bytes > iBudget) {
+    int lru = -1;
+    for (int i = 0; i < size(iEntries); ++i) {
+      if (iEntries[i].iSurface &&
+	  (lru < 0 || iEntries[i].iLastUse < iEntries[lru].iLastUse))
+	lru = i;
+    }
+    if (lru < 0)
+      return;
+    eraseEntry(lru);
+  }
+}
+
+//! Queue a job for rendering in the background.
+/*! Jobs are rendered in the order they were queued.  Nothing happens
+  if the page is already in the cache, or does not fit. */
+void PdfRenderCache::prefetch(const Job &job)
+{
+  size_t bytes = 4 * size_t(job.iBWidth) * job.iBHeight;
+  if (bytes == 0 || bytes > iBudget)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    int i = findEntry(job);
+    if (i >= 0) {
+      iEntries[i].iLastUse = ++iClock;
+      return;
+    }
+    if (std::find(iQueue.begin(), iQueue.end(), job) != iQueue.end())
+      return;
+    iQueue.push_back(job);
+  }
+  iWork.notify_one();
+}
+
+//! Discard all jobs that are not yet being rendered.
+void PdfRenderCache::cancel()
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  iQueue.clear();
+}
+
+//! Return the rendered surface for \a job, or nullptr if not in the cache.
+/*! If the job is being rendered right now, waits for it to finish.
+  The caller owns a reference to the returned surface. */
+cairo_surface_t *PdfRenderCache::find(const Job &job)
+{
+  std::unique_lock<std::mutex> lock(iMutex);
+  auto it = std::find(iQueue.begin(), iQueue.end(), job);
+  if (it != iQueue.end()) {
+    // faster to render it right away
+    iQueue.erase(it);
+    return nullptr;
+  }
+  int i;
+  iDone.wait(lock, [&] {
+    i = findEntry(job);
+    return i < 0 || !iEntries[i].iRendering; });
+  if (i < 0 || !iEntries[i].iSurface)
+    return nullptr;
+  iEntries[i].iLastUse = ++iClock;
+  return cairo_surface_reference(iEntries[i].iSurface);
+}
+
+//! Store a surface rendered for \a job (adds a reference).
+void PdfRenderCache::insert(const Job &job, cairo_surface_t *surface)
+{
+  size_t bytes = 4 * size_t(job.iBWidth) * job.iBHeight;
+  if (bytes > iBudget)
+    return;
+  std::lock_guard<std::mutex> lock(iMutex);
+  if (findEntry(job) >= 0)
+    return;
+  makeRoom(bytes);
+  Entry e = { job, cairo_surface_reference(surface), false, false, ++iClock };
+  iEntries.push_back(e);
+  iUsed += bytes;
+}
+
+//! Remove all pages rendered for \a view (for instance when it is resized).
+void PdfRenderCache::remove(const PdfViewBase *view)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  iQueue.erase(std::remove_if(iQueue.begin(), iQueue.end(),
+			      [view](const Job &j) { return j.iView == view; }),
+	       iQueue.end());
+  for (int i = size(iEntries) - 1; i >= 0; --i) {
+    if (iEntries[i].iJob.iView != view)
+      continue;
+    if (iEntries[i].iRendering)
+      iEntries[i].iDiscard = true;  // erased when finished
+    else
+      eraseEntry(i);
+  }
+}
+
+//! Discard all jobs and pages, and wait until no job is being rendered.
+/*! Must be called before the PDF document or the Fonts used by the
+  jobs are deleted. */
+void PdfRenderCache::clear()
+{
+  std::unique_lock<std::mutex> lock(iMutex);
+  iQueue.clear();
+  iDone.wait(lock, [this] {
+    for (const auto &e : iEntries) {
+      if (e.iRendering)
+	return false;
+    }
+    return true; });
+  while (!iEntries.empty())
+    eraseEntry(size(iEntries) - 1);
+}
+
+void PdfRenderCache::work()
+{
+  std::unique_lock<std::mutex> lock(iMutex);
+  for (;;) {
+    iWork.wait(lock, [this] { return iStop || !iQueue.empty(); });
+    if (iStop)
+      return;
+    Job job = iQueue.front();
+    iQueue.erase(iQueue.begin());
+    size_t bytes = 4 * size_t(job.iBWidth) * job.iBHeight;
+    makeRoom(bytes);
+    // the entry reserves its memory while rendering
+    Entry e = { job, nullptr, true, false, ++iClock };
+    iEntries.push_back(e);
+    iUsed += bytes;
+    lock.unlock();
+    cairo_surface_t *surface = job.render();
+    lock.lock();
+    int i = 0;
+    while (!iEntries[i].iRendering || !(iEntries[i].iJob == job))
+      ++i;
+    iEntries[i].iSurface = surface;
+    iEntries[i].iRendering = false;
+    if (iEntries[i].iDiscard)
+      eraseEntry(i);
+    iDone.notify_all();
+  }
+}
+
+// --------------------------------------------------------------------
+
 /*! \class ipe::PdfViewBase
   \ingroup canvas
   \brief A widget (control) that displays a PDF document.
@@ -47,7 +297,7 @@ PdfViewBase::PdfViewBase()
   iSurface = nullptr;
   iPdf = nullptr;
   iPage = nullptr;
-  iStream = nullptr;
+  iCache = nullptr;
 
   iPan = Vector::ZERO;
   iZoom = 1.0;
@@ -74,9 +324,10 @@ PdfViewBase::~PdfViewBase()
 //! Provide the PDF document.
 void PdfViewBase::setPdf(const PdfFile *pdf)
 {
+  if (iCache)
+    iCache->clear();
   iFonts.reset();
   iPage = nullptr;
-  iStream = nullptr;
   iPdf = pdf;
   iResources = std::make_unique<PdfFileResources>(iPdf);
   iFonts = std::make_unique<Fonts>(iResources.get());
@@ -87,8 +338,42 @@ void PdfViewBase::setPage(const PdfDict *page, const Rect &paper)
 {
   iPage = page;
   iPaperBox = paper;
-  const PdfObj *stream = iPage->get("Contents", iPdf);
-  iStream = stream ? stream->dict() : nullptr;
+}
+
+//! Use a cache for rendered pages (the cache is shared by several views).
+/*! The cache must be destroyed or cleared before the view. */
+void PdfViewBase::setCache(PdfRenderCache *cache)
+{
+  iCache = cache;
+}
+
+//! Render page in the background, as it would be shown by this view.
+/*! Uses the current size, zoom, and pan of the view. */
+void PdfViewBase::prefetch(const PdfDict *page, const Rect &paper)
+{
+  if (iCache && iBWidth > 0 && iBHeight > 0)
+    iCache->prefetch(job(page, paper));
+}
+
+//! Return job that renders \a page as shown in this view.
+PdfRenderCache::Job PdfViewBase::job(const PdfDict *page,
+				     const Rect &paper) const
+{
+  PdfRenderCache::Job job;
+  job.iView = this;
+  job.iPage = page;
+  const PdfObj *stream = page ? page->get("Contents", iPdf) : nullptr;
+  job.iStream = stream ? stream->dict() : nullptr;
+  job.iPaperBox = paper;
+  job.iBWidth = int(iBWidth);
+  job.iBHeight = int(iBHeight);
+  job.iWidth = iWidth;
+  job.iHeight = iHeight;
+  job.iZoom = iZoom;
+  job.iPan = iPan;
+  job.iCascade = iCascade.get();
+  job.iFonts = iFonts.get();
+  return job;
 }
 
 // --------------------------------------------------------------------
@@ -134,17 +419,6 @@ Matrix PdfViewBase::canvasTfm() const
   return Matrix(center()) * Linear(iZoom, 0, 0, -iZoom) * Matrix(-iPan);
 }
 
-// --------------------------------------------------------------------
-
-void PdfViewBase::drawPaper(cairo_t *cc)
-{
-  if (!iPaperBox.isEmpty()) {
-    cairo_rectangle(cc, iPaperBox.left(), iPaperBox.bottom(),
-		    iPaperBox.width(), iPaperBox.height());
-    cairo_set_source_rgb(cc, 1.0, 1.0, 1.0);
-    cairo_fill(cc);
-  }
-}
 
 // --------------------------------------------------------------------
 
@@ -169,30 +443,22 @@ void PdfViewBase::refreshSurface()
       cairo_surface_destroy(iSurface);
     iSurface = nullptr;
     iRepaint = true;
+    // pages prefetched at the old size are useless now
+    if (iCache)
+      iCache->remove(this);
   }
   if (iRepaint) {
     iRepaint = false;
-    if (!iSurface)
-      iSurface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
-					    iBWidth, iBHeight);
-    cairo_t *cc = cairo_create(iSurface);
-    // background
-    cairo_set_source_rgb(cc, 0.4, 0.4, 0.4);
-    cairo_rectangle(cc, 0, 0, iBWidth, iBHeight);
-    cairo_fill(cc);
-
-    cairo_translate(cc, 0.5 * iBWidth, 0.5 * iBHeight);
-    cairo_scale(cc, iBWidth / iWidth, iBHeight / iHeight);
-    cairo_scale(cc, iZoom, -iZoom);
-    cairo_translate(cc, -iPan.x, -iPan.y);
-
-    drawPaper(cc);
-    if (iStream) {
-      CairoPainter painter(iCascade.get(), iFonts.get(), cc, iZoom, false);
-      painter.executeStream(iStream, iPage);
+    PdfRenderCache::Job j = job(iPage, iPaperBox);
+    cairo_surface_t *surface = iCache ? iCache->find(j) : nullptr;
+    if (!surface) {
+      surface = j.render();
+      if (iCache)
+	iCache->insert(j, surface);
     }
-    cairo_surface_flush(iSurface);
-    cairo_destroy(cc);
+    if (iSurface)
+      cairo_surface_destroy(iSurface);
+    iSurface = surface;
   }
 }
 
@@ -33,6 +33,10 @@
 #include "ipelib.h"
 #include "ipepdfparser.h"
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 // --------------------------------------------------------------------
 
 // Avoid including cairo.h
@@ -45,6 +49,65 @@ namespace ipe {
 
   class Fonts;
   class PdfFileResources;
+  class PdfViewBase;
+
+  // --------------------------------------------------------------------
+
+  class PdfRenderCache {
+  public:
+    //! Everything needed to render a page as shown in a view.
+    struct Job {
+      cairo_surface_t *render() const;
+      bool operator==(const Job &rhs) const;
+
+      const PdfViewBase *iView;
+      const PdfDict *iPage;
+      const PdfDict *iStream;
+      Rect iPaperBox;
+      int iBWidth, iBHeight;
+      double iWidth, iHeight;
+      double iZoom;
+      Vector iPan;
+      const Cascade *iCascade;
+      Fonts *iFonts;
+    };
+
+    explicit PdfRenderCache(size_t budget, int threads = 0);
+    ~PdfRenderCache();
+
+    void prefetch(const Job &job);
+    void cancel();
+    cairo_surface_t *find(const Job &job);
+    void insert(const Job &job, cairo_surface_t *surface);
+    void remove(const PdfViewBase *view);
+    void clear();
+
+  private:
+    struct Entry {
+      Job iJob;
+      cairo_surface_t *iSurface; // nullptr while not rendered
+      bool iRendering;
+      bool iDiscard; // view was changed while rendering
+      uint64_t iLastUse;
+    };
+
+    void work();
+    int findEntry(const Job &job) const;
+    void makeRoom(size_t bytes);
+    void eraseEntry(int i);
+
+  private:
+    size_t iBudget;
+    size_t iUsed;
+    uint64_t iClock;
+    bool iStop;
+    std::vector<Entry> iEntries;
+    std::vector<Job> iQueue;
+    std::mutex iMutex;
+    std::condition_variable iWork;
+    std::condition_variable iDone;
+    std::vector<std::thread> iThreads;
+  };
 
   // --------------------------------------------------------------------
 
@@ -55,6 +118,8 @@ namespace ipe {
 
     void setPdf(const PdfFile *pdf);
     void setPage(const PdfDict *page, const Rect &paper);
+    void setCache(PdfRenderCache *cache);
+    void prefetch(const PdfDict *page, const Rect &paper);
 
     //! Return current pan.
     inline Vector pan() const { return iPan; }
@@ -81,8 +146,8 @@ namespace ipe {
 
   protected:
     PdfViewBase();
-    void drawPaper(cairo_t *cc);
     void refreshSurface();
+    PdfRenderCache::Job job(const PdfDict *page, const Rect &paper) const;
 
   protected:
     double iWidth, iHeight;
@@ -97,10 +162,10 @@ namespace ipe {
 
     const PdfDict *iPage;
     Rect iPaperBox;
-    const PdfDict *iStream;
     const PdfFile *iPdf;
     std::unique_ptr<PdfFileResources> iResources;
     std::unique_ptr<Fonts> iFonts;
+    PdfRenderCache *iCache;
   };
 
 } // namespace
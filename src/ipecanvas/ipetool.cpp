@@ -116,8 +116,12 @@ SelectTool::SelectTool(CanvasBase *canvas, Page *page, int view,
   double bound = iSelectDistance / iCanvas->zoom();
 
   // Collect objects close enough
+  std::vector<int> near;
+  iPage->findObjects(Rect(v - Vector(bound, bound), v + Vector(bound, bound)),
+		     near);
   double d;
-  for (int i = iPage->count() - 1; i >= 0; --i) {
+  for (auto it = near.rbegin(); it != near.rend(); ++it) {
+    int i = *it;
     if (iPage->objectVisible(iView, i) &&
 	!iPage->isLocked(iPage->layerOf(i))) {
       if ((d = iPage->distance(i, v, bound)) < bound) {
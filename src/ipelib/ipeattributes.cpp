@@ -183,62 +183,173 @@ void Effect::pageDictionary(Stream &stream) const
 
   The Repository is a singleton object.  It is created the first time
   it is used. You obtain access to the repository using get().
+
+  Strings are found through a hash table, and can be looked up and
+  added from several threads at the same time.  There can be at most
+  as many strings as an Attribute can index; toIndex() maps any
+  further names to "undefined".
 */
 
 // pointer to singleton object
-Repository *Repository::singleton = nullptr;
+std::atomic<Repository *> Repository::singleton(nullptr);
+
+// FNV-1a
+static uint32_t hashString(const String &str)
+{
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < str.size(); ++i) {
+    h ^= uint8_t(str[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+Repository::Table::Table(int size)
+  : iMask(size - 1), iSlots(new std::atomic<int>[size])
+{
+  for (int i = 0; i < size; ++i)
+    iSlots[i].store(-1, std::memory_order_relaxed);
+}
 
 //! Constructor.
 Repository::Repository()
 {
+  for (int i = 0; i < EMaxDirs; ++i)
+    iDirs[i].store(nullptr, std::memory_order_relaxed);
+  iCount = 0;
+  iTables.emplace_back(new Table(64));
+  iTable.store(iTables.back().get());
+
   // put certain strings at index 0 ..
-  iStrings.push_back("normal");
-  iStrings.push_back("undefined");
-  iStrings.push_back("Background");
-  iStrings.push_back("sym-stroke");
-  iStrings.push_back("sym-fill");
-  iStrings.push_back("sym-pen");
-  iStrings.push_back("arrow/normal(spx)");
-  iStrings.push_back("opaque");
-  iStrings.push_back("arrow/arc(spx)");
-  iStrings.push_back("arrow/farc(spx)");
-  iStrings.push_back("arrow/ptarc(spx)");
-  iStrings.push_back("arrow/fptarc(spx)");
+  toIndex("normal");
+  toIndex("undefined");
+  toIndex("Background");
+  toIndex("sym-stroke");
+  toIndex("sym-fill");
+  toIndex("sym-pen");
+  toIndex("arrow/normal(spx)");
+  toIndex("opaque");
+  toIndex("arrow/arc(spx)");
+  toIndex("arrow/farc(spx)");
+  toIndex("arrow/ptarc(spx)");
+  toIndex("arrow/fptarc(spx)");
+}
+
+Repository::~Repository()
+{
+  for (int i = 0; i < EMaxDirs; ++i) {
+    Block *dir = iDirs[i].load();
+    if (dir) {
+      for (int j = 0; j < EDirSize; ++j)
+	delete [] dir[j].load();
+      delete [] dir;
+    }
+  }
 }
 
 //! Get pointer to singleton Repository.
 Repository *Repository::get()
 {
-  if (!singleton) {
-    singleton = new Repository();
+  Repository *rep = singleton.load(std::memory_order_acquire);
+  if (!rep) {
+    static std::mutex creation;
+    std::lock_guard<std::mutex> lock(creation);
+    rep = singleton.load(std::memory_order_relaxed);
+    if (!rep) {
+      rep = new Repository();
+      singleton.store(rep, std::memory_order_release);
+    }
   }
-  return singleton;
+  return rep;
 }
 
 //! Return string with given index.
 String Repository::toString(int index) const
 {
-  return iStrings[index];
+  return string(index);
+}
+
+/* Readers do not lock: strings are never moved once stored, and a
+   slot of the hash table is set only after its string has been
+   stored.  A reader may still be looking at a table that has been
+   replaced by a larger one, so old tables are kept until the
+   Repository is destroyed.  If it misses the string for this reason,
+   toIndex looks again while holding the lock. */
+int Repository::find(const String &str, uint32_t hash) const
+{
+  const Table *t = iTable.load(std::memory_order_acquire);
+  for (uint32_t i = hash & t->iMask; ; i = (i + 1) & t->iMask) {
+    int k = t->iSlots[i].load(std::memory_order_acquire);
+    if (k < 0)
+      return -1;
+    if (string(k) == str)
+      return k;
+  }
+}
+
+void Repository::insert(Table *t, int index, uint32_t hash)
+{
+  uint32_t i = hash & t->iMask;
+  while (t->iSlots[i].load(std::memory_order_relaxed) >= 0)
+    i = (i + 1) & t->iMask;
+  t->iSlots[i].store(index, std::memory_order_release);
 }
 
 //! Return index of given string.
-/*! The string is added to the repository if it doesn't exist yet. */
+/*! The string is added to the repository if it doesn't exist yet.
+  This can be called from several threads at once. */
 int Repository::toIndex(String str)
 {
   assert(!str.empty());
-  std::vector<String>::const_iterator it =
-    std::find(iStrings.begin(), iStrings.end(), str);
-  if (it != iStrings.end())
-    return (it - iStrings.begin());
-  iStrings.push_back(str);
-  return iStrings.size() - 1;
+  uint32_t hash = hashString(str);
+  int k = find(str, hash);
+  if (k >= 0)
+    return k;
+
+  std::lock_guard<std::mutex> lock(iMutex);
+  k = find(str, hash);
+  if (k >= 0)
+    return k;
+
+  if (iCount >= EMaxIndex) {
+    ipeDebug("Too many attribute names, cannot add '%s'", str.z());
+    return 1;  // "undefined"
+  }
+
+  k = iCount++;
+  int d = k >> (EBlockBits + EDirBits);
+  Block *dir = iDirs[d].load(std::memory_order_relaxed);
+  if (!dir) {
+    dir = new Block[EDirSize];
+    for (int j = 0; j < EDirSize; ++j)
+      dir[j].store(nullptr, std::memory_order_relaxed);
+    iDirs[d].store(dir, std::memory_order_release);
+  }
+  Block &b = dir[(k >> EBlockBits) & (EDirSize - 1)];
+  String *block = b.load(std::memory_order_relaxed);
+  if (!block) {
+    block = new String[EBlockSize];
+    b.store(block, std::memory_order_release);
+  }
+  block[k & (EBlockSize - 1)] = str;
+
+  Table *t = iTable.load(std::memory_order_relaxed);
+  if (2 * iCount > t->iMask + 1) {
+    // keep the table at most half full
+    iTables.emplace_back(new Table(2 * (t->iMask + 1)));
+    t = iTables.back().get();
+    for (int i = 0; i < k; ++i)
+      insert(t, i, hashString(string(i)));
+  }
+  insert(t, k, hash);
+  iTable.store(t, std::memory_order_release);
+  return k;
 }
 
 //! Destroy repository object.
 void Repository::cleanup()
 {
-  delete singleton;
-  singleton = nullptr;
+  delete singleton.exchange(nullptr);
 }
 
 // --------------------------------------------------------------------
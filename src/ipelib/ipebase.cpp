@@ -308,6 +308,16 @@ void String::append(const char *rhs) noexcept
   }
 }
 
+//! Append \a n bytes starting at \a data to this string.
+void String::append(const char *data, int n) noexcept
+{
+  if (n > 0) {
+    detach(n);
+    memcpy(iImp->iData + iImp->iSize, data, n);
+    iImp->iSize += n;
+  }
+}
+
 //! Append \a ch to this string.
 void String::append(char ch) noexcept
 {
@@ -691,6 +701,16 @@ void Stream::putXmlString(String s)
 
 // --------------------------------------------------------------------
 
+//! Move the write position to \a pos, as returned by tell().
+/*! Writing there overwrites earlier output.  Returns false if the
+  stream does not support this (the default implementation). */
+bool TellStream::seek(long /* pos */)
+{
+  return false;
+}
+
+// --------------------------------------------------------------------
+
 /*! \class ipe::StringStream
   \ingroup base
   \brief Stream writing into an String.
@@ -721,8 +741,7 @@ void StringStream::putCString(const char *s)
 
 void StringStream::putRaw(const char *data, int size)
 {
-  for (int i = 0; i < size; i++)
-    iString += data[i];
+  iString.append(data, size);
 }
 
 long StringStream::tell() const
@@ -751,8 +770,7 @@ void FileStream::putChar(char ch)
 
 void FileStream::putString(String s)
 {
-  for (int i = 0; i < s.size(); ++i)
-    std::fputc(s[i], iFile);
+  std::fwrite(s.data(), 1, s.size(), iFile);
 }
 
 void FileStream::putCString(const char *s)
@@ -762,8 +780,7 @@ void FileStream::putCString(const char *s)
 
 void FileStream::putRaw(const char *data, int size)
 {
-  for (int i = 0; i < size; i++)
-    std::fputc(data[i], iFile);
+  std::fwrite(data, 1, size, iFile);
 }
 
 long FileStream::tell() const
@@ -771,6 +788,11 @@ long FileStream::tell() const
   return std::ftell(iFile);
 }
 
+bool FileStream::seek(long pos)
+{
+  return std::fseek(iFile, pos, SEEK_SET) == 0;
+}
+
 // --------------------------------------------------------------------
 
 /*! \class ipe::DataSource
@@ -784,6 +806,51 @@ DataSource::~DataSource()
   // nothing
 }
 
+//! Return input that is available in memory, without consuming it.
+/*! Sets \a data to the next unread character, and returns the
+  number of characters that can be read from there.  Parsers can scan
+  this range directly, and then consume what they used with skip().
+
+  Returns 0 at the end of the input, or if the source does not keep
+  its input in memory.  Such sources have to be read using getChar().
+*/
+int DataSource::span(const char *&data)
+{
+  data = nullptr;
+  return 0;
+}
+
+//! Consume \a n characters.
+/*! \a n must not be larger than the value returned by span(). */
+void DataSource::skip(int n)
+{
+  while (n-- > 0)
+    getChar();
+}
+
+//! Read up to \a n characters into \a buf.
+/*! Returns the number of characters read, which is less than \a n
+  only at the end of the input. */
+int DataSource::getChars(char *buf, int n)
+{
+  int k = 0;
+  while (k < n) {
+    const char *data;
+    int m = std::min(span(data), n - k);
+    if (m > 0) {
+      memcpy(buf + k, data, m);
+      skip(m);
+      k += m;
+    } else {
+      int ch = getChar();
+      if (ch == EOF)
+	break;
+      buf[k++] = char(ch);
+    }
+  }
+  return k;
+}
+
 // --------------------------------------------------------------------
 
 /*! \class ipe::FileSource
@@ -825,4 +892,15 @@ int BufferSource::getChar()
   return uint8_t(iBuffer[iPos++]);
 }
 
+int BufferSource::span(const char *&data)
+{
+  data = iBuffer.data() + iPos;
+  return std::max(iBuffer.size() - iPos, 0);
+}
+
+void BufferSource::skip(int n)
+{
+  iPos += n;
+}
+
 // --------------------------------------------------------------------
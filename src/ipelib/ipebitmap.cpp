@@ -31,10 +31,27 @@
 #include "ipebitmap.h"
 #include "ipeutils.h"
 #include <zlib.h>
+#include <cstring>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 
 using namespace ipe;
 
-extern bool dctDecode(Buffer dctData, Buffer pixelData);
+extern bool dctDecode(Buffer dctData, Buffer pixelData, int reduction);
+
+// in ipebitmap_pixels.cpp
+extern void premultiplyPixels(const uint32_t *p, uint32_t *q, int n);
+extern void expandPixels(const uint8_t *p, uint32_t *q, int n,
+			 bool gray, bool alpha);
+extern void mergeAlpha(uint32_t *q, const uint8_t *a, int n);
+extern void splitPixels(const uint32_t *p, uint8_t *q, int n, bool gray);
+extern void splitAlpha(const uint32_t *p, uint8_t *q, int n);
+extern void halvePixels(const uint32_t *p, int width, int height, uint32_t *q);
+
+const int MAX_MIP_LEVEL = 12;
 
 // --------------------------------------------------------------------
 
@@ -78,10 +95,9 @@ Bitmap::Bitmap(const XmlAttributes &attr, String pcdata)
     Buffer dbuffer(pcdata.data(), pcdata.size());
     BufferSource source(dbuffer);
     Base64Source b64source(source);
-    while (length-- > 0)
-      *p++ = b64source.getChar();
-    while (alphaLength-- > 0)
-      *q++ = b64source.getChar();
+    b64source.getChars(p, length);
+    if (alphaLength > 0)
+      b64source.getChars(q, alphaLength);
   } else {
     Lex datalex(pcdata);
     while (length-- > 0)
@@ -111,6 +127,7 @@ std::pair<int, int> Bitmap::init(const XmlAttributes &attr)
   iImp->iFlags = 0;
   iImp->iColorKey = -1;
   iImp->iPixelsComputed = false;
+  iImp->iReducedDctFailed = false;
   iImp->iObjNum = Lex(attr["id"]).getInt();
   iImp->iWidth = Lex(attr["width"]).getInt();
   iImp->iHeight = Lex(attr["height"]).getInt();
@@ -153,6 +170,7 @@ Bitmap::Bitmap(int width, int height, uint32_t flags, Buffer data)
   iImp->iHeight = height;
   iImp->iData = data;
   iImp->iPixelsComputed = false;
+  iImp->iReducedDctFailed = false;
   assert(iImp->iWidth > 0 && iImp->iHeight > 0);
   unpack(Buffer());
   computeChecksum();
@@ -186,39 +204,16 @@ void Bitmap::unpack(Buffer alphaChannel)
   // convert data to ARGB32 format
   bool alphaInMain = hasAlpha() && alphaChannel.size() == 0;
   Buffer pixels(npixels * sizeof(uint32_t));
-  const char *p = iImp->iData.data();
-  uint32_t *q = (uint32_t *) pixels.data();
-  uint32_t *fin = q + npixels;
-  if (!isGray()) {
-    while (q < fin) {
-      uint8_t alpha = (alphaInMain ? uint8_t(*p++) : 0xff);
-      uint8_t r = uint8_t(*p++);
-      uint8_t g = uint8_t(*p++);
-      uint8_t b = uint8_t(*p++);
-      uint32_t pixel = (alpha << 24) | (r << 16) | (g << 8) | b;
-      *q++ = pixel;
-    }
-  } else {
-    while (q < fin) {
-      uint8_t alpha = (alphaInMain ? uint8_t(*p++) : 0xff);
-      uint8_t r = uint8_t(*p++);
-      *q++ = (alpha << 24) | (r << 16) | (r << 8) | r;
-    }
-  }
+  expandPixels((const uint8_t *) iImp->iData.data(),
+	       (uint32_t *) pixels.data(), npixels, isGray(), alphaInMain);
   // merge separate alpha channel
-  if (hasAlpha() && alphaChannel.size() > 0) {
-    q = (uint32_t *) pixels.data();
-    p = alphaChannel.data();
-    uint32_t pixel;
-    while (q < fin) {
-      pixel = *q;
-      pixel = (pixel & 0x00ffffff) | (*p++ << 24);
-      *q++ = pixel;
-    }
-  }
+  if (hasAlpha() && alphaChannel.size() > 0)
+    mergeAlpha((uint32_t *) pixels.data(),
+	       (const uint8_t *) alphaChannel.data(), npixels);
   if (iImp->iColorKey >= 0) {
     uint32_t colorKey = (iImp->iColorKey | 0xff000000);
-    q = (uint32_t *) pixels.data();
+    uint32_t *q = (uint32_t *) pixels.data();
+    uint32_t *fin = q + npixels;
     while (q < fin) {
       if (*q == colorKey)
 	*q = iImp->iColorKey;
@@ -382,16 +377,36 @@ bool Bitmap::equal(Bitmap rhs) const
   return true;
 }
 
+static inline uint64_t rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+/* The checksum is a 64-bit multiply-rotate hash over four independent
+   lanes of 8-byte words (in the style of xxHash), folded to an int. */
 void Bitmap::computeChecksum()
 {
-  int s = 0;
+  const uint64_t P1 = 0x9e3779b185ebca87ULL;
+  const uint64_t P2 = 0xc2b2ae3d27d4eb4fULL;
   int len = iImp->iData.size();
-  char *p = iImp->iData.data();
-  while (len--) {
-    s = (s & 0x0fffffff) << 3;
-    s += *p++;
+  const char *p = iImp->iData.data();
+  uint64_t acc[4] = { P1 + P2, P2, 0, 0 - P1 };
+  int i = 0;
+  for (; i + 32 <= len; i += 32) {
+    for (int k = 0; k < 4; ++k) {
+      uint64_t w;
+      memcpy(&w, p + i + 8 * k, 8);
+      acc[k] = rotl(acc[k] + w * P2, 31) * P1;
+    }
   }
-  iImp->iChecksum = s;
+  uint64_t h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12)
+    + rotl(acc[3], 18) + uint64_t(len);
+  for (; i < len; ++i)
+    h = rotl(h ^ (uint8_t(p[i]) * P1), 11) * P2;
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  iImp->iChecksum = int(h ^ (h >> 32));
 }
 
 //! Create the data to be embedded in an XML or PDF file.
@@ -403,31 +418,16 @@ std::pair<Buffer, Buffer> Bitmap::embed() const
   if (isJpeg())
     return std::make_pair(iImp->iData, Buffer());
   int npixels = width() * height();
-  uint32_t *src = (uint32_t *) iImp->iData.data();
-  uint32_t *fin = src + npixels;
-  uint32_t pixel;
+  const uint32_t *src = (const uint32_t *) iImp->iData.data();
   Buffer rgb(npixels * (isGray() ? 1 : 3));
-  char *p = rgb.data();
-  while (src < fin) {
-    pixel = *src++;
-    if (isGray()) {
-      *p++ = pixel & 0xff;
-    } else {
-      *p++ = (pixel & 0xff0000) >> 16;
-      *p++ = (pixel & 0x00ff00) >> 8;
-      *p++ = (pixel & 0x0000ff);
-    }
-  }
+  splitPixels(src, (uint8_t *) rgb.data(), npixels, isGray());
   int deflatedSize;
   Buffer deflated = DeflateStream::deflate(rgb.data(), rgb.size(), deflatedSize, 9);
   rgb = Buffer(deflated.data(), deflatedSize);
   Buffer alpha;
   if (hasAlpha()) {
     alpha = Buffer(npixels);
-    src = (uint32_t *) iImp->iData.data();
-    p = alpha.data();
-    while (src < fin)
-      *p++ = (*src++ & 0xff000000) >> 24;
+    splitAlpha(src, (uint8_t *) alpha.data(), npixels);
     deflated = DeflateStream::deflate(alpha.data(), alpha.size(), deflatedSize, 9);
     alpha = Buffer(deflated.data(), deflatedSize);
   }
@@ -441,42 +441,195 @@ std::pair<Buffer, Buffer> Bitmap::embed() const
   Otherwise, returns a buffer of size width() * height() uint32_t's.
   The data is in cairo ARGB32 format, that is native-endian uint32_t's
   with premultiplied alpha.
+
+  The pixels are computed on first use.  It is safe to render the
+  same bitmap from several threads.
 */
 Buffer Bitmap::pixelData()
 {
+  std::lock_guard<std::mutex> lock(iImp->iPixelsMutex);
   if (!iImp->iPixelsComputed) {
-    iImp->iPixelsComputed = true;
     if (isJpeg()) {
-      Buffer stream = iImp->iData;
-      Buffer pixels;
-      pixels = Buffer(4 * width() * height());
-      if (!dctDecode(stream, pixels))
-	return Buffer();
-      iImp->iPixelData = pixels;
+      Buffer pixels(4 * width() * height());
+      // leaves iPixelData empty if decoding fails
+      if (dctDecode(iImp->iData, pixels, 0))
+	iImp->iPixelData = pixels;
     } else {
       if (hasAlpha() || colorKey() >= 0) {
 	// premultiply RGB data
 	iImp->iPixelData = Buffer(iImp->iData.size());
-	uint32_t *p = (uint32_t *) iImp->iData.data();
-	uint32_t *q = (uint32_t *) iImp->iPixelData.data();
-	uint32_t *fin = p + width() * height();
-	uint32_t pixel, alpha, alphaM, r, g, b;
-	while (p < fin) {
-	  pixel = *p++;
-	  alpha = (pixel & 0xff000000);
-	  alphaM = alpha >> 24;
-	  r = alphaM * (pixel & 0xff0000) / 255;
-	  g = alphaM * (pixel & 0x00ff00) / 255;
-	  b = alphaM * (pixel & 0x0000ff) / 255;
-	  *q++ = alpha | (r & 0xff0000) | (g & 0x00ff00) | (b & 0x0000ff);
-	}
+	premultiplyPixels((const uint32_t *) iImp->iData.data(),
+			  (uint32_t *) iImp->iPixelData.data(),
+			  width() * height());
       } else
 	iImp->iPixelData = iImp->iData;
     }
+    // set only now, so that pixelData(level, ...) need not wait
+    iImp->iPixelsComputed = true;
   }
   return iImp->iPixelData;
 }
 
+//! Return pixels for rendering at reduced resolution.
+/*! Returns level \a level of the mip pyramid of the bitmap, that is,
+  the pixels scaled down by a factor of 2^level, and sets \a width and
+  \a height to the size of this pixel array.  Level 0 is pixelData(),
+  the highest level is 12.
+
+  The levels are computed on first use and cached, each by averaging
+  2x2 blocks of the level below.  Jpeg images whose full resolution
+  pixels have not been computed yet are instead decoded directly at
+  1/2, 1/4, or 1/8 size, which is much faster than decoding them
+  fully. */
+Buffer Bitmap::pixelData(int level, int &width, int &height)
+{
+  level = std::max(0, std::min(level, MAX_MIP_LEVEL));
+  if (level == 0) {
+    width = iImp->iWidth;
+    height = iImp->iHeight;
+    return pixelData();
+  }
+  std::lock_guard<std::mutex> lock(iImp->iMipMutex);
+  return mipLevel(level, width, height);
+}
+
+// compute mip level, iMipMutex must be held
+Buffer Bitmap::mipLevel(int level, int &width, int &height)
+{
+  if (level == 0) {
+    width = iImp->iWidth;
+    height = iImp->iHeight;
+    return pixelData();
+  }
+  width = iImp->iWidth;
+  height = iImp->iHeight;
+  for (int k = 0; k < level; ++k) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+  }
+  Buffer &pixels = iImp->iMipData[level - 1];
+  if (pixels.size() == 0 && isJpeg() && level <= 3 && !iImp->iPixelsComputed
+      && !iImp->iReducedDctFailed) {
+    Buffer reduced(4 * width * height);
+    if (dctDecode(iImp->iData, reduced, level))
+      pixels = reduced;
+    else  // don't try again on every repaint
+      iImp->iReducedDctFailed = true;
+  }
+  if (pixels.size() == 0) {
+    int w, h;
+    Buffer source = mipLevel(level - 1, w, h);
+    if (source.size() == 0)
+      return source;
+    Buffer reduced(4 * width * height);
+    halvePixels((const uint32_t *) source.data(), w, h,
+		(uint32_t *) reduced.data());
+    pixels = reduced;
+  }
+  return pixels;
+}
+
+//! Return the mip level for showing the bitmap on a raster device.
+/*! \a ex and \a ey are the bottom and left edge of the bitmap in
+  device pixels.  Returns the highest level that still has at least
+  the resolution of the device, and sets \a ratio to the number of
+  bitmap pixels per device pixel at that level. */
+int Bitmap::displayLevel(Vector ex, Vector ey, double &ratio) const
+{
+  int level = 0;
+  ratio = std::min(width() / ex.len(), height() / ey.len());
+  while (level < MAX_MIP_LEVEL && ratio >= 2.0) {
+    ++level;
+    ratio /= 2.0;
+  }
+  return level;
+}
+
+// --------------------------------------------------------------------
+
+namespace {
+  // Computes pixels of bitmaps on worker threads.
+  class BitmapDecoder {
+  public:
+    BitmapDecoder();
+    ~BitmapDecoder();
+    void add(Bitmap bitmap, int level);
+
+  private:
+    void work();
+
+  private:
+    bool iStop;
+    std::deque<std::pair<Bitmap, int>> iJobs;  // bitmap and mip level
+    std::mutex iMutex;
+    std::condition_variable iWork;
+    std::vector<std::thread> iThreads;
+  };
+}
+
+BitmapDecoder::BitmapDecoder()
+{
+  iStop = false;
+  int n = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+  for (int i = 0; i < n; ++i)
+    iThreads.emplace_back(&BitmapDecoder::work, this);
+}
+
+BitmapDecoder::~BitmapDecoder()
+{
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    iStop = true;
+    iJobs.clear();
+  }
+  iWork.notify_all();
+  for (auto &t : iThreads)
+    t.join();
+}
+
+void BitmapDecoder::add(Bitmap bitmap, int level)
+{
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    iJobs.emplace_back(bitmap, level);
+  }
+  iWork.notify_one();
+}
+
+void BitmapDecoder::work()
+{
+  for (;;) {
+    std::pair<Bitmap, int> job;
+    {
+      std::unique_lock<std::mutex> lock(iMutex);
+      iWork.wait(lock, [this] { return iStop || !iJobs.empty(); });
+      if (iStop)
+	return;
+      job = iJobs.front();
+      iJobs.pop_front();
+    }
+    int width, height;
+    job.first.pixelData(job.second, width, height);
+  }
+}
+
+//! Compute the pixels for rendering on a background thread.
+/*! Computes level \a level of the mip pyramid, as pixelData(level,
+  width, height) would, so a Jpeg shown at reduced size is decoded at
+  reduced size.  Does nothing if the full pixels have already been
+  computed, or if there is nothing to compute.  The bitmaps are decoded
+  in parallel, one per worker thread, in the order in which they were
+  submitted.  A later call to pixelData() waits for the background
+  computation if it is still in progress. */
+void Bitmap::decodeInBackground(int level)
+{
+  if (iImp->iPixelsComputed ||
+      (level == 0 && !(isJpeg() || hasAlpha() || colorKey() >= 0)))
+    return;
+  static BitmapDecoder decoder;
+  decoder.add(*this, level);
+}
+
 // --------------------------------------------------------------------
 
 /*
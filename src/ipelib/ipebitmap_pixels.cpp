@@ -0,0 +1,423 @@
+// ipebitmap_pixels.cpp
+// Pixel conversion loops for bitmaps, with SIMD versions
+/*
+
+    This file is part of the extensible drawing editor Ipe.
+    Copyright (c) 1993-2019 Otfried Cheong
+
+    Ipe is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    As a special exception, you have permission to link Ipe with the
+    CGAL library and distribute executables, as long as you follow the
+    requirements of the Gnu General Public License in regard to all of
+    the software in the executable aside from CGAL.
+
+    Ipe is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+    or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+    License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ipe; if not, you can find it at
+    "http://www.gnu.org/copyleft/gpl.html", or write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "ipebitmap.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IPE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+using namespace ipe;
+
+/* All pixels are native-endian ARGB32 uint32_t's.  The SIMD versions
+   assume a little-endian machine, which is true for all x86 machines.
+   The SIMD versions are selected at runtime, depending on the
+   capabilities of the processor.  They return the number of pixels
+   they have processed, the remaining ones are handled by the scalar
+   loops. */
+
+// --------------------------------------------------------------------
+
+// floor(x / 255) for 0 <= x <= 255 * 255, without division
+inline uint32_t div255(uint32_t x)
+{
+  return (x + 1 + (x >> 8)) >> 8;
+}
+
+static void premultiplyScalar(const uint32_t *p, uint32_t *q, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    uint32_t pixel = p[i];
+    uint32_t alphaM = pixel >> 24;
+    uint32_t r = div255(alphaM * ((pixel >> 16) & 0xff));
+    uint32_t g = div255(alphaM * ((pixel >> 8) & 0xff));
+    uint32_t b = div255(alphaM * (pixel & 0xff));
+    q[i] = (pixel & 0xff000000) | (r << 16) | (g << 8) | b;
+  }
+}
+
+// average of 2x2 blocks: n pixels of q from 2n pixels of rows r0 and r1
+static void halveScalar(const uint32_t *r0, const uint32_t *r1,
+			uint32_t *q, int n)
+{
+  // each channel sum is at most 4 * 255 and fits in 16 bits
+  for (int i = 0; i < n; ++i) {
+    uint32_t a = r0[2*i], b = r0[2*i+1], c = r1[2*i], d = r1[2*i+1];
+    uint32_t rb = (a & 0x00ff00ff) + (b & 0x00ff00ff)
+      + (c & 0x00ff00ff) + (d & 0x00ff00ff) + 0x00020002;
+    uint32_t ag = ((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff)
+      + ((c >> 8) & 0x00ff00ff) + ((d >> 8) & 0x00ff00ff) + 0x00020002;
+    q[i] = ((rb >> 2) & 0x00ff00ff) | (((ag >> 2) & 0x00ff00ff) << 8);
+  }
+}
+
+// --------------------------------------------------------------------
+
+#ifdef IPE_X86_SIMD
+
+// premultiply two pixels, unpacked to 16-bit lanes
+__attribute__((target("sse2")))
+static inline __m128i premultiply2(__m128i x)
+{
+  __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xff), 0xff);
+  __m128i t = _mm_mullo_epi16(x, a);
+  t = _mm_add_epi16(t, _mm_add_epi16(_mm_srli_epi16(t, 8),
+				     _mm_set1_epi16(1)));
+  return _mm_srli_epi16(t, 8);
+}
+
+__attribute__((target("sse2")))
+static int premultiplySse2(const uint32_t *p, uint32_t *q, int n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alphaMask = _mm_set1_epi32(int(0xff000000));
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+    __m128i lo = premultiply2(_mm_unpacklo_epi8(x, zero));
+    __m128i hi = premultiply2(_mm_unpackhi_epi8(x, zero));
+    __m128i r = _mm_packus_epi16(lo, hi);
+    r = _mm_or_si128(_mm_andnot_si128(alphaMask, r),
+		     _mm_and_si128(alphaMask, x));
+    _mm_storeu_si128((__m128i *) (q + i), r);
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static int premultiplyAvx2(const uint32_t *p, uint32_t *q, int n)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi16(1);
+  const __m256i alphaMask = _mm256_set1_epi32(int(0xff000000));
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) (p + i));
+    __m256i lo = _mm256_unpacklo_epi8(x, zero);
+    __m256i hi = _mm256_unpackhi_epi8(x, zero);
+    __m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, 0xff), 0xff);
+    __m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, 0xff), 0xff);
+    lo = _mm256_mullo_epi16(lo, alo);
+    hi = _mm256_mullo_epi16(hi, ahi);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_add_epi16
+					     (_mm256_srli_epi16(lo, 8), one)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_add_epi16
+					     (_mm256_srli_epi16(hi, 8), one)), 8);
+    // unpack and pack both work within 128-bit lanes, so the order is kept
+    __m256i r = _mm256_packus_epi16(lo, hi);
+    r = _mm256_or_si256(_mm256_andnot_si256(alphaMask, r),
+			_mm256_and_si256(alphaMask, x));
+    _mm256_storeu_si256((__m256i *) (q + i), r);
+  }
+  return i;
+}
+
+// RGB bytes to opaque pixels
+__attribute__((target("ssse3")))
+static int expandRgbSsse3(const uint8_t *p, uint32_t *q, int n)
+{
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+					8, 7, 6, -1, 11, 10, 9, -1);
+  const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+  int i = 0;
+  // loads 16 bytes but uses 12, so stop in time
+  for (; i + 6 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (p + 3 * i));
+    x = _mm_or_si128(_mm_shuffle_epi8(x, shuffle), alpha);
+    _mm_storeu_si128((__m128i *) (q + i), x);
+  }
+  return i;
+}
+
+// ARGB bytes to pixels
+__attribute__((target("ssse3")))
+static int expandArgbSsse3(const uint8_t *p, uint32_t *q, int n)
+{
+  const __m128i shuffle = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+					11, 10, 9, 8, 15, 14, 13, 12);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (p + 4 * i));
+    _mm_storeu_si128((__m128i *) (q + i), _mm_shuffle_epi8(x, shuffle));
+  }
+  return i;
+}
+
+// gray bytes to opaque pixels
+__attribute__((target("ssse3")))
+static int expandGraySsse3(const uint8_t *p, uint32_t *q, int n)
+{
+  const __m128i shuffle = _mm_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1,
+					2, 2, 2, -1, 3, 3, 3, -1);
+  const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+    for (int k = 0; k < 4; ++k) {
+      __m128i y = _mm_or_si128(_mm_shuffle_epi8(x, shuffle), alpha);
+      _mm_storeu_si128((__m128i *) (q + i + 4 * k), y);
+      x = _mm_srli_si128(x, 4);
+    }
+  }
+  return i;
+}
+
+// replace alpha channel of pixels
+__attribute__((target("sse2")))
+static int mergeAlphaSse2(uint32_t *q, const uint8_t *a, int n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rgbMask = _mm_set1_epi32(0x00ffffff);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (a + i));
+    __m128i lo = _mm_unpacklo_epi8(x, zero);
+    __m128i hi = _mm_unpackhi_epi8(x, zero);
+    __m128i alpha[4] = { _mm_unpacklo_epi16(lo, zero),
+			 _mm_unpackhi_epi16(lo, zero),
+			 _mm_unpacklo_epi16(hi, zero),
+			 _mm_unpackhi_epi16(hi, zero) };
+    for (int k = 0; k < 4; ++k) {
+      __m128i *dst = (__m128i *) (q + i + 4 * k);
+      __m128i y = _mm_and_si128(_mm_loadu_si128(dst), rgbMask);
+      _mm_storeu_si128(dst, _mm_or_si128(y, _mm_slli_epi32(alpha[k], 24)));
+    }
+  }
+  return i;
+}
+
+// pixels to RGB bytes
+__attribute__((target("ssse3")))
+static int splitRgbSsse3(const uint32_t *p, uint8_t *q, int n)
+{
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+					8, 14, 13, 12, -1, -1, -1, -1);
+  int i = 0;
+  // stores 16 bytes but only 12 are valid, so stop in time
+  for (; i + 6 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+    _mm_storeu_si128((__m128i *) (q + 3 * i), _mm_shuffle_epi8(x, shuffle));
+  }
+  return i;
+}
+
+// one byte of each pixel, at bit position shift
+__attribute__((target("sse2")))
+static int splitChannelSse2(const uint32_t *p, uint8_t *q, int n, int shift)
+{
+  const __m128i mask = _mm_set1_epi32(0xff);
+  const __m128i count = _mm_cvtsi32_si128(shift);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x[4];
+    for (int k = 0; k < 4; ++k)
+      x[k] = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128
+					 ((const __m128i *) (p + i + 4 * k)),
+					 count), mask);
+    __m128i lo = _mm_packs_epi32(x[0], x[1]);
+    __m128i hi = _mm_packs_epi32(x[2], x[3]);
+    _mm_storeu_si128((__m128i *) (q + i), _mm_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+// average of 2x2 blocks, two output pixels from four pixels in each row
+__attribute__((target("sse2")))
+static inline __m128i halve2(const uint32_t *r0, const uint32_t *r1)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = _mm_loadu_si128((const __m128i *) r0);
+  __m128i b = _mm_loadu_si128((const __m128i *) r1);
+  __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+			     _mm_unpacklo_epi8(b, zero));
+  __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+			     _mm_unpackhi_epi8(b, zero));
+  __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+			      _mm_unpackhi_epi64(lo, hi));
+  return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+__attribute__((target("sse2")))
+static int halveSse2(const uint32_t *r0, const uint32_t *r1,
+		     uint32_t *q, int n)
+{
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = halve2(r0 + 2 * i, r1 + 2 * i);
+    __m128i y = halve2(r0 + 2 * i + 4, r1 + 2 * i + 4);
+    _mm_storeu_si128((__m128i *) (q + i), _mm_packus_epi16(x, y));
+  }
+  return i;
+}
+
+#endif
+
+// --------------------------------------------------------------------
+
+namespace {
+  struct PixelKernels {
+    int (*premultiply)(const uint32_t *p, uint32_t *q, int n) = nullptr;
+    int (*expandRgb)(const uint8_t *p, uint32_t *q, int n) = nullptr;
+    int (*expandArgb)(const uint8_t *p, uint32_t *q, int n) = nullptr;
+    int (*expandGray)(const uint8_t *p, uint32_t *q, int n) = nullptr;
+    int (*mergeAlpha)(uint32_t *q, const uint8_t *a, int n) = nullptr;
+    int (*splitRgb)(const uint32_t *p, uint8_t *q, int n) = nullptr;
+    int (*splitChannel)(const uint32_t *p, uint8_t *q, int n,
+			int shift) = nullptr;
+    int (*halve)(const uint32_t *r0, const uint32_t *r1,
+		 uint32_t *q, int n) = nullptr;
+  };
+}
+
+static PixelKernels selectKernels()
+{
+  PixelKernels k;
+#ifdef IPE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    k.premultiply = premultiplySse2;
+    k.mergeAlpha = mergeAlphaSse2;
+    k.splitChannel = splitChannelSse2;
+    k.halve = halveSse2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    k.expandRgb = expandRgbSsse3;
+    k.expandArgb = expandArgbSsse3;
+    k.expandGray = expandGraySsse3;
+    k.splitRgb = splitRgbSsse3;
+  }
+  if (__builtin_cpu_supports("avx2"))
+    k.premultiply = premultiplyAvx2;
+#endif
+  return k;
+}
+
+static const PixelKernels &kernels()
+{
+  static const PixelKernels k = selectKernels();
+  return k;
+}
+
+// --------------------------------------------------------------------
+
+//! Premultiply RGB values of \a n pixels by their alpha value.
+void premultiplyPixels(const uint32_t *p, uint32_t *q, int n)
+{
+  int i = kernels().premultiply ? kernels().premultiply(p, q, n) : 0;
+  premultiplyScalar(p + i, q + i, n - i);
+}
+
+/*! Convert \a n pixels stored as RGB, ARGB, gray, or alpha-gray bytes
+  to ARGB32 pixels.  Without alpha channel, the pixels are opaque. */
+void expandPixels(const uint8_t *p, uint32_t *q, int n, bool gray, bool alpha)
+{
+  int i = 0;
+  const PixelKernels &k = kernels();
+  if (!gray && !alpha && k.expandRgb)
+    i = k.expandRgb(p, q, n);
+  else if (!gray && alpha && k.expandArgb)
+    i = k.expandArgb(p, q, n);
+  else if (gray && !alpha && k.expandGray)
+    i = k.expandGray(p, q, n);
+  int components = (gray ? 1 : 3) + (alpha ? 1 : 0);
+  p += i * components;
+  for (; i < n; ++i) {
+    uint32_t a = alpha ? *p++ : 0xff;
+    uint32_t r = *p++;
+    uint32_t g = gray ? r : *p++;
+    uint32_t b = gray ? r : *p++;
+    q[i] = (a << 24) | (r << 16) | (g << 8) | b;
+  }
+}
+
+//! Replace the alpha values of \a n pixels.
+void mergeAlpha(uint32_t *q, const uint8_t *a, int n)
+{
+  int i = kernels().mergeAlpha ? kernels().mergeAlpha(q, a, n) : 0;
+  for (; i < n; ++i)
+    q[i] = (q[i] & 0x00ffffff) | (uint32_t(a[i]) << 24);
+}
+
+//! Store the RGB values (or the blue value only, if \a gray) of \a n pixels.
+void splitPixels(const uint32_t *p, uint8_t *q, int n, bool gray)
+{
+  const PixelKernels &k = kernels();
+  int i = 0;
+  if (gray) {
+    if (k.splitChannel)
+      i = k.splitChannel(p, q, n, 0);
+    for (; i < n; ++i)
+      q[i] = p[i] & 0xff;
+  } else {
+    if (k.splitRgb)
+      i = k.splitRgb(p, q, n);
+    for (; i < n; ++i) {
+      q[3 * i] = (p[i] >> 16) & 0xff;
+      q[3 * i + 1] = (p[i] >> 8) & 0xff;
+      q[3 * i + 2] = p[i] & 0xff;
+    }
+  }
+}
+
+//! Store the alpha values of \a n pixels.
+void splitAlpha(const uint32_t *p, uint8_t *q, int n)
+{
+  int i = kernels().splitChannel ? kernels().splitChannel(p, q, n, 24) : 0;
+  for (; i < n; ++i)
+    q[i] = p[i] >> 24;
+}
+
+// --------------------------------------------------------------------
+
+/*! Scale \a width x \a height pixels down by a factor of two, by
+  averaging 2x2 blocks.  The result has size ceil(width/2) x
+  ceil(height/2).  At an odd border, the last row or column is
+  repeated. */
+void halvePixels(const uint32_t *p, int width, int height, uint32_t *q)
+{
+  const PixelKernels &k = kernels();
+  int w2 = width / 2;
+  int qw = (width + 1) / 2;
+  uint32_t edge[4];
+  for (int y = 0; y < height; y += 2) {
+    const uint32_t *r0 = p + y * width;
+    const uint32_t *r1 = (y + 1 < height) ? r0 + width : r0;
+    int i = k.halve ? k.halve(r0, r1, q, w2) : 0;
+    halveScalar(r0 + 2 * i, r1 + 2 * i, q + i, w2 - i);
+    if (width & 1) {
+      edge[0] = edge[1] = r0[width - 1];
+      edge[2] = edge[3] = r1[width - 1];
+      halveScalar(edge, edge + 2, q + w2, 1);
+    }
+    q += qw;
+  }
+}
+
+// --------------------------------------------------------------------
@@ -45,8 +45,10 @@ using namespace ipe;
 
 #ifdef __APPLE__
 
-bool dctDecode(Buffer dctData, Buffer pixelData)
+bool dctDecode(Buffer dctData, Buffer pixelData, int reduction)
 {
+  if (reduction > 0)
+    return false; // only full resolution is supported
   CGDataProviderRef source =
     CGDataProviderCreateWithData(nullptr, dctData.data(), dctData.size(), nullptr);
   CGImageRef bitmap =
@@ -115,7 +117,10 @@ static void jpegErrorExit (j_common_ptr cinfo)
   longjmp(myerr->setjmp_buffer, 1);
 }
 
-bool dctDecode(Buffer dctData, Buffer pixelData)
+/* If reduction > 0, decode at 1/2^reduction of full size, using the
+   DCT scaling of libjpeg.  pixelData must have exactly the right size
+   for the output. */
+bool dctDecode(Buffer dctData, Buffer pixelData, int reduction)
 {
   struct jpeg_decompress_struct cinfo;
 
@@ -133,7 +138,13 @@ bool dctDecode(Buffer dctData, Buffer pixelData)
   jpeg_mem_src(&cinfo, (unsigned char *) dctData.data(), dctData.size());
   jpeg_read_header(&cinfo, 1);
   cinfo.out_color_space = JCS_RGB;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = 1 << reduction;
   jpeg_start_decompress(&cinfo);
+  if (4 * int(cinfo.output_width * cinfo.output_height) != pixelData.size()) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
   uint32_t *p = (uint32_t *) pixelData.data();
   Buffer row(cinfo.output_width * cinfo.output_components);
   uint8_t *buffer[1];
@@ -41,8 +41,10 @@ typedef IStream* WINAPI (*LPFNSHCREATEMEMSTREAM)(const BYTE *, UINT);
 static bool libLoaded = false;
 static LPFNSHCREATEMEMSTREAM pSHCreateMemStream = nullptr;
 
-bool dctDecode(Buffer dctData, Buffer pixelData)
+bool dctDecode(Buffer dctData, Buffer pixelData, int reduction)
 {
+  if (reduction > 0)
+    return false; // only full resolution is supported
   if (!libLoaded) {
     libLoaded = true;
     HMODULE hDll = LoadLibraryA("shlwapi.dll");
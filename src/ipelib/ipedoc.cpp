@@ -38,7 +38,10 @@
 #include "ipepdfwriter.h"
 #include "ipelatex.h"
 
+#include <cstring>
 #include <errno.h>
+#include <mutex>
+#include <thread>
 
 using namespace ipe;
 
@@ -342,10 +345,37 @@ Document *doParsePdf(DataSource &source, int &reason)
   if (!type || !type->name() || type->name()->value() != "Ipe")
     return nullptr;
 
+  Document *self = new Document;
+
+  // written by an incremental save, the XML data is split into parts
+  const PdfObj *parts = obj->dict()->get("Parts", &loader);
+  if (parts && parts->array()) {
+    std::vector<Buffer> data;
+    int total = 0;
+    for (int i = 0; i < parts->array()->count(); ++i) {
+      const PdfObj *part = parts->array()->obj(i, &loader);
+      if (!part || !part->dict()) {
+	delete self;
+	return nullptr;
+      }
+      data.push_back(part->dict()->deflated() ? part->dict()->inflate() :
+		     part->dict()->stream());
+      total += data.back().size();
+    }
+    Buffer buffer(total);
+    char *p = buffer.data();
+    for (const auto &b : data) {
+      std::memcpy(p, b.data(), b.size());
+      p += b.size();
+    }
+    BufferSource xml(buffer);
+    PdfStreamParser parser(loader, xml);
+    return doParse(self, parser, reason);
+  }
+
   Buffer buffer = obj->dict()->stream();
   BufferSource xml(buffer);
 
-  Document *self = new Document;
   if (obj->dict()->deflated()) {
     InflateSource xml1(xml);
     PdfStreamParser parser(loader, xml1);
@@ -381,15 +411,12 @@ Document *Document::load(DataSource &source, FileFormat format,
 Document *Document::load(const char *fname, int &reason)
 {
   reason = EFileOpenError;
-  std::FILE *fd = Platform::fopen(fname, "rb");
-  if (!fd)
+  MappedFileSource source(fname);
+  if (!source.isOpen())
     return nullptr;
-  FileSource source(fd);
   FileFormat format = fileFormat(source);
-  std::rewind(fd);
-  Document *self = load(source, format, reason);
-  std::fclose(fd);
-  return self;
+  source.setPosition(0);
+  return load(source, format, reason);
 }
 
 Document *Document::loadWithErrorReport(const char *fname)
@@ -445,20 +472,9 @@ bool Document::save(TellStream &stream, FileFormat format, uint32_t flags) const
     writer.createPages();
     writer.createBookmarks();
     writer.createNamedDests();
-    if (!(flags & SaveFlag::Export)) {
-      String xmlData;
-      StringStream stream(xmlData);
-      if (compresslevel > 0) {
-	DeflateStream dfStream(stream, compresslevel);
-	// all bitmaps have been embedded and carry correct object number
-	saveAsXml(dfStream, true);
-	dfStream.close();
-	writer.createXmlStream(xmlData, true);
-      } else {
-	saveAsXml(stream, true);
-	writer.createXmlStream(xmlData, false);
-      }
-    }
+    // all bitmaps have been embedded and carry correct object number
+    if (!(flags & SaveFlag::Export))
+      writer.createXmlStream();
     writer.createTrailer();
     return true;
   }
@@ -468,6 +484,8 @@ bool Document::save(TellStream &stream, FileFormat format, uint32_t flags) const
 
 bool Document::save(const char *fname, FileFormat format, uint32_t flags) const
 {
+  if (format == FileFormat::Pdf && (flags & SaveFlag::Incremental))
+    return saveIncremental(fname, flags & ~uint32_t(SaveFlag::Incremental));
   std::FILE *fd = Platform::fopen(fname, "wb");
   if (!fd)
     return false;
@@ -477,6 +495,50 @@ bool Document::save(const char *fname, FileFormat format, uint32_t flags) const
   return result;
 }
 
+/*! Save as PDF, and remember what has been written.  If the file is
+  still the one written by the last incremental save, only the changes
+  are appended to it as a PDF update.  Once the appended updates have
+  doubled the size of the file, it is written again completely. */
+bool Document::saveIncremental(const char *fname, uint32_t flags) const
+{
+  int compresslevel = 9;
+  if (flags & SaveFlag::NoZip)
+    compresslevel = 0;
+
+  std::FILE *fd = nullptr;
+  if (iPdfRecord && iPdfRecord->iFileName == fname &&
+      iPdfRecord->iFlags == flags &&
+      iPdfRecord->iSize < 2 * iPdfRecord->iFullSize) {
+    fd = Platform::fopen(fname, "r+b");
+    if (fd && !iPdfRecord->unchanged(fd)) {
+      std::fclose(fd);
+      fd = nullptr;
+    }
+  }
+  if (!fd) {
+    iPdfRecord = std::make_unique<PdfSaveRecord>();
+    fd = Platform::fopen(fname, "w+b");
+    if (!fd) {
+      iPdfRecord.reset();
+      return false;
+    }
+  }
+  {
+    FileStream stream(fd);
+    PdfWriter writer(stream, this, iResources, flags, 0, -1, compresslevel,
+		     iPdfRecord.get());
+    writer.createPages();
+    writer.createBookmarks();
+    writer.createNamedDests();
+    if (!(flags & SaveFlag::Export))
+      writer.createXmlStream();
+    writer.createTrailer();
+  }
+  iPdfRecord->finish(fd, fname, flags);
+  std::fclose(fd);
+  return true;
+}
+
 //! Export a single view to PDF
 bool Document::exportView(const char *fname, FileFormat format, uint32_t flags,
 			  int pno, int vno) const
@@ -537,6 +599,17 @@ void Document::findBitmaps(BitmapFinder &bm) const
 
 //! Save in XML format into an Stream.
 void Document::saveAsXml(Stream &stream, bool usePdfBitmaps) const
+{
+  saveXmlHeader(stream, usePdfBitmaps);
+  // save pages
+  for (int i = 0; i < countPages(); ++i)
+    page(i)->saveAsXml(stream);
+  stream << "</ipe>\n";
+}
+
+//! Save the XML data that comes before the pages.
+/*! This is everything except the pages and the final "</ipe>" tag. */
+void Document::saveXmlHeader(Stream &stream, bool usePdfBitmaps) const
 {
   stream << "<ipe version=\"" << FILE_FORMAT << "\"";
   if (!iProperties.iCreator.empty())
@@ -623,11 +696,6 @@ void Document::saveAsXml(Stream &stream, bool usePdfBitmaps) const
 
   // now save style sheet
   iCascade->saveAsXml(stream);
-
-  // save pages
-  for (int i = 0; i < countPages(); ++i)
-    page(i)->saveAsXml(stream);
-  stream << "</ipe>\n";
 }
 
 // --------------------------------------------------------------------
@@ -753,86 +821,163 @@ Page *Document::remove(int no)
 
 // --------------------------------------------------------------------
 
-//! Run PdfLatex or Xelatex
-int Document::runLatex(String &texLog)
-{
-  texLog = "";
-  Latex converter(cascade(), iProperties.iTexEngine);
+// Latex runs share the directories in the Latex directory
+static std::mutex latexRunMutex;
 
+// Let converter collect the texts of the document, including page
+// numbers.  Returns the number of texts (not counting page numbers).
+static int scanTexts(Document *doc, Latex &converter)
+{
+  const Cascade *cascade = doc->cascade();
   AttributeSeq seq;
-  cascade()->allNames(ESymbol, seq);
+  cascade->allNames(ESymbol, seq);
 
   for (AttributeSeq::iterator it = seq.begin(); it != seq.end(); ++it) {
-    const Symbol *sym = cascade()->findSymbol(*it);
+    const Symbol *sym = cascade->findSymbol(*it);
     if (sym)
       converter.scanObject(sym->iObject);
   }
 
   int count = 0;
-  for (int i = 0; i < countPages(); ++i)
-    count = converter.scanPage(page(i));
+  for (int i = 0; i < doc->countPages(); ++i)
+    count = converter.scanPage(doc->page(i));
   if (count == 0)
-    return ErrNoText;
+    return 0;
 
-  if (iProperties.iNumberPages) {
-    for (int i = 0; i < countPages(); ++i) {
-      int nviews = page(i)->countViews();
+  if (doc->properties().iNumberPages) {
+    for (int i = 0; i < doc->countPages(); ++i) {
+      int nviews = doc->page(i)->countViews();
       for (int j = 0; j < nviews; ++j)
-	converter.addPageNumber(i, j, countPages(), nviews);
+	converter.addPageNumber(i, j, doc->countPages(), nviews);
     }
   }
+  return count;
+}
+
+// at most this many Latex runs in parallel
+static int maxLatexShards()
+{
+  int maxShards = std::thread::hardware_concurrency();
+  const char *p = getenv("IPELATEXSHARDS");
+  if (p)
+    maxShards = Lex(p).getInt();
+  return std::max(maxShards, 1);
+}
+
+// Write sources for the shards prepared by converter, and run Latex
+// on them in parallel.  On success, returns the names of the PDF files.
+static int runShards(Latex &converter, int shards, LatexType engine,
+		     String &texLog, std::vector<String> &pdfFiles)
+{
+  std::vector<String> dirs;
+  for (int s = 0; s < shards; ++s) {
+    char name[16];
+    sprintf(name, "shard%d", s);
+    String dir = (s == 0) ? Platform::latexDirectory() :
+      Platform::latexSubdirectory(name);
+    if (dir.empty())
+      return Document::ErrNoDir;
+    String texFile = dir + "ipetemp.tex";
+    String logFile = dir + "ipetemp.log";
+    std::remove(logFile.z());
+    std::FILE *file = Platform::fopen(texFile.z(), "wb");
+    if (!file)
+      return Document::ErrWritingSource;
+    FileStream stream(file);
+    int err = converter.createLatexSource(stream, s);
+    std::fclose(file);
+    if (err < 0)
+      return Document::ErrWritingSource;
+    dirs.push_back(dir);
+  }
+
+  std::vector<int> results(shards);
+  std::vector<std::thread> threads;
+  for (int s = 1; s < shards; ++s)
+    threads.emplace_back([&dirs, &results, engine, s]() {
+	results[s] = Platform::runLatex(dirs[s], engine); });
+  results[0] = Platform::runLatex(dirs[0], engine);
+  for (auto &t : threads)
+    t.join();
+
+  // check shard 0 last, so that its log is returned on success
+  pdfFiles.clear();
+  for (int s = shards - 1; s >= 0; --s) {
+    if (results[s] != 0 && results[s] != 1)
+      return Document::ErrRunLatex;
+
+    // Check log file for Pdflatex version and errors
+    texLog = Platform::readFile(dirs[s] + "ipetemp.log");
+    if (texLog.left(14) != "This is pdfTeX" &&
+	texLog.left(15) != "This is pdfeTeX" &&
+	texLog.left(13) != "This is XeTeX" &&
+	texLog.left(14) != "This is LuaTeX" &&
+	texLog.left(22) != "entering extended mode")
+      return Document::ErrRunLatex;
+    int i = texLog.find('\n');
+    if (i < 0)
+      return Document::ErrRunLatex;
+    String version = texLog.substr(8, i);
+    ipeDebug("%s", version.z());
+    // Check for error
+    if (texLog.find("\n!") >= 0)
+      return Document::ErrLatex;
+
+    String pdfFile = dirs[s] + "ipetemp.pdf";
+    if (!Platform::fileExists(pdfFile))
+      return Document::ErrLatex;
+    pdfFiles.insert(pdfFiles.begin(), pdfFile);
+  }
+  return Document::ErrNone;
+}
+
+//! Run PdfLatex or Xelatex
+/*! If many texts need to be converted, several Latex processes run
+  in parallel (at most the number of hardware threads, or the value
+  of the environment variable IPELATEXSHARDS). */
+int Document::runLatex(String &texLog)
+{
+  texLog = "";
+  Latex converter(cascade(), iProperties.iTexEngine);
+
+  if (scanTexts(this, converter) == 0)
+    return ErrNoText;
 
   // First we need a directory
   String latexDir = Platform::latexDirectory();
   if (latexDir.empty())
     return ErrNoDir;
 
-  String texFile = latexDir + "ipetemp.tex";
-  String pdfFile = latexDir + "ipetemp.pdf";
-  String logFile = latexDir + "ipetemp.log";
-
-  std::remove(logFile.z());
-
-  std::FILE *file = Platform::fopen(texFile.z(), "wb");
-  if (!file)
-    return ErrWritingSource;
-  FileStream stream(file);
-  int err = converter.createLatexSource(stream, properties().iPreamble);
-  std::fclose(file);
-
-  if (err < 0)
-    return ErrWritingSource;
-
-  int result = Platform::runLatex(latexDir, iProperties.iTexEngine);
-
-  if (result != 0 && result != 1)
-    return ErrRunLatex;
-
-  // Check log file for Pdflatex version and errors
-  texLog = Platform::readFile(logFile);
-  if (texLog.left(14) != "This is pdfTeX" &&
-      texLog.left(15) != "This is pdfeTeX" &&
-      texLog.left(13) != "This is XeTeX" &&
-      texLog.left(14) != "This is LuaTeX" &&
-      texLog.left(22) != "entering extended mode")
-    return ErrRunLatex;
-  int i = texLog.find('\n');
-  if (i < 0)
-    return ErrRunLatex;
-  String version = texLog.substr(8, i);
-  ipeDebug("%s", version.z());
-  // Check for error
-  if (texLog.find("\n!") >= 0)
-    return ErrLatex;
-
-  std::FILE *pdfF = Platform::fopen(pdfFile.z(), "rb");
-  if (!pdfF)
-    return ErrLatex;
-  FileSource source(pdfF);
-  bool okay = (converter.readPdf(source) && converter.updateTextObjects());
-  std::fclose(pdfF);
-
-  if (okay) {
+  // the cache can be disabled if texts depend on files that may change
+  if (getenv("IPENOLATEXCACHE") == nullptr)
+    converter.setCacheDirectory(Platform::latexSubdirectory("cache"));
+
+  int maxShards = maxLatexShards();
+
+  // run Latex only if some texts are not in the cache
+  int shards = converter.prepareShards(properties().iPreamble, maxShards);
+  if (shards > 0) {
+    std::lock_guard<std::mutex> lock(latexRunMutex);
+    std::vector<String> pdfFiles;
+    int err = runShards(converter, shards, iProperties.iTexEngine,
+			texLog, pdfFiles);
+    if (err != ErrNone)
+      return err;
+    bool unmergeable;
+    if (!converter.readPdf(pdfFiles, unmergeable)) {
+      if (!unmergeable)
+	return ErrLatexOutput;
+      // the output of the shards cannot be combined
+      converter.prepareShards(properties().iPreamble, 1);
+      err = runShards(converter, 1, iProperties.iTexEngine, texLog, pdfFiles);
+      if (err != ErrNone)
+	return err;
+      if (!converter.readPdf(pdfFiles, unmergeable))
+	return ErrLatexOutput;
+    }
+  }
+
+  if (converter.updateTextObjects()) {
     setResources(converter.takeResources());
     // resources()->show();
     return ErrNone;
@@ -875,4 +1020,66 @@ int Document::runLatex()
   }
 }
 
+//! Run Latex once for the texts of several documents.
+/*! The texts of all documents with the same Latex engine and header
+  (that is, the same preamble and colors) that are not yet in the
+  Latex cache are converted together, and the results are stored in
+  the cache.  Calling runLatex() on each document afterwards finds
+  all its texts in the cache and only builds its PdfResources.
+
+  Does nothing if the cache is disabled.  Errors are ignored here:
+  runLatex() on the documents concerned will run Latex again and
+  report them.
+*/
+void Document::prepareLatex(const std::vector<Document *> &docs)
+{
+  if (getenv("IPENOLATEXCACHE") != nullptr)
+    return;
+  String cacheDir = Platform::latexSubdirectory("cache");
+  if (cacheDir.empty())
+    return;
+
+  // find the texts of each document that are not in the cache
+  std::vector<std::unique_ptr<Latex>> converters(docs.size());
+  std::vector<int> shards(docs.size(), 0);
+  Platform::parallelFor(size(docs), [&](int i) {
+    Document *doc = docs[i];
+    converters[i].reset(new Latex(doc->cascade(),
+				  doc->iProperties.iTexEngine));
+    converters[i]->setCacheDirectory(cacheDir);
+    if (scanTexts(doc, *converters[i]) > 0)
+      shards[i] = converters[i]->prepareShards(doc->iProperties.iPreamble, 1);
+  });
+
+  // one converter for each engine and header
+  std::map<String, std::pair<LatexType, std::unique_ptr<Latex>>> batches;
+  for (int i = 0; i < size(docs); ++i) {
+    if (shards[i] == 0)
+      continue;
+    LatexType engine = docs[i]->iProperties.iTexEngine;
+    String key;
+    key += char('0' + int(engine));
+    key += converters[i]->header();
+    auto &batch = batches[key];
+    if (!batch.second) {
+      batch.first = engine;
+      batch.second.reset(new Latex(docs[i]->cascade(), engine));
+      batch.second->setCacheDirectory(cacheDir);
+    }
+    batch.second->addUncached(*converters[i]);
+  }
+
+  std::lock_guard<std::mutex> lock(latexRunMutex);
+  for (auto &it : batches) {
+    Latex &converter = *it.second.second;
+    int n = converter.distribute(maxLatexShards());
+    String texLog;
+    std::vector<String> pdfFiles;
+    bool unmergeable;
+    if (n > 0 && runShards(converter, n, it.second.first,
+			   texLog, pdfFiles) == ErrNone)
+      converter.readPdf(pdfFiles, unmergeable);
+  }
+}
+
 // --------------------------------------------------------------------
@@ -772,46 +772,157 @@ void Bezier::closedSpline(int n,  const Vector *v, std::vector<Bezier> &result)
   }
 }
 
+// precision of the pieces in nearestPiece
+const double NEAREST_PRECISION = 0.25;
+
+/* Find the piece of \a b nearest to \a v, if it is closer than \a
+   bound.  \a b is the part of the original spline for parameters \a
+   t0 to \a t1.  The spline is subdivided until its inner control
+   points are close to the thirds of its chord.  Then the spline is
+   within NEAREST_PRECISION of the chord traversed at uniform speed,
+   so the point nearest to \a v on the chord gives its parameter.
+   Pieces whose control polygon is too far away are skipped.  Sets \a
+   t to the parameter, and \a bound to the distance of \a v to the
+   spline point at that parameter. */
+static bool nearestPiece(const Bezier &b, const Vector &v,
+			 double t0, double t1, double &t, double &bound)
+{
+  Rect box(b.iV[0], b.iV[1]);
+  box.addPoint(b.iV[2]);
+  box.addPoint(b.iV[3]);
+  if (box.certainClearance(v, bound))
+    return false;
+
+  Vector dir = b.iV[3] - b.iV[0];
+  Vector third = (1.0 / 3.0) * dir;
+  if ((b.iV[1] - b.iV[0] - third).len() < NEAREST_PRECISION &&
+      (b.iV[3] - b.iV[2] - third).len() < NEAREST_PRECISION) {
+    double len2 = dir.sqLen();
+    double s = 0.0;
+    if (len2 > 0.0)
+      s = std::max(0.0, std::min(1.0, dot(v - b.iV[0], dir) / len2));
+    double d = (v - b.point(s)).len();
+    if (d >= bound)
+      return false;
+    bound = d;
+    t = t0 + s * (t1 - t0);
+    return true;
+  }
+
+  Bezier l, r;
+  b.subdivide(l, r);
+  double tm = 0.5 * (t0 + t1);
+  // search the nearer half first, so that the bound is tighter for
+  // the other half
+  if ((v - l.iV[0]).sqLen() < (v - r.iV[3]).sqLen()) {
+    bool p1 = nearestPiece(l, v, t0, tm, t, bound);
+    bool p2 = nearestPiece(r, v, tm, t1, t, bound);
+    return p1 || p2;
+  } else {
+    bool p2 = nearestPiece(r, v, tm, t1, t, bound);
+    bool p1 = nearestPiece(l, v, t0, tm, t, bound);
+    return p1 || p2;
+  }
+}
+
+/* Improve parameter \a t of the point of \a b nearest to \a v by
+   Newton iteration on the derivative of the squared distance. */
+static double refineNearest(const Bezier &b, const Vector &v, double t)
+{
+  for (int i = 0; i < 5; ++i) {
+    double t1 = 1.0 - t;
+    Vector p = b.point(t) - v;
+    Vector d1 = 3.0 * (t1 * t1 * (b.iV[1] - b.iV[0]) +
+		       2.0 * t * t1 * (b.iV[2] - b.iV[1]) +
+		       t * t * (b.iV[3] - b.iV[2]));
+    Vector d2 = 6.0 * (t1 * (b.iV[2] - 2.0 * b.iV[1] + b.iV[0]) +
+		       t * (b.iV[3] - 2.0 * b.iV[2] + b.iV[1]));
+    double df = dot(d1, d1) + dot(p, d2);
+    if (df <= 0.0)
+      break;
+    double tn = std::max(0.0, std::min(1.0, t - dot(p, d1) / df));
+    bool done = std::abs(tn - t) < 1e-9;
+    t = tn;
+    if (done)
+      break;
+  }
+  return t;
+}
+
+/* Find parameter \a t and point \a pos on \a b nearest to \a v, if
+   it is closer than \a bound.  Does not allocate any memory. */
+static bool nearestPoint(const Bezier &b, const Vector &v,
+			 double &t, Vector &pos, double &bound)
+{
+  double t0 = 0.0;
+  double d = bound;
+  if (!nearestPiece(b, v, 0.0, 1.0, t0, d))
+    return false;
+  Vector p0 = b.point(t0);
+  double d0 = (v - p0).len();
+  double t1 = refineNearest(b, v, t0);
+  Vector p1 = b.point(t1);
+  double d1 = (v - p1).len();
+  if (d1 < d0) {
+    t0 = t1;
+    p0 = p1;
+    d0 = d1;
+  }
+  if (d0 >= bound)
+    return false;
+  t = t0;
+  pos = p0;
+  bound = d0;
+  return true;
+}
+
 //! Return distance to Bezier spline.
 /*! But may just return \a bound if actual distance is larger.  The
-  Bezier spline is approximated to a precision of 1.0, and the
-  distance to the approximation is returned.
+  nearest point is found by subdividing the spline, and refined by
+  Newton iteration.
  */
 double Bezier::distance(const Vector &v, double bound)
 {
-  Rect box;
-  box.addPoint(iV[0]);
-  box.addPoint(iV[1]);
-  box.addPoint(iV[2]);
-  box.addPoint(iV[3]);
-  if (box.certainClearance(v, bound))
-    return bound;
-  std::vector<Vector> approx;
-  approximate(1.0, approx);
-  Vector cur = iV[0];
+  double t;
+  Vector pos;
   double d = bound;
-  double d1;
-  for (std::vector<Vector>::const_iterator it = approx.begin();
-       it != approx.end(); ++it) {
-    if ((d1 = Segment(cur, *it).distance(v, d)) < d)
-      d = d1;
-    cur = *it;
-  }
+  nearestPoint(*this, v, t, pos, d);
   return d;
 }
 
-//! Return a tight bounding box (accurate to within 0.5).
+//! Return a tight bounding box.
+/*! The extreme points of the spline are found as the roots of its
+  derivative in each coordinate. */
 Rect Bezier::bbox() const
 {
-  Rect box(iV[0]);
-  std::vector<Vector> approx;
-  approximate(0.5, approx);
-  for (std::vector<Vector>::const_iterator it = approx.begin();
-       it != approx.end(); ++it) {
-    box.addPoint(*it);
+  Rect box(iV[0], iV[3]);
+  // derivative divided by 3 is a t^2 + b t + c
+  Vector a = iV[3] - 3.0 * iV[2] + 3.0 * iV[1] - iV[0];
+  Vector b = 2.0 * (iV[2] - 2.0 * iV[1] + iV[0]);
+  Vector c = iV[1] - iV[0];
+  const double aa[2] = { a.x, a.y };
+  const double bb[2] = { b.x, b.y };
+  const double cc[2] = { c.x, c.y };
+  for (int k = 0; k < 2; ++k) {
+    double roots[2];
+    int n = 0;
+    if (std::abs(aa[k]) < 1e-12) {
+      if (std::abs(bb[k]) > 1e-12)
+	roots[n++] = -cc[k] / bb[k];
+    } else {
+      double disc = bb[k] * bb[k] - 4.0 * aa[k] * cc[k];
+      if (disc >= 0.0) {
+	double sq = sqrt(disc);
+	roots[n++] = (-bb[k] + sq) / (2.0 * aa[k]);
+	roots[n++] = (-bb[k] - sq) / (2.0 * aa[k]);
+      }
+    }
+    for (int i = 0; i < n; ++i) {
+      if (0.0 < roots[i] && roots[i] < 1.0)
+	box.addPoint(point(roots[i]));
+    }
   }
-  return Rect(box.bottomLeft() - Vector(0.5, 0.5),
-	      box.topRight() + Vector(0.5, 0.5));
+  return box;
 }
 
 //! Find (approximately) nearest point on Bezier spline.
@@ -851,39 +962,7 @@ bool Bezier::snap(const Vector &v, double &t, Vector &pos, double &bound) const
     } // endpoints handled by code below
   }
 
-  if (straight(1.0)) {
-    Vector prj;
-    if (iV[0] != iV[3] && Segment(iV[0], iV[3]).project(v, prj)) {
-      double t1 = (prj - iV[0]).len() / (iV[3] - iV[0]).len();
-      Vector u = point(t1);
-      double d = (v - u).len();
-      if (d < bound) {
-	t = t1;
-	bound = d;
-	pos = u;
-	return true;
-      } else
-	return false;
-    } else {
-      bool v0 = iV[0].snap(v, pos, bound);
-      bool v1 = iV[3].snap(v, pos, bound);
-      if (v0)
-	t = 0.0;
-      if (v1)
-	t = 1.0;
-      return v0 || v1;
-    }
-  } else {
-    Bezier l, r;
-    subdivide(l, r);
-    bool p1 = l.snap(v, t, pos, bound);
-    bool p2 = r.snap(v, t, pos, bound);
-    if (p1 || p2)
-      t = 0.5 * t;
-    if (p2)
-      t = t + 0.5;
-    return p1 || p2;
-  }
+  return nearestPoint(*this, v, t, pos, bound);
 }
 
 // --------------------------------------------------------------------
@@ -35,15 +35,65 @@
 #include "ipelatex.h"
 
 #include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
 
 using namespace ipe;
 
+// Texts whose cached results are spread over more PDF files are
+// converted again, so that they end up in a single file.
+constexpr int MAX_BUNDLES = 16;
+// Object numbers of the i-th PDF file are shifted by i * BUNDLE_OFFSET.
+constexpr int BUNDLE_OFFSET = 1 << 20;
+// Each parallel Latex run should have at least this many texts, as
+// starting Latex and reading the preamble takes time.
+constexpr int MIN_SHARD_TEXTS = 32;
+// Files in the cache that have not been written for this many days
+// are removed.
+constexpr int CACHE_DAYS = 90;
+
+// FNV-1a
+static uint64_t hashString(String s, uint64_t h = 0xcbf29ce484222325ULL)
+{
+  for (int i = 0; i < s.size(); ++i) {
+    h ^= uint8_t(s[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static String hashKey(uint64_t h)
+{
+  char buf[20];
+  sprintf(buf, "%016llx", static_cast<unsigned long long>(h));
+  return String(buf);
+}
+
 /*! \class ipe::Latex
   \brief Object that converts latex source to PDF format.
 
   This object is responsible for creating the PDF representation of
   text objects.
 
+  If a cache directory has been set, the results are cached on disk.
+  The key for each text object is a hash of the Latex preamble, the
+  engine, and the Latex source generated for the text (which
+  includes its style attributes).  The PDF file produced by a Latex
+  run is stored in the cache, and for each key the cache records
+  which PDF file contains its XForm.  Only texts without a cached
+  result are given to Latex, and the resources of all PDF files
+  involved are merged into a single PdfResources.
+
+  When many texts need to be converted, they can be split into
+  several shards, for Latex runs in parallel.
+
+  The texts of several documents whose Latex header is the same can
+  be converted in a single run: a separate converter takes over the
+  uncached texts of each document's converter (see addUncached), and
+  stores its results in the cache, where the documents then find them.
 */
 
 //! Create a converter object.
@@ -53,16 +103,26 @@ Latex::Latex(const Cascade *sheet, LatexType latexType)
   iResources = new PdfResources;
   iLatexType = latexType;
   iXetex = (latexType == LatexType::Xetex);
+  iShards = 1;
+  iBundles.push_back(String()); // the output of this run
 }
 
 //! Destructor.
 Latex::~Latex()
 {
   for (auto &it : iXForms)
-    delete it;
+    delete it.second;
   delete iResources;
 }
 
+//! Enable caching of results in directory \a dir.
+/*! \a dir must end with a path separator.  An empty string disables
+  the cache. */
+void Latex::setCacheDirectory(String dir)
+{
+  iCacheDir = dir;
+}
+
 // --------------------------------------------------------------------
 
 //! Return the newly created PdfResources and pass ownership to caller.
@@ -98,6 +158,8 @@ void TextCollectingVisitor::visitText(const Text *obj)
   Latex::SText s;
   s.iText = obj;
   s.iSize = obj->size();
+  s.iBundle = -1;
+  s.iId = 0;
   iList->push_back(s);
   iTextFound = true;
 }
@@ -163,6 +225,8 @@ void Latex::addPageNumber(int pno, int vno, int npages, int nviews)
   SText s;
   s.iText = t;
   s.iSize = t->size();
+  s.iBundle = -1;
+  s.iId = 0;
   iTextObjects.push_back(s);
   PdfResources::SPageNumber pn;
   pn.page = pno;
@@ -171,39 +235,40 @@ void Latex::addPageNumber(int pno, int vno, int npages, int nviews)
   iResources->addPageNumber(pn);
 }
 
-/*! Create a Latex source file with all the text objects collected
-  before.  The client should have prepared a directory for the
-  Pdflatex run, and pass the name of the Latex source file to be
-  written by Latex.
+/*! Prepare the Latex sources for the text objects collected
+  before.  Texts whose result is in the cache are skipped, texts with
+  the same source are converted only once, and the remaining texts
+  are distributed over at most \a maxShards Latex runs.
 
-  Returns the number of text objects that did not yet have an XForm,
-  or a negative error code.
+  Returns the number of Latex runs needed (zero if all texts are
+  cached).
 */
-int Latex::createLatexSource(Stream &stream, String preamble)
+int Latex::prepareShards(String preamble, int maxShards)
 {
   bool ancient = (getenv("IPEANCIENTPDFTEX") != nullptr);
-  int count = 0;
-  stream << "\\nonstopmode\n";
+  iHeader = String();
+  StringStream hs(iHeader);
+  hs << "\\nonstopmode\n";
   if (!iXetex) {
-    stream << "\\expandafter\\ifx\\csname pdfobjcompresslevel\\endcsname"
-	   << "\\relax\\else\\pdfobjcompresslevel0\\fi\n";
+    hs << "\\expandafter\\ifx\\csname pdfobjcompresslevel\\endcsname"
+       << "\\relax\\else\\pdfobjcompresslevel0\\fi\n";
     if (!ancient && iLatexType != LatexType::Luatex)
-      stream << "\\ifnum\\the\\pdftexversion<140"
-	     << "\\errmessage{Pdftex is too old. "
-	     << "Set IPEANCIENTPDFTEX environment variable!}\\fi\n";
+      hs << "\\ifnum\\the\\pdftexversion<140"
+	 << "\\errmessage{Pdftex is too old. "
+	 << "Set IPEANCIENTPDFTEX environment variable!}\\fi\n";
     if (iLatexType == LatexType::Luatex)
       // load luatex85 for new versions of Luatex
-      stream << "\\expandafter\\ifx\\csname pdfcolorstack\\endcsname\\relax"
-	     << "\\RequirePackage{luatex85}\\fi\n";
+      hs << "\\expandafter\\ifx\\csname pdfcolorstack\\endcsname\\relax"
+	 << "\\RequirePackage{luatex85}\\fi\n";
   }
-  stream << "\\documentclass{article}\n"
-	 << "\\newdimen\\ipefs\n"
-	 << "\\newcounter{ipePage}\\newcounter{ipeView}\n"
-	 << "\\newcounter{ipePages}\\newcounter{ipeViews}\n"
-	 << "\\newcommand{\\PageTitle}[1]{#1}\n"
-	 << "\\newcommand{\\ipesymbol}[4]{$\\bullet$}\n";
-  stream << "\\def\\ipedefinecolors#1{\\ipecolorpreamble{#1}\\let\\ipecolorpreamble\\relax}\n"
-	 << "\\def\\ipecolorpreamble#1{\\usepackage[#1]{xcolor}\n";
+  hs << "\\documentclass{article}\n"
+     << "\\newdimen\\ipefs\n"
+     << "\\newcounter{ipePage}\\newcounter{ipeView}\n"
+     << "\\newcounter{ipePages}\\newcounter{ipeViews}\n"
+     << "\\newcommand{\\PageTitle}[1]{#1}\n"
+     << "\\newcommand{\\ipesymbol}[4]{$\\bullet$}\n";
+  hs << "\\def\\ipedefinecolors#1{\\ipecolorpreamble{#1}\\let\\ipecolorpreamble\\relax}\n"
+     << "\\def\\ipecolorpreamble#1{\\usepackage[#1]{xcolor}\n";
   AttributeSeq colors;
   iCascade->allNames(EColor, colors);
   for (AttributeSeq::const_iterator it = colors.begin();
@@ -212,91 +277,123 @@ int Latex::createLatexSource(Stream &stream, String preamble)
     String name = it->string();
     Color value = iCascade->find(EColor, *it).color();
     if (value.isGray())
-      stream << "\\definecolor{" << name << "}{gray}{"
-	     << value.iRed << "}\n";
+      hs << "\\definecolor{" << name << "}{gray}{"
+	 << value.iRed << "}\n";
     else
-      stream << "\\definecolor{" << name << "}{rgb}{"
-	     << value.iRed << "," << value.iGreen << ","
-	     << value.iBlue << "}\n";
+      hs << "\\definecolor{" << name << "}{rgb}{"
+	 << value.iRed << "," << value.iGreen << ","
+	 << value.iBlue << "}\n";
   }
-  stream << "}\n";
+  hs << "}\n";
   if (iXetex) {
-    stream << "\\def\\ipesetcolor#1#2#3{\\special{pdf:bc [#1 #2 #3]}}\n"
-	   << "\\def\\iperesetcolor{\\special{pdf:ec}}\n";
+    hs << "\\def\\ipesetcolor#1#2#3{\\special{pdf:bc [#1 #2 #3]}}\n"
+       << "\\def\\iperesetcolor{\\special{pdf:ec}}\n";
   } else if (!ancient) {
-    stream << "\\makeatletter\n"
-	   << "\\def\\ipesetcolor#1#2#3{\\def\\current@color{#1 #2 #3 rg #1 #2 #3 RG}"
-	   << "\\pdfcolorstack\\@pdfcolorstack push{\\current@color}}\n"
-	   << "\\def\\iperesetcolor{\\pdfcolorstack\\@pdfcolorstack pop}\n"
-	   << "\\makeatother\n";
+    hs << "\\makeatletter\n"
+       << "\\def\\ipesetcolor#1#2#3{\\def\\current@color{#1 #2 #3 rg #1 #2 #3 RG}"
+       << "\\pdfcolorstack\\@pdfcolorstack push{\\current@color}}\n"
+       << "\\def\\iperesetcolor{\\pdfcolorstack\\@pdfcolorstack pop}\n"
+       << "\\makeatother\n";
   } else {
-    stream << "\\def\\ipesetcolor#1#2#3{\\color[rgb]{#1,#2,#3}}\n"
-	   << "\\def\\iperesetcolor{}\n";
+    hs << "\\def\\ipesetcolor#1#2#3{\\color[rgb]{#1,#2,#3}}\n"
+       << "\\def\\iperesetcolor{}\n";
   }
-  stream << iCascade->findPreamble() << "\n"
-	 << preamble << "\n"
-	 << "\\ipedefinecolors{}\n"
-	 << "\\pagestyle{empty}\n"
-	 << "\\newcount\\bigpoint\\dimen0=0.01bp\\bigpoint=\\dimen0\n"
-	 << "\\begin{document}\n"
-	 << "\\begin{picture}(500,500)\n";
+  hs << iCascade->findPreamble() << "\n"
+     << preamble << "\n"
+     << "\\ipedefinecolors{}\n"
+     << "\\pagestyle{empty}\n"
+     << "\\newcount\\bigpoint\\dimen0=0.01bp\\bigpoint=\\dimen0\n"
+     << "\\begin{document}\n"
+     << "\\begin{picture}(500,500)\n";
+
+  findCached(iHeader);
+  return distribute(maxShards);
+}
 
-  int curnum = 1;
-  if (iXetex)
-    stream << "\\special{pdf:obj @ipeforms []}\n";
+//! Take over the texts of \a other that are not in the cache.
+/*! \a other must have been prepared with prepareShards() and must
+  use the same Latex engine and header.  Texts with the same source
+  in different documents are converted only once.  The text objects
+  are not modified, so this converter only serves to fill the cache.
+*/
+void Latex::addUncached(const Latex &other)
+{
+  iHeader = other.iHeader;
+  for (const auto &it : other.iTextObjects) {
+    if (it.iBundle < other.iShards) {
+      iTextObjects.push_back(it);
+      iTextObjects.back().iBundle = -1;
+      iTextObjects.back().iId = 0;
+    }
+  }
+}
+
+/*! Distribute the texts that are not in the cache over at most \a
+  maxShards Latex runs.  Returns the number of Latex runs needed (zero
+  if all texts are cached).
+
+  Each shard takes a contiguous range of the texts, so that the texts
+  of one document (see addUncached) end up in as few PDF files as
+  possible, and there are never more shards than a document may use
+  bundles (otherwise findCached would discard the results).
+*/
+int Latex::distribute(int maxShards)
+{
+  std::map<String, std::pair<int, int>> assigned;  // key -> (shard, id)
+  int count = 0;
   for (auto &it : iTextObjects) {
-    const Text *text = it.iText;
+    if (it.iBundle < 0 && assigned.emplace(it.iKey, std::make_pair(0, 0)).second)
+      ++count;
+  }
+  int shards = (count + MIN_SHARD_TEXTS - 1) / MIN_SHARD_TEXTS;
+  shards = std::max(1, std::min({shards, maxShards, MAX_BUNDLES}));
+  int perShard = (count + shards - 1) / shards;
+
+  // bundles 0 .. iShards-1 are the output of the Latex runs
+  iShards = shards;
+  iBundles.insert(iBundles.begin(), shards - 1, String());
+  std::vector<int> ids(shards, 0);
+  int next = 0;
+  for (auto &it : iTextObjects) {
+    if (it.iBundle > 0) {
+      it.iBundle += shards - 1;
+    } else {
+      auto &a = assigned[it.iKey];
+      if (a.second == 0) {
+	a.first = next++ / perShard;
+	a.second = ++ids[a.first];
+      }
+      it.iBundle = a.first;
+      it.iId = a.second;
+    }
+  }
+  return count > 0 ? shards : 0;
+}
 
-    if (!text->getXForm())
-      count++;
+/*! Create the Latex source file for shard \a shard, as prepared by
+  prepareShards().  The client should have prepared a directory for
+  the Pdflatex run, and pass the Latex source file to be written by
+  Latex.
 
-    Attribute fsAttr = iCascade->find(ETextSize, it.iSize);
+  Returns the number of text objects written to the source, or a
+  negative error code.
+*/
+int Latex::createLatexSource(Stream &stream, int shard)
+{
+  stream << iHeader;
 
-    // compute x-stretch factor from textstretch
-    Fixed stretch(1);
-    if (it.iSize.isSymbolic())
-      stretch = iCascade->find(ETextStretch, it.iSize).number();
+  int curnum = 1;
+  if (iXetex)
+    stream << "\\special{pdf:obj @ipeforms []}\n";
+  for (auto &it : iTextObjects) {
+    // write each id once, they were assigned in order
+    if (it.iBundle != shard || it.iId != curnum)
+      continue;
 
-    stream << "\\setbox0=\\hbox{";
-    if (text->isMinipage()) {
-      stream << "\\begin{minipage}{" <<
-	text->width()/stretch.toDouble() << "bp}";
-    }
+    Fixed stretch = it.iStretch;
+    stream << it.iSource;
 
-    if (fsAttr.isNumber()) {
-      Fixed fs = fsAttr.number();
-      stream << "\\fontsize{" << fs << "}"
-	     << "{" << fs.mult(6, 5) << "bp}\\selectfont\n";
-    } else
-      stream << fsAttr.string() << "\n";
-    Color col = iCascade->find(EColor, text->stroke()).color();
-    stream << "\\ipesetcolor{" << col.iRed.toDouble()
-	   << "}{" << col.iGreen.toDouble()
-	   << "}{" << col.iBlue.toDouble()
-	   << "}%\n";
-
-    Attribute absStyle =
-      iCascade->find(text->isMinipage() ? ETextStyle : ELabelStyle,
-		     text->style());
-    String style = absStyle.string();
-    int sp = 0;
-    while (sp < style.size() && style[sp] != '\0')
-      ++sp;
-    stream << style.substr(0, sp);
-
-    String txt = text->text();
-    stream << txt;
-
-    if (text->isMinipage()) {
-      if (!txt.empty() && txt[txt.size() - 1] != '\n')
-	stream << "\n";
-      stream << style.substr(sp + 1);
-      stream << "\\end{minipage}";
-    } else
-      stream << style.substr(sp + 1) << "%\n";
-
-    stream << "\\iperesetcolor}\n"
-	   << "\\count0=\\dp0\\divide\\count0 by \\bigpoint\n";
+    stream << "\\count0=\\dp0\\divide\\count0 by \\bigpoint\n";
     if (iXetex) {
       stream << "\\special{ pdf:bxobj @ipeform" << curnum << "\n"
 	     << "width \\the\\wd0 \\space "
@@ -325,10 +422,104 @@ int Latex::createLatexSource(Stream &stream, String preamble)
     stream << "\\special{pdf:close @ipeforms}\n"
 	   << "\\special{pdf:put @resources << /Ipe @ipeforms >>}\n";
   stream << "\\end{document}\n";
-  return count;
+  return curnum - 1;
 }
 
-bool Latex::getXForm(String key, const PdfDict *ipeInfo)
+//! Write the Latex source that typesets \a text into box 0.
+void Latex::writeText(Stream &stream, const Text *text, Attribute size,
+		      Fixed stretch)
+{
+  Attribute fsAttr = iCascade->find(ETextSize, size);
+
+  stream << "\\setbox0=\\hbox{";
+  if (text->isMinipage()) {
+    stream << "\\begin{minipage}{" <<
+      text->width()/stretch.toDouble() << "bp}";
+  }
+
+  if (fsAttr.isNumber()) {
+    Fixed fs = fsAttr.number();
+    stream << "\\fontsize{" << fs << "}"
+	   << "{" << fs.mult(6, 5) << "bp}\\selectfont\n";
+  } else
+    stream << fsAttr.string() << "\n";
+  Color col = iCascade->find(EColor, text->stroke()).color();
+  stream << "\\ipesetcolor{" << col.iRed.toDouble()
+	 << "}{" << col.iGreen.toDouble()
+	 << "}{" << col.iBlue.toDouble()
+	 << "}%\n";
+
+  Attribute absStyle =
+    iCascade->find(text->isMinipage() ? ETextStyle : ELabelStyle,
+		   text->style());
+  String style = absStyle.string();
+  int sp = 0;
+  while (sp < style.size() && style[sp] != '\0')
+    ++sp;
+  stream << style.substr(0, sp);
+
+  String txt = text->text();
+  stream << txt;
+
+  if (text->isMinipage()) {
+    if (!txt.empty() && txt[txt.size() - 1] != '\n')
+      stream << "\n";
+    stream << style.substr(sp + 1);
+    stream << "\\end{minipage}";
+  } else
+    stream << style.substr(sp + 1) << "%\n";
+
+  stream << "\\iperesetcolor}\n";
+}
+
+//! Compute the sources and cache keys, and look up the texts in the cache.
+/*! Sets iBundle and iId of the texts that are found. */
+void Latex::findCached(String header)
+{
+  iBundles.clear();
+  iBundles.push_back(String()); // the output of this run
+  char engine[8];
+  sprintf(engine, "%d\n", int(iLatexType));
+  uint64_t h0 = hashString(header, hashString(engine));
+  for (auto &it : iTextObjects) {
+    // compute x-stretch factor from textstretch
+    it.iStretch = Fixed(1);
+    if (it.iSize.isSymbolic())
+      it.iStretch = iCascade->find(ETextStretch, it.iSize).number();
+    String src;
+    StringStream ss(src);
+    writeText(ss, it.iText, it.iSize, it.iStretch);
+    it.iSource = src;
+    ss << it.iStretch;
+    it.iKey = hashKey(hashString(src, h0));
+    it.iBundle = -1;
+    it.iId = 0;
+    if (iCacheDir.empty())
+      continue;
+    Lex lex(Platform::readFile(iCacheDir + it.iKey + ".txt"));
+    String bundle = lex.nextToken();
+    int id = lex.getInt();
+    if (bundle.empty() || id <= 0)
+      continue;
+    String fname = iCacheDir + bundle + ".pdf";
+    auto b = std::find(iBundles.begin(), iBundles.end(), fname);
+    if (b == iBundles.end()) {
+      if (!Platform::fileExists(fname))
+	continue;
+      b = iBundles.insert(b, fname);
+    }
+    it.iBundle = b - iBundles.begin();
+    it.iId = id;
+  }
+  if (iBundles.size() > 1 + MAX_BUNDLES) {
+    for (auto &it : iTextObjects)
+      it.iBundle = -1;
+    iBundles.resize(1);
+  }
+}
+
+bool Latex::getXForm(String key, const PdfDict *ipeInfo, const PdfFile &pdf,
+		     int bundle, int offset, String suffix)
 {
   /*
      /Type /XObject
@@ -341,13 +532,12 @@ bool Latex::getXForm(String key, const PdfDict *ipeInfo)
      /Matrix [1 0 0 1 0 0]
      /Resources 11 0 R
   */
-  Text::XForm *xf = new Text::XForm;
-  iXForms.push_back(xf);
+  std::unique_ptr<Text::XForm> xf(new Text::XForm);
   const PdfObj *xform = iXetex ? ipeInfo->get("IpeXForm", nullptr) :
-    iResources->findResource("XObject", key);
+    iResources->findResource("XObject", key + suffix);
   int xformNum = -1;
   if (xform && xform->ref()) {
-    xformNum = xform->ref()->value();
+    xformNum = xform->ref()->value() + offset;
     xform = iResources->object(xformNum);
   }
   if (!xform || !xform->dict())
@@ -366,101 +556,278 @@ bool Latex::getXForm(String key, const PdfDict *ipeInfo)
     if (xf->iName.empty())
       return false;
   } else {
-    xf->iName = key;
+    xf->iName = key + suffix;
     ipeInfo = xformd;
   }
   double val;
   // Get  id
-  if (!ipeInfo->getNumber("IpeId", val, &iPdf))
+  if (!ipeInfo->getNumber("IpeId", val, &pdf))
     return false;
-  xf->iRefCount = val;  // abusing refcount field
-  if (!ipeInfo->getNumber("IpeDepth", val, &iPdf))
+  int id = int(val);
+  if (!ipeInfo->getNumber("IpeDepth", val, &pdf))
     return false;
   xf->iDepth = int(val);
-  if (!ipeInfo->getNumber("IpeStretch", val, &iPdf))
+  if (!ipeInfo->getNumber("IpeStretch", val, &pdf))
     return false;
   xf->iStretch = val;
 
   // Get BBox
   std::vector<double> a;
-  if (!xformd->getNumberArray("BBox", &iPdf, a) || a.size() != 4)
+  if (!xformd->getNumberArray("BBox", &pdf, a) || a.size() != 4)
     return false;
   xf->iBBox.addPoint(Vector(a[0], a[1]));
   xf->iBBox.addPoint(Vector(a[2], a[3]));
 
-  if (!xformd->getNumberArray("Matrix", &iPdf, a) || a.size() != 6)
+  if (!xformd->getNumberArray("Matrix", &pdf, a) || a.size() != 6)
     return false;
   if (a[0] != 1.0 || a[1] != 0.0 || a[2] != 0.0 || a[3] != 1.0) {
     ipeDebug("PDF XObject has a non-trivial transformation");
     return false;
   }
   xf->iTranslation = Vector(-a[4], -a[5]) - xf->iBBox.bottomLeft();
+  Text::XForm *&entry = iXForms[std::make_pair(bundle, id)];
+  delete entry;
+  entry = xf.release();
   return true;
 }
 
-//! Read the PDF file created by Pdflatex.
-/*! Must have performed the call to Pdflatex, and pass the name of the
-  resulting output file.
-*/
-bool Latex::readPdf(DataSource &source)
+// Return the resources of the first page.
+static const PdfDict *pageResources(const PdfFile &pdf)
 {
-  if (!iPdf.parse(source)) {
-    warn("Ipe cannot parse the PDF file produced by Pdflatex.");
-    return false;
+  const PdfDict *page1 = pdf.page();
+  if (!page1)
+    return nullptr;
+  const PdfObj *res = page1->get("Resources", &pdf);
+  return res ? res->dict() : nullptr;
+}
+
+// Can the resources be renamed, to combine the file with others?
+static bool canRename(const PdfDict *res)
+{
+  // other resources (like shadings) may be used by name inside XForms
+  for (int i = 0; i < res->count(); ++i) {
+    String key = res->key(i);
+    if (key != "XObject" && key != "Font" && key != "ProcSet" && key != "Ipe")
+      return false;
   }
+  return true;
+}
 
-  const PdfDict *page1 = iPdf.page();
+//! Read the PDF files created by Pdflatex.
+/*! Must have performed the calls to Pdflatex, and pass the names of
+  the resulting output files, one for each shard.  The files are
+  stored in the cache.
 
-  const PdfObj *res = page1->get("Resources", &iPdf);
-  if (!res || !res->dict())
-    return false;
+  If the output of several shards cannot be combined, sets \a
+  unmergeable and returns false without reading anything.  The
+  client should then prepare and run a single shard.
+*/
+bool Latex::readPdf(const std::vector<String> &fnames, bool &unmergeable)
+{
+  unmergeable = false;
+  std::vector<std::unique_ptr<PdfFile>> pdfs;
+  std::vector<bool> rename;
+  for (int k = 0; k < size(fnames); ++k) {
+    iBundles[k] = fnames[k];
+    std::unique_ptr<PdfFile> pdf(new PdfFile);
+    const PdfDict *res = nullptr;
+    if (!pdf->load(fnames[k].z(), true)
+	|| (res = pageResources(*pdf)) == nullptr) {
+      warn("Ipe cannot parse the PDF file produced by Pdflatex.");
+      return false;
+    }
+    rename.push_back(canRename(res));
+    if (size(fnames) > 1 && !rename.back()) {
+      unmergeable = true;
+      return false;
+    }
+    pdfs.push_back(std::move(pdf));
+  }
+  for (int k = 0; k < size(fnames); ++k) {
+    if (!readBundle(k, *pdfs[k]))
+      return false;
+    if (!iCacheDir.empty() && rename[k])
+      storeCache(fnames[k], k);
+  }
+  return true;
+}
 
-  if (!iResources->collect(res->dict(), &iPdf))
+//! Read the XForms and resources of PDF file \a bundle.
+bool Latex::readBundle(int bundle, PdfFile &pdf)
+{
+  const PdfDict *resd = pageResources(pdf);
+  if (!resd)
     return false;
 
+  const PdfObj *xobj = resd->get("XObject", &pdf);
+  if (!xobj || !xobj->dict()) {
+    warn("Page 1 has no XForms.");
+    return false;
+  }
+  const PdfObj *ipe = nullptr;
   if (iXetex) {
-    const PdfObj *obj = res->dict()->get("Ipe", &iPdf);
-    if (!obj || !obj->array()) {
+    ipe = resd->get("Ipe", &pdf);
+    if (!ipe || !ipe->array()) {
       warn("Page 1 has no /Ipe link.");
       return false;
     }
-    for (int i = 0; i < obj->array()->count(); i++) {
-      const PdfObj *info = obj->array()->obj(i, &iPdf);
+  }
+
+  std::unique_ptr<PdfDict> used;
+  std::set<int> usedForms;
+  bool cached = (bundle >= iShards);
+  if (cached) {
+    // a cached file: only take the XForms of our texts
+    std::set<int> ids;
+    for (auto &it : iTextObjects) {
+      if (it.iBundle == bundle)
+	ids.insert(it.iId);
+    }
+    double id;
+    if (iXetex) {
+      for (int i = 0; i < ipe->array()->count(); i++) {
+	const PdfObj *info = ipe->array()->obj(i, &pdf);
+	const PdfObj *xf = info && info->dict() ?
+	  info->dict()->get("IpeXForm", nullptr) : nullptr;
+	if (xf && xf->ref() && info->dict()->getNumber("IpeId", id, &pdf)
+	    && ids.count(int(id)))
+	  usedForms.insert(xf->ref()->value());
+      }
+    } else {
+      for (int i = 0; i < xobj->dict()->count(); i++) {
+	const PdfObj *xf = xobj->dict()->value(i);
+	const PdfObj *form = xf->ref() ? pdf.object(xf->ref()->value()) : nullptr;
+	if (form && form->dict() && form->dict()->getNumber("IpeId", id, &pdf)
+	    && ids.count(int(id)))
+	  usedForms.insert(xf->ref()->value());
+      }
+    }
+    PdfDict *forms = new PdfDict;
+    for (int i = 0; i < xobj->dict()->count(); i++) {
+      const PdfObj *xf = xobj->dict()->value(i);
+      if (xf->ref() && usedForms.count(xf->ref()->value()))
+	forms->add(xobj->dict()->key(i), new PdfRef(xf->ref()->value()));
+    }
+    used.reset(new PdfDict);
+    used->add("XObject", forms);
+    resd = used.get();
+  }
+
+  int offset = bundle * BUNDLE_OFFSET;
+  String suffix;
+  if (bundle > 0) {
+    char buf[16];
+    sprintf(buf, "-%d", bundle);
+    suffix = buf;
+  }
+  if (!iResources->collect(resd, &pdf, offset, suffix))
+    return false;
+
+  if (iXetex) {
+    for (int i = 0; i < ipe->array()->count(); i++) {
+      const PdfObj *info = ipe->array()->obj(i, &pdf);
       if (!info || !info->dict())
 	return false;
-      if (!getXForm(String(), info->dict()))
+      const PdfObj *xf = info->dict()->get("IpeXForm", nullptr);
+      if (cached && !(xf && xf->ref() && usedForms.count(xf->ref()->value())))
+	continue;
+      if (!getXForm(String(), info->dict(), pdf, bundle, offset, suffix))
 	return false;
     }
   } else {
-    const PdfObj *obj = res->dict()->get("XObject", &iPdf);
-    if (!obj || !obj->dict()) {
-      warn("Page 1 has no XForms.");
-      return false;
-    }
-    for (int i = 0; i < obj->dict()->count(); i++) {
-      String key = obj->dict()->key(i);
-      if (!getXForm(key, nullptr))
+    const PdfDict *forms = resd->get("XObject", &pdf)->dict();
+    for (int i = 0; i < forms->count(); i++) {
+      if (!getXForm(forms->key(i), nullptr, pdf, bundle, offset, suffix))
 	return false;
     }
   }
   return true;
 }
 
+// Write \a data to \a fname through a temporary file, so that
+// other threads and processes reading the cache never see a partial file.
+static bool writeCacheFile(String fname, String data)
+{
+  // a name that no other process or thread uses at the same time
+  static const uint64_t process = std::random_device()();
+  char suffix[40];
+  sprintf(suffix, ".%llx-%llx.tmp", static_cast<unsigned long long>(process),
+	  static_cast<unsigned long long>
+	  (std::hash<std::thread::id>()(std::this_thread::get_id())));
+  String tmpFile = fname + suffix;
+  std::FILE *file = Platform::fopen(tmpFile.z(), "wb");
+  if (!file)
+    return false;
+  bool okay = (std::fwrite(data.data(), 1, data.size(), file)
+	       == size_t(data.size()));
+  okay = (std::fclose(file) == 0) && okay;
+#ifdef WIN32
+  // rename does not replace existing files on Windows
+  std::remove(fname.z());
+#endif
+  if (!okay || std::rename(tmpFile.z(), fname.z()) != 0) {
+    std::remove(tmpFile.z());
+    return false;
+  }
+  return true;
+}
+
+// Remove the files in the cache that have not been written for
+// CACHE_DAYS days.  A text whose entry or bundle is removed is simply
+// converted again.
+static void pruneCache(String dir)
+{
+  std::vector<String> files;
+  if (!Platform::listDirectory(dir, files))
+    return;
+  int64_t limit = int64_t(std::time(nullptr)) - CACHE_DAYS * 86400;
+  for (const auto &f : files) {
+    String fname = dir + f;
+    int64_t mtime, size;
+    if (Platform::fileStatus(fname, mtime, size) && mtime < limit)
+      std::remove(fname.z());
+  }
+}
+
+//! Store PDF file \a fname and the keys of the texts it contains.
+/*! The first time in each process, old files are removed from the
+  cache. */
+void Latex::storeCache(String fname, int bundle)
+{
+  static std::once_flag pruned;
+  std::call_once(pruned, pruneCache, iCacheDir);
+  String data = Platform::readFile(fname);
+  if (data.empty())
+    return;
+  uint64_t h = hashString(data);
+  String name = hashKey(h);
+  if (!writeCacheFile(iCacheDir + name + ".pdf", data))
+    return;
+  for (auto &it : iTextObjects) {
+    if (it.iBundle != bundle)
+      continue;
+    String entry;
+    StringStream ss(entry);
+    ss << name << " " << it.iId << "\n";
+    writeCacheFile(iCacheDir + it.iKey + ".txt", entry);
+  }
+}
+
 //! Notify all text objects about their updated PDF code.
-/*! Returns true if successful. */
+/*! Reads the cached results, and combines them with the output of
+  the Latex run.  Returns true if successful. */
 bool Latex::updateTextObjects()
 {
-  int curnum = 1;
+  for (int k = iShards; k < size(iBundles); ++k) {
+    PdfFile pdf;
+    if (!pdf.load(iBundles[k].z(), true) || !readBundle(k, pdf))
+      return false;
+  }
   for (auto &it : iTextObjects) {
-    auto xf = std::find_if(iXForms.begin(), iXForms.end(),
-			   [curnum](Text::XForm *f)
-			   { return f->iRefCount == curnum; } );
+    auto xf = iXForms.find(std::make_pair(it.iBundle, it.iId));
     if (xf == iXForms.end())
       return false;
-    Text::XForm *xform = *xf;
-    iXForms.erase(xf);
-    it.iText->setXForm(xform);
-    ++curnum;
+    it.iText->setXForm(new Text::XForm(*xf->second));
   }
   return true;
 }
@@ -68,7 +68,11 @@ using namespace ipe;
   UI), and possibly a transition effect (Acrobat Reader eye candy).
 
   A Page can be copied and assigned.  The operation takes time linear
-  in the number of top-level object on the page.
+  in the number of top-level object on the page, but does not copy the
+  objects themselves: they are shared between the copies, and an
+  object is only duplicated when it is modified through one of them
+  (that is, when the objectForEdit() method is called).  This makes
+  page copies cheap enough to be used as undo snapshots.
 
 */
 
@@ -78,6 +82,7 @@ Page::Page() : iTitle()
 {
   iUseTitle[0] = iUseTitle[1] = false;
   iMarked = true;
+  iDetached = 0;
 }
 
 //! Create a new empty page with standard settings.
@@ -435,40 +440,97 @@ int Page::findView(String s) const
 
 // --------------------------------------------------------------------
 
+// revision numbers are unique over all pages, but copying a page
+// keeps the revisions of its objects
+static std::atomic<uint32_t> nextRevision(0);
+
+// Drop one reference to obj, whose reference count is shared.
+static void release(Object *obj, std::atomic<int> *shared)
+{
+  if (shared && --(*shared) == 0) {
+    delete obj;
+    delete shared;
+  }
+}
+
 Page::SObject::SObject()
 {
   iObject = nullptr;
+  iShared = nullptr;
   iLayer = 0;
   iSelect = ENotSelected;
+  iRevision = ++nextRevision;
 }
 
+//! Copy constructor shares the object with \a rhs (constant-time).
+/*! The reference count is allocated together with the object, so
+  that several threads can copy the same page. */
 Page::SObject::SObject(const SObject &rhs)
-  : iSelect(rhs.iSelect), iLayer(rhs.iLayer)
+  : iSelect(rhs.iSelect), iLayer(rhs.iLayer), iRevision(rhs.iRevision),
+    iBBox(rhs.iBBox), iObject(rhs.iObject), iShared(rhs.iShared)
 {
-  if (rhs.iObject)
-    iObject = rhs.iObject->clone();
-  else
-    iObject = nullptr;
+  if (iShared)
+    ++(*iShared);
+}
+
+//! Move constructor, used when the object sequence is rearranged.
+Page::SObject::SObject(SObject &&rhs) noexcept
+  : iSelect(rhs.iSelect), iLayer(rhs.iLayer), iRevision(rhs.iRevision),
+    iBBox(rhs.iBBox), iObject(rhs.iObject), iShared(rhs.iShared)
+{
+  rhs.iObject = nullptr;
+  rhs.iShared = nullptr;
 }
 
 Page::SObject &Page::SObject::operator=(const SObject &rhs)
+{
+  if (this != &rhs)
+    *this = SObject(rhs);
+  return *this;
+}
+
+Page::SObject &Page::SObject::operator=(SObject &&rhs) noexcept
 {
   if (this != &rhs) {
-    delete iObject;
+    release(iObject, iShared);
     iSelect = rhs.iSelect;
     iLayer = rhs.iLayer;
-    if (rhs.iObject)
-      iObject = rhs.iObject->clone();
-    else
-      iObject = nullptr;
-    iBBox.clear(); // invalidate
+    iRevision = rhs.iRevision;
+    iBBox = rhs.iBBox;
+    iObject = rhs.iObject;
+    iShared = rhs.iShared;
+    rhs.iObject = nullptr;
+    rhs.iShared = nullptr;
   }
   return *this;
 }
 
 Page::SObject::~SObject()
 {
-  delete iObject;
+  release(iObject, iShared);
+}
+
+//! Duplicate the object at index \a i, which is shared with another page.
+void Page::unshare(int i)
+{
+  SObject &s = iObjects[i];
+  Object *obj = s.iObject->clone();
+  release(s.iObject, s.iShared);
+  s.iObject = obj;
+  s.iShared = new std::atomic<int>(1);
+  ++iDetached;
+}
+
+//! Return number of shared objects the page has let go of.
+/*! Counts the objects that were duplicated, removed, or replaced
+  while they were shared with a copy of the page, since the last call.
+  These objects are now held only by the copies, so this measures the
+  memory used by the copies (undo snapshots) in constant time. */
+int Page::takeDetached()
+{
+  int n = iDetached;
+  iDetached = 0;
+  return n;
 }
 
 // --------------------------------------------------------------------
@@ -482,6 +544,8 @@ void Page::insert(int i, TSelect select, int layer, Object *obj)
   s.iSelect = select;
   s.iLayer = layer;
   s.iObject = obj;
+  s.iShared = new std::atomic<int>(1);
+  iGrid.insert(i);
 }
 
 //! Append a new object.
@@ -493,20 +557,28 @@ void Page::append(TSelect select, int layer, Object *obj)
   s.iSelect = select;
   s.iLayer = layer;
   s.iObject = obj;
+  s.iShared = new std::atomic<int>(1);
+  iGrid.insert(count() - 1);
 }
 
 //! Remove the object at index \a i.
 void Page::remove(int i)
 {
+  if (isShared(i))
+    ++iDetached;
   iObjects.erase(iObjects.begin() + i);
+  iGrid.remove(i);
 }
 
 //! Replace the object at index \a i.
 /*! Takes ownership of \a obj. */
 void Page::replace(int i, Object *obj)
 {
-  delete iObjects[i].iObject;
+  if (isShared(i))
+    ++iDetached;
+  release(iObjects[i].iObject, iObjects[i].iShared);
   iObjects[i].iObject = obj;
+  iObjects[i].iShared = new std::atomic<int>(1);
   invalidateBBox(i);
 }
 
@@ -527,13 +599,16 @@ double Page::distance(int i, const Vector &v, double bound) const
 void Page::transform(int i, const Matrix &m)
 {
   invalidateBBox(i);
-  object(i)->setMatrix(m * object(i)->matrix());
+  Object *obj = objectForEdit(i);
+  obj->setMatrix(m * obj->matrix());
 }
 
 //! Invalidate the bounding box at index \a i (the object is somehow changed).
 void Page::invalidateBBox(int i) const
 {
+  iObjects[i].iRevision = ++nextRevision;
   iObjects[i].iBBox.clear();
+  iGrid.update(i);
 }
 
 //! Return a bounding box for the object at index \a i.
@@ -592,14 +667,246 @@ void Page::snapBnd(int i, const Vector &mouse,
   ETextSize property is actually changed. */
 bool Page::setAttribute(int i, Property prop, Attribute value)
 {
-  bool changed = object(i)->setAttribute(prop, value);
+  bool changed = objectForEdit(i)->setAttribute(prop, value);
   if (changed && (prop == EPropTextSize || prop == EPropTransformations))
     invalidateBBox(i);
+  else if (changed)
+    iObjects[i].iRevision = ++nextRevision;
   return changed;
 }
 
 // --------------------------------------------------------------------
 
+/*! The Page maintains a uniform grid over the cached bounding boxes
+  of its objects, so that snapping and selection need to look only at
+  objects near the mouse position.  The grid is built on the first
+  query, and then updated incrementally when objects are inserted,
+  removed, or changed.  Objects whose bounding box covers many cells
+  are kept in a separate list and returned by every query.
+
+  Copies of a page start without a grid, so that undo snapshots do
+  not copy it.  As queries are const but build the grid, it is
+  protected by a mutex, and several threads can query a page. */
+
+// objects covering more cells than this are not stored in the cells
+const int MAX_GRID_CELLS = 64;
+
+Page::Grid::Grid()
+{
+  iValid = false;
+  iCellSize = 1.0;
+  iBuiltCount = 0;
+}
+
+//! Copy constructor does not copy the grid, it is built when needed.
+Page::Grid::Grid(const Grid &) : Grid() { /* nothing */ }
+
+//! Assignment discards the grid, it is built when needed.
+Page::Grid &Page::Grid::operator=(const Grid &rhs)
+{
+  if (this != &rhs) {
+    std::lock_guard<std::mutex> lock(iMutex);
+    invalidate();
+  }
+  return *this;
+}
+
+//! Discard grid, it will be rebuilt on the next query.
+void Page::Grid::invalidate()
+{
+  iValid = false;
+  iBox.clear();
+  iCells.clear();
+  iLarge.clear();
+  iPending.clear();
+}
+
+//! Object has been inserted at index \a i.
+void Page::Grid::insert(int i)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  if (!iValid)
+    return;
+  shift(i, 1);
+  iBox.insert(iBox.begin() + i, Rect());
+  iPending.push_back(i);
+}
+
+//! Object at index \a i has been removed.
+void Page::Grid::remove(int i)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  if (!iValid)
+    return;
+  unlink(i);
+  shift(i + 1, -1);
+  iBox.erase(iBox.begin() + i);
+}
+
+//! Bounding box of object at index \a i has changed.
+void Page::Grid::update(int i)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  if (!iValid)
+    return;
+  unlink(i);
+  iPending.push_back(i);
+}
+
+//! Compute range of cells covered by \a box.
+/*! Returns false if the box is empty. */
+bool Page::Grid::cellRange(const Rect &box, int r[4]) const
+{
+  if (box.isEmpty())
+    return false;
+  const double lim = 1e9;
+  double c[4] = { box.left(), box.bottom(), box.right(), box.top() };
+  for (int k = 0; k < 4; ++k)
+    r[k] = int(std::floor(std::max(-lim, std::min(lim, c[k] / iCellSize))));
+  return true;
+}
+
+static inline uint64_t cellKey(int x, int y)
+{
+  return (uint64_t(uint32_t(x)) << 32) | uint32_t(y);
+}
+
+//! Store object \a i in the grid.
+void Page::Grid::add(const Page *page, int i)
+{
+  Rect box = page->bbox(i);
+  int r[4];
+  if (!cellRange(box, r) ||
+      double(r[2] - r[0] + 1) * double(r[3] - r[1] + 1) > MAX_GRID_CELLS) {
+    iLarge.push_back(i);
+    return;
+  }
+  iBox[i] = box;
+  for (int x = r[0]; x <= r[2]; ++x)
+    for (int y = r[1]; y <= r[3]; ++y)
+      iCells[cellKey(x, y)].push_back(i);
+}
+
+//! Remove object \a i from the grid (but keep its index).
+void Page::Grid::unlink(int i)
+{
+  int r[4];
+  if (cellRange(iBox[i], r)) {
+    for (int x = r[0]; x <= r[2]; ++x) {
+      for (int y = r[1]; y <= r[3]; ++y) {
+	auto it = iCells.find(cellKey(x, y));
+	if (it != iCells.end()) {
+	  std::vector<int> &cell = it->second;
+	  cell.erase(std::remove(cell.begin(), cell.end(), i), cell.end());
+	  if (cell.empty())
+	    iCells.erase(it);
+	}
+      }
+    }
+    iBox[i].clear();
+  }
+  iLarge.erase(std::remove(iLarge.begin(), iLarge.end(), i), iLarge.end());
+  iPending.erase(std::remove(iPending.begin(), iPending.end(), i),
+		 iPending.end());
+}
+
+//! Add \a delta to all object indices >= \a i.
+void Page::Grid::shift(int i, int delta)
+{
+  auto shiftSeq = [i, delta](std::vector<int> &seq) {
+    for (int &k : seq) {
+      if (k >= i)
+	k += delta;
+    }
+  };
+  for (auto &cell : iCells)
+    shiftSeq(cell.second);
+  shiftSeq(iLarge);
+  shiftSeq(iPending);
+}
+
+//! Build grid for all objects on the page.
+/*! The cell size is chosen so that a typical object covers only a
+  few cells. */
+void Page::Grid::build(const Page *page)
+{
+  invalidate();
+  int n = page->count();
+  std::vector<double> extent;
+  Rect all;
+  for (int i = 0; i < n; ++i) {
+    Rect box = page->bbox(i);
+    if (!box.isEmpty()) {
+      extent.push_back(std::max(box.width(), box.height()));
+      all.addRect(box);
+    }
+  }
+  iCellSize = 1.0;
+  if (!extent.empty()) {
+    std::nth_element(extent.begin(), extent.begin() + extent.size() / 2,
+		     extent.end());
+    double median = extent[extent.size() / 2];
+    double uniform = std::sqrt(all.width() * all.height() / extent.size());
+    iCellSize = std::max(1.0, std::max(median, uniform));
+  }
+  iBox.resize(n);
+  for (int i = 0; i < n; ++i)
+    add(page, i);
+  iBuiltCount = n;
+  iValid = true;
+}
+
+//! Find objects whose bounding box may intersect \a box.
+void Page::Grid::find(const Page *page, const Rect &box,
+		      std::vector<int> &objs)
+{
+  std::lock_guard<std::mutex> lock(iMutex);
+  int n = page->count();
+  if (!iValid || n > 2 * iBuiltCount + 64 || 2 * n + 64 < iBuiltCount)
+    build(page);
+  for (int i : iPending)
+    add(page, i);
+  iPending.clear();
+
+  objs = iLarge;
+  int r[4];
+  if (cellRange(box, r)) {
+    if (double(r[2] - r[0] + 1) * double(r[3] - r[1] + 1) > iCells.size()) {
+      for (const auto &cell : iCells) {
+	int x = int(cell.first >> 32);
+	int y = int(uint32_t(cell.first));
+	if (r[0] <= x && x <= r[2] && r[1] <= y && y <= r[3])
+	  objs.insert(objs.end(), cell.second.begin(), cell.second.end());
+      }
+    } else {
+      for (int x = r[0]; x <= r[2]; ++x) {
+	for (int y = r[1]; y <= r[3]; ++y) {
+	  auto it = iCells.find(cellKey(x, y));
+	  if (it != iCells.end())
+	    objs.insert(objs.end(), it->second.begin(), it->second.end());
+	}
+      }
+    }
+  }
+  std::sort(objs.begin(), objs.end());
+  objs.erase(std::unique(objs.begin(), objs.end()), objs.end());
+}
+
+//! Find objects near a rectangle.
+/*! Stores in \a objs the indices (in increasing order) of all objects
+  whose bounding box may intersect \a box.  The result can contain
+  further objects, but any object whose bounding box (as returned by
+  bbox()) intersects \a box is guaranteed to be included.
+
+  This uses a spatial index of the cached bounding boxes, and so is
+  much faster than looking at all objects of a large page. */
+void Page::findObjects(const Rect &box, std::vector<int> &objs) const
+{
+  iGrid.find(this, box, objs);
+}
+
+// --------------------------------------------------------------------
+
 //! Return section title at \a level.
 /*! Level 0 is the section, level 1 the subsection. */
 String Page::section(int level) const
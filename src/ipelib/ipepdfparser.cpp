@@ -31,6 +31,7 @@
 #include "ipepdfparser.h"
 #include "ipeutils.h"
 #include <cstdlib>
+#include <cstring>
 
 using namespace ipe;
 
@@ -339,6 +340,20 @@ void PdfDict::add(String key, const PdfObj *obj)
   iItems.push_back(item);
 }
 
+//! Add or replace an entry.
+/*! Dictionary takes ownership of \a obj, and deletes the old value. */
+void PdfDict::set(String key, const PdfObj *obj)
+{
+  for (auto &it : iItems) {
+    if (it.iKey == key) {
+      delete it.iVal;
+      it.iVal = obj;
+      return;
+    }
+  }
+  add(key, obj);
+}
+
 //! Look up key in dictionary.
 /*! Indirect objects (references) are looked up if \a file is not nullptr,
   and the object referred to is returned.
@@ -425,8 +440,8 @@ Buffer PdfDict::inflate() const noexcept
 
  The parser reads a PDF file sequentially from front to back, ignores
  the contents of 'xref' sections, stores only generation 0 objects,
- and stops after reading the first 'trailer' section (so it cannot
- deal with files with incremental updates).  It cannot handle stream
+ and continues after a 'trailer' section, so that objects of
+ incremental updates replace the earlier ones.  It cannot handle stream
  objects whose /Length entry has been deferred (using an indirect
  object).
 
@@ -555,6 +570,16 @@ void PdfParser::getToken()
     if (eos())
       return; // Err
     iTok.iString.append(char(iCh));
+    const char *data;
+    int n = iSource.span(data);
+    int m = 0;
+    while (m < n && !specialChars[uint8_t(data[m])])
+      ++m;
+    if (m > 0) {
+      iTok.iString.append(data, m);
+      iSource.skip(m);
+      iPos += m;
+    }
     getChar();
   }
 
@@ -636,9 +661,10 @@ PdfDict *PdfParser::makeDict()
 	return nullptr;
       int bytes = int(len->number()->value());
       Buffer buf(bytes);
-      char *p = buf.data();
-      while (bytes--) {
+      if (bytes > 0) {
+	char *p = buf.data();
 	*p++ = char(iCh);
+	iPos += iSource.getChars(p, bytes - 1);
 	getChar();
       }
       dict->setStream(buf);
@@ -733,13 +759,16 @@ PdfObj *PdfParser::getObjectDef()
 void PdfParser::skipXRef()
 {
   getToken(); // first object number
-  getToken(); // number of objects
-  int k = toInt(iTok.iString);
-  getToken();
-  while (k--) {
-    getToken(); // obj num
-    getToken(); // gen num
-    getToken(); // n or f
+  // an update section has one subsection per range of objects
+  while (iTok.iType == PdfToken::ENumber) {
+    getToken(); // number of objects
+    int k = toInt(iTok.iString);
+    getToken();
+    while (k--) {
+      getToken(); // obj num
+      getToken(); // gen num
+      getToken(); // n or f
+    }
   }
 }
 
@@ -758,9 +787,18 @@ PdfDict *PdfParser::getTrailer()
 /*! \class ipe::PdfFile
  * \ingroup base
  * \brief All information obtained by parsing a PDF file.
+
+ A PdfFile is either filled by parse(), which reads the entire file
+ sequentially, or opened by load(), which only reads the
+ cross-reference information and parses objects when they are first
+ requested through object().
  */
 
-bool PdfFile::parseObjectStream(const PdfDict *d)
+//! Parse the objects in the object stream \a d and store them.
+/*! If \a num is the object number of \a d, only objects that the
+  cross-reference information places in this stream and that have
+  not been loaded yet are stored. */
+bool PdfFile::parseObjectStream(const PdfDict *d, int num) const
 {
   const PdfObj *objn = d->get("N", this);
   const PdfObj *objfirst = d->get("First", this);
@@ -780,15 +818,21 @@ bool PdfFile::parseObjectStream(const PdfDict *d)
     parser.getToken();
   }
   for (int i = 0; i < n; ++i) {
-    int num = dir[2*i];
+    int objnum = dir[2*i];
     source.setPosition(first + dir[2*i+1]);
     parser.getChar();
     parser.getToken();
+    if (num >= 0) {
+      auto x = iXRef.find(objnum);
+      if (x == iXRef.end() || x->second.iType != 2
+	  || x->second.iStream != num || iObjects.count(objnum))
+	continue;
+    }
     PdfObj *obj = parser.getObject();
     if (!obj)
       return false;
     // ipeDebug("Object: %s", obj->repr().z());
-    iObjects[num] = std::unique_ptr<const PdfObj>(obj);
+    iObjects[objnum] = std::unique_ptr<const PdfObj>(obj);
   }
   return true;
 }
@@ -822,21 +866,26 @@ bool PdfFile::parse(DataSource &source)
       }
     } else if (t.iType == PdfToken::EOp) {
       if (t.iString == "trailer") {
+	// an incremental update may follow, its trailer replaces this one
 	iTrailer = std::unique_ptr<const PdfDict>(parser.getTrailer());
 	if (!iTrailer) {
 	  ipeDebug("Failed to get trailer");
 	  return false;
 	}
-	return readPageTree();
       } else if (t.iString == "xref") {
 	parser.skipXRef();
       } else if (t.iString == "startxref") {
-	return readPageTree(); // this is the end
+	parser.getToken(); // offset of the xref section
+	parser.getToken();
+      } else if (iTrailer) {
+	return readPageTree(); // junk after the end
       } else {
 	ipeDebug("Weird token: %s", t.iString.z());
 	// don't know what's happening
 	return false;
       }
+    } else if (iTrailer) {
+      return readPageTree(); // end of file
     } else {
       ipeDebug("Weird token type: %d %s", t.iType, t.iString.z());
       // don't know what's happening
@@ -845,12 +894,272 @@ bool PdfFile::parse(DataSource &source)
   }
 }
 
+//! Open PDF file \a fname for loading objects on demand.
+/*! Reads the cross-reference tables or streams (following /Prev
+  links to earlier sections), the trailer, and the page tree.  All
+  other objects are parsed, and object streams inflated, only when
+  they are requested.  If the cross-reference information cannot be
+  used, the entire file is parsed as in parse().
+
+  The file is read into memory.  If \a map is true, it is mapped
+  instead, and must then not be modified while the PdfFile exists
+  (see MappedFileSource), so only short-lived PdfFiles should map their
+  file. */
+bool PdfFile::load(const char *fname, bool map)
+{
+  iSource = std::make_unique<MappedFileSource>(fname, map);
+  if (!iSource->isOpen())
+    return false;
+  // find "startxref" near the end of the file
+  size_t tail = std::min(iSource->size(), size_t(1024));
+  iSource->setPosition(iSource->size() - tail);
+  const char *data;
+  int n = iSource->span(data);
+  String s(data, n);
+  int i = n - 9;
+  while (i >= 0 && std::strncmp(s.z() + i, "startxref", 9))
+    --i;
+  if (i >= 0) {
+    size_t offset = std::strtoul(s.z() + i + 9, nullptr, 10);
+    if (readXRef(offset) && iTrailer && readPageTree())
+      return true;
+  }
+  ipeDebug("Cannot use cross-reference information, parsing entire file");
+  iXRef.clear();
+  iObjects.clear();
+  iTrailer.reset();
+  iPages.clear();
+  std::unique_ptr<MappedFileSource> source = std::move(iSource);
+  source->setPosition(0);
+  return parse(*source);
+}
+
+//! Read cross-reference section at \a offset, and all earlier ones.
+/*! Entries already known take precedence, since later sections
+  override earlier ones.  The first trailer read becomes the
+  trailer of the file. */
+bool PdfFile::readXRef(size_t offset)
+{
+  std::vector<size_t> seen;
+  for (;;) {
+    if (offset >= iSource->size()
+	|| std::find(seen.begin(), seen.end(), offset) != seen.end())
+      return false;
+    seen.push_back(offset);
+    iSource->setPosition(offset);
+    PdfParser parser(*iSource);
+    PdfToken t = parser.token();
+    std::unique_ptr<const PdfDict> trailer;
+    if (t.iType == PdfToken::EOp && t.iString == "xref") {
+      std::vector<int> freed;
+      if (!readXRefTable(parser, freed))
+	return false;
+      trailer.reset(parser.getTrailer());
+      if (!trailer)
+	return false;
+      // hybrid file: the stream holds the compressed objects, which
+      // the table of the same section lists as free
+      double stm;
+      if (trailer->getNumber("XRefStm", stm, nullptr)) {
+	std::unique_ptr<const PdfObj> obj(objectAt(size_t(stm), -1));
+	if (!obj || !obj->dict() || !readXRefStream(obj->dict(), &freed))
+	  return false;
+      }
+    } else if (t.iType == PdfToken::ENumber) {
+      std::unique_ptr<const PdfObj> obj(parser.getObjectDef());
+      if (!obj || !obj->dict() || !readXRefStream(obj->dict()))
+	return false;
+      trailer.reset(obj.release()->dict());
+    } else
+      return false;
+    double prev;
+    bool hasPrev = trailer->getNumber("Prev", prev, nullptr);
+    if (!iTrailer)
+      iTrailer = std::move(trailer);
+    if (!hasPrev)
+      return true;
+    offset = size_t(prev);
+  }
+}
+
+//! Read cross-reference table (current token is 'xref').
+/*! The numbers of the free entries that were not known before are
+  stored in \a freed, sorted. */
+bool PdfFile::readXRefTable(PdfParser &parser, std::vector<int> &freed)
+{
+  parser.getToken();
+  while (parser.token().iType == PdfToken::ENumber) {
+    int first = std::strtol(parser.token().iString.z(), nullptr, 10);
+    parser.getToken();
+    if (parser.token().iType != PdfToken::ENumber)
+      return false;
+    int count = std::strtol(parser.token().iString.z(), nullptr, 10);
+    parser.getToken();
+    for (int i = 0; i < count; ++i) {
+      PdfToken offset = parser.token();
+      parser.getToken(); // generation number
+      parser.getToken();
+      PdfToken type = parser.token();
+      parser.getToken();
+      if (offset.iType != PdfToken::ENumber || type.iType != PdfToken::EOp)
+	return false;
+      XRef x;
+      x.iType = (type.iString == "n") ? 1 : 0;
+      x.iStream = 0;
+      x.iOffset = std::strtoul(offset.iString.z(), nullptr, 10);
+      if (iXRef.emplace(first + i, x).second && x.iType == 0)
+	freed.push_back(first + i);
+    }
+  }
+  std::sort(freed.begin(), freed.end());
+  return (parser.token().iType == PdfToken::EOp
+	  && parser.token().iString == "trailer");
+}
+
+//! Read entries of cross-reference stream \a d.
+/*! For the stream of a hybrid file, \a freed are the free entries of
+  the table in the same section, which the stream overrides. */
+bool PdfFile::readXRefStream(const PdfDict *d, const std::vector<int> *freed)
+{
+  const PdfObj *type = d->get("Type", nullptr);
+  if (!type || !type->name() || type->name()->value() != "XRef")
+    return false;
+  std::vector<double> w;
+  if (!d->getNumberArray("W", nullptr, w) || w.size() != 3)
+    return false;
+  std::vector<double> index;
+  if (!d->getNumberArray("Index", nullptr, index)) {
+    double size;
+    if (!d->getNumber("Size", size, nullptr))
+      return false;
+    index.push_back(0.0);
+    index.push_back(size);
+  }
+  int w0 = int(w[0]), w1 = int(w[1]), w2 = int(w[2]);
+  int rowLen = w0 + w1 + w2;
+  if (w0 < 0 || w1 < 0 || w2 < 0 || rowLen == 0)
+    return false;
+  Buffer buf = d->inflate();
+  uint8_t *data = reinterpret_cast<uint8_t *>(buf.data());
+  int size = buf.size();
+
+  // undo PNG predictors, where each row starts with a filter byte
+  const PdfObj *parms = d->get("DecodeParms", nullptr);
+  double predictor = 1.0;
+  if (parms && parms->dict())
+    parms->dict()->getNumber("Predictor", predictor, nullptr);
+  if (predictor >= 10.0) {
+    std::vector<uint8_t> prev(rowLen, 0);
+    int rows = size / (rowLen + 1);
+    for (int r = 0; r < rows; ++r) {
+      uint8_t *in = data + r * (rowLen + 1);
+      uint8_t *out = data + r * rowLen;
+      int filter = in[0];
+      for (int j = 0; j < rowLen; ++j) {
+	int a = j > 0 ? out[j-1] : 0;
+	int b = prev[j];
+	int c = j > 0 ? prev[j-1] : 0;
+	int x = in[j+1];
+	switch (filter) {
+	case 1: x += a; break;
+	case 2: x += b; break;
+	case 3: x += (a + b) / 2; break;
+	case 4: {
+	  int p = a + b - c;
+	  int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+	  x += (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+	  break; }
+	default: break;
+	}
+	out[j] = uint8_t(x);
+      }
+      // rows overlap in place, so keep a copy of the decoded row
+      std::memcpy(prev.data(), out, rowLen);
+    }
+    size = rows * rowLen;
+  }
+
+  auto field = [&data](int &pos, int width, size_t def) {
+    if (width == 0)
+      return def;
+    size_t val = 0;
+    while (width--)
+      val = (val << 8) | data[pos++];
+    return val;
+  };
+
+  int pos = 0;
+  for (size_t k = 0; k + 1 < index.size(); k += 2) {
+    int first = int(index[k]);
+    int count = int(index[k+1]);
+    for (int i = 0; i < count; ++i) {
+      if (pos + rowLen > size)
+	return false;
+      XRef x;
+      x.iType = int(field(pos, w0, 1));
+      size_t f1 = field(pos, w1, 0);
+      size_t f2 = field(pos, w2, 0);
+      x.iStream = (x.iType == 2) ? int(f1) : 0;
+      x.iOffset = (x.iType == 2) ? f2 : f1;
+      if (!iXRef.emplace(first + i, x).second && freed
+	  && std::binary_search(freed->begin(), freed->end(), first + i))
+	iXRef[first + i] = x;
+    }
+  }
+  return true;
+}
+
+//! Parse object definition at \a offset in the source.
+/*! If \a num is not negative, check that it is the object number. */
+PdfObj *PdfFile::objectAt(size_t offset, int num) const
+{
+  iSource->setPosition(offset);
+  PdfParser parser(*iSource);
+  PdfToken t = parser.token();
+  if (t.iType != PdfToken::ENumber
+      || (num >= 0 && std::strtol(t.iString.z(), nullptr, 10) != num))
+    return nullptr;
+  return parser.getObjectDef();
+}
+
+//! Parse object \a num using the cross-reference information.
+const PdfObj *PdfFile::loadObject(int num) const
+{
+  auto x = iXRef.find(num);
+  if (x == iXRef.end())
+    return nullptr;
+  if (x->second.iType == 1) {
+    PdfObj *obj = objectAt(x->second.iOffset, num);
+    if (!obj) {
+      ipeDebug("Failed to get object %d", num);
+      return nullptr;
+    }
+    iObjects[num] = std::unique_ptr<const PdfObj>(obj);
+    return obj;
+  } else if (x->second.iType == 2) {
+    int stream = x->second.iStream;
+    const PdfObj *stm = object(stream);
+    if (!stm || !stm->dict() || !parseObjectStream(stm->dict(), stream)) {
+      ipeDebug("Failed to read object stream %d", stream);
+      return nullptr;
+    }
+    auto got = iObjects.find(num);
+    return (got != iObjects.end()) ? got->second.get() : nullptr;
+  }
+  return nullptr;
+}
+
 //! Return object with number \a num.
+/*! If the file was opened with load(), the object is parsed the
+  first time it is requested. */
 const PdfObj *PdfFile::object(int num) const noexcept
 {
+  std::lock_guard<std::recursive_mutex> lock(iMutex);
   auto got = iObjects.find(num);
   if (got != iObjects.end())
     return got->second.get();
+  else if (iSource)
+    return loadObject(num);
   else
     return nullptr;
 }
@@ -858,6 +1167,8 @@ const PdfObj *PdfFile::object(int num) const noexcept
 //! Take ownership of object with number \a num, remove from PdfFile.
 std::unique_ptr<const PdfObj> PdfFile::take(int num)
 {
+  object(num); // make sure it has been loaded
+  std::lock_guard<std::recursive_mutex> lock(iMutex);
   auto got = iObjects.find(num);
   if (got != iObjects.end()) {
     std::unique_ptr<const PdfObj> obj = std::move(got->second);
@@ -39,6 +39,9 @@
 #include "ipepdfparser.h"
 #include "iperesources.h"
 
+#include <algorithm>
+#include <thread>
+
 using namespace ipe;
 
 typedef std::vector<Bitmap>::const_iterator BmIter;
@@ -151,11 +154,11 @@ void PdfPainter::drawAttributes()
   drawOpacity(true);
 }
 
-static const char *opacityName(Fixed alpha)
+static String opacityName(Fixed alpha)
 {
-  static char buf[12];
+  char buf[12];
   sprintf(buf, "/alpha%03d", alpha.internal());
-  return buf;
+  return String(buf);
 }
 
 void PdfPainter::drawOpacity(bool withStroke)
@@ -235,6 +238,126 @@ void PdfPainter::doDrawSymbol(Attribute symbol)
     sym->iObject->draw(*this);
 }
 
+// 64-bit FNV-1a hash
+static uint64_t hashBytes(const char *data, int size)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < size; ++i) {
+    h ^= uint8_t(data[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// hash of the last kilobyte of the file
+static uint64_t fileTail(std::FILE *file, long size)
+{
+  char buf[1024];
+  long n = std::min(size, long(sizeof(buf)));
+  if (std::fseek(file, size - n, SEEK_SET) != 0 ||
+      std::fread(buf, 1, n, file) != size_t(n))
+    return 0;
+  return hashBytes(buf, n);
+}
+
+/*! \class ipe::PdfSaveRecord
+  \brief Record of a PDF file written by Ipe.
+
+  Remembers the object numbers of what PdfWriter has written to a
+  file, so that a later save can append an incremental update
+  containing only the objects that have changed.
+*/
+
+//! Has the file remained as we left it?
+/*! The file must be open for reading and writing.  If true, the file
+  is positioned at its end. */
+bool PdfSaveRecord::unchanged(std::FILE *file) const
+{
+  if (iObjNum == 0 || std::fseek(file, 0, SEEK_END) != 0 ||
+      std::ftell(file) != iSize || fileTail(file, iSize) != iTail)
+    return false;
+  return std::fseek(file, 0, SEEK_END) == 0;
+}
+
+//! Remember the state of the file after writing it.
+void PdfSaveRecord::finish(std::FILE *file, String fname, uint32_t flags)
+{
+  std::fflush(file);
+  std::fseek(file, 0, SEEK_END);
+  iSize = std::ftell(file);
+  iTail = fileTail(file, iSize);
+  iFileName = fname;
+  iFlags = flags;
+  if (iFullSize == 0)
+    iFullSize = iSize;
+}
+
+// --------------------------------------------------------------------
+
+PdfWriter::Output::Output(TellStream &stream)
+  : iStream(stream), iCapture(false)
+{
+  // nothing
+}
+
+void PdfWriter::Output::putChar(char ch)
+{
+  if (iCapture)
+    iBuffer.append(ch);
+  else
+    iStream.putChar(ch);
+}
+
+void PdfWriter::Output::putString(String s)
+{
+  if (iCapture)
+    iBuffer.append(s);
+  else
+    iStream.putString(s);
+}
+
+void PdfWriter::Output::putCString(const char *s)
+{
+  if (iCapture)
+    iBuffer.append(s);
+  else
+    iStream.putCString(s);
+}
+
+void PdfWriter::Output::putRaw(const char *data, int size)
+{
+  if (iCapture)
+    iBuffer.append(data, size);
+  else
+    iStream.putRaw(data, size);
+}
+
+long PdfWriter::Output::tell() const
+{
+  return iStream.tell() + (iCapture ? iBuffer.size() : 0);
+}
+
+bool PdfWriter::Output::seek(long pos)
+{
+  return !iCapture && iStream.seek(pos);
+}
+
+//! Collect the output instead of writing it.
+void PdfWriter::Output::capture()
+{
+  iBuffer = String();
+  iCapture = true;
+}
+
+//! Stop collecting and return what has been collected.
+String PdfWriter::Output::release()
+{
+  iCapture = false;
+  String s = iBuffer;
+  iBuffer = String();
+  return s;
+}
+
 // --------------------------------------------------------------------
 
 /*! \class ipe::PdfWriter
@@ -248,6 +371,11 @@ void PdfPainter::doDrawSymbol(Attribute symbol)
   document. Finally, call \c createTrailer to complete the PDF
   document, and close the file.
 
+  If a PdfSaveRecord is given, the writer records what it writes.
+  When the record already describes the file, the writer appends an
+  incremental update to the file instead, containing only the
+  objects that differ from those already in the file.
+
   Some reserved PDF object numbers:
 
     - 0: Must be left empty (a PDF restriction).
@@ -260,12 +388,16 @@ void PdfPainter::doDrawSymbol(Attribute symbol)
 */
 
 //! Create a PDF writer operating on this (open and empty) file.
+/*! If \a record has been filled by an earlier save, the file is
+  instead positioned at the end of that earlier save, and an update is
+  appended. */
 PdfWriter::PdfWriter(TellStream &stream, const Document *doc, const PdfResources *resources,
 		     uint32_t flags, int fromPage, int toPage,
-		     int compression)
+		     int compression, PdfSaveRecord *record)
   : iStream(stream), iDoc(doc), iResources(resources), iSaveFlags(flags),
-    iFromPage(fromPage), iToPage(toPage)
+    iFromPage(fromPage), iToPage(toPage), iRecord(record)
 {
+  iAppend = iRecord && iRecord->iObjNum > 0;
   iCompressLevel = compression;
   iObjNum = 7;  // 0 - 6 are reserved
   iXmlStreamNum = -1; // no XML stream yet
@@ -289,8 +421,27 @@ PdfWriter::PdfWriter(TellStream &stream, const Document *doc, const PdfResources
     --id;
   }
 
+  if (iAppend) {
+    appendPreamble(bm);
+    return;
+  }
+
   iStream << "%PDF-1.4\n";
+  if (iRecord) {
+    iRecord->iPreambleStart = iObjNum;
+    iStream.capture();
+    embedPreamble();
+    String preamble = iStream.release();
+    iRecord->iPreambleKey = hashBytes(preamble.data(), preamble.size());
+    iRecord->iPreambleEnd = iObjNum;
+    iStream << preamble;
+  } else
+    embedPreamble();
+}
 
+//! Embed resources, style sheet objects, and symbols.
+void PdfWriter::embedPreamble()
+{
   // embed all fonts and other resources from Pdflatex
   embedResources();
 
@@ -446,6 +597,62 @@ PdfWriter::~PdfWriter()
   // nothing
 }
 
+//! Start an update by writing the preamble, if it has changed.
+/*! If the preamble is unchanged, it is not written again.  If it
+  does not take more object numbers than before, it replaces the
+  previous objects.  Otherwise it is written with new object numbers.
+  Bitmaps that are already in the file are reused. */
+void PdfWriter::appendPreamble(const BitmapFinder &all)
+{
+  iObjNum = iRecord->iPreambleStart;
+  iStream.capture();
+  embedPreamble();
+  String preamble = iStream.release();
+  uint64_t key = hashBytes(preamble.data(), preamble.size());
+  if (key == iRecord->iPreambleKey) {
+    iXref.clear();  // already in the file
+  } else if (iObjNum <= iRecord->iPreambleEnd) {
+    iStream << preamble;
+    iRecord->iPreambleKey = key;
+  } else {
+    resetPreamble(all);
+    iObjNum = iRecord->iObjNum;
+    iRecord->iPreambleStart = iObjNum;
+    iStream.capture();
+    embedPreamble();
+    preamble = iStream.release();
+    iRecord->iPreambleKey = hashBytes(preamble.data(), preamble.size());
+    iRecord->iPreambleEnd = iObjNum;
+    iStream << preamble;
+  }
+  iObjNum = std::max(iObjNum, iRecord->iObjNum);
+
+  std::vector<Bitmap> sorted = all.iBitmaps;
+  std::sort(sorted.begin(), sorted.end());
+  for (auto &b : iRecord->iBitmaps) {
+    if (std::binary_search(sorted.begin(), sorted.end(), b.first) &&
+	std::find(iBitmaps.begin(), iBitmaps.end(), b.first) == iBitmaps.end()) {
+      b.first.setObjNum(b.second);
+      iBitmaps.push_back(b.first);
+    }
+  }
+}
+
+//! Forget the objects written by embedPreamble().
+void PdfWriter::resetPreamble(const BitmapFinder &all)
+{
+  iXref.clear();
+  iResourceNumber.clear();
+  iBitmaps.clear();
+  iGradients.clear();
+  iSymbols.clear();
+  iExtGState = -1;
+  iPatternNum = -1;
+  int id = -1;
+  for (auto bitmap : all.iBitmaps)
+    bitmap.setObjNum(id--);
+}
+
 /*! Write the beginning of the next object: "no 0 obj " and save
   information about file position. Default argument uses next unused
   object number.  Returns number of new object. */
@@ -526,8 +733,7 @@ void PdfWriter::embedIpeXForm(const PdfDict *d)
   if (stream.size() > 0) {
     iStream << "/Length " << stream.size()
 	    << ">>\nstream\n";
-    for (int i = 0; i < stream.size(); ++i)
-      iStream.putChar(stream[i]);
+    iStream.putRaw(stream.data(), stream.size());
     iStream << "\nendstream";
   } else
     iStream << ">>";
@@ -612,10 +818,27 @@ void PdfWriter::createStream(const char *data, int size, bool preCompressed)
 
 // --------------------------------------------------------------------
 
+// deflate the data
+static String compressed(String data, int level)
+{
+  int deflatedSize;
+  Buffer deflated = DeflateStream::deflate(data.data(), data.size(),
+					   deflatedSize, level);
+  return String(deflated.data(), deflatedSize);
+}
+
+// --------------------------------------------------------------------
+
 void PdfWriter::embedBitmap(Bitmap bitmap)
 {
   int smaskNum = -1;
-  auto embed = bitmap.embed();
+  std::pair<Buffer, Buffer> embed;
+  auto it = iEmbedData.find(bitmap);
+  if (it != iEmbedData.end()) {
+    embed = it->second;
+    iEmbedData.erase(it);
+  } else
+    embed = bitmap.embed();
   if (bitmap.hasAlpha() && embed.second.size() > 0) {
     smaskNum = startObject();
     iStream << "<<\n";
@@ -678,6 +901,24 @@ void PdfWriter::embedBitmaps(const BitmapFinder &bm)
   }
 }
 
+//! Compress the bitmaps that are not yet embedded in parallel.
+void PdfWriter::prepareBitmaps(const std::vector<BitmapFinder> &bms)
+{
+  std::vector<Bitmap> todo;
+  for (const auto &bm : bms) {
+    for (const auto &bitmap : bm.iBitmaps) {
+      // objNum is negative until the bitmap is embedded
+      if (bitmap.objNum() < 0 && !iEmbedData.count(bitmap) &&
+	  std::find(todo.begin(), todo.end(), bitmap) == todo.end())
+	todo.push_back(bitmap);
+    }
+  }
+  std::vector<std::pair<Buffer, Buffer>> data(todo.size());
+  Platform::parallelFor(size(todo), [&](int i) { data[i] = todo[i].embed(); });
+  for (int i = 0; i < size(todo); ++i)
+    iEmbedData[todo[i]] = data[i];
+}
+
 void PdfWriter::createResources(const BitmapFinder &bm)
 {
   // These are only the resources needed by Ipe drawing directly.
@@ -764,29 +1005,100 @@ void PdfWriter::paintView(Stream &stream, int pno, int view)
   }
 }
 
-//! create contents and page stream for this page view.
-void PdfWriter::createPageView(int pno, int view)
+void PdfWriter::findViewBitmaps(int pno, int view, BitmapFinder &bm)
 {
-  const Page *page = iDoc->page(pno);
-  // Find bitmaps to embed
-  BitmapFinder bm;
   const Symbol *background =
     iDoc->cascade()->findSymbol(Attribute::BACKGROUND());
-  if (background && page->findLayer("BACKGROUND") < 0)
+  if (background && iDoc->page(pno)->findLayer("BACKGROUND") < 0)
     background->iObject->accept(bm);
-  bm.scanPage(page);
-  // ipeDebug("# of bitmaps: %d", bm.iBitmaps.size());
-  embedBitmaps(bm);
-  // create page stream
+  bm.scanPage(iDoc->page(pno));
+}
+
+/*! Return the contents stream of the page view, compressed if \a
+  compress is true.  The bitmaps it uses must have been embedded
+  already.  This writes nothing to the PDF file, and so can run on
+  several threads at once. */
+String PdfWriter::pageContents(int pno, int view, bool compress)
+{
   String pagedata;
   StringStream sstream(pagedata);
-  if (iCompressLevel > 0) {
+  if (compress) {
     DeflateStream dfStream(sstream, iCompressLevel);
     paintView(dfStream, pno, view);
     dfStream.close();
   } else
     paintView(sstream, pno, view);
+  return pagedata;
+}
+
+//! create contents and page stream for this page view.
+void PdfWriter::createPageView(int pno, int view)
+{
+  // Find bitmaps to embed
+  BitmapFinder bm;
+  findViewBitmaps(pno, view, bm);
+  // ipeDebug("# of bitmaps: %d", bm.iBitmaps.size());
+  embedBitmaps(bm);
+  writePageView(pno, view, bm, pageContents(pno, view, iCompressLevel > 0));
+}
+
+// object numbers used to try out a page object
+const int TRIAL_OBJNUM = 1 << 30;
+
+//! Write the objects for the page view, with its contents stream.
+/*! When recording, \a key is the hash of the uncompressed contents
+  stream, and \a contentsNum is the object number of an identical
+  stream already in the file (or -1).  Page objects identical to those
+  in the file are not written again. */
+void PdfWriter::writePageView(int pno, int view, const BitmapFinder &bm,
+			      String pagedata, uint64_t key, int contentsNum)
+{
+  if (iRecord && contentsNum < 0) {
+    auto it = iNewContents.find(key);
+    if (it != iNewContents.end())
+      contentsNum = it->second;
+  }
+  if (contentsNum < 0) {
+    contentsNum = startObject();
+    iStream << "<<\n";
+    createStream(pagedata.data(), pagedata.size(), (iCompressLevel > 0));
+  }
+  if (!iRecord) {
+    writePageObjects(pno, view, bm, contentsNum);
+    return;
+  }
+  iNewContents[key] = contentsNum;
+
+  // write objects with trial numbers to see if they are already in the file
+  int objNum = iObjNum;
+  iObjNum = TRIAL_OBJNUM;
+  iStream.capture();
+  writePageObjects(pno, view, bm, contentsNum);
+  String trial = iStream.release();
+  iObjNum = objNum;
+  iXref.erase(iXref.lower_bound(TRIAL_OBJNUM), iXref.end());
+  iPageObjectNumbers.pop_back();
+  uint64_t pageKey = hashBytes(trial.data(), trial.size());
+
+  if (iAppend) {
+    auto it = iRecord->iPages.find(pageKey);
+    if (it != iRecord->iPages.end() && !it->second.empty()) {
+      int num = it->second.front();
+      it->second.erase(it->second.begin());
+      iPageObjectNumbers.push_back({ pno, view, num });
+      iNewPages[pageKey].push_back(num);
+      return;
+    }
+  }
+  writePageObjects(pno, view, bm, contentsNum);
+  iNewPages[pageKey].push_back(iPageObjectNumbers.back().objNum);
+}
 
+//! Write annotations and page object for the page view.
+void PdfWriter::writePageObjects(int pno, int view, const BitmapFinder &bm,
+				 int contentsNum)
+{
+  const Page *page = iDoc->page(pno);
   int firstLink = -1;
   int lastLink = -1;
   for (int i = 0; i < page->count(); ++i) {
@@ -831,9 +1143,6 @@ void PdfWriter::createPageView(int pno, int view)
     iStream << "\n>> endobj\n";
   }
 
-  int contentsobj = startObject();
-  iStream << "<<\n";
-  createStream(pagedata.data(), pagedata.size(), (iCompressLevel > 0));
   int pageobj = startObject();
   iStream << "<<\n";
   iStream << "/Type /Page\n";
@@ -847,7 +1156,7 @@ void PdfWriter::createPageView(int pno, int view)
       iStream << notesObj << " 0 R";
     iStream << "]\n";
   }
-  iStream << "/Contents " << contentsobj << " 0 R\n";
+  iStream << "/Contents " << contentsNum << " 0 R\n";
   // iStream << "/Rotate 0\n";
   createResources(bm);
   if (!page->effect(view).isNormal()) {
@@ -874,8 +1183,11 @@ void PdfWriter::createPageView(int pno, int view)
 }
 
 //! Create all PDF pages.
+/*! The contents streams of the pages are painted and compressed in
+  parallel, a batch of views at a time, and written in order. */
 void PdfWriter::createPages()
 {
+  std::vector<std::pair<int, int>> views;
   for (int page = iFromPage; page <= iToPage; ++page) {
     if ((iSaveFlags & SaveFlag::MarkedView) && !iDoc->page(page)->marked())
       continue;
@@ -884,16 +1196,64 @@ void PdfWriter::createPages()
       bool shown = false;
       for (int view = 0; view < nViews; ++view) {
 	if (iDoc->page(page)->markedView(view)) {
-	  createPageView(page, view);
+	  views.push_back(std::make_pair(page, view));
 	  shown = true;
 	}
       }
       if (!shown)
-	createPageView(page, nViews - 1);
+	views.push_back(std::make_pair(page, nViews - 1));
     } else {
       for (int view = 0; view < nViews; ++view)
-	createPageView(page, view);
+	views.push_back(std::make_pair(page, view));
+    }
+  }
+
+  int batch = 4 * std::max(1, int(std::thread::hardware_concurrency()));
+  for (int first = 0; first < size(views); first += batch) {
+    int n = std::min(batch, size(views) - first);
+    // embed bitmaps first, so that painting knows their object numbers
+    std::vector<BitmapFinder> bms(n);
+    for (int i = 0; i < n; ++i)
+      findViewBitmaps(views[first + i].first, views[first + i].second, bms[i]);
+    prepareBitmaps(bms);
+    for (int i = 0; i < n; ++i)
+      embedBitmaps(bms[i]);
+    std::vector<String> contents(n);
+    if (!iRecord) {
+      Platform::parallelFor(n, [&](int i) {
+	  contents[i] = pageContents(views[first + i].first,
+				     views[first + i].second,
+				     iCompressLevel > 0); });
+      for (int i = 0; i < n; ++i)
+	writePageView(views[first + i].first, views[first + i].second,
+		      bms[i], contents[i]);
+      continue;
+    }
+    // only compress the contents streams that are not yet in the file
+    std::vector<uint64_t> keys(n);
+    std::vector<int> nums(n, -1);
+    Platform::parallelFor(n, [&](int i) {
+	contents[i] = pageContents(views[first + i].first,
+				   views[first + i].second, false);
+	keys[i] = hashBytes(contents[i].data(), contents[i].size()); });
+    for (int i = 0; i < n; ++i) {
+      auto it = iNewContents.find(keys[i]);
+      if (it != iNewContents.end())
+	nums[i] = it->second;
+      else if (iAppend) {
+	it = iRecord->iContents.find(keys[i]);
+	if (it != iRecord->iContents.end())
+	  nums[i] = it->second;
+      }
+    }
+    if (iCompressLevel > 0) {
+      Platform::parallelFor(n, [&](int i) {
+	  if (nums[i] < 0)
+	    contents[i] = compressed(contents[i], iCompressLevel); });
     }
+    for (int i = 0; i < n; ++i)
+      writePageView(views[first + i].first, views[first + i].second,
+		    bms[i], contents[i], keys[i], nums[i]);
   }
 }
 
@@ -905,6 +1265,112 @@ void PdfWriter::createXmlStream(String xmldata, bool preCompressed)
   createStream(xmldata.data(), xmldata.size(), preCompressed);
 }
 
+//! Create a stream containing the XML data of the document.
+/*! The XML data is compressed and written directly to the PDF file,
+  and the /Length entry is filled in afterwards.  If the output stream
+  cannot seek, the XML data is collected in memory first.  When
+  recording, the XML data is written in parts instead. */
+void PdfWriter::createXmlStream()
+{
+  if (iRecord) {
+    createXmlParts();
+    return;
+  }
+  if (!iStream.seek(iStream.tell())) {
+    String xmlData;
+    StringStream stream(xmlData);
+    if (iCompressLevel > 0) {
+      DeflateStream dfStream(stream, iCompressLevel);
+      iDoc->saveAsXml(dfStream, true);
+      dfStream.close();
+    } else
+      iDoc->saveAsXml(stream, true);
+    createXmlStream(xmlData, iCompressLevel > 0);
+    return;
+  }
+  iXmlStreamNum = startObject(1);
+  iStream << "<<\n/Type /Ipe\n/Length ";
+  long lengthPos = iStream.tell();
+  iStream << "          ";  // room for the length
+  if (iCompressLevel > 0)
+    iStream << " /Filter /FlateDecode";
+  iStream << " >>\nstream\n";
+  long start = iStream.tell();
+  if (iCompressLevel > 0) {
+    DeflateStream dfStream(iStream, iCompressLevel);
+    iDoc->saveAsXml(dfStream, true);
+    dfStream.close();
+  } else
+    iDoc->saveAsXml(iStream, true);
+  long end = iStream.tell();
+  iStream.seek(lengthPos);
+  iStream << int(end - start);
+  iStream.seek(end);
+  iStream << "\nendstream endobj\n";
+}
+
+//! Create the XML data as a sequence of streams.
+/*! There are two streams for the header (the info element, which
+  changes on every save, and the rest), one for each page, and one for
+  the end of the document.  Streams that are already in the file are
+  not written again.  Object 1 lists the streams in its /Parts
+  array. */
+void PdfWriter::createXmlParts()
+{
+  int n = iDoc->countPages() + 3;
+  std::vector<String> parts(n);
+  String header;
+  StringStream headerStream(header);
+  iDoc->saveXmlHeader(headerStream, true);
+  int split = header.find('\n') + 1;
+  if (header.substr(split, 5) == "<info")
+    split = header.find("/>\n") + 3;
+  parts[0] = header.left(split);
+  parts[1] = header.substr(split);
+  Platform::parallelFor(iDoc->countPages(), [&](int i) {
+      StringStream stream(parts[i + 2]);
+      iDoc->page(i)->saveAsXml(stream); });
+  parts[n - 1] = "</ipe>\n";
+
+  std::vector<uint64_t> keys(n);
+  std::vector<int> nums(n, -1);
+  Platform::parallelFor(n, [&](int i) {
+      keys[i] = hashBytes(parts[i].data(), parts[i].size()); });
+  for (int i = 0; i < n; ++i) {
+    auto it = iNewXmlParts.find(keys[i]);
+    if (it != iNewXmlParts.end())
+      nums[i] = it->second;
+    else if (iAppend) {
+      it = iRecord->iXmlParts.find(keys[i]);
+      if (it != iRecord->iXmlParts.end())
+	nums[i] = it->second;
+    }
+    if (nums[i] < 0)
+      iNewXmlParts[keys[i]] = -1;  // duplicates are written only once
+  }
+  if (iCompressLevel > 0) {
+    Platform::parallelFor(n, [&](int i) {
+	if (nums[i] < 0)
+	  parts[i] = compressed(parts[i], iCompressLevel); });
+  }
+  for (int i = 0; i < n; ++i) {
+    if (nums[i] < 0) {
+      nums[i] = iNewXmlParts[keys[i]];
+      if (nums[i] < 0) {
+	nums[i] = startObject();
+	iStream << "<<\n";
+	createStream(parts[i].data(), parts[i].size(), iCompressLevel > 0);
+      }
+    }
+    iNewXmlParts[keys[i]] = nums[i];
+  }
+  iXmlStreamNum = startObject(1);
+  iStream << "<<\n/Type /Ipe\n/Parts [";
+  for (int num : nums)
+    iStream << " " << num << " 0 R";
+  iStream << " ]\n>> endobj\n";
+}
+
 //! Write a PDF string object to the PDF stream.
 void PdfWriter::writeString(String text)
 {
@@ -1142,23 +1608,55 @@ void PdfWriter::createTrailer()
   iStream << ">> endobj\n";
   // create Xref
   long xrefpos = iStream.tell();
-  iStream << "xref\n0 " << iObjNum << "\n";
-  for (int obj = 0; obj < iObjNum; ++obj) {
-    std::map<int, long>::const_iterator it = iXref.find(obj);
-    char s[12];
-    if (it == iXref.end()) {
-      std::sprintf(s, "%010d", obj);
-      iStream << s << " 00000 f \n"; // note the final space!
-    } else {
-      std::sprintf(s, "%010ld", iXref[obj]);
-      iStream << s << " 00000 n \n"; // note the final space!
+  if (iAppend) {
+    // only the objects of the update, in subsections of consecutive numbers
+    iStream << "xref\n";
+    for (auto it = iXref.begin(); it != iXref.end(); ) {
+      auto end = it;
+      int count = 0;
+      while (end != iXref.end() && end->first == it->first + count) {
+	++end;
+	++count;
+      }
+      iStream << it->first << " " << count << "\n";
+      for (; it != end; ++it) {
+	char s[12];
+	std::sprintf(s, "%010ld", it->second);
+	iStream << s << " 00000 n \n"; // note the final space!
+      }
+    }
+  } else {
+    iStream << "xref\n0 " << iObjNum << "\n";
+    for (int obj = 0; obj < iObjNum; ++obj) {
+      std::map<int, long>::const_iterator it = iXref.find(obj);
+      char s[12];
+      if (it == iXref.end()) {
+	std::sprintf(s, "%010d", obj);
+	iStream << s << " 00000 f \n"; // note the final space!
+      } else {
+	std::sprintf(s, "%010ld", iXref[obj]);
+	iStream << s << " 00000 n \n"; // note the final space!
+      }
     }
   }
   iStream << "trailer\n<<\n";
   iStream << "/Size " << iObjNum << "\n";
   iStream << "/Root " << catalogobj << " 0 R\n";
   iStream << "/Info " << infoobj << " 0 R\n";
+  if (iAppend)
+    iStream << "/Prev " << int(iRecord->iXRefPos) << "\n";
   iStream << ">>\nstartxref\n" << int(xrefpos) << "\n%%EOF\n";
+
+  if (iRecord) {
+    iRecord->iXRefPos = xrefpos;
+    iRecord->iObjNum = iObjNum;
+    iRecord->iBitmaps.clear();
+    for (const auto &bitmap : iBitmaps)
+      iRecord->iBitmaps.push_back(std::make_pair(bitmap, bitmap.objNum()));
+    iRecord->iContents = std::move(iNewContents);
+    iRecord->iPages = std::move(iNewPages);
+    iRecord->iXmlParts = std::move(iNewXmlParts);
+  }
 }
 
 // --------------------------------------------------------------------
@@ -35,9 +35,11 @@
 #include <windows.h>
 #include <shlobj.h>
 #include <direct.h>
+#include <io.h>
 #include <gdiplus.h>
 #else
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <dirent.h>
 #endif
 #ifdef __APPLE__
@@ -56,6 +58,7 @@
 #include <unistd.h>
 #include <clocale>
 #include <cstring>
+#include <thread>
 
 using namespace ipe;
 
@@ -394,6 +397,27 @@ String Platform::latexDirectory()
 #endif
 }
 
+//! Return subdirectory \a name of the Latex directory.
+/*! Used for the cache of Latex results and for parallel Latex runs.
+  The directory is created if necessary.  Returns an empty string if
+  it cannot be created. */
+String Platform::latexSubdirectory(String name)
+{
+  String latexDir = latexDirectory();
+  if (latexDir.empty())
+    return latexDir;
+  String dir = latexDir + name;
+#ifdef WIN32
+  if (!fileExists(dir) && Platform::mkdir(dir.z()) != 0)
+    return String();
+  return dir + "\\";
+#else
+  if (!fileExists(dir) && mkdir(dir.z(), 0700) != 0)
+    return String();
+  return dir + "/";
+#endif
+}
+
 //! Determine whether file exists.
 bool Platform::fileExists(String fname)
 {
@@ -404,6 +428,24 @@ bool Platform::fileExists(String fname)
 #endif
 }
 
+//! Determine modification time and size of file.
+/*! Returns false if the file does not exist. */
+bool Platform::fileStatus(String fname, int64_t &mtime, int64_t &size)
+{
+#ifdef WIN32
+  struct _stat64 st;
+  if (_wstat64(fname.w().data(), &st) != 0)
+    return false;
+#else
+  struct stat st;
+  if (stat(fname.z(), &st) != 0)
+    return false;
+#endif
+  mtime = st.st_mtime;
+  size = st.st_size;
+  return true;
+}
+
 //! Convert relative filename to absolute.
 /*! This also works when the filename does not exist, or at least it tries. */
 String Platform::realPath(String fname)
@@ -465,13 +507,122 @@ String Platform::readFile(String fname)
   if (!file)
     return String();
   String s;
-  int ch;
-  while ((ch = std::fgetc(file)) != EOF)
-    s.append(ch);
+  char buf[4096];
+  size_t n;
+  while ((n = std::fread(buf, 1, sizeof(buf), file)) > 0)
+    s.append(buf, int(n));
   std::fclose(file);
   return s;
 }
 
+// --------------------------------------------------------------------
+
+/*! \class ipe::MappedFileSource
+  \ingroup base
+  \brief Data source for parsing a file mapped into memory.
+
+  The entire file is available through span(), so parsers can scan it
+  without a function call per character.  If the file cannot be
+  mapped (for instance, because it is a pipe), it is read into memory
+  instead.
+
+  A mapped file must not be truncated or rewritten while the source
+  exists (on Unix, this raises SIGBUS, on Windows, the file cannot be
+  overwritten).  Sources that live long should therefore be read into
+  memory.
+*/
+
+//! Open and map the file \a fname.
+/*! If \a map is false, the file is read into memory instead.
+  Check isOpen() to see whether this was successful. */
+MappedFileSource::MappedFileSource(const char *fname, bool map)
+{
+  iOpen = false;
+  iMapped = false;
+  iData = nullptr;
+  iSize = 0;
+  iPos = 0;
+  std::FILE *file = Platform::fopen(fname, "rb");
+  if (!file)
+    return;
+  iOpen = true;
+#ifdef WIN32
+  HANDLE fh = (HANDLE) _get_osfhandle(_fileno(file));
+  LARGE_INTEGER size;
+  if (map && GetFileSizeEx(fh, &size) && size.QuadPart > 0) {
+    HANDLE mapping = CreateFileMapping(fh, nullptr, PAGE_READONLY, 0, 0,
+				      nullptr);
+    if (mapping) {
+      iData = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);  // the view keeps the mapping alive
+      if (iData) {
+	iSize = size.QuadPart;
+	iMapped = true;
+      }
+    }
+  }
+#else
+  struct stat st;
+  if (map && fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode)
+      && st.st_size > 0) {
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE,
+		   fileno(file), 0);
+    if (p != MAP_FAILED) {
+      madvise(p, st.st_size, MADV_SEQUENTIAL);
+      iData = (const char *) p;
+      iSize = st.st_size;
+      iMapped = true;
+    }
+  }
+#endif
+  if (!iMapped) {
+    char buf[0x10000];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), file)) > 0)
+      iCopy.append(buf, int(n));
+    iData = iCopy.data();
+    iSize = iCopy.size();
+  }
+  std::fclose(file);
+}
+
+MappedFileSource::~MappedFileSource()
+{
+  if (iMapped) {
+#ifdef WIN32
+    UnmapViewOfFile(iData);
+#else
+    munmap(const_cast<char *>(iData), iSize);
+#endif
+  }
+}
+
+int MappedFileSource::getChar()
+{
+  if (iPos >= iSize)
+    return EOF;
+  return uint8_t(iData[iPos++]);
+}
+
+int MappedFileSource::span(const char *&data)
+{
+  data = iData + iPos;
+  return int(std::min(iSize - iPos, size_t(0x7fffffff)));
+}
+
+void MappedFileSource::skip(int n)
+{
+  iPos += n;
+}
+
+//! Continue reading at offset \a pos in the file.
+void MappedFileSource::setPosition(size_t pos)
+{
+  iPos = std::min(pos, iSize);
+}
+
+// --------------------------------------------------------------------
+
 //! Runs latex on file text.tex in given directory.
 int Platform::runLatex(String dir, LatexType engine) noexcept
 {
@@ -644,6 +795,38 @@ int Platform::toNumber(String s, int &iValue, double &dValue)
   return 0;
 }
 
+// --------------------------------------------------------------------
+
+// is this thread executing a job of parallelFor?
+static thread_local bool inParallelJob = false;
+
+//! Run job(0), ..., job(n-1) on all cores.
+/*! When called from inside a job of another parallelFor, the jobs are
+  run one after the other on the calling thread, so that nested loops
+  do not start more threads than there are cores. */
+void Platform::parallelFor(int n, const std::function<void (int)> &job)
+{
+  int threads = std::min(n, int(std::thread::hardware_concurrency()));
+  if (inParallelJob || threads <= 1) {
+    for (int i = 0; i < n; ++i)
+      job(i);
+    return;
+  }
+  std::atomic<int> next(0);
+  auto worker = [&]() {
+    inParallelJob = true;
+    for (int i = next++; i < n; i = next++)
+      job(i);
+    inParallelJob = false;
+  };
+  std::vector<std::thread> pool;
+  for (int k = 1; k < threads; ++k)
+    pool.emplace_back(worker);
+  worker();
+  for (auto &t : pool)
+    t.join();
+}
+
 void ipeAssertionFailed(const char *file, int line, const char *assertion)
 {
   fprintf(stderr, "Assertion failed on line #%d (%s): '%s'\n",
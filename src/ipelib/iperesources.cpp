@@ -29,11 +29,43 @@
 */
 
 #include "iperesources.h"
+#include "ipeutils.h"
 
 using namespace ipe;
 
 // --------------------------------------------------------------------
 
+static void findRefs(const PdfObj *obj, int offset, PdfRenumber &renumber)
+{
+  if (obj->array()) {
+    for (int i = 0; i < obj->array()->count(); ++i)
+      findRefs(obj->array()->obj(i, nullptr), offset, renumber);
+  } else if (obj->dict()) {
+    for (int i = 0; i < obj->dict()->count(); ++i)
+      findRefs(obj->dict()->value(i), offset, renumber);
+  } else if (obj->ref())
+    renumber[obj->ref()->value()] = obj->ref()->value() + offset;
+}
+
+//! Return a copy of \a obj with all references shifted by \a offset.
+static PdfObj *copyObject(const PdfObj *obj, int offset)
+{
+  if (obj->ref())  // parser only reads references inside arrays and dicts
+    return new PdfRef(obj->ref()->value() + offset);
+  PdfRenumber renumber;
+  findRefs(obj, offset, renumber);
+  String s;
+  StringStream ss(s);
+  obj->write(ss, &renumber, false);
+  ss << "\n";  // a token must not end at end of input
+  Buffer buf(s.data(), s.size());
+  BufferSource source(buf);
+  PdfParser parser(source);
+  return parser.getObject();
+}
+
+// --------------------------------------------------------------------
+
 /*! \class ipe::PdfResourceBase
  * \ingroup base
  * \brief Base class providing access to PDF objects.
@@ -118,31 +150,36 @@ PdfResources::PdfResources()
   // nothing
 }
 
-void PdfResources::add(int num, PdfFile *file)
+void PdfResources::add(int num, PdfFile *file, int offset)
 {
-  if (object(num)) // already present
+  if (object(num + offset)) // already present
     return;
   std::unique_ptr<const PdfObj> obj = file->take(num);
   if (!obj)
     return;  // no such object
+  if (offset)
+    obj.reset(copyObject(obj.get(), offset));
+  if (!obj)
+    return;
   const PdfObj *q = obj.get();
-  iObjects[num] = std::move(obj);
-  addIndirect(q, file);
-  iEmbedSequence.push_back(num); // after all its dependencies!
+  iObjects[num + offset] = std::move(obj);
+  addIndirect(q, file, offset);
+  iEmbedSequence.push_back(num + offset); // after all its dependencies!
 }
 
-void PdfResources::addIndirect(const PdfObj *q, PdfFile *file)
+// References in q have already been shifted by offset
+void PdfResources::addIndirect(const PdfObj *q, PdfFile *file, int offset)
 {
   if (q->array()) {
     const PdfArray *arr = q->array();
     for (int i = 0; i < arr->count(); ++i)
-      addIndirect(arr->obj(i, nullptr), file);
+      addIndirect(arr->obj(i, nullptr), file, offset);
   } else if (q->dict()) {
     const PdfDict *dict = q->dict();
     for (int i = 0; i < dict->count(); ++i)
-      addIndirect(dict->value(i), file);
+      addIndirect(dict->value(i), file, offset);
   } else if (q->ref())
-    add(q->ref()->value(), file);
+    add(q->ref()->value() - offset, file, offset);
 }
 
 const PdfObj *PdfResources::object(int num) const noexcept
@@ -161,7 +198,12 @@ const PdfDict *PdfResources::baseResources() const noexcept
 
 //! Collect (recursively) all the given resources (of the one latex page).
 //! Takes ownership of all the scanned objects.
-bool PdfResources::collect(const PdfDict *resd, PdfFile *file)
+/*! To combine the resources of several PDF files, call collect() once
+  for each file.  Objects of the file are stored with their numbers
+  increased by \a offset, and resource names get the \a suffix, so
+  that they do not collide with resources collected earlier. */
+bool PdfResources::collect(const PdfDict *resd, PdfFile *file,
+			   int offset, String suffix)
 {
   /* A resource is a dictionary, like this:
     /Font << /F8 9 0 R /F10 18 0 R >>
@@ -178,17 +220,22 @@ bool PdfResources::collect(const PdfDict *resd, PdfFile *file)
       return false;
     }
     PdfDict *d = new PdfDict;
+    const PdfDict *old = resourcesOfKind(key);
+    if (old) {
+      for (int j = 0; j < old->count(); ++j)
+	d->add(old->key(j), copyObject(old->value(j), 0));
+    }
     for (int j = 0; j < rd->count(); ++j) {
-      if (!addToResource(d, rd->key(j), rd->value(j), file))
+      if (!addToResource(d, rd->key(j) + suffix, rd->value(j), file, offset))
 	return false;
     }
-    iPageResources->add(key, d);
+    iPageResources->set(key, d);
   }
   return true;
 }
 
 bool PdfResources::addToResource(PdfDict *d, String key,
-				 const PdfObj *el, PdfFile *file)
+				 const PdfObj *el, PdfFile *file, int offset)
 {
   if (el->name())
     d->add(key, new PdfName(el->name()->value()));
@@ -196,8 +243,8 @@ bool PdfResources::addToResource(PdfDict *d, String key,
     d->add(key, new PdfNumber(el->number()->value()));
   else if (el->ref()) {
     int ref = el->ref()->value();
-    d->add(key, new PdfRef(ref));
-    add(ref, file);             // take all dependencies from file
+    d->add(key, new PdfRef(ref + offset));
+    add(ref, file, offset);     // take all dependencies from file
   } else if (el->array()) {
     PdfArray *a = new PdfArray;
     for (int i = 0; i < el->array()->count(); ++i) {
@@ -216,7 +263,7 @@ bool PdfResources::addToResource(PdfDict *d, String key,
     const PdfDict *eld = el->dict();
     PdfDict *d1 = new PdfDict;
     for (int i = 0; i < eld->count(); ++i) {
-      if (!addToResource(d1, eld->key(i), eld->value(i), file))
+      if (!addToResource(d1, eld->key(i), eld->value(i), file, offset))
 	return false;
     }
     d->add(key, d1);
@@ -34,6 +34,8 @@
 #include "ipereference.h"
 #include "ipepath.h"
 
+#include <algorithm>
+
 using namespace ipe;
 
 /*! \defgroup high Ipe Utilities
@@ -81,8 +83,12 @@ CollectSegs::CollectSegs(const Vector &mouse, double snapDist,
   : iMouse(mouse), iDist(snapDist), iView(view)
 {
   iMatrices.push_back(Matrix()); // identity matrix
-  for (int i = 0; i < page->count(); ++i) {
-    if (page->objSnapsInView(i, iView))
+  std::vector<int> objs;
+  page->findObjects(Rect(mouse - Vector(snapDist, snapDist),
+			 mouse + Vector(snapDist, snapDist)), objs);
+  for (int i : objs) {
+    if (page->objSnapsInView(i, iView) &&
+	!page->bbox(i).certainClearance(mouse, snapDist))
       page->object(i)->accept(*this);
   }
 }
@@ -162,6 +168,97 @@ void CollectSegs::visitPath(const Path *obj)
 
 // --------------------------------------------------------------------
 
+// Bounding boxes are enlarged by this much in the broad phase, to be
+// safe against rounding errors.
+const double BROAD_PHASE_MARGIN = 1e-3;
+
+// kinds of primitives collected by CollectSegs
+enum { KSeg, KBezier, KArc };
+
+struct SnapItem {
+  Rect iBox;
+  int iKind;
+  int iIndex;
+};
+
+/* A pair of primitives to intersect.  The outer primitive is the one
+   with the larger kind (or the smaller index), the rank orders inner
+   primitives as the nested loops in intersectionSnap used to. */
+struct SnapPair {
+  int iOuterKind;
+  int iOuter;
+  int iInnerRank;
+  int iInnerKind;
+  int iInner;
+
+  bool operator<(const SnapPair &rhs) const {
+    if (iOuterKind != rhs.iOuterKind) return iOuterKind < rhs.iOuterKind;
+    if (iOuter != rhs.iOuter) return iOuter < rhs.iOuter;
+    if (iInnerRank != rhs.iInnerRank) return iInnerRank < rhs.iInnerRank;
+    return iInner < rhs.iInner;
+  }
+};
+
+/* Broad phase for intersection snapping: find all pairs of primitives
+   whose bounding boxes overlap, by sorting the boxes on their left
+   side and sweeping from left to right.  The exact intersection
+   tests reject pairs with disjoint bounding boxes anyway, so this
+   only skips work.  The pairs are returned in the order in which
+   they used to be tested. */
+static void overlappingPairs(const CollectSegs &segs,
+			     std::vector<SnapPair> &pairs)
+{
+  std::vector<SnapItem> items;
+  Vector margin(BROAD_PHASE_MARGIN, BROAD_PHASE_MARGIN);
+  auto add = [&](Rect box, int kind, int index) {
+    items.push_back(SnapItem { Rect(box.bottomLeft() - margin,
+				    box.topRight() + margin), kind, index });
+  };
+  for (int i = 0; i < size(segs.iSegs); ++i)
+    add(Rect(segs.iSegs[i].iP, segs.iSegs[i].iQ), KSeg, i);
+  for (int i = 0; i < size(segs.iBeziers); ++i) {
+    const Bezier &b = segs.iBeziers[i];
+    Rect box(b.iV[0], b.iV[1]);
+    box.addPoint(b.iV[2]);
+    box.addPoint(b.iV[3]);
+    add(box, KBezier, i);
+  }
+  for (int i = 0; i < size(segs.iArcs); ++i)
+    add(segs.iArcs[i].bbox(), KArc, i);
+
+  std::sort(items.begin(), items.end(),
+	    [](const SnapItem &a, const SnapItem &b) {
+	      return a.iBox.bottomLeft().x < b.iBox.bottomLeft().x; });
+
+  std::vector<const SnapItem *> active;
+  for (const SnapItem &item : items) {
+    double left = item.iBox.bottomLeft().x;
+    // drop boxes that end before this one starts
+    active.erase(std::remove_if(active.begin(), active.end(),
+				[left](const SnapItem *a) {
+				  return a->iBox.topRight().x < left; }),
+		 active.end());
+    for (const SnapItem *a : active) {
+      if (a->iBox.bottomLeft().y > item.iBox.topRight().y ||
+	  item.iBox.bottomLeft().y > a->iBox.topRight().y)
+	continue;
+      const SnapItem *outer = a;
+      const SnapItem *inner = &item;
+      if (inner->iKind > outer->iKind ||
+	  (inner->iKind == outer->iKind && inner->iIndex < outer->iIndex))
+	std::swap(outer, inner);
+      int rank = (inner->iKind == outer->iKind) ? 0 :
+	(inner->iKind == KBezier) ? 1 : 2;
+      pairs.push_back(SnapPair { outer->iKind, outer->iIndex, rank,
+				 inner->iKind, inner->iIndex });
+    }
+    active.push_back(&item);
+  }
+  std::sort(pairs.begin(), pairs.end());
+}
+
+// --------------------------------------------------------------------
+
 /*! Find line through \a base with slope determined by angular snap
   size and direction. */
 Line Snap::getLine(const Vector &mouse, const Vector &base) const noexcept
@@ -187,34 +284,36 @@ void Snap::intersectionSnap(const Vector &pos,  Vector &fifi,
   Vector v;
   std::vector<Vector> pts;
 
-  // 1. seg-seg intersections
-  for (int i = 0; i < size(segs.iSegs); ++i) {
-    for (int j = i + 1; j < size(segs.iSegs); ++j) {
+  // only primitives with overlapping bounding boxes can intersect
+  std::vector<SnapPair> pairs;
+  overlappingPairs(segs, pairs);
+
+  for (const SnapPair &p : pairs) {
+    int i = p.iOuter;
+    int j = p.iInner;
+    switch (p.iOuterKind) {
+    case KSeg: // seg-seg intersections
       if (segs.iSegs[i].intersects(segs.iSegs[j], v))
 	pts.push_back(v);
+      break;
+    case KBezier: // bezier-bezier and bezier-seg intersections
+      if (p.iInnerKind == KBezier) {
+	if (j > i+1 || !segs.iBeziersCont[j])
+	  segs.iBeziers[i].intersect(segs.iBeziers[j], pts);
+      } else
+	segs.iBeziers[i].intersect(segs.iSegs[j], pts);
+      break;
+    case KArc: // arc-arc, arc-bezier, and arc-segment intersections
+      if (p.iInnerKind == KArc)
+	segs.iArcs[i].intersect(segs.iArcs[j], pts);
+      else if (p.iInnerKind == KBezier)
+	segs.iArcs[i].intersect(segs.iBeziers[j], pts);
+      else
+	segs.iArcs[i].intersect(segs.iSegs[j], pts);
+      break;
     }
   }
 
-  // 2. bezier-bezier and bezier-seg intersections
-  for (int i = 0; i < size(segs.iBeziers); ++i) {
-    for (int j = i + 1; j < size(segs.iBeziers); ++j) {
-      if (j > i+1 || !segs.iBeziersCont[j])
-	segs.iBeziers[i].intersect(segs.iBeziers[j], pts);
-    }
-    for (int j = 0; j < size(segs.iSegs); ++j)
-      segs.iBeziers[i].intersect(segs.iSegs[j], pts);
-  }
-
-  // 3. arc-arc, arc-bezier, and arc-segment intersections
-  for (int i = 0; i < size(segs.iArcs); ++i) {
-    for (int j = i+1; j < size(segs.iArcs); ++j)
-      segs.iArcs[i].intersect(segs.iArcs[j], pts);
-    for (int j = 0; j < size(segs.iBeziers); ++j)
-      segs.iArcs[i].intersect(segs.iBeziers[j], pts);
-    for (int j = 0; j < size(segs.iSegs); ++j)
-      segs.iArcs[i].intersect(segs.iSegs[j], pts);
-  }
-
   double d = snapDist;
   Vector pos1 = pos;
   double d1;
@@ -281,9 +380,15 @@ Snap::TSnapModes Snap::simpleSnap(Vector &pos, const Page *page, int view,
   double d = snapDist;
   Vector fifi = pos;
 
+  // only objects near the mouse can snap
+  std::vector<int> objs;
+  if (iSnap & (ESnapVtx | ESnapCtl | ESnapBd))
+    page->findObjects(Rect(pos - Vector(snapDist, snapDist),
+			   pos + Vector(snapDist, snapDist)), objs);
+
   // highest priority: vertex snapping
   if (iSnap & ESnapVtx) {
-    for (int i = 0; i < page->count(); ++i) {
+    for (int i : objs) {
       if (page->objSnapsInView(i, view))
 	page->snapVtx(i, pos, fifi, d);
     }
@@ -294,7 +399,7 @@ Snap::TSnapModes Snap::simpleSnap(Vector &pos, const Page *page, int view,
   double dvtx = d;
   Vector fifiCtl = pos;
   if (iSnap & ESnapCtl) {
-    for (int i = 0; i < page->count(); ++i) {
+    for (int i : objs) {
       if (page->objSnapsInView(i, view))
 	page->snapCtl(i, pos, fifiCtl, d);
     }
@@ -321,7 +426,7 @@ Snap::TSnapModes Snap::simpleSnap(Vector &pos, const Page *page, int view,
 
   // boundary snapping
   if (iSnap & ESnapBd) {
-    for (int i = 0; i < page->count(); ++i) {
+    for (int i : objs) {
       if (page->objSnapsInView(i, view))
 	page->snapBnd(i, pos, fifi, d);
     }
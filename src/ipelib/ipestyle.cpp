@@ -124,12 +124,23 @@ StyleSheet::StyleSheet()
   iLineJoin = EDefaultJoin;
   iLineCap = EDefaultCap;
   iFillRule = EDefaultRule;
+  modified();
+}
+
+// revision numbers are unique over all style sheets
+static std::atomic<uint32_t> nextRevision(0);
+
+//! Give the style sheet a new revision number.
+void StyleSheet::modified()
+{
+  iRevision = ++nextRevision;
 }
 
 //! Set page layout.
 void StyleSheet::setLayout(const Layout &layout)
 {
   iLayout = layout;
+  modified();
 }
 
 //! Return page layout (or 0 if none defined).
@@ -154,12 +165,14 @@ const TextPadding *StyleSheet::textPadding() const
 void StyleSheet::setTextPadding(const TextPadding &pad)
 {
   iTextPadding = pad;
+  modified();
 }
 
 //! Set style of page titles.
 void StyleSheet::setTitleStyle(const TitleStyle &ts)
 {
   iTitleStyle = ts;
+  modified();
 }
 
 //! Return title style (or 0 if none defined).
@@ -175,6 +188,7 @@ const StyleSheet::TitleStyle *StyleSheet::titleStyle() const
 void StyleSheet::setPageNumberStyle(const PageNumberStyle &pns)
 {
   iPageNumberStyle = pns;
+  modified();
 }
 
 //! Return page number style.
@@ -191,6 +205,7 @@ void StyleSheet::addGradient(Attribute name, const Gradient &s)
 {
   assert(name.isSymbolic());
   iGradients[name.index()] = s;
+  modified();
 }
 
 //! Find gradient in style sheet cascade.
@@ -210,6 +225,7 @@ void StyleSheet::addTiling(Attribute name, const Tiling &s)
 {
   assert(name.isSymbolic());
   iTilings[name.index()] = s;
+  modified();
 }
 
 //! Find tiling in style sheet cascade.
@@ -228,6 +244,7 @@ void StyleSheet::addEffect(Attribute name, const Effect &e)
 {
   assert(name.isSymbolic());
   iEffects[name.index()] = e;
+  modified();
 }
 
 const Effect *StyleSheet::findEffect(Attribute sym) const
@@ -247,18 +264,21 @@ const Effect *StyleSheet::findEffect(Attribute sym) const
 void StyleSheet::setLineCap(TLineCap s)
 {
   iLineCap = s;
+  modified();
 }
 
 //! Set line join.
 void StyleSheet::setLineJoin(TLineJoin s)
 {
   iLineJoin = s;
+  modified();
 }
 
 //! Set fill rule.
 void StyleSheet::setFillRule(TFillRule s)
 {
   iFillRule = s;
+  modified();
 }
 
 // --------------------------------------------------------------------
@@ -268,6 +288,7 @@ void StyleSheet::addSymbol(Attribute name, const Symbol &symbol)
 {
   assert(name.isSymbolic());
   iSymbols[name.index()] = symbol;
+  modified();
 }
 
 //! Find a symbol object with given name.
@@ -292,6 +313,7 @@ void StyleSheet::add(Kind kind, Attribute name, Attribute value)
   if (!name.isSymbolic())
     return;
   iMap[name.index() | (kind << SHIFT)] = value;
+  modified();
 }
 
 //! Find a symbolic attribute.
@@ -361,6 +383,7 @@ void StyleSheet::remove(Kind kind, Attribute sym)
     iMap.erase(sym.index() | (kind << SHIFT));
     break;
   };
+  modified();
 }
 
 // --------------------------------------------------------------------
@@ -592,11 +615,158 @@ void StyleSheet::saveAsXml(Stream &stream, bool saveBitmaps) const
   lookup is done from top to bottom, and returns as soon as a match is
   found. Ipe always appends the built-in "standard" style sheet at the
   bottom of the cascade.
+
+  The cascade keeps a flattened table of the definitions in all its
+  sheets, so that a lookup does not need to search the sheets.  The
+  table is rebuilt when a sheet is inserted, removed, or modified.
 */
 
+// number of different kinds
+const int KINDS = EEffect + 1;
+
+//! Flattened lookup table of a cascade.
+/*! For each kind, the table has a dense array indexed by the
+  repository index of the symbolic name. */
+struct Cascade::Table {
+  Table(const std::vector<StyleSheet *> &sheets);
+  bool current(const std::vector<StyleSheet *> &sheets) const;
+  int sheet(Kind kind, Attribute sym) const;
+  Attribute value(Kind kind, Attribute sym) const;
+  template<typename T>
+  static const T *object(const std::vector<const T *> &objects,
+			 Attribute sym);
+
+  //! The style sheets and their revisions when the table was built.
+  std::vector<std::pair<const StyleSheet *, uint32_t>> iSheets;
+  //! Last revision of any style sheet when the table was known to be current.
+  mutable std::atomic<uint32_t> iLastRevision;
+  //! Index of the sheet defining a name, or -1.
+  std::vector<int> iSheet[KINDS];
+  //! Value of a name (undefined if not defined).
+  std::vector<Attribute> iValue[KINDS];
+  //! Value of "normal".
+  Attribute iNormal[KINDS];
+  std::vector<const Symbol *> iSymbols;
+  std::vector<const Gradient *> iGradients;
+  std::vector<const Tiling *> iTilings;
+  std::vector<const Effect *> iEffects;
+  const Layout *iLayout;
+  const TextPadding *iTextPadding;
+  const StyleSheet::TitleStyle *iTitleStyle;
+  const StyleSheet::PageNumberStyle *iPageNumberStyle;
+  TLineCap iLineCap;
+  TLineJoin iLineJoin;
+  TFillRule iFillRule;
+};
+
+template<typename T>
+static void setEntry(std::vector<T> &v, int i, T value, T none = T())
+{
+  if (i >= size(v))
+    v.resize(i + 1, none);
+  v[i] = value;
+}
+
+Cascade::Table::Table(const std::vector<StyleSheet *> &sheets)
+  : iLastRevision(nextRevision.load())
+{
+  iLayout = nullptr;
+  iTextPadding = nullptr;
+  iTitleStyle = nullptr;
+  iPageNumberStyle = nullptr;
+  iLineCap = EButtCap;
+  iLineJoin = ERoundJoin;
+  iFillRule = EEvenOddRule;
+  // go from bottom to top, so that higher sheets override lower ones
+  for (int i = size(sheets) - 1; i >= 0; --i) {
+    const StyleSheet *sheet = sheets[i];
+    for (int kind = 0; kind < KINDS; ++kind) {
+      AttributeSeq names;
+      sheet->allNames(Kind(kind), names);
+      for (const auto &name : names) {
+	int k = name.index();
+	setEntry(iSheet[kind], k, i, -1);
+	switch (kind) {
+	case ESymbol:
+	  setEntry(iSymbols, k, sheet->findSymbol(name));
+	  break;
+	case EGradient:
+	  setEntry(iGradients, k, sheet->findGradient(name));
+	  break;
+	case ETiling:
+	  setEntry(iTilings, k, sheet->findTiling(name));
+	  break;
+	case EEffect:
+	  setEntry(iEffects, k, sheet->findEffect(name));
+	  break;
+	default:
+	  setEntry(iValue[kind], k, sheet->find(Kind(kind), name),
+		   Attribute::UNDEFINED());
+	  break;
+	}
+      }
+    }
+    if (sheet->layout()) iLayout = sheet->layout();
+    if (sheet->textPadding()) iTextPadding = sheet->textPadding();
+    if (sheet->titleStyle()) iTitleStyle = sheet->titleStyle();
+    if (sheet->pageNumberStyle()) iPageNumberStyle = sheet->pageNumberStyle();
+    if (sheet->lineCap() != EDefaultCap) iLineCap = sheet->lineCap();
+    if (sheet->lineJoin() != EDefaultJoin) iLineJoin = sheet->lineJoin();
+    if (sheet->fillRule() != EDefaultRule) iFillRule = sheet->fillRule();
+  }
+  for (const StyleSheet *sheet : sheets)
+    iSheets.push_back(std::make_pair(sheet, sheet->revision()));
+  for (int kind = 0; kind < KINDS; ++kind) {
+    Attribute normal = Attribute::normal(Kind(kind));
+    if (sheets.empty())
+      iNormal[kind] = Attribute::UNDEFINED();
+    else if (normal.isSymbolic())
+      iNormal[kind] = value(Kind(kind), normal);
+    else
+      iNormal[kind] = normal;
+  }
+}
+
+//! Has the table been built from these sheets in their current state?
+bool Cascade::Table::current(const std::vector<StyleSheet *> &sheets) const
+{
+  if (sheets.size() != iSheets.size())
+    return false;
+  for (int i = 0; i < size(sheets); ++i) {
+    if (iSheets[i].first != sheets[i] ||
+	iSheets[i].second != sheets[i]->revision())
+      return false;
+  }
+  return true;
+}
+
+inline int Cascade::Table::sheet(Kind kind, Attribute sym) const
+{
+  int k = sym.index();
+  return k < size(iSheet[kind]) ? iSheet[kind][k] : -1;
+}
+
+inline Attribute Cascade::Table::value(Kind kind, Attribute sym) const
+{
+  int k = sym.index();
+  return k < size(iValue[kind]) ? iValue[kind][k] : Attribute::UNDEFINED();
+}
+
+template<typename T>
+inline const T *Cascade::Table::object(const std::vector<const T *> &objects,
+				       Attribute sym)
+{
+  if (!sym.isSymbolic())
+    return nullptr;
+  int k = sym.index();
+  return k < size(objects) ? objects[k] : nullptr;
+}
+
+// --------------------------------------------------------------------
+
 //! Create an empty cascade.
 /*! This does not add the standard style sheet. */
-Cascade::Cascade()
+Cascade::Cascade() : iTable(nullptr)
 {
   // nothing
 }
@@ -611,7 +781,7 @@ static void destruct_sheets(std::vector<StyleSheet *> &sheets)
 }
 
 //! Copy constructor.
-Cascade::Cascade(const Cascade &rhs)
+Cascade::Cascade(const Cascade &rhs) : iTable(nullptr)
 {
   destruct_sheets(iSheets);
   for (int i = 0; i < rhs.count(); ++i)
@@ -622,6 +792,7 @@ Cascade::Cascade(const Cascade &rhs)
 Cascade &Cascade::operator=(const Cascade &rhs)
 {
   if (this != &rhs) {
+    invalidate();
     destruct_sheets(iSheets);
     for (int i = 0; i < rhs.count(); ++i)
       iSheets.push_back(new StyleSheet(*rhs.iSheets[i]));
@@ -632,6 +803,7 @@ Cascade &Cascade::operator=(const Cascade &rhs)
 //! Destructor.
 Cascade::~Cascade()
 {
+  invalidate();
   destruct_sheets(iSheets);
 }
 
@@ -639,6 +811,7 @@ Cascade::~Cascade()
 /*! Takes ownership of \a sheet. */
 void Cascade::insert(int index, StyleSheet *sheet)
 {
+  invalidate();
   iSheets.insert(iSheets.begin() + index, sheet);
 }
 
@@ -646,9 +819,49 @@ void Cascade::insert(int index, StyleSheet *sheet)
 /*! The old sheet is deleted. */
 void Cascade::remove(int index)
 {
+  invalidate();
   iSheets.erase(iSheets.begin() + index);
 }
 
+//! Forget the lookup tables.
+/*! Only called when the cascade itself is modified, and so nobody can
+  be using the tables. */
+void Cascade::invalidate()
+{
+  iTable.store(nullptr);
+  iTables.clear();
+}
+
+/*! Return the lookup table, rebuilding it if the sheets have changed.
+  Several threads can look up attributes at the same time, as long as
+  nobody modifies the cascade or its sheets. */
+const Cascade::Table *Cascade::table() const
+{
+  Table *t = iTable.load(std::memory_order_acquire);
+  // if no style sheet at all has been modified, the table is current
+  uint32_t revision = nextRevision.load(std::memory_order_acquire);
+  if (t && t->iLastRevision.load(std::memory_order_relaxed) == revision)
+    return t;
+  if (t && t->current(iSheets)) {
+    t->iLastRevision.store(revision, std::memory_order_relaxed);
+    return t;
+  }
+  std::lock_guard<std::mutex> lock(iTableMutex);
+  t = iTable.load(std::memory_order_relaxed);
+  if (t && t->current(iSheets))
+    return t;
+  // The outdated table is retired, not deleted, as other threads may
+  // still be looking up attributes in it.  Tables retired before are
+  // no longer in use: a sheet has been modified since, and nobody
+  // looks up attributes while a sheet is being modified.
+  if (iTables.size() > 1)
+    iTables.erase(iTables.begin(), iTables.end() - 1);
+  Table *table = new Table(iSheets);
+  iTables.emplace_back(table);
+  iTable.store(table, std::memory_order_release);
+  return table;
+}
+
 void Cascade::saveAsXml(Stream &stream) const
 {
   for (int i = count() - 1; i >= 0; --i) {
@@ -659,108 +872,71 @@ void Cascade::saveAsXml(Stream &stream) const
 
 bool Cascade::has(Kind kind, Attribute sym) const
 {
-  for (int i = 0; i < count(); ++i) {
-    if (iSheets[i]->has(kind, sym))
-      return true;
-  }
-  return false;
+  if (!sym.isSymbolic())
+    return count() > 0;
+  return table()->sheet(kind, sym) >= 0;
 }
 
 Attribute Cascade::find(Kind kind, Attribute sym) const
 {
-  for (int i = 0; i < count(); ++i) {
-    Attribute a = iSheets[i]->find(kind, sym);
-    if (a != Attribute::UNDEFINED())
-      return a;
-  }
-  Attribute normal = Attribute::normal(kind);
-  for (int i = 0; i < count(); ++i) {
-    Attribute a = iSheets[i]->find(kind, normal);
-    if (a != Attribute::UNDEFINED())
-      return a;
-  }
-  // this shouldn't happen
-  return Attribute::UNDEFINED();
+  if (!sym.isSymbolic())
+    return count() > 0 ? sym : Attribute::UNDEFINED();
+  const Table *t = table();
+  Attribute a = t->value(kind, sym);
+  if (a != Attribute::UNDEFINED())
+    return a;
+  // this is undefined if not even "normal" is defined
+  return t->iNormal[kind];
 }
 
 const Symbol *Cascade::findSymbol(Attribute sym) const
 {
-  for (int i = 0; i < count(); ++i) {
-    const Symbol *s = iSheets[i]->findSymbol(sym);
-    if (s) return s;
-  }
-  return nullptr;
+  return Table::object(table()->iSymbols, sym);
 }
 
 const Gradient *Cascade::findGradient(Attribute sym) const
 {
-  for (int i = 0; i < count(); ++i) {
-    const Gradient *s = iSheets[i]->findGradient(sym);
-    if (s) return s;
-  }
-  return nullptr;
+  return Table::object(table()->iGradients, sym);
 }
 
 const Tiling *Cascade::findTiling(Attribute sym) const
 {
-  for (int i = 0; i < count(); ++i) {
-    const Tiling *s = iSheets[i]->findTiling(sym);
-    if (s) return s;
-  }
-  return nullptr;
+  return Table::object(table()->iTilings, sym);
 }
 
 const Effect *Cascade::findEffect(Attribute sym) const
 {
-  for (int i = 0; i < count(); ++i) {
-    const Effect *s = iSheets[i]->findEffect(sym);
-    if (s) return s;
-  }
-  return nullptr;
+  return Table::object(table()->iEffects, sym);
 }
 
 //! Find page layout (such as text margins).
 const Layout *Cascade::findLayout() const
 {
-  for (int i = 0; i < count(); ++i) {
-    const Layout *l = iSheets[i]->layout();
-    if (l) return l;
-  }
+  const Layout *l = table()->iLayout;
   // must never happen
-  assert(false);
-  return nullptr;
+  assert(l);
+  return l;
 }
 
 //! Find text padding (for text bbox computation).
 const TextPadding *Cascade::findTextPadding() const
 {
-  for (int i = 0; i < count(); ++i) {
-    const TextPadding *t = iSheets[i]->textPadding();
-    if (t) return t;
-  }
+  const TextPadding *t = table()->iTextPadding;
   // must never happen
-  assert(false);
-  return nullptr;
+  assert(t);
+  return t;
 }
 
 //! Get style of page titles (or 0 if none defined).
 const StyleSheet::TitleStyle *Cascade::findTitleStyle() const
 {
-  for (int i = 0; i < count(); ++i) {
-    const StyleSheet::TitleStyle *ts = iSheets[i]->titleStyle();
-    if (ts) return ts;
-  }
-  return nullptr;
+  return table()->iTitleStyle;
 }
 
 //! Return style of page numbering (or 0 if none defined).
 const StyleSheet::PageNumberStyle *Cascade::findPageNumberStyle() const
 {
-  for (int i = 0; i < count(); ++i) {
-    const StyleSheet::PageNumberStyle *pns = iSheets[i]->pageNumberStyle();
-    if (pns) return pns;
-  }
-  return nullptr;
+  return table()->iPageNumberStyle;
 }
 
 //! Return total LaTeX preamble (of the whole cascade).
@@ -775,29 +951,17 @@ String Cascade::findPreamble() const
 
 TLineCap Cascade::lineCap() const
 {
-  for (int i = 0; i < count(); ++i) {
-    if (iSheets[i]->lineCap() != EDefaultCap)
-      return iSheets[i]->lineCap();
-  }
-  return EButtCap;  // should not happen
+  return table()->iLineCap;
 }
 
 TLineJoin Cascade::lineJoin() const
 {
-  for (int i = 0; i < count(); ++i) {
-    if (iSheets[i]->lineJoin() != EDefaultJoin)
-      return iSheets[i]->lineJoin();
-  }
-  return ERoundJoin;  // should not happen
+  return table()->iLineJoin;
 }
 
 TFillRule Cascade::fillRule() const
 {
-  for (int i = 0; i < count(); ++i) {
-    if (iSheets[i]->fillRule() != EDefaultRule)
-      return iSheets[i]->fillRule();
-  }
-  return EEvenOddRule;  // should not happen
+  return table()->iFillRule;
 }
 
 void Cascade::allNames(Kind kind, AttributeSeq &seq) const
@@ -820,11 +984,7 @@ void Cascade::allNames(Kind kind, AttributeSeq &seq) const
 int Cascade::findDefinition(Kind kind, Attribute sym) const
 {
   assert(sym.isSymbolic());
-  for (int i = 0; i < count(); ++i) {
-    if (iSheets[i]->has(kind, sym))
-      return i;
-  }
-  return -1;
+  return table()->sheet(kind, sym);
 }
 
 // --------------------------------------------------------------------
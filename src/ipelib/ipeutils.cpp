@@ -38,6 +38,9 @@
 
 #include <zlib.h>
 
+#include <algorithm>
+#include <cstring>
+
 using namespace ipe;
 
 // --------------------------------------------------------------------
@@ -449,6 +452,50 @@ int Base64Source::getChar()
   return uint8_t(iBuf[0]);
 };
 
+//! Decode up to \a n bytes into \a buf.
+/*! Complete groups of four characters are decoded directly from the
+  span of the underlying source.  Padding, groups crossing the end
+  of the span, and the end of the stream go through getChar(). */
+int Base64Source::getChars(char *buf, int n)
+{
+  int k = 0;
+  while (k < n) {
+    if (!iEof && iIndex == iBufLen) {
+      const char *data;
+      int m = iSource.span(data);
+      int i = 0;
+      while (n - k >= 3) {
+	int j = i;
+	uint32_t w = 0;
+	int g = 0;
+	while (g < 4 && j < m) {
+	  int ch = uint8_t(data[j++]);
+	  if (ch == '\n' || ch == '\r' || ch == ' ')
+	    continue;
+	  if (ch == '=' || base64illegal(ch))
+	    break;
+	  w = (w << 6) | base64value(ch);
+	  ++g;
+	}
+	if (g < 4)
+	  break;
+	buf[k++] = (w >> 16) & 0xff;
+	buf[k++] = (w >> 8) & 0xff;
+	buf[k++] = w & 0xff;
+	i = j;
+      }
+      iSource.skip(i);
+      if (k == n)
+	break;
+    }
+    int ch = getChar();
+    if (ch == EOF)
+      break;
+    buf[k++] = char(ch);
+  }
+  return k;
+}
+
 // --------------------------------------------------------------------
 
 /*! \class ipe::DeflateStream
@@ -461,7 +508,7 @@ struct DeflateStream::Private {
 };
 
 DeflateStream::DeflateStream(Stream &stream, int level)
-  : iStream(stream), iIn(0x400), iOut(0x400) // create buffers
+  : iStream(stream), iIn(0x10000), iOut(0x10000) // create buffers
 {
   iPriv = new Private;
   z_streamp z = &iPriv->iFlate;
@@ -491,13 +538,39 @@ DeflateStream::~DeflateStream()
 void DeflateStream::putChar(char ch)
 {
   iIn[iN++] = ch;
-  if (iN < iIn.size())
-    return;
+  if (iN == iIn.size())
+    flush();
+}
 
-  // compress and write
+void DeflateStream::putString(String s)
+{
+  putRaw(s.data(), s.size());
+}
+
+void DeflateStream::putCString(const char *s)
+{
+  putRaw(s, std::strlen(s));
+}
+
+void DeflateStream::putRaw(const char *data, int size)
+{
+  while (size > 0) {
+    int n = std::min(size, iIn.size() - iN);
+    std::memcpy(iIn.data() + iN, data, n);
+    iN += n;
+    data += n;
+    size -= n;
+    if (iN == iIn.size())
+      flush();
+  }
+}
+
+// compress and write the input buffer
+void DeflateStream::flush()
+{
   z_streamp z = &iPriv->iFlate;
   z->next_in = (Bytef *) iIn.data();
-  z->avail_in = iIn.size();
+  z->avail_in = iN;
   while (z->avail_in) {
     z->next_out = (Bytef *) iOut.data();
     z->avail_out = iOut.size();
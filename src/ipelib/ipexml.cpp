@@ -30,6 +30,8 @@
 
 #include "ipexml.h"
 
+#include <cstring>
+
 using namespace ipe;
 
 // --------------------------------------------------------------------
@@ -123,6 +125,27 @@ void XmlParser::skipWhitespace()
     getChar();
 }
 
+//! Append characters to \a s until \a stop or the end of the input.
+/*! Returns with iCh equal to \a stop (or EOF).  Runs of characters
+  are copied directly from the span of the data source, if it has
+  one. */
+void XmlParser::appendUntil(int stop, String &s)
+{
+  while (!eos() && iCh != stop) {
+    s += char(iCh);
+    const char *data;
+    int n = iSource.span(data);
+    if (n > 0) {
+      const char *end = (const char *) memchr(data, stop, n);
+      int m = end ? end - data : n;
+      s.append(data, m);
+      iSource.skip(m);
+      iPos += m;
+    }
+    getChar();
+  }
+}
+
 //! Parse whitespace and the name of a tag.
 /*! If the tag is a closing tag, skips > and returns with stream after that.
   Otherwise, returns with stream just after the tag name.
@@ -259,10 +282,7 @@ bool XmlParser::parseAttributes(XmlAttributes &attr, bool qm)
       return false;
     getChar();
     String val;
-    while (!eos() && iCh != quote) {
-      val += char(iCh);
-      getChar();
-    }
+    appendUntil(quote, val);
     if (iCh != quote)
       return false;
     getChar();
@@ -288,36 +308,27 @@ bool XmlParser::parseAttributes(XmlAttributes &attr, bool qm)
 bool XmlParser::parsePCDATA(String tag, String &pcdata)
 {
   String s;
-  bool haveEntity = false;
-  for (;;) {
-    if (eos())
+  appendUntil('<', s);
+  if (eos())
+    return false;
+  getChar();
+  if (iCh != '/')
+    return false;
+  getChar();
+  for (int i = 0; i < tag.size(); i++) {
+    if (iCh != tag[i])
       return false;
-    if (iCh == '<') {
-      getChar();
-      if (iCh != '/')
-	return false;
-      getChar();
-      for (int i = 0; i < tag.size(); i++) {
-	if (iCh != tag[i])
-	  return false;
-	getChar();
-      }
-      skipWhitespace();
-      if (iCh != '>')
-	return false;
-      getChar();
-      if (haveEntity)
-	pcdata = fromXml(s);
-      else
-	pcdata = s;
-      return true;
-    } else {
-      if (iCh == '&')
-	haveEntity = true;
-      s += char(iCh);
-    }
     getChar();
   }
+  skipWhitespace();
+  if (iCh != '>')
+    return false;
+  getChar();
+  if (s.find('&') >= 0)
+    pcdata = fromXml(s);
+  else
+    pcdata = s;
+  return true;
 }
 
 // --------------------------------------------------------------------
@@ -217,6 +217,10 @@ static uint32_t check_flags(lua_State *L, int index)
   if (lua_toboolean(L, -1))
     flags |= SaveFlag::MarkedView;
   lua_pop(L, 1);
+  lua_getfield(L, index, "incremental");
+  if (lua_toboolean(L, -1))
+    flags |= SaveFlag::Incremental;
+  lua_pop(L, 1);
   return flags;
 }
 
@@ -648,6 +652,161 @@ static int image_constructor(lua_State *L)
   return 1;
 }
 
+// --------------------------------------------------------------------
+// Bytecode cache
+// --------------------------------------------------------------------
+
+/* Lua sources loaded through load_cached are compiled only once.  The
+   bytecode is kept in the "luac" subdirectory of the Latex directory,
+   one file per source, after a header with the Lua and Ipe versions
+   and the path, modification time, and size of the source.  Setting
+   the environment variable IPENOLUACACHE disables the cache. */
+
+// FNV-1a
+static uint64_t hashString(const String &s)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < s.size(); ++i) {
+    h ^= uint8_t(s[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static int dump_writer(lua_State *, const void *p, size_t sz, void *ud)
+{
+  static_cast<String *>(ud)->append(static_cast<const char *>(p), int(sz));
+  return 0;
+}
+
+static int load_source(lua_State *L, const char *fname)
+{
+  String source = Platform::readFile(fname);
+  if (source.empty() && !Platform::fileExists(fname)) {
+    lua_pushfstring(L, "cannot open %s", fname);
+    return LUA_ERRFILE;
+  }
+  String chunkname = String("@") + fname;
+  return luaL_loadbufferx(L, source.data(), source.size(), chunkname.z(),
+			  nullptr);
+}
+
+//! Load the Lua source file \a fname, using the bytecode cache.
+/*! Like luaL_loadfile, pushes the compiled chunk or an error message,
+  and returns a Lua status code.  The file name is UTF-8 encoded, also
+  on Windows. */
+int ipelua::load_cached(lua_State *L, const char *fname)
+{
+  int64_t mtime, fsize;
+  String cacheDir;
+  if (getenv("IPENOLUACACHE") == nullptr &&
+      Platform::fileStatus(fname, mtime, fsize))
+    cacheDir = Platform::latexSubdirectory("luac");
+  if (cacheDir.empty())
+    return load_source(L, fname);
+
+  char buf[96];
+  sprintf(buf, "IPELUAC %d %d %lld %lld\n", LUA_VERSION_NUM, IPELIB_VERSION,
+	  static_cast<long long>(mtime), static_cast<long long>(fsize));
+  String header = String(buf) + fname + "\n";
+  sprintf(buf, "%016llx.luac",
+	  static_cast<unsigned long long>(hashString(fname)));
+  String cacheFile = cacheDir + buf;
+
+  String data = Platform::readFile(cacheFile);
+  if (data.left(header.size()) == header) {
+    String chunkname = String("@") + fname;
+    if (luaL_loadbufferx(L, data.data() + header.size(),
+			 data.size() - header.size(), chunkname.z(),
+			 "b") == LUA_OK)
+      return LUA_OK;
+    lua_pop(L, 1);  // unusable, compile again
+  }
+
+  int status = load_source(L, fname);
+  if (status != LUA_OK)
+    return status;
+  String code = header;
+  lua_dump(L, dump_writer, &code, 0);
+  String tmpFile = cacheFile + ".tmp";
+  std::FILE *file = Platform::fopen(tmpFile.z(), "wb");
+  if (file) {
+    bool okay = (std::fwrite(code.data(), 1, code.size(), file)
+		 == size_t(code.size()));
+    okay = (std::fclose(file) == 0) && okay;
+    std::remove(cacheFile.z());
+    if (!okay || std::rename(tmpFile.z(), cacheFile.z()) != 0)
+      std::remove(tmpFile.z());
+  }
+  return LUA_OK;
+}
+
+// package searcher for require, using the bytecode cache
+static int cached_searcher(lua_State *L)
+{
+  const char *name = luaL_checklstring(L, 1, nullptr);
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "searchpath");
+  lua_pushvalue(L, 1);
+  lua_getfield(L, -3, "path");
+  lua_call(L, 2, 2);
+  if (lua_isnil(L, -2))
+    return 1;  // message why the module was not found
+  lua_pop(L, 1);
+  String fname = lua_tolstring(L, -1, nullptr);
+  if (load_cached(L, fname.z()) != LUA_OK)
+    return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s",
+		      name, fname.z(), lua_tolstring(L, -1, nullptr));
+  lua_insert(L, -2);  // loader, file name
+  return 2;
+}
+
+//! Make require load Lua modules through the bytecode cache.
+/*! The searcher is placed before the standard searcher for Lua files,
+  and uses package.path in the same way. */
+void ipelua::use_bytecode_cache(lua_State *L)
+{
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "searchers");
+  int n = lua_rawlen(L, -1);
+  for (int i = n; i >= 2; --i) {
+    lua_rawgeti(L, -1, i);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushcfunction(L, cached_searcher);
+  lua_rawseti(L, -2, 2);
+  lua_pop(L, 2);
+}
+
+// load a Lua source file like loadfile, using the bytecode cache
+static int ipe_loadFile(lua_State *L)
+{
+  String fname = check_filename(L, 1);
+  bool env = !lua_isnoneornil(L, 2);
+  if (load_cached(L, fname.z()) != LUA_OK) {
+    lua_pushnil(L);
+    lua_insert(L, -2);
+    return 2;  // nil, error message
+  }
+  if (env) {
+    lua_pushvalue(L, 2);
+    if (!lua_setupvalue(L, -2, 1))  // _ENV of the main chunk
+      lua_pop(L, 1);
+  }
+  return 1;
+}
+
+static int ipe_fileStatus(lua_State *L)
+{
+  String fname = check_filename(L, 1);
+  int64_t mtime, size;
+  if (!Platform::fileStatus(fname, mtime, size))
+    return 0;
+  lua_pushinteger(L, mtime);
+  lua_pushinteger(L, size);
+  return 2;
+}
+
 // --------------------------------------------------------------------
 
 static const struct luaL_Reg ipelib_functions[] = {
@@ -681,6 +840,8 @@ static const struct luaL_Reg ipelib_functions[] = {
   { "realPath", ipe_realpath },
   { "directory", ipe_directory },
   { "openFile", ipe_openFile },
+  { "loadFile", ipe_loadFile },
+  { "fileStatus", ipe_fileStatus },
   { "readImage", ipe_readImage },
   { "Image", image_constructor },
   { nullptr, nullptr }
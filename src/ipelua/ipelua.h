@@ -63,6 +63,10 @@ namespace ipelua {
   struct SObject {
     bool owned;
     ipe::Object *obj;
+    // for references to an object on a page, to unshare it when modified
+    ipe::Page *page;
+    int objno;
+    uint32_t revision;
   };
 
   inline ipe::Document **check_document(lua_State *L, int i)
@@ -183,6 +187,7 @@ namespace ipelua {
   extern void check_allattributes(lua_State *L, int i, ipe::AllAttributes &all);
 
   extern void push_object(lua_State *L, ipe::Object *obj, bool owned = true);
+  extern void push_page_object(lua_State *L, ipe::Page *page, int objno);
 
   extern int reference_constructor(lua_State *L);
   extern int text_constructor(lua_State *L);
@@ -219,6 +224,11 @@ namespace ipelua {
   extern int open_ipepage(lua_State *L);
   extern int open_ipelets(lua_State *L);
 
+  // bytecode cache
+
+  extern int load_cached(lua_State *L, const char *fname);
+  extern void use_bytecode_cache(lua_State *L);
+
 } // namespace
 
 extern "C" int luaopen_ipe(lua_State *L);
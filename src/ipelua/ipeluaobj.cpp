@@ -81,10 +81,25 @@ void ipelua::push_object(lua_State *L, Object *s0, bool owned)
   SObject *s = (SObject *) lua_newuserdata(L, sizeof(SObject));
   s->owned = owned;
   s->obj = s0;
+  s->page = nullptr;
+  s->objno = -1;
+  s->revision = 0;
   luaL_getmetatable(L, "Ipe.object");
   lua_setmetatable(L, -2);
 }
 
+//! Push reference to object \a objno of \a page.
+/*! The object may be shared with copies of the page, and is only
+  unshared when it is modified through the reference. */
+void ipelua::push_page_object(lua_State *L, Page *page, int objno)
+{
+  push_object(L, page->object(objno), false);
+  SObject *s = check_object(L, -1);
+  s->page = page;
+  s->objno = objno;
+  s->revision = page->revision(objno);
+}
+
 void ipelua::push_color(lua_State *L, Color color)
 {
   lua_createtable(L, 0, 3);
@@ -434,6 +449,30 @@ int ipelua::xml_constructor(lua_State *L)
 
 // --------------------------------------------------------------------
 
+// Return the object of s for modification.
+/* A reference to a page object is resolved to the object currently
+   in its slot: either the very same object, or a copy made when the
+   slot was unshared (which keeps the revision).  If the slot holds a
+   different object now, the reference is stale, and modifying it
+   would change an object that belongs to an undo snapshot. */
+static Object *modify(lua_State *L, SObject *s)
+{
+  if (s->page) {
+    const Page *cpage = s->page;
+    int i = s->objno;
+    if (i >= cpage->count() || (cpage->object(i) != s->obj &&
+				cpage->revision(i) != s->revision))
+      luaL_error(L, "object reference is stale: "
+		 "the object has been changed or removed from its page");
+    // make sure the object is not shared with a copy of the page
+    s->obj = s->page->objectForEdit(i);
+    // bump the revision, so cached thumbnails are not reused
+    s->page->invalidateBBox(i);
+    s->revision = cpage->revision(i);
+  }
+  return s->obj;
+}
+
 static int object_destructor(lua_State *L)
 {
   SObject *r = check_object(L, 1);
@@ -464,7 +503,7 @@ static int object_set(lua_State *L)
   SObject *s = check_object(L, 1);
   Property prop = Property(luaL_checkoption(L, 2, nullptr, property_names));
   Attribute value = check_property(prop, L, 3);
-  s->obj->setAttribute(prop, value);
+  modify(L, s)->setAttribute(prop, value);
   return 0;
 }
 
@@ -507,7 +546,7 @@ static int object_text(lua_State *L)
 
 static int object_setText(lua_State *L)
 {
-  Object *obj = check_object(L, 1)->obj;
+  Object *obj = modify(L, check_object(L, 1));
   String s = luaL_checklstring(L, 2, nullptr);
   if (obj->type() == Object::EGroup) {
     obj->asGroup()->setUrl(s);
@@ -536,7 +575,7 @@ static int object_setMatrix(lua_State *L)
 {
   SObject *s = check_object(L, 1);
   Matrix *m = check_matrix(L, 2);
-  s->obj->setMatrix(*m);
+  modify(L, s)->setMatrix(*m);
   return 0;
 }
 
@@ -805,7 +844,7 @@ static int object_shape(lua_State *L)
 
 static int object_setShape(lua_State *L)
 {
-  Object *s = check_object(L, 1)->obj;
+  Object *s = modify(L, check_object(L, 1));
   luaL_argcheck(L, s->type() == Object::EPath, 1, "not a path object");
   Shape shape = check_shape(L, 2);
   s->asPath()->setShape(shape);
@@ -834,7 +873,7 @@ static int object_clip(lua_State *L)
 
 static int object_setclip(lua_State *L)
 {
-  Object *s = check_object(L, 1)->obj;
+  Object *s = modify(L, check_object(L, 1));
   luaL_argcheck(L, s->type() == Object::EGroup, 1, "not a group object");
   if (lua_isnoneornil(L, 2)) {
     s->asGroup()->setClip(Shape());
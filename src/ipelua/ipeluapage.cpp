@@ -105,7 +105,7 @@ static int page_index(lua_State *L)
   Page *p = check_page(L, 1)->page;
   if (lua_type(L, 2) == LUA_TNUMBER) {
     int n = check_objno(L, 2, p);
-    push_object(L, p->object(n), false);
+    push_page_object(L, p, n);
   } else {
     const char *key = luaL_checklstring(L, 2, nullptr);
     if (!luaL_getmetafield(L, 1, key))
@@ -135,6 +135,13 @@ static int page_clone(lua_State *L)
   return 1;
 }
 
+static int page_takeDetached(lua_State *L)
+{
+  Page *p = check_page(L, 1)->page;
+  lua_pushinteger(L, p->takeDetached());
+  return 1;
+}
+
 // --------------------------------------------------------------------
 
 static void push_select(lua_State *L, TSelect sel)
@@ -167,7 +174,7 @@ static int page_object_iterator(lua_State *L)
   i = i + 1;
   if (i <= p->count()) {
     lua_pushinteger(L, i);                           // new counter
-    push_object(L, p->object(i-1), false);           // object
+    push_page_object(L, p, i-1);                     // object
     push_select(L, p->select(i-1));
     push_string(L, p->layer(p->layerOf(i-1)));       // layer
     return 4;
@@ -642,6 +649,7 @@ static const struct luaL_Reg page_methods[] = {
   { "__gc", page_destructor },
   { "__len", page_len },
   { "clone", page_clone },
+  { "takeDetached", page_takeDetached },
   { "objects", page_objects },
   { "countViews", page_countViews },
   { "countLayers", page_countLayers },
@@ -74,16 +74,14 @@ int ipelua::sheet_constructor(lua_State *L)
 {
   if (lua_type(L, 1) == LUA_TSTRING) {
     String fname = check_filename(L, 1);
-    FILE *fd = Platform::fopen(fname.z(), "rb");
-    if (!fd) {
+    MappedFileSource source(fname.z());
+    if (!source.isOpen()) {
       lua_pushnil(L);
       lua_pushfstring(L, "fopen error: %s", strerror(errno));
       return 2;
     }
-    FileSource source(fd);
     ImlParser parser(source);
     StyleSheet *sheet = parser.parseStyleSheet();
-    fclose(fd);
     if (!sheet) {
       lua_pushnil(L);
       lua_pushfstring(L, "Parsing error at %d", parser.parsePosition());
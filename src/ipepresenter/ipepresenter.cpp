@@ -32,20 +32,31 @@
 
 // --------------------------------------------------------------------
 
-bool Presenter::load(const char *fname)
+// number of views before and after the current one that are prefetched
+const int PREFETCH_VIEWS = 3;
+
+// default memory budget for prefetched views in megabytes
+const int CACHE_BUDGET = 256;
+
+Presenter::Presenter()
 {
-  std::FILE *pdfFile = Platform::fopen(fname, "rb");
-  if (!pdfFile)
-    return false;
+  size_t budget = CACHE_BUDGET;
+  const char *p = getenv("IPEPRESENTERCACHE");
+  if (p)
+    budget = std::max(0, Lex(String(p)).getInt());
+  iCache = std::make_unique<PdfRenderCache>(budget << 20);
+}
 
-  FileSource source(pdfFile);
+bool Presenter::load(const char *fname)
+{
   std::unique_ptr<PdfFile> pdf = std::make_unique<PdfFile>();
-  bool okay = pdf->parse(source);
-  std::fclose(pdfFile);
+  bool okay = pdf->load(fname);
 
   if (!okay)
     return false;
 
+  // workers may still be rendering from the old document
+  iCache->clear();
   iPdf = std::move(pdf);
 
   iFileName = fname;
@@ -141,6 +152,26 @@ void Presenter::setViewPage(PdfViewBase *view, int pdfpno)
   view->updatePdf();
 }
 
+//! Render the views around the current one in the background.
+/*! The \a views show the current view, \a nextView shows the one
+  after it.  Closer views are rendered first. */
+void Presenter::prefetch(std::initializer_list<PdfViewBase *> views,
+			 PdfViewBase *nextView)
+{
+  iCache->cancel();
+  int n = iPdf->countPages();
+  for (int d = 1; d <= PREFETCH_VIEWS; ++d) {
+    for (int pno : { iPdfPageNo + d, iPdfPageNo - d }) {
+      if (pno < 0 || pno >= n)
+	continue;
+      for (PdfViewBase *view : views)
+	view->prefetch(iPdf->page(pno), mediaBox(pno));
+      int next = std::min(pno + 1, n - 1);
+      nextView->prefetch(iPdf->page(next), mediaBox(next));
+    }
+  }
+}
+
 void Presenter::fitBox(const Rect &box, PdfViewBase *view)
 {
   if (box.isEmpty())
@@ -53,6 +53,8 @@ public:
   };
 
 public:
+  Presenter();
+
   void nextView(int delta);
   void nextPage(int delta);
   void firstView();
@@ -69,12 +71,16 @@ protected:
   void makePageLabels();
   void collectPageLabels(const PdfDict *d);
   void setViewPage(PdfViewBase *view, int pdfpno);
+  void prefetch(std::initializer_list<PdfViewBase *> views,
+		PdfViewBase *nextView);
   String pageLabel(int pdfno);
   String currentLabel();
   void jumpToPage(String page);
 
 protected:
   std::unique_ptr<PdfFile> iPdf;
+  // declared after iPdf, so that the workers stop before it is deleted
+  std::unique_ptr<PdfRenderCache> iCache;
 
   String iFileName;
   int iPdfPageNo;
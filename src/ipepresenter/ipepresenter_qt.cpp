@@ -309,6 +309,9 @@ void MainWindow::jumpTo()
 
 void MainWindow::setPdf()
 {
+  iScreen->pdfView()->setCache(iCache.get());
+  iCurrent->setCache(iCache.get());
+  iNext->setCache(iCache.get());
   iScreen->pdfView()->setPdf(iPdf.get());
   iCurrent->setPdf(iPdf.get());
   iNext->setPdf(iPdf.get());
@@ -319,6 +322,10 @@ void MainWindow::setView()
   setViewPage(iScreen->pdfView(), iPdfPageNo);
   setViewPage(iCurrent, iPdfPageNo);
   setViewPage(iNext, iPdfPageNo < iPdf->countPages() - 1 ? iPdfPageNo + 1 : iPdfPageNo);
+  if (iScreen->isVisible())
+    prefetch({ iScreen->pdfView(), iCurrent }, iNext);
+  else
+    prefetch({ iCurrent }, iNext);
 
   setWindowTitle(QIpe(currentLabel()));
   iNotes->setPlainText(QIpe(iAnnotations[iPdfPageNo]));
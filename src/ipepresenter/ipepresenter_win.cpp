@@ -230,6 +230,7 @@ AppUi::~AppUi()
   if (iThumbNails)
     ImageList_Destroy(iThumbNails);
   KillTimer(hwnd, 1);
+  iCache->clear();
   delete iScreen;
   ipeDebug("AppUi::~AppUi()");
 }
@@ -364,6 +365,9 @@ bool AppUi::load(const char* fn)
 
 void AppUi::setPdf()
 {
+  iScreen->setCache(iCache.get());
+  iCurrent->setCache(iCache.get());
+  iNext->setCache(iCache.get());
   iScreen->setPdf(iPdf.get());
   iCurrent->setPdf(iPdf.get());
   iNext->setPdf(iPdf.get());
@@ -374,6 +378,10 @@ void AppUi::setView()
   setViewPage(iScreen, iPdfPageNo);
   setViewPage(iCurrent, iPdfPageNo);
   setViewPage(iNext, iPdfPageNo < iPdf->countPages() - 1 ? iPdfPageNo + 1 : iPdfPageNo);
+  if (IsWindowVisible(iScreen->windowId()))
+    prefetch({ iScreen, iCurrent }, iNext);
+  else
+    prefetch({ iCurrent }, iNext);
 
   setWindowText(hwnd, currentLabel().z());
   setWindowText(hNotes, iAnnotations[iPdfPageNo].z());
@@ -34,10 +34,15 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
+#include <string>
+#include <thread>
+#include <atomic>
 
 using ipe::Document;
 using ipe::Page;
 using ipe::Thumbnail;
+using ipe::String;
 
 // --------------------------------------------------------------------
 
@@ -81,6 +86,115 @@ static int renderPage(Thumbnail::TargetFormat fm,
 
 // --------------------------------------------------------------------
 
+// the output pattern must contain exactly one %d or %0<n>d
+static bool parsePattern(const std::string &pattern, size_t &pos, size_t &len,
+			 int &width)
+{
+  pos = pattern.find('%');
+  if (pos == std::string::npos)
+    return false;
+  size_t i = pos + 1;
+  width = 0;
+  while (i < pattern.size() && isdigit((unsigned char) pattern[i]))
+    width = 10 * width + (pattern[i++] - '0');
+  if (i == pattern.size() || pattern[i] != 'd' || width > 9)
+    return false;
+  len = i + 1 - pos;
+  return pattern.find('%', i) == std::string::npos;
+}
+
+// parse a page range "a-b", where a and b are page numbers or names
+static bool findPages(const Document *doc, const char *spec,
+		      int &from, int &to)
+{
+  const char *dash = strchr(spec, '-');
+  if (!dash) {
+    from = to = doc->findPage(spec);
+    return from >= 0;
+  }
+  String first(spec, dash - spec);
+  String last(dash + 1);
+  from = first.empty() ? 0 : doc->findPage(first);
+  to = last.empty() ? doc->countPages() - 1 : doc->findPage(last);
+  return from >= 0 && to >= from;
+}
+
+/* Render a range of pages, loading the document only once.  The
+   pages are distributed over a number of threads, which share the
+   document and the font cache of a single Thumbnail. */
+static int renderPages(Thumbnail::TargetFormat fm,
+		       const char *src, const char *pattern,
+		       const char *pagesSpec, const char *viewSpec,
+		       double zoom, bool transparent, bool nocrop,
+		       int threads)
+{
+  std::string dst(pattern);
+  size_t pos, len;
+  int width;
+  if (!parsePattern(dst, pos, len, width)) {
+    fprintf(stderr, "The output file name must contain one %%d, "
+	    "which is replaced by the page number.\n");
+    return 1;
+  }
+
+  Document *doc = Document::loadWithErrorReport(src);
+
+  if (!doc)
+    return 1;
+
+  int from = 0;
+  int to = doc->countPages() - 1;
+  if (pagesSpec && !findPages(doc, pagesSpec, from, to)) {
+    fprintf(stderr, "Incorrect -pages specification.\n");
+    delete doc;
+    return 1;
+  }
+
+  if (doc->runLatex()) {
+    delete doc;
+    return 1;
+  }
+
+  Thumbnail tn(doc, 0);
+  std::atomic<int> next(from);
+  std::atomic<int> failures(0);
+
+  auto worker = [&]() {
+    for (int pno = next++; pno <= to; pno = next++) {
+      const Page *page = doc->page(pno);
+      int viewIdx = viewSpec ? page->findView(viewSpec) : 0;
+      if (viewIdx < 0) {
+	fprintf(stderr, "Page %d has no view '%s'.\n", pno + 1, viewSpec);
+	++failures;
+	continue;
+      }
+      char num[16];
+      sprintf(num, "%0*d", width, pno + 1);
+      std::string fname = dst.substr(0, pos) + num + dst.substr(pos + len);
+      if (!tn.saveRender(fm, fname.c_str(), page, viewIdx, zoom,
+			 transparent, nocrop)) {
+	fprintf(stderr, "Failure to render page %d.\n", pno + 1);
+	++failures;
+      }
+    }
+  };
+
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, to - from + 1);
+  std::vector<std::thread> pool;
+  for (int k = 1; k < threads; ++k)
+    pool.emplace_back(worker);
+  worker();
+  for (auto &t : pool)
+    t.join();
+
+  delete doc;
+  return failures > 0;
+}
+
+// --------------------------------------------------------------------
+
 static void usage()
 {
   fprintf(stderr, "Usage: iperender [ -png ");
@@ -97,13 +211,22 @@ static void usage()
 	  "[ -page <page> ] [ -view <view> ] [ -resolution <dpi> ] "
 	  "[ -transparent ] [ -nocrop ] "
 	  "infile outfile\n"
+	  "       iperender [ -png ... ] [ -all | -pages <from>-<to> ] "
+	  "[ -threads <n> ] [ options ] infile pattern\n"
 	  "Iperender saves a single page of the Ipe document in some formats.\n"
 	  " -page       : page to save (default 1).\n"
+	  " -all        : save all pages.\n"
+	  " -pages      : save a range of pages (<from> or <to> can be empty).\n"
+	  " -threads    : number of threads for -all and -pages "
+	  "(default: number of cores).\n"
 	  " -view       : view to save (default 1).\n"
 	  " -resolution : resolution for png format (default 72.0 ppi).\n"
 	  " -transparent: use transparent background in png format.\n"
 	  " -nocrop     : do not crop page.\n"
 	  "<page> can be a page number or a page name.\n"
+	  "With -all or -pages, the %%d in pattern is replaced by the page "
+	  "number,\n"
+	  "for instance slide-%%03d.png.\n"
 	  );
   exit(1);
 }
@@ -135,6 +258,9 @@ int main(int argc, char *argv[])
     usage();
 
   const char *page = nullptr;
+  const char *pages = nullptr;
+  bool all = false;
+  int threads = 0;
   const char *view = nullptr;
   double dpi = 72.0;
   bool transparent = false;
@@ -147,6 +273,19 @@ int main(int argc, char *argv[])
 	usage();
       page = argv[i+1];
       i += 2;
+    } else if (!strcmp(argv[i], "-pages")) {
+      if (i + 1 == argc)
+	usage();
+      pages = argv[i+1];
+      i += 2;
+    } else if (!strcmp(argv[i], "-all")) {
+      all = true;
+      ++i;
+    } else if (!strcmp(argv[i], "-threads")) {
+      if (i + 1 == argc)
+	usage();
+      threads = ipe::Lex(ipe::String(argv[i+1])).getInt();
+      i += 2;
     } else if (!strcmp(argv[i], "-view")) {
       if (i + 1 == argc)
 	usage();
@@ -171,6 +310,13 @@ int main(int argc, char *argv[])
   const char *src = argv[i];
   const char *dst = argv[i+1];
 
+  if (all || pages) {
+    if (page)
+      usage();
+    return renderPages(fm, src, dst, pages, view, dpi / 72.0,
+		       transparent, nocrop, threads);
+  }
+
   return renderPage(fm, src, dst, page, view, dpi / 72.0,
 		    transparent, nocrop);
 }
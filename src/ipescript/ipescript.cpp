@@ -31,8 +31,10 @@
 #include "ipebase.h"
 #include "ipelua.h"
 
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 using namespace ipe;
 using namespace ipelua;
@@ -163,15 +165,467 @@ static void setup_globals(lua_State *L)
   lua_setglobal(L, "config");
 }
 
+// --------------------------------------------------------------------
+// Server mode
+// --------------------------------------------------------------------
+
+/* In server mode, ipescript reads requests from stdin, one JSON object
+   per line, and writes one JSON object per line to stdout.  The Lua
+   interpreter, the modules loaded with "require", and the style sheets
+   read with ipe.Sheet stay alive between requests, but every script
+   runs in a fresh environment table.  Since stdout carries the
+   responses, print and io.write are redirected into the response. */
+
+static String output;  // output of the running script
+
+static void skip_space(const char *&p)
+{
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+    ++p;
+}
+
+static void append_utf8(String &s, unsigned int ch)
+{
+  if (ch < 0x80) {
+    s += char(ch);
+  } else if (ch < 0x800) {
+    s += char(0xc0 | (ch >> 6));
+    s += char(0x80 | (ch & 0x3f));
+  } else if (ch < 0x10000) {
+    s += char(0xe0 | (ch >> 12));
+    s += char(0x80 | ((ch >> 6) & 0x3f));
+    s += char(0x80 | (ch & 0x3f));
+  } else {
+    s += char(0xf0 | (ch >> 18));
+    s += char(0x80 | ((ch >> 12) & 0x3f));
+    s += char(0x80 | ((ch >> 6) & 0x3f));
+    s += char(0x80 | (ch & 0x3f));
+  }
+}
+
+static bool parse_hex4(const char *&p, unsigned int &ch)
+{
+  ch = 0;
+  for (int i = 0; i < 4; ++i) {
+    char c = *p++;
+    ch <<= 4;
+    if ('0' <= c && c <= '9')
+      ch += c - '0';
+    else if ('a' <= c && c <= 'f')
+      ch += c - 'a' + 10;
+    else if ('A' <= c && c <= 'F')
+      ch += c - 'A' + 10;
+    else
+      return false;
+  }
+  return true;
+}
+
+static bool parse_json_string(const char *&p, String &s)
+{
+  ++p;  // opening quote
+  while (*p != '"') {
+    unsigned char c = *p++;
+    if (c < 0x20)
+      return false;
+    if (c != '\\') {
+      s += char(c);
+      continue;
+    }
+    c = *p++;
+    switch (c) {
+    case '"': case '\\': case '/':
+      s += char(c); break;
+    case 'b': s += '\b'; break;
+    case 'f': s += '\f'; break;
+    case 'n': s += '\n'; break;
+    case 'r': s += '\r'; break;
+    case 't': s += '\t'; break;
+    case 'u': {
+      unsigned int ch;
+      if (!parse_hex4(p, ch))
+	return false;
+      if (0xd800 <= ch && ch < 0xdc00 && p[0] == '\\' && p[1] == 'u') {
+	const char *q = p + 2;
+	unsigned int lo;
+	if (parse_hex4(q, lo) && 0xdc00 <= lo && lo < 0xe000) {
+	  ch = 0x10000 + ((ch - 0xd800) << 10) + (lo - 0xdc00);
+	  p = q;
+	}
+      }
+      append_utf8(s, ch);
+      break; }
+    default:
+      return false;
+    }
+  }
+  ++p;  // closing quote
+  return true;
+}
+
+//! Parse a JSON value and push it on the Lua stack.
+/*! Objects and arrays become tables, null becomes nil.  Returns false
+  (with nothing pushed) on a syntax error. */
+static bool push_json(lua_State *L, const char *&p, int depth = 0)
+{
+  skip_space(p);
+  if (depth > 64)
+    return false;
+  if (*p == '"') {
+    String s;
+    if (!parse_json_string(p, s))
+      return false;
+    push_string(L, s);
+  } else if (*p == '{') {
+    ++p;
+    lua_newtable(L);
+    skip_space(p);
+    if (*p == '}') {
+      ++p;
+      return true;
+    }
+    for (;;) {
+      skip_space(p);
+      String key;
+      if (*p != '"' || !parse_json_string(p, key))
+	break;
+      skip_space(p);
+      if (*p++ != ':' || !push_json(L, p, depth + 1))
+	break;
+      lua_setfield(L, -2, key.z());
+      skip_space(p);
+      if (*p == '}') {
+	++p;
+	return true;
+      }
+      if (*p++ != ',')
+	break;
+    }
+    lua_pop(L, 1);
+    return false;
+  } else if (*p == '[') {
+    ++p;
+    lua_newtable(L);
+    skip_space(p);
+    if (*p == ']') {
+      ++p;
+      return true;
+    }
+    for (int i = 1; ; ++i) {
+      if (!push_json(L, p, depth + 1))
+	break;
+      lua_rawseti(L, -2, i);
+      skip_space(p);
+      if (*p == ']') {
+	++p;
+	return true;
+      }
+      if (*p++ != ',')
+	break;
+    }
+    lua_pop(L, 1);
+    return false;
+  } else if (!strncmp(p, "true", 4)) {
+    p += 4;
+    lua_pushboolean(L, true);
+  } else if (!strncmp(p, "false", 5)) {
+    p += 5;
+    lua_pushboolean(L, false);
+  } else if (!strncmp(p, "null", 4)) {
+    p += 4;
+    lua_pushnil(L);
+  } else {
+    char *end;
+    double v = strtod(p, &end);
+    if (end == p)
+      return false;
+    p = end;
+    if (-1e15 < v && v < 1e15 && v == double(lua_Integer(v)))
+      lua_pushinteger(L, lua_Integer(v));
+    else
+      lua_pushnumber(L, v);
+  }
+  return true;
+}
+
+static void append_json_string(String &s, const char *str, size_t len)
+{
+  static const char hex[] = "0123456789abcdef";
+  s += '"';
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = str[i];
+    switch (c) {
+    case '"': s += "\\\""; break;
+    case '\\': s += "\\\\"; break;
+    case '\n': s += "\\n"; break;
+    case '\r': s += "\\r"; break;
+    case '\t': s += "\\t"; break;
+    default:
+      if (c < 0x20) {
+	s += "\\u00";
+	s += hex[c >> 4];
+	s += hex[c & 0x0f];
+      } else
+	s += char(c);
+    }
+  }
+  s += '"';
+}
+
+// numbers are written so that they read back as the same value
+static void append_json_number(String &s, lua_State *L, int i)
+{
+  char buf[32];
+  if (lua_isinteger(L, i))
+    sprintf(buf, "%lld", (long long) lua_tointeger(L, i));
+  else if (std::isfinite(lua_tonumber(L, i)))
+    sprintf(buf, "%.17g", double(lua_tonumber(L, i)));
+  else
+    strcpy(buf, "null");
+  s += buf;
+}
+
+// --------------------------------------------------------------------
+
+static void append_output(lua_State *L, int i)
+{
+  size_t len;
+  const char *s = luaL_tolstring(L, i, &len);
+  output += String(s, int(len));
+  lua_pop(L, 1);
+}
+
+// replaces print in server mode
+static int server_print(lua_State *L)
+{
+  int n = lua_gettop(L);
+  for (int i = 1; i <= n; ++i) {
+    if (i > 1)
+      output += '\t';
+    append_output(L, i);
+  }
+  output += '\n';
+  return 0;
+}
+
+// replaces io.write in server mode
+static int server_write(lua_State *L)
+{
+  int n = lua_gettop(L);
+  for (int i = 1; i <= n; ++i)
+    append_output(L, i);
+  return 0;
+}
+
+// replaces os.exit in server mode
+static int server_exit(lua_State *L)
+{
+  return luaL_error(L, "os.exit called by script");
+}
+
+//! Replacement for ipe.Sheet that keeps parsed style sheets.
+/*! Sheets read from a file are cached with the file contents, and a
+  clone of the cached sheet is returned as long as the file has not
+  changed.  Upvalue 1 is the original constructor, upvalue 2 the
+  cache table. */
+static int server_sheet(lua_State *L)
+{
+  if (lua_type(L, 1) != LUA_TSTRING) {
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 1);
+    lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+    return lua_gettop(L);
+  }
+  lua_settop(L, 1);
+  const char *fname = lua_tostring(L, 1);
+  String data = Platform::readFile(fname);
+  lua_getfield(L, lua_upvalueindex(2), fname);   // 2: cache entry
+  if (lua_istable(L, 2)) {
+    lua_getfield(L, 2, "data");
+    bool same = (String(lua_tostring(L, -1)) == data);
+    lua_pop(L, 1);
+    if (same)
+      lua_getfield(L, 2, "sheet");                // 3: cached sheet
+    else
+      lua_pushnil(L);
+  } else
+    lua_pushnil(L);
+  if (lua_isnil(L, 3)) {
+    lua_settop(L, 1);
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushvalue(L, 1);
+    lua_call(L, 1, 2);
+    if (lua_isnil(L, 2))
+      return 2;  // nil, error message
+    lua_pop(L, 1);                                // 2: new sheet
+    lua_createtable(L, 0, 2);
+    push_string(L, data);
+    lua_setfield(L, -2, "data");
+    lua_pushvalue(L, 2);
+    lua_setfield(L, -2, "sheet");
+    lua_setfield(L, lua_upvalueindex(2), fname);
+  }
+  // the cached sheet is never handed out, only clones
+  lua_getfield(L, -1, "clone");
+  lua_insert(L, -2);
+  lua_call(L, 1, 1);
+  return 1;
+}
+
+static void setup_server(lua_State *L)
+{
+  lua_pushcfunction(L, server_print);
+  lua_setglobal(L, "print");
+  lua_getglobal(L, "io");
+  lua_pushcfunction(L, server_write);
+  lua_setfield(L, -2, "write");
+  lua_pop(L, 1);
+  lua_getglobal(L, "os");
+  lua_pushcfunction(L, server_exit);
+  lua_setfield(L, -2, "exit");
+  lua_pop(L, 1);
+
+  lua_getglobal(L, "ipe");
+  lua_getfield(L, -1, "Sheet");
+  lua_newtable(L);
+  lua_pushcclosure(L, server_sheet, 2);
+  lua_setfield(L, -2, "Sheet");
+  lua_pop(L, 1);
+
+  // metatable for the script environments
+  lua_createtable(L, 0, 1);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+  lua_setfield(L, -2, "__index");
+  lua_setfield(L, LUA_REGISTRYINDEX, "ipescript.env");
+}
+
+// Create the environment for one script: globals are visible, but
+// assignments go to the fresh table.
+static void push_environment(lua_State *L, int args)
+{
+  lua_newtable(L);
+  luaL_setmetatable(L, "ipescript.env");
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "_G");
+  lua_pushvalue(L, args);
+  lua_setfield(L, -2, "argv");
+}
+
+// Run the request on top of the stack, leaves nothing on the stack.
+// Returns false and sets output to the error message if it fails.
+static bool run_request(lua_State *L, String &error)
+{
+  int req = lua_gettop(L);
+  lua_getfield(L, req, "script");
+  if (lua_type(L, -1) != LUA_TSTRING) {
+    lua_settop(L, req - 1);
+    error = "request has no script";
+    return false;
+  }
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "searchpath");
+  lua_pushvalue(L, -3);
+  lua_getfield(L, -3, "path");
+  lua_call(L, 2, 2);
+  if (lua_isnil(L, -2)) {
+    error = String("script not found:") + lua_tostring(L, -1);
+    lua_settop(L, req - 1);
+    return false;
+  }
+  String path = lua_tostring(L, -2);
+  lua_settop(L, req);
+
+  lua_getfield(L, req, "args");
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+  }
+  int args = lua_gettop(L);
+
+  lua_pushcfunction(L, traceback);
+  if (luaL_loadfilex(L, path.z(), nullptr)) {
+    error = lua_tostring(L, -1);
+    lua_settop(L, req - 1);
+    return false;
+  }
+  push_environment(L, args);
+  lua_setupvalue(L, -2, 1);  // _ENV of the main chunk
+  bool ok = !lua_pcallk(L, 0, 0, -2, 0, nullptr);
+  if (!ok)
+    error = lua_tostring(L, -1);
+  lua_settop(L, req - 1);
+  return ok;
+}
+
+static void serve(lua_State *L)
+{
+  setup_server(L);
+  int base = lua_gettop(L);
+  String line;
+  int ch;
+  while ((ch = getchar()) != EOF) {
+    if (ch != '\n') {
+      line += char(ch);
+      continue;
+    }
+    const char *p = line.z();
+    skip_space(p);
+    if (*p) {
+      output = String();
+      String error;
+      String response("{");
+      bool ok = false;
+      if (!push_json(L, p) || !lua_istable(L, -1)) {
+	lua_settop(L, base);
+	error = "invalid request";
+      } else {
+	lua_getfield(L, -1, "id");
+	if (lua_type(L, -1) == LUA_TNUMBER) {
+	  response += "\"id\":";
+	  append_json_number(response, L, -1);
+	  response += ",";
+	} else if (lua_type(L, -1) == LUA_TSTRING) {
+	  size_t len;
+	  const char *id = lua_tolstring(L, -1, &len);
+	  response += "\"id\":";
+	  append_json_string(response, id, len);
+	  response += ",";
+	}
+	lua_pop(L, 1);
+	ok = run_request(L, error);
+      }
+      response += ok ? "\"ok\":true," : "\"ok\":false,\"error\":";
+      if (!ok) {
+	append_json_string(response, error.data(), error.size());
+	response += ",";
+      }
+      response += "\"output\":";
+      append_json_string(response, output.data(), output.size());
+      response += "}\n";
+      fwrite(response.data(), 1, response.size(), stdout);
+      fflush(stdout);
+      // documents hold memory Lua does not know about
+      lua_gc(L, LUA_GCCOLLECT, 0);
+    }
+    line = String();
+  }
+}
+
 // --------------------------------------------------------------------
 
 static void usage()
 {
   fprintf(stderr,
 	  "Usage: ipescript <script> { <arguments> }\n"
+	  "   or: ipescript --serve\n"
 	  "Ipescript runs a script from your scripts directories with\n"
 	  "the given arguments.\n"
-	  "Do not include the .lua extension in the script name.\n");
+	  "Do not include the .lua extension in the script name.\n"
+	  "With --serve, ipescript reads requests from standard input,\n"
+	  "one JSON object per line, such as\n"
+	  "  {\"id\": 1, \"script\": \"name\", \"args\": [\"a\", \"b\"]}\n"
+	  "and writes one JSON object per line with fields id, ok,\n"
+	  "error, and output (what the script printed).\n");
   exit(1);
 }
 
@@ -182,6 +636,16 @@ int main(int argc, char *argv[])
   if (argc < 2)
     usage();
 
+  if (!strcmp(argv[1], "--serve")) {
+    if (argc != 2)
+      usage();
+    lua_State *L = setup_lua();
+    setup_globals(L);
+    serve(L);
+    lua_close(L);
+    return 0;
+  }
+
   String s = "require \"";
   s += argv[1];
   s += "\"";
@@ -37,6 +37,17 @@ using ipe::String;
 using ipe::FileFormat;
 using ipe::SaveFlag;
 
+// One file to convert
+struct Job {
+  String infile;
+  String outfile;
+  std::unique_ptr<Document> doc;
+  int fromPage = -1;
+  int toPage = -1;
+  int viewNo = -1;
+  int result = 1;
+};
+
 static int topdf(Document *doc, String src, String dst, uint32_t flags,
 		 int fromPage = -1, int toPage = -1, int viewNo = -1)
 {
@@ -67,6 +78,8 @@ static void usage()
   fprintf(stderr,
 	  "Usage: ipetoipe ( -xml | -pdf ) <options> "
 	  "infile [ outfile ]\n"
+	  "   or: ipetoipe ( -xml | -pdf ) <options> "
+	  "( -batch infile { infile } | -manifest file )\n"
 	  "Ipetoipe converts between the different Ipe file formats.\n"
 	  " -export      : output contains no Ipe markup.\n"
 	  " -pages <n-m> : export only these pages (implies -export).\n"
@@ -75,11 +88,95 @@ static void usage()
 	  " -runlatex    : run Latex even for XML output.\n"
 	  " -nozip       : do not compress PDF streams.\n"
 	  " -keepnotes   : save page notes as PDF annotations even when exporting.\n"
+	  " -batch       : convert all the following files.\n"
+	  " -manifest <f>: convert the files listed in <f>, one per line.\n"
 	  "Pages can be specified by page number or by section title.\n"
+	  "In batch mode, the output filenames are derived from the input\n"
+	  "filenames, the files are converted in parallel, and texts with\n"
+	  "the same Latex preamble are converted by shared Latex runs.\n"
 	  );
   exit(1);
 }
 
+// Guess output filename from input filename, or return empty string.
+static String outputName(String infile, FileFormat frm)
+{
+  String outfile = infile;
+  String ext = infile.right(4);
+  if (ext == ".ipe" || ext == ".pdf" || ext == ".xml")
+    outfile = infile.left(infile.size() - 4);
+  switch (frm) {
+  case FileFormat::Xml:
+    outfile += ".ipe";
+    break;
+  case FileFormat::Pdf:
+    outfile += ".pdf";
+  default:
+    break;
+  }
+  if (outfile == infile) {
+    fprintf(stderr, "Cannot guess output filename for %s.\n", infile.z());
+    return String();
+  }
+  return outfile;
+}
+
+// Read filenames from manifest, one per line.  Empty lines and lines
+// starting with '#' are ignored.
+static bool readManifest(const char *fname, std::vector<Job> &jobs)
+{
+  if (!ipe::Platform::fileExists(fname))
+    return false;
+  String data = ipe::Platform::readFile(fname);
+  int i = 0;
+  while (i < data.size()) {
+    int j = i;
+    while (j < data.size() && data[j] != '\n')
+      ++j;
+    int k = j;
+    while (k > i && (data[k-1] == '\r' || data[k-1] == ' ' || data[k-1] == '\t'))
+      --k;
+    if (k > i && data[i] != '#') {
+      jobs.emplace_back();
+      jobs.back().infile = data.substr(i, k - i);
+    }
+    i = j + 1;
+  }
+  return true;
+}
+
+// Find the pages or view to export.
+static bool parseRange(Job &job, const char *pages, const char *view)
+{
+  Document *doc = job.doc.get();
+  if (pages) {
+    String p(pages);
+    int j = p.find('-');
+    if (j >= 0) {
+      job.fromPage = (j > 0) ? doc->findPage(p.left(j)) : 0;
+      job.toPage = (j < p.size() - 1) ? doc->findPage(p.substr(j+1)) :
+	doc->countPages() - 1;
+    }
+    if (job.fromPage < 0 || job.fromPage > job.toPage) {
+      fprintf(stderr, "incorrect -pages specification.\n");
+      return false;
+    }
+  } else if (view) {
+    String v(view);
+    int j = v.find('-');
+    if (j > 0) {
+      job.fromPage = doc->findPage(v.left(j));
+      if (job.fromPage >= 0)
+	job.viewNo = doc->page(job.fromPage)->findView(v.substr(j+1));
+    }
+    if (job.fromPage < 0 || job.viewNo < 0) {
+      fprintf(stderr, "incorrect -view specification.\n");
+      return false;
+    }
+  }
+  return true;
+}
+
 int main(int argc, char *argv[])
 {
   ipe::Platform::initLib(ipe::IPELIB_VERSION);
@@ -99,12 +196,12 @@ int main(int argc, char *argv[])
 
   uint32_t flags = SaveFlag::SaveNormal;
   bool runLatex = false;
+  bool batch = false;
   const char *pages = nullptr;
   const char *view = nullptr;
   int i = 2;
 
-  String infile;
-  String outfile;
+  std::vector<Job> jobs;
 
   while (i < argc) {
 
@@ -136,12 +233,28 @@ int main(int argc, char *argv[])
     } else if (!strcmp(argv[i], "-keepnotes")) {
       flags |= SaveFlag::KeepNotes;
       ++i;
+    } else if (!strcmp(argv[i], "-manifest")) {
+      if (i + 2 != argc)
+	usage();
+      if (!readManifest(argv[i+1], jobs)) {
+	fprintf(stderr, "Cannot read manifest %s.\n", argv[i+1]);
+	exit(1);
+      }
+      batch = true;
+      i += 2;
+    } else if (!strcmp(argv[i], "-batch")) {
+      for (++i; i < argc; ++i) {
+	jobs.emplace_back();
+	jobs.back().infile = argv[i];
+      }
+      batch = true;
     } else {
       // last one or two arguments must be filenames
-      infile = argv[i];
+      jobs.emplace_back();
+      jobs.back().infile = argv[i];
       ++i;
       if (i < argc) {
-	outfile = argv[i];
+	jobs.back().outfile = argv[i];
 	++i;
       }
       if (i != argc)
@@ -149,7 +262,7 @@ int main(int argc, char *argv[])
     }
   }
 
-  if (infile.empty())
+  if (jobs.empty())
     usage();
 
   if ((flags & SaveFlag::Export) && frm == FileFormat::Xml) {
@@ -167,61 +280,11 @@ int main(int argc, char *argv[])
     exit(1);
   }
 
-  if (outfile.empty()) {
-    outfile = infile;
-    String ext = infile.right(4);
-    if (ext == ".ipe" || ext == ".pdf" || ext == ".xml")
-      outfile = infile.left(infile.size() - 4);
-    switch (frm) {
-    case FileFormat::Xml:
-      outfile += ".ipe";
-      break;
-    case FileFormat::Pdf:
-      outfile += ".pdf";
-    default:
-      break;
-    }
-    if (outfile == infile) {
-      fprintf(stderr, "Cannot guess output filename.\n");
-      exit(1);
-    }
-  }
-
-  std::unique_ptr<Document> doc(Document::loadWithErrorReport(infile.z()));
-
-  if (!doc)
-    return 1;
-
-  fprintf(stderr, "Document %s has %d pages (%d views)\n",
-	  infile.z(), doc->countPages(), doc->countTotalViews());
-
-  // parse pages and view
-  int fromPage = -1;
-  int toPage = -1;
-  int viewNo = -1;
-
-  if (pages) {
-    String p(pages);
-    int j = p.find('-');
-    if (j >= 0) {
-      fromPage = (j > 0) ? doc->findPage(p.left(j)) : 0;
-      toPage = (j < p.size() - 1) ? doc->findPage(p.substr(j+1)) : doc->countPages() - 1;
-    }
-    if (fromPage < 0 || fromPage > toPage) {
-      fprintf(stderr, "incorrect -pages specification.\n");
-      exit(1);
-    }
-  } else if (view) {
-    String v(view);
-    int j = v.find('-');
-    if (j > 0) {
-      fromPage = doc->findPage(v.left(j));
-      if (fromPage >= 0)
-	viewNo = doc->page(fromPage)->findView(v.substr(j+1));
-    }
-    if (fromPage < 0 || viewNo < 0) {
-      fprintf(stderr, "incorrect -view specification.\n");
-      exit(1);
+  for (auto &job : jobs) {
+    if (job.outfile.empty()) {
+      job.outfile = outputName(job.infile, frm);
+      if (job.outfile.empty() && !batch)
+	exit(1);
     }
   }
 
@@ -230,22 +293,67 @@ int main(int argc, char *argv[])
 	  ipe::IPELIB_VERSION / 10000,
 	  (ipe::IPELIB_VERSION / 100) % 100,
 	  ipe::IPELIB_VERSION % 100);
-  Document::SProperties props = doc->properties();
-  props.iCreator = buf;
-  doc->setProperties(props);
 
-  switch (frm) {
-  case FileFormat::Xml:
-    if (runLatex)
-      return topdf(doc.get(), infile, outfile, flags);
-    else
-      doc->save(outfile.z(), FileFormat::Xml, SaveFlag::SaveNormal);
-  default:
-    return 0;
+  ipe::Platform::parallelFor(ipe::size(jobs), [&](int k) {
+    Job &job = jobs[k];
+    if (job.outfile.empty())
+      return;
+    job.doc.reset(Document::loadWithErrorReport(job.infile.z()));
+    if (!job.doc)
+      return;
+    fprintf(stderr, "Document %s has %d pages (%d views)\n",
+	    job.infile.z(), job.doc->countPages(), job.doc->countTotalViews());
+    if (!parseRange(job, pages, view)) {
+      if (!batch)
+	exit(1);
+      job.doc.reset();
+      return;
+    }
+    Document::SProperties props = job.doc->properties();
+    props.iCreator = buf;
+    job.doc->setProperties(props);
+  });
+
+  if (frm == FileFormat::Pdf || runLatex) {
+    std::vector<Document *> docs;
+    for (auto &job : jobs) {
+      if (job.doc)
+	docs.push_back(job.doc.get());
+    }
+    if (docs.size() > 1)
+      Document::prepareLatex(docs);
+  }
 
-  case FileFormat::Pdf:
-    return topdf(doc.get(), infile, outfile, flags, fromPage, toPage, viewNo);
+  ipe::Platform::parallelFor(ipe::size(jobs), [&](int k) {
+    Job &job = jobs[k];
+    if (!job.doc)
+      return;
+    switch (frm) {
+    case FileFormat::Xml:
+      if (runLatex)
+	job.result = topdf(job.doc.get(), job.infile, job.outfile, flags);
+      else {
+	job.doc->save(job.outfile.z(), FileFormat::Xml, SaveFlag::SaveNormal);
+	job.result = 0;
+      }
+      break;
+    case FileFormat::Pdf:
+      job.result = topdf(job.doc.get(), job.infile, job.outfile, flags,
+			 job.fromPage, job.toPage, job.viewNo);
+    default:
+      break;
+    }
+  });
+
+  int failed = 0;
+  for (auto &job : jobs) {
+    if (job.result != 0) {
+      if (batch)
+	fprintf(stderr, "Conversion of %s failed.\n", job.infile.z());
+      ++failed;
+    }
   }
+  return failed > 0 ? 1 : 0;
 }
 
 // --------------------------------------------------------------------